@@ -0,0 +1,77 @@
+#version 330 core
+// Model shader. ShaderVariants inserts a #define after the #version line for each feature a variant has:
+// INSTANCED, LIGHTING, SPECULAR_MAP, NORMAL_MAP, ALPHA_TEST, FOG, TEXTURE_ARRAY, INDIRECT (which also raises #version to 430)
+out vec4 FragColor;
+
+in vec2 TexCoords;
+#if defined(LIGHTING) || defined(FOG)
+in vec3 ViewPosition;
+#endif
+#ifdef LIGHTING
+in vec3 ViewNormal;
+in vec3 ViewLightDirection;
+uniform vec3 lightColor;
+uniform vec3 ambientColor;
+#endif
+#ifdef TEXTURE_ARRAY
+// the textures are layers of texture arrays (see MaterialPacker.h), shared by many materials
+#define SAMPLER sampler2DArray
+#define SAMPLE(s, uv, layer) texture(s, vec3(uv, layer))
+#ifdef INDIRECT
+flat in vec3 DrawMaterialLayers;
+#define materialLayers DrawMaterialLayers
+#else
+uniform vec3 materialLayers; // layers of the diffuse, specular and normal textures
+#endif
+#else
+#define SAMPLER sampler2D
+#define SAMPLE(s, uv, layer) texture(s, uv)
+#endif
+#ifdef SPECULAR_MAP
+uniform SAMPLER texture_specular1;
+uniform float shininess;
+#endif
+#ifdef NORMAL_MAP
+in vec3 ViewTangent;
+in vec3 ViewBitangent;
+uniform SAMPLER texture_normal1;
+#endif
+#ifdef ALPHA_TEST
+uniform float alphaCutoff;
+#endif
+#ifdef FOG
+uniform vec3 fogColor;
+uniform float fogDensity;
+#endif
+
+uniform SAMPLER texture_diffuse1;
+
+void main()
+{     
+    vec4 color = SAMPLE(texture_diffuse1, TexCoords, materialLayers.x);
+#ifdef ALPHA_TEST
+    if (color.a < alphaCutoff)
+        discard;
+#endif
+#ifdef LIGHTING
+    vec3 n = normalize(ViewNormal);
+#ifdef NORMAL_MAP
+    mat3 tangentToView = mat3(normalize(ViewTangent), normalize(ViewBitangent), n);
+    n = normalize(tangentToView * (SAMPLE(texture_normal1, TexCoords, materialLayers.z).rgb * 2.0 - 1.0));
+#endif
+    vec3 l = normalize(ViewLightDirection);
+    float diffuse = max(dot(n, l), 0.0);
+    color.rgb *= ambientColor + lightColor * diffuse;
+#ifdef SPECULAR_MAP
+    // Blinn-Phong, with the viewer at the view space origin
+    vec3 h = normalize(l - normalize(ViewPosition));
+    float specular = diffuse > 0.0 ? pow(max(dot(n, h), 0.0), shininess) : 0.0;
+    color.rgb += lightColor * specular * SAMPLE(texture_specular1, TexCoords, materialLayers.y).r;
+#endif
+#endif
+#ifdef FOG
+    float fog = exp(-fogDensity * length(ViewPosition));
+    color.rgb = mix(fogColor, color.rgb, fog);
+#endif
+    FragColor = color;
+}
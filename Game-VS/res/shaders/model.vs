@@ -0,0 +1,71 @@
+#version 330 core
+// Model shader. ShaderVariants inserts a #define after the #version line for each feature a variant has:
+// INSTANCED, LIGHTING, SPECULAR_MAP, NORMAL_MAP, ALPHA_TEST, FOG, TEXTURE_ARRAY, INDIRECT (which also raises #version to 430)
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+#if defined(INDIRECT)
+// per-draw data of multi-draw indirect rendering, see IndirectRenderer.h; the draw id attribute counts from the
+// command's baseInstance, since gl_BaseInstance needs GLSL 4.6
+struct DrawData {
+    mat4 model;
+    vec4 materialLayers;
+};
+layout (std430, binding = 0) readonly buffer DrawBuffer {
+    DrawData draws[];
+};
+layout (location = 7) in uint aDrawID;
+flat out vec3 DrawMaterialLayers;
+#elif defined(INSTANCED)
+layout (location = 3) in mat4 instanceMatrix;
+#else
+uniform mat4 model;
+#endif
+#ifdef NORMAL_MAP
+layout (location = 3) in vec3 aTangent;
+layout (location = 4) in vec3 aBitangent;
+#endif
+
+out vec2 TexCoords;
+#if defined(LIGHTING) || defined(FOG)
+out vec3 ViewPosition;
+#endif
+#ifdef LIGHTING
+out vec3 ViewNormal;
+out vec3 ViewLightDirection;
+uniform vec3 lightDirection; // toward the light, in world space
+#endif
+#ifdef NORMAL_MAP
+out vec3 ViewTangent;
+out vec3 ViewBitangent;
+#endif
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main() {
+#if defined(INDIRECT)
+    mat4 modelMatrix = draws[aDrawID].model;
+    DrawMaterialLayers = draws[aDrawID].materialLayers.xyz;
+#elif defined(INSTANCED)
+    mat4 modelMatrix = instanceMatrix;
+#else
+    mat4 modelMatrix = model;
+#endif
+    TexCoords = aTexCoords;
+    vec4 viewPosition = view * modelMatrix * vec4(aPos, 1.0);
+#if defined(LIGHTING) || defined(FOG)
+    ViewPosition = viewPosition.xyz;
+#endif
+#ifdef LIGHTING
+    // lit in view space, so the viewer is at the origin; assumes uniform scale, as the game objects have
+    mat3 modelView = mat3(view * modelMatrix);
+    ViewNormal = modelView * aNormal;
+    ViewLightDirection = mat3(view) * lightDirection;
+#endif
+#ifdef NORMAL_MAP
+    ViewTangent = modelView * aTangent;
+    ViewBitangent = modelView * aBitangent;
+#endif
+    gl_Position = projection * viewPosition;
+}
@@ -0,0 +1,277 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "AudioEngine.h"
+#include "SoundInfo.h"
+
+/**
+ * Counters of the most recent AmbientEmitterManager update
+ */
+struct AmbientEmitterStats {
+	int emitters = 0;        // emitters of all types
+	int emittersInRange = 0; // emitters within the max distance of their type
+	int activeEmitters = 0;  // emitters playing on their own voice
+	int mergedEmitters = 0;  // emitters represented by the merged voice of their type
+	int cellsVisited = 0;
+	int voices = 0;          // voices used by the manager, at most (maxActive + 1) per type
+	float updateMS = 0.0f;
+};
+
+/**
+ * Class which plays looping ambient sounds for thousands of static emitters (e.g. birds in every tree) with a
+ * bounded number of voices.
+ *
+ * Emitters are stored in a uniform grid over the XZ plane, per sound type. Around the listener, the nearest
+ * maxActive emitters of each type play on their own voice. All other emitters in range are merged into one voice
+ * placed at their centroid, weighted by how loud each emitter is at the listener, with a volume matching the summed
+ * energy of the merged emitters. Voice cost is therefore constant no matter how many emitters are placed.
+ */
+class AmbientEmitterManager {
+public:
+	/**
+	 * Constructs an emitter manager
+	 * @param audioEngine Shared audio engine used to play the emitters' sounds. Must be initialized.
+	 * @param cellSize Size of the grid cells the emitters are indexed in
+	 */
+	AmbientEmitterManager(std::shared_ptr<AudioEngine> audioEngine, float cellSize = 16.0f)
+		: audioEngine(audioEngine), cellSize(cellSize), types() { }
+
+	~AmbientEmitterManager() {
+		stopAll();
+	}
+
+	/**
+	 * Adds a type of ambient sound. The SoundInfo must be a looping 3D sound which has been loaded by the audio engine.
+	 * @param maxActive Number of nearest emitters that play on their own voice
+	 * @param maxDistance Emitters further from the listener than this are not heard at all
+	 * @returns the type index used to add emitters
+	 */
+	int addSoundType(SoundInfo soundInfo, int maxActive = 3, float maxDistance = 150.0f) {
+		EmitterType type{ soundInfo };
+		type.maxActive = maxActive;
+		type.maxDistance = maxDistance;
+		type.slots.assign(maxActive, Slot());
+		types.push_back(type);
+		return (int)types.size() - 1;
+	}
+
+	/**
+	 * Adds a static emitter of a sound type
+	 * @param weight Relative loudness of the emitter, multiplied with the type's volume
+	 */
+	void addEmitter(int type, glm::vec3 position, float weight = 1.0f) {
+		EmitterType& t = types[type];
+		t.emitters.push_back({ position, weight });
+		t.grid[cellKey(cellCoord(position.x), cellCoord(position.z))].push_back((int)t.emitters.size() - 1);
+		forceUpdate = true;
+	}
+
+	/**
+	 * Reassigns voices around the listener. Does nothing unless the listener has moved far enough since the
+	 * last reassignment, or emitters were added.
+	 */
+	void update(glm::vec3 listenerPosition) {
+		if (!forceUpdate && glm::length(listenerPosition - lastListenerPosition) < UPDATE_DISTANCE)
+			return;
+		auto start = std::chrono::high_resolution_clock::now();
+		forceUpdate = false;
+		lastListenerPosition = listenerPosition;
+		stats = AmbientEmitterStats();
+		for (EmitterType& type : types)
+			updateType(type, listenerPosition);
+		stats.updateMS = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	/**
+	 * Stops all voices of the manager. They restart on the next update.
+	 */
+	void stopAll() {
+		for (EmitterType& type : types) {
+			for (Slot& slot : type.slots)
+				stopSlot(slot);
+			stopSlot(type.merged);
+		}
+		forceUpdate = true;
+	}
+
+	/**
+	 * Returns the counters of the most recent update
+	 */
+	const AmbientEmitterStats& getStats() {
+		return stats;
+	}
+
+	/**
+	 * Prints the counters of the most recent update to the console
+	 */
+	void printStats() {
+		std::cout << "Ambient Emitters: " << stats.emitters << " emitters, " << stats.emittersInRange << " in range, "
+			<< stats.activeEmitters << " active, " << stats.mergedEmitters << " merged, " << stats.voices << " voices, "
+			<< stats.cellsVisited << " cells visited, " << stats.updateMS << " ms\n";
+	}
+
+private:
+	// The listener must move this far before voices are reassigned
+	const float UPDATE_DISTANCE = 0.5f;
+
+	struct Emitter {
+		glm::vec3 position;
+		float weight;
+	};
+
+	// A voice that plays one emitter, or the merged emitters, of a type
+	struct Slot {
+		int voiceID = -1;
+		int emitter = -1; // emitter index, -1 if the slot is unused or is the merged slot
+	};
+
+	struct EmitterType {
+		SoundInfo soundInfo;
+		int maxActive = 3;
+		float maxDistance = 150.0f;
+		std::vector<Emitter> emitters;
+		// emitter indices per grid cell
+		std::unordered_map<long long, std::vector<int>> grid;
+		std::vector<Slot> slots;
+		Slot merged;
+	};
+
+	// an emitter in range of the listener, and its squared distance
+	struct Candidate {
+		int emitter;
+		float distance2;
+	};
+
+	std::shared_ptr<AudioEngine> audioEngine;
+	float cellSize;
+	std::vector<EmitterType> types;
+	glm::vec3 lastListenerPosition{ 0.0f };
+	bool forceUpdate = true;
+	AmbientEmitterStats stats;
+	// scratch lists, kept to avoid reallocating every update
+	std::vector<Candidate> candidates;
+	std::vector<int> unassigned;
+
+	int cellCoord(float x) {
+		return (int)std::floor(x / cellSize);
+	}
+
+	static long long cellKey(int x, int z) {
+		return ((long long)x << 32) ^ (long long)(unsigned int)z;
+	}
+
+	void updateType(EmitterType& type, glm::vec3 listener) {
+		stats.emitters += (int)type.emitters.size();
+
+		// gather the emitters within range from the cells overlapping the range
+		candidates.clear();
+		float maxDistance2 = type.maxDistance * type.maxDistance;
+		int x0 = cellCoord(listener.x - type.maxDistance), x1 = cellCoord(listener.x + type.maxDistance);
+		int z0 = cellCoord(listener.z - type.maxDistance), z1 = cellCoord(listener.z + type.maxDistance);
+		for (int x = x0; x <= x1; x++)
+			for (int z = z0; z <= z1; z++) {
+				auto cell = type.grid.find(cellKey(x, z));
+				if (cell == type.grid.end())
+					continue;
+				stats.cellsVisited++;
+				for (int e : cell->second) {
+					glm::vec3 d = type.emitters[e].position - listener;
+					float distance2 = glm::dot(d, d);
+					if (distance2 <= maxDistance2)
+						candidates.push_back({ e, distance2 });
+				}
+			}
+		stats.emittersInRange += (int)candidates.size();
+
+		// the nearest maxActive candidates get their own voice
+		int nActive = std::min((int)candidates.size(), type.maxActive);
+		auto byDistance = [](const Candidate& a, const Candidate& b) { return a.distance2 < b.distance2; };
+		if (nActive < (int)candidates.size())
+			std::nth_element(candidates.begin(), candidates.begin() + nActive, candidates.end(), byDistance);
+
+		// slots keep their emitter if it is still among the nearest, so voices aren't restarted needlessly
+		unassigned.clear();
+		for (int i = 0; i < nActive; i++) {
+			bool slotted = false;
+			for (Slot& slot : type.slots)
+				slotted = slotted || slot.emitter == candidates[i].emitter;
+			if (!slotted)
+				unassigned.push_back(candidates[i].emitter);
+		}
+		for (Slot& slot : type.slots) {
+			bool keep = false;
+			for (int i = 0; i < nActive && !keep; i++)
+				keep = slot.emitter == candidates[i].emitter;
+			if (keep)
+				continue;
+			if (unassigned.empty()) {
+				slot.emitter = -1;
+				setSlot(type, slot, glm::vec3(0.0f), 0.0f);
+			}
+			else {
+				slot.emitter = unassigned.back();
+				unassigned.pop_back();
+				const Emitter& emitter = type.emitters[slot.emitter];
+				setSlot(type, slot, emitter.position, type.soundInfo.getVolume() * emitter.weight);
+			}
+		}
+		stats.activeEmitters += nActive;
+
+		// the remaining emitters are merged into one voice at their loudness-weighted centroid
+		glm::vec3 centroid(0.0f);
+		float gainSum = 0.0f, energySum = 0.0f;
+		for (int i = nActive; i < (int)candidates.size(); i++) {
+			const Emitter& emitter = type.emitters[candidates[i].emitter];
+			float gain = emitter.weight * audioEngine->getDistanceAttenuation(std::sqrt(candidates[i].distance2));
+			centroid += gain * emitter.position;
+			gainSum += gain;
+			energySum += gain * gain;
+		}
+		stats.mergedEmitters += (int)candidates.size() - nActive;
+		if (gainSum > 0.0f) {
+			centroid /= gainSum;
+			// choose the volume so the merged voice is as loud at the listener as the emitters' summed energy
+			float centroidGain = audioEngine->getDistanceAttenuation(glm::length(centroid - listener));
+			float volume = std::min(std::sqrt(energySum) / centroidGain, 1.0f) * type.soundInfo.getVolume();
+			setSlot(type, type.merged, centroid, volume);
+		}
+		else
+			setSlot(type, type.merged, glm::vec3(0.0f), 0.0f);
+
+		for (Slot& slot : type.slots)
+			stats.voices += slot.voiceID >= 0;
+		stats.voices += type.merged.voiceID >= 0;
+	}
+
+	// Moves a slot's voice and sets its volume, starting the voice if it isn't playing yet.
+	// Unused slots are kept at volume 0, where the voice manager virtualizes them.
+	void setSlot(EmitterType& type, Slot& slot, glm::vec3 position, float volume) {
+		// the voice manager may have stolen the voice
+		if (slot.voiceID >= 0 && !audioEngine->voiceIsPlaying(slot.voiceID))
+			slot.voiceID = -1;
+		if (slot.voiceID < 0) {
+			if (volume <= 0.0f)
+				return;
+			SoundInfo soundInfo = type.soundInfo;
+			soundInfo.set3DCoords(position.x, position.y, position.z);
+			soundInfo.setVolume(volume);
+			slot.voiceID = audioEngine->playVoice(soundInfo);
+			return;
+		}
+		audioEngine->setVoice3DPosition(slot.voiceID, position.x, position.y, position.z);
+		audioEngine->setVoiceVolume(slot.voiceID, volume);
+	}
+
+	void stopSlot(Slot& slot) {
+		if (slot.voiceID >= 0)
+			audioEngine->stopVoice(slot.voiceID);
+		slot.voiceID = -1;
+		slot.emitter = -1;
+	}
+};
@@ -0,0 +1,159 @@
+#pragma once
+///
+/// @file AudioCommandQueue.h
+///
+/// Commands sent from the game thread to the AudioEngine's audio thread, and the lock-free queue they are sent through.
+///
+#include <atomic>
+#include <thread>
+#include <type_traits>
+#include "SoundInfo.h"
+#include "VoiceManager.h"
+
+// Types of AudioEngine commands
+typedef enum {
+    AUDIO_COMMAND_LOAD_SOUND,
+    AUDIO_COMMAND_PLAY_SOUND,
+    AUDIO_COMMAND_STOP_SOUND,
+    AUDIO_COMMAND_UPDATE_LOOP_VOLUME,
+    AUDIO_COMMAND_FADE_LOOP_VOLUME,
+    AUDIO_COMMAND_UPDATE_3D_POSITION,
+    AUDIO_COMMAND_PLAY_VOICE,
+    AUDIO_COMMAND_PLAY_HANDLE,
+    AUDIO_COMMAND_STOP_VOICE,
+    AUDIO_COMMAND_SET_VOICE_POSITION,
+    AUDIO_COMMAND_SET_VOICE_VOLUME,
+    AUDIO_COMMAND_SET_LISTENER,
+    AUDIO_COMMAND_SET_MUTE,
+    AUDIO_COMMAND_SET_CATEGORY_SETTINGS,
+    AUDIO_COMMAND_QUERY_SOUND_LENGTH,
+    AUDIO_COMMAND_PRINT_VOICE_STATS,
+    AUDIO_COMMAND_PRINT_SOUND_MEMORY
+} AUDIO_COMMAND_TYPE;
+
+/**
+ * A single call to the AudioEngine, stored as plain data so it can be copied through the command queue
+ * without allocating. SoundInfo arguments are flattened into their fields; the file path must point to a
+ * string that outlives the audio engine (e.g. a string literal), as SoundInfo's file paths do.
+ */
+struct AudioCommand {
+    AUDIO_COMMAND_TYPE type;
+
+    // SoundInfo fields
+    const char* filePath;
+    float volume, reverbAmount;
+    float x, y, z;
+    bool loop, is3D;
+    SOUND_CATEGORY category;
+    int priority;
+
+    // Command arguments
+    int id;                       // voice ID, or query ID for queries
+    int handle;                   // sound handle, for commands that refer to a sound by handle instead of file path
+    float pitch;                  // playback speed of a played voice, 1 for the original pitch
+    float value;                  // new volume, or 1 to mute
+    unsigned int fadeSampleLength;
+    unsigned long long clock;     // DSP clock a scheduled play, stop or fade happens at, 0 for immediately
+    float listener[9];            // position, forward and up vectors
+    VoiceCategorySettings categorySettings;
+
+    /**
+     * Creates a command with the fields of a SoundInfo
+     */
+    static AudioCommand make(AUDIO_COMMAND_TYPE type, SoundInfo& soundInfo) {
+        AudioCommand command = make(type);
+        command.filePath = soundInfo.getFilePath();
+        command.volume = soundInfo.getVolume();
+        command.reverbAmount = soundInfo.getReverbAmount();
+        command.x = soundInfo.getX(), command.y = soundInfo.getY(), command.z = soundInfo.getZ();
+        command.loop = soundInfo.isLoop();
+        command.is3D = soundInfo.is3D();
+        command.category = soundInfo.getCategory();
+        command.priority = soundInfo.getPriority();
+        return command;
+    }
+
+    /**
+     * Creates a command without a SoundInfo
+     */
+    static AudioCommand make(AUDIO_COMMAND_TYPE type) {
+        AudioCommand command = { };
+        command.type = type;
+        command.handle = -1;
+        command.pitch = 1.0f;
+        return command;
+    }
+
+    /**
+     * Recreates the SoundInfo the command was made with
+     */
+    SoundInfo getSoundInfo() const {
+        SoundInfo soundInfo(filePath, volume, reverbAmount, loop ? SOUND_LOOP : SOUND_ONE_SHOT, is3D ? SOUND_3D : SOUND_2D, x, y, z);
+        soundInfo.setCategory(category);
+        soundInfo.setPriority(priority);
+        return soundInfo;
+    }
+};
+static_assert(std::is_trivially_copyable<AudioCommand>::value, "AudioCommand must be plain data");
+
+/**
+ * Bounded lock-free queue for exactly one producer thread and one consumer thread.
+ * The producer and consumer indices are on separate cache lines, so the two threads don't contend
+ * for the same line on every push and pop.
+ * @tparam Capacity - number of elements, must be a power of two
+ */
+template <typename T, unsigned int Capacity>
+class SPSCQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "SPSCQueue capacity must be a power of two");
+public:
+    /**
+     * Adds an element. Called by the producer thread only.
+     * @returns false if the queue is full
+     */
+    bool tryPush(const T& element) {
+        unsigned int tail = tailIndex.load(std::memory_order_relaxed);
+        if (tail - headIndex.load(std::memory_order_acquire) == Capacity)
+            return false;
+        buffer[tail & (Capacity - 1)] = element;
+        tailIndex.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Adds an element, yielding to the consumer until there is room. Called by the producer thread only.
+     * @returns the number of times the producer had to wait
+     */
+    unsigned int push(const T& element) {
+        unsigned int stalls = 0;
+        while (!tryPush(element)) {
+            stalls++;
+            std::this_thread::yield();
+        }
+        return stalls;
+    }
+
+    /**
+     * Removes the oldest element. Called by the consumer thread only.
+     * @returns false if the queue is empty
+     */
+    bool pop(T& element) {
+        unsigned int head = headIndex.load(std::memory_order_relaxed);
+        if (head == tailIndex.load(std::memory_order_acquire))
+            return false;
+        element = buffer[head & (Capacity - 1)];
+        headIndex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Number of elements in the queue. Only exact when neither thread is using the queue.
+     */
+    unsigned int size() const {
+        return tailIndex.load(std::memory_order_acquire) - headIndex.load(std::memory_order_acquire);
+    }
+
+private:
+    alignas(64) std::atomic<unsigned int> headIndex{ 0 }; // next element to pop, written by the consumer
+    alignas(64) std::atomic<unsigned int> tailIndex{ 0 }; // next free element, written by the producer
+    alignas(64) T buffer[Capacity];
+};
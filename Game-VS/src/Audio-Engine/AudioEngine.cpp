@@ -4,67 +4,257 @@
 #include "AudioEngine.h"
 #include <FMOD/fmod_errors.h>
 #include <iostream>
+#include <algorithm>
+
+// true on the audio thread, whose calls into the engine are executed immediately
+static thread_local bool onAudioThread = false;
 
 AudioEngine::AudioEngine() : sounds(), loopsPlaying(), soundBanks(), 
-    eventDescriptions(), eventInstances() {}
+    eventDescriptions(), eventPools(), eventHandles() {}
+
+void AudioEngine::init(FMOD_OUTPUTTYPE outputType, const char* outputFilePath) {
+    AudioEngineInitOptions options;
+    options.outputType = outputType;
+    options.outputFilePath = outputFilePath;
+    init(options);
+}
 
-void AudioEngine::init() {
+void AudioEngine::init(const AudioEngineInitOptions& options) {
+    this->outputType = options.outputType;
     ERRCHECK( FMOD::Studio::System::create(&studioSystem) );
     ERRCHECK( studioSystem->getCoreSystem(&lowLevelSystem) );
+    ERRCHECK( lowLevelSystem->setOutput(outputType) );
     ERRCHECK( lowLevelSystem->setSoftwareFormat(AUDIO_SAMPLE_RATE, FMOD_SPEAKERMODE_STEREO, 0) );
-    ERRCHECK( lowLevelSystem->set3DSettings(1.0, DISTANCEFACTOR, 0.5f) );
-    ERRCHECK( studioSystem->initialize(MAX_AUDIO_CHANNELS, FMOD_STUDIO_INIT_NORMAL, FMOD_INIT_NORMAL, 0) );
+    // the mixer's buffering can only be changed before the system is initialized
+    if (options.dspBufferLength > 0 || options.dspBufferCount > 0) {
+        unsigned int bufferLength = 0;
+        int bufferCount = 0;
+        ERRCHECK( lowLevelSystem->getDSPBufferSize(&bufferLength, &bufferCount) );
+        ERRCHECK( lowLevelSystem->setDSPBufferSize(options.dspBufferLength > 0 ? options.dspBufferLength : bufferLength,
+            options.dspBufferCount > 0 ? options.dspBufferCount : bufferCount) );
+    }
+    // the voice manager keeps real voices within this budget, so FMOD's own virtualization is only a safety net
+    ERRCHECK( lowLevelSystem->setSoftwareChannels(MAX_REAL_VOICES) );
+    ERRCHECK( lowLevelSystem->set3DSettings(1.0, DISTANCEFACTOR, ROLLOFF_SCALE) );
+    // non-realtime outputs mix in the update, so Studio must update on the calling thread instead of its own
+    FMOD_STUDIO_INITFLAGS studioFlags = isNonRealtime() ? FMOD_STUDIO_INIT_SYNCHRONOUS_UPDATE : FMOD_STUDIO_INIT_NORMAL;
+    ERRCHECK( studioSystem->initialize(MAX_AUDIO_CHANNELS, studioFlags, FMOD_INIT_NORMAL, (void*)options.outputFilePath) );
     ERRCHECK( lowLevelSystem->getMasterChannelGroup(&mastergroup) );
+    voiceManager.init(lowLevelSystem, MIN_DISTANCE * DISTANCEFACTOR, ROLLOFF_SCALE, MAX_REAL_VOICES);
     initReverb();
 }
 
+bool AudioEngine::isNonRealtime() {
+    return outputType == FMOD_OUTPUTTYPE_NOSOUND_NRT || outputType == FMOD_OUTPUTTYPE_WAVWRITER_NRT;
+}
+
 void AudioEngine::deactivate() {
+	stopAudioThread();
+	// the pools' DSPs must be released while the system is open
+	for (OneShotPoolEntry& entry : oneShotPools)
+		entry.pool->release();
 	lowLevelSystem->close();
 	studioSystem->release();
+	// the mixer has stopped, so the reverb's buffers can go
+	convolutionReverb.release();
 }
 
 void AudioEngine::update() {
-    ERRCHECK(studioSystem->update()); // also updates the low level system
+    // the audio thread updates FMOD at its own rate
+    if (!shouldQueue())
+        doUpdate();
+    dispatchLoadCallbacks();
+    // Studio event calls aren't queued, so finished instances are returned to their pools on this thread
+    for (EventInstancePool& pool : eventPools)
+        pool.update();
+}
+
+void AudioEngine::startAudioThread(float updatesPerSecond) {
+    if (audioThreadRunning)
+        return;
+    producerThreadID = std::this_thread::get_id();
+    audioThreadUpdatePeriod = std::chrono::duration<double>(1.0 / updatesPerSecond);
+    publishSnapshot();
+    audioThreadRunning = true;
+    audioThread = std::thread(&AudioEngine::audioThreadLoop, this);
+}
+
+void AudioEngine::stopAudioThread() {
+    if (!audioThreadRunning)
+        return;
+    audioThreadRunning = false;
+    audioThread.join();
+}
+
+bool AudioEngine::isThreaded() {
+    return audioThreadRunning;
+}
+
+void AudioEngine::benchmarkCallCost(SoundInfo loopSound, int calls) {
+    bool wasThreaded = isThreaded();
+    SoundInfo voiceSound = loopSound;
+    voiceSound.setVolume(0.0f);
+    const char* names[] = { "set3DListenerPosition", "updateSoundLoopVolume", "update3DSoundPosition",
+                            "playVoice + stopVoice", "soundIsPlaying", "getSoundLengthInMS", "update" };
+    const int nCalls = sizeof(names) / sizeof(names[0]);
+    double microseconds[2][nCalls];
+    unsigned long long stalls[2];
+    for (int threaded = 0; threaded < 2; threaded++) {
+        threaded ? startAudioThread() : stopAudioThread();
+        unsigned long long stallsBefore = commandQueueStalls;
+        for (int c = 0; c < nCalls; c++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int i = 0; i < calls; i++) {
+                switch (c) {
+                case 0: set3DListenerPosition(listenerpos.x, listenerpos.y, listenerpos.z, forward.x, forward.y, forward.z, up.x, up.y, up.z); break;
+                case 1: updateSoundLoopVolume(loopSound, loopSound.getVolume()); break;
+                case 2: update3DSoundPosition(loopSound); break;
+                case 3: stopVoice(playVoice(voiceSound)); break;
+                case 4: soundIsPlaying(loopSound); break;
+                case 5: getSoundLengthInMS(loopSound); break;
+                default: update(); break;
+                }
+            }
+            microseconds[threaded][c] = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count() / calls;
+        }
+        stalls[threaded] = commandQueueStalls - stallsBefore;
+    }
+    if (!wasThreaded)
+        stopAudioThread();
+
+    std::cout << "Audio Engine: game thread cost per call (" << calls << " calls each), immediate vs queued to audio thread\n";
+    for (int c = 0; c < nCalls; c++)
+        std::cout << "  " << names[c] << ": " << microseconds[0][c] << " us vs " << microseconds[1][c] << " us\n";
+    std::cout << "  command queue full stalls while queued: " << stalls[1] << '\n';
+}
+
+int AudioEngine::loadSound(SoundInfo soundInfo, SoundLoadCallback onLoaded) {
+    if (onLoaded)
+        soundLoadCallbacks.insert({ soundInfo.getUniqueID(), onLoaded });
+    pendingSoundLoads++;
+    AudioCommand command = AudioCommand::make(AUDIO_COMMAND_LOAD_SOUND, soundInfo);
+    auto handle = soundHandles.find(soundInfo.getUniqueID());
+    command.handle = handle != soundHandles.end() ? handle->second : (soundHandles[soundInfo.getUniqueID()] = nextSoundHandle++);
+    submit(command);
+    return command.handle;
+}
+
+int AudioEngine::getSoundHandle(SoundInfo& soundInfo) {
+    auto handle = soundHandles.find(soundInfo.getUniqueID());
+    return handle != soundHandles.end() ? handle->second : -1;
+}
+
+SOUND_LOAD_STATE AudioEngine::getSoundLoadState(SoundInfo soundInfo) {
+    std::lock_guard<std::mutex> lock(snapshotMutex);
+    auto state = soundLoadStates.find(soundInfo.getUniqueID());
+    return state != soundLoadStates.end() ? state->second : SOUND_LOAD_STATE_UNLOADED;
+}
+
+int AudioEngine::getPendingSoundLoads() {
+    return pendingSoundLoads;
 }
 
-void AudioEngine::loadSound(SoundInfo soundInfo) {
-    if (!soundInfo.isLoaded()) {
+void AudioEngine::waitForSoundLoads() {
+    while (pendingSoundLoads > 0) {
+        if (shouldQueue())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        else {
+            pollLoadingSounds();
+            if (pendingSoundLoads > 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    dispatchLoadCallbacks();
+}
+
+void AudioEngine::doLoadSound(SoundInfo soundInfo, int handle) {
+    if (handle >= (int)handleSounds.size()) {
+        handleSounds.resize(handle + 1, nullptr);
+        handleSoundInfos.resize(handle + 1, soundInfo);
+    }
+    handleSoundInfos[handle] = soundInfo;
+    handlesByPath[soundInfo.getUniqueID()] = handle;
+    SOUND_LOAD_STATE state = getSoundLoadState(soundInfo);
+    if (state == SOUND_LOAD_STATE_UNLOADED || state == SOUND_LOAD_STATE_FAILED) {
         std::cout << "Audio Engine: Loading Sound from file " << soundInfo.getFilePath() << '\n';
-        FMOD::Sound* sound;
-        ERRCHECK(lowLevelSystem->createSound(soundInfo.getFilePath(), soundInfo.is3D() ? FMOD_3D : FMOD_2D, 0, &sound));
-        ERRCHECK(sound->setMode(soundInfo.isLoop() ? FMOD_LOOP_NORMAL : FMOD_LOOP_OFF));
-        ERRCHECK(sound->set3DMinMaxDistance(0.5f * DISTANCEFACTOR, 5000.0f * DISTANCEFACTOR));
-        sounds.insert({ soundInfo.getUniqueID(), sound });
-        unsigned int msLength = 0;
-		ERRCHECK(sounds[soundInfo.getUniqueID()]->getLength(&msLength, FMOD_TIMEUNIT_MS));
-        //soundInfo.setMSLength(msLength);
-        soundInfo.setLoaded(SOUND_LOADED);
+        // the file is read and decoded on FMOD's loading thread, pollLoadingSounds() finishes the sound once it's ready
+        FMOD_MODE mode = FMOD_NONBLOCKING | (soundInfo.is3D() ? FMOD_3D : FMOD_2D) | (soundInfo.isLoop() ? FMOD_LOOP_NORMAL : FMOD_LOOP_OFF);
+        // packed sounds are read from their range of the pack file
+        const AudioPack* pack = nullptr;
+        const AudioPackEntry* packEntry = nullptr;
+        for (const AudioPack& audioPack : audioPacks)
+            if ((packEntry = audioPack.find(soundInfo.getFilePath())) != nullptr) {
+                pack = &audioPack;
+                break;
+            }
+        FMOD_CREATESOUNDEXINFO exinfo = { };
+        exinfo.cbsize = sizeof(FMOD_CREATESOUNDEXINFO);
+        if (packEntry) {
+            exinfo.fileoffset = (unsigned int)packEntry->offset;
+            exinfo.length = (unsigned int)packEntry->size;
+            if (packEntry->loadMode == AUDIO_PACK_LOAD_COMPRESSED)
+                mode |= FMOD_CREATECOMPRESSEDSAMPLE;
+            else if (packEntry->loadMode == AUDIO_PACK_LOAD_STREAM)
+                mode |= FMOD_CREATESTREAM;
+        }
+        FMOD::Sound* sound = nullptr;
+        FMOD_RESULT result = lowLevelSystem->createSound(packEntry ? pack->getFilePath().c_str() : soundInfo.getFilePath(), mode, packEntry ? &exinfo : 0, &sound);
+        if (result != FMOD_OK) { // e.g. a missing file, finished here as a load that failed on the loading thread
+            std::cout << "Audio Engine: Failed to load sound from file " << soundInfo.getFilePath() << '\n';
+            ERRCHECK(result);
+            pendingSoundLoads--;
+            std::lock_guard<std::mutex> lock(snapshotMutex);
+            soundLoadStates[soundInfo.getUniqueID()] = SOUND_LOAD_STATE_FAILED;
+            completedSoundLoads.push_back({ soundInfo, false });
+            return;
+        }
+        if (loadingSounds.empty())
+            soundLoadStartTime = std::chrono::steady_clock::now();
+        sounds[soundInfo.getUniqueID()] = sound;
+        loadingSounds.push_back(soundInfo);
+        std::lock_guard<std::mutex> lock(snapshotMutex);
+        soundLoadStates[soundInfo.getUniqueID()] = SOUND_LOAD_STATE_LOADING;
     }
-    else
+    else if (state == SOUND_LOAD_STATE_READY) {
         std::cout << "Audio Engine: Sound File was already loaded!\n";
+        pendingSoundLoads--;
+        std::lock_guard<std::mutex> lock(snapshotMutex);
+        completedSoundLoads.push_back({ soundInfo, true });
+    }
+    else // the callback is called when the load in progress finishes
+        pendingSoundLoads--;
 }
 
 void AudioEngine::playSound(SoundInfo soundInfo) {
-    if (!soundInfo.isLoaded()) {
-        //std::cout << "Playing Sound\n";
-        FMOD::Channel* channel;
-        // start play in 'paused' state
-        ERRCHECK(lowLevelSystem->playSound(sounds[soundInfo.getUniqueID()], 0, true /* start paused */, &channel));
-
-        if (soundInfo.is3D())
-            set3dChannelPosition(soundInfo, channel);
-
-        //std::cout << "Playing sound at volume " << soundInfo.getVolume() << '\n';
-        channel->setVolume(soundInfo.getVolume());
+    AudioCommand command = AudioCommand::make(AUDIO_COMMAND_PLAY_SOUND, soundInfo);
+    command.id = nextVoiceID++;
+    submit(command);
+}
 
-        if (soundInfo.isLoop()) // add to channel map of sounds currently playing, to stop later
-            loopsPlaying.insert({ soundInfo.getUniqueID(), channel });
+void AudioEngine::playSoundAt(SoundInfo soundInfo, unsigned long long startClock) {
+    AudioCommand command = AudioCommand::make(AUDIO_COMMAND_PLAY_SOUND, soundInfo);
+    command.id = nextVoiceID++;
+    command.clock = startClock;
+    submit(command);
+}
 
-        ERRCHECK( channel->setReverbProperties(0, soundInfo.getReverbAmount()) );
+void AudioEngine::doPlaySound(SoundInfo soundInfo, int voiceID, unsigned long long startClock) {
+    lastVoiceID = std::max(lastVoiceID, voiceID); // deferred voices are played after newer ones
+    AudioCommand command = AudioCommand::make(AUDIO_COMMAND_PLAY_SOUND, soundInfo);
+    command.id = voiceID;
+    command.clock = startClock;
+    if (deferUntilLoaded(command)) {
+        if (soundInfo.isLoop()) // the loop counts as playing while it waits for its file
+            loopsPlaying[soundInfo.getUniqueID()] = voiceID;
+        return;
+    }
+    if (soundLoaded(soundInfo)) {
+        //std::cout << "Playing Sound\n";
+        // the voice manager starts the channel if the voice is important enough to be real
+        bool playing = voiceManager.play(sounds[soundInfo.getUniqueID()], soundInfo, get3DPosition(soundInfo), voiceID, startClock);
 
-        // start audio playback
-        ERRCHECK( channel->setPaused(false) );
-         
+        if (playing && soundInfo.isLoop()) // add to voice map of sounds currently playing, to stop later
+            loopsPlaying[soundInfo.getUniqueID()] = voiceID;
     }
     else
         std::cout << "Audio Engine: Can't play, sound was not loaded yet from " << soundInfo.getFilePath() << '\n';
@@ -72,35 +262,172 @@ void AudioEngine::playSound(SoundInfo soundInfo) {
 }
 
 void AudioEngine::stopSound(SoundInfo soundInfo) {
+    submit(AudioCommand::make(AUDIO_COMMAND_STOP_SOUND, soundInfo));
+}
+
+void AudioEngine::stopSoundAt(SoundInfo soundInfo, unsigned long long endClock) {
+    AudioCommand command = AudioCommand::make(AUDIO_COMMAND_STOP_SOUND, soundInfo);
+    command.clock = endClock;
+    submit(command);
+}
+
+void AudioEngine::doStopSound(SoundInfo soundInfo, unsigned long long endClock) {
     if (soundIsPlaying(soundInfo)) {
-        ERRCHECK( loopsPlaying[soundInfo.getUniqueID()]->stop() );
-        loopsPlaying.erase(soundInfo.getUniqueID());
+        int voiceID = loopsPlaying[soundInfo.getUniqueID()];
+        if (cancelDeferredVoice(voiceID))
+            loopsPlaying.erase(soundInfo.getUniqueID());
+        else if (endClock) // the loop counts as playing until it stops
+            voiceManager.stopAt(voiceID, endClock);
+        else {
+            voiceManager.stop(voiceID);
+            loopsPlaying.erase(soundInfo.getUniqueID());
+        }
     }
     else
         std::cout << "Audio Engine: Can't stop a looping sound that's not playing!\n";
 }
 
+unsigned long long AudioEngine::getDSPClock() {
+    if (!shouldQueue())
+        return voiceManager.getDSPClock();
+    std::lock_guard<std::mutex> lock(snapshotMutex);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - snapshotClockTime).count();
+    return snapshotDSPClock + (unsigned long long)(elapsed * AUDIO_SAMPLE_RATE);
+}
+
+int AudioEngine::playVoice(SoundInfo soundInfo) {
+    AudioCommand command = AudioCommand::make(AUDIO_COMMAND_PLAY_VOICE, soundInfo);
+    command.id = nextVoiceID++;
+    submit(command);
+    return command.id;
+}
+
+int AudioEngine::playVoice(int soundHandle, float volume, float pitch, float x, float y, float z) {
+    AudioCommand command = AudioCommand::make(AUDIO_COMMAND_PLAY_HANDLE);
+    command.id = nextVoiceID++;
+    command.handle = soundHandle;
+    command.volume = volume;
+    command.pitch = pitch;
+    command.x = x, command.y = y, command.z = z;
+    submit(command);
+    return command.id;
+}
+
+void AudioEngine::doPlayVoice(SoundInfo soundInfo, int voiceID, float pitch) {
+    lastVoiceID = std::max(lastVoiceID, voiceID); // deferred voices are played after newer ones
+    AudioCommand command = AudioCommand::make(AUDIO_COMMAND_PLAY_VOICE, soundInfo);
+    command.id = voiceID;
+    command.pitch = pitch;
+    if (deferUntilLoaded(command))
+        return;
+    if (!soundLoaded(soundInfo)) {
+        std::cout << "Audio Engine: Can't play voice, sound was not loaded yet from " << soundInfo.getFilePath() << '\n';
+        return;
+    }
+    voiceManager.play(sounds[soundInfo.getUniqueID()], soundInfo, get3DPosition(soundInfo), voiceID, 0, pitch);
+}
+
+void AudioEngine::doPlayHandle(const AudioCommand& command) {
+    lastVoiceID = std::max(lastVoiceID, command.id);
+    if (command.handle < 0 || command.handle >= (int)handleSounds.size()) {
+        std::cout << "Audio Engine: Can't play voice, invalid sound handle " << command.handle << '\n';
+        return;
+    }
+    // the handle's SoundInfo is reused for every voice, so playing by handle doesn't copy the file path
+    SoundInfo& soundInfo = handleSoundInfos[command.handle];
+    soundInfo.setVolume(command.volume);
+    soundInfo.set3DCoords(command.x, command.y, command.z);
+    if (!handleSounds[command.handle]) { // still loading, or failed to load
+        doPlayVoice(soundInfo, command.id, command.pitch);
+        return;
+    }
+    voiceManager.play(handleSounds[command.handle], soundInfo, get3DPosition(soundInfo), command.id, 0, command.pitch);
+}
+
+void AudioEngine::stopVoice(int voiceID) {
+    AudioCommand command = AudioCommand::make(AUDIO_COMMAND_STOP_VOICE);
+    command.id = voiceID;
+    submit(command);
+}
+
+bool AudioEngine::voiceIsPlaying(int voiceID) {
+    if (!shouldQueue())
+        return voiceManager.isActive(voiceID) || findDeferredVoice(voiceID);
+    std::lock_guard<std::mutex> lock(snapshotMutex);
+    // voices still in the queue are reported as playing
+    return voiceID > snapshotLastVoiceID || std::binary_search(snapshotActiveVoices.begin(), snapshotActiveVoices.end(), voiceID);
+}
+
+void AudioEngine::setVoice3DPosition(int voiceID, float x, float y, float z) {
+    AudioCommand command = AudioCommand::make(AUDIO_COMMAND_SET_VOICE_POSITION);
+    command.id = voiceID;
+    command.x = x, command.y = y, command.z = z;
+    submit(command);
+}
+
+void AudioEngine::setVoiceVolume(int voiceID, float volume) {
+    AudioCommand command = AudioCommand::make(AUDIO_COMMAND_SET_VOICE_VOLUME);
+    command.id = voiceID;
+    command.value = volume;
+    submit(command);
+}
+
+void AudioEngine::doSetVoiceVolume(int voiceID, float volume) {
+    AudioCommand* deferred = findDeferredVoice(voiceID);
+    if (deferred)
+        deferred->volume = volume;
+    voiceManager.setVolume(voiceID, volume);
+    FMOD::Channel* channel = voiceManager.getChannel(voiceID);
+    if (channel)
+        ERRCHECK(channel->setVolume(volume));
+}
+
+float AudioEngine::getDistanceAttenuation(float distance) {
+    float minDistance = MIN_DISTANCE * DISTANCEFACTOR;
+    distance *= DISTANCEFACTOR;
+    if (distance <= minDistance)
+        return 1.0f;
+    return minDistance / (minDistance + ROLLOFF_SCALE * (distance - minDistance));
+}
+
 void AudioEngine::updateSoundLoopVolume(SoundInfo& soundInfo, float newVolume, unsigned int fadeSampleLength) {
+    // the command holds the current volume, which the fade starts from
+    AudioCommand command = AudioCommand::make(AUDIO_COMMAND_UPDATE_LOOP_VOLUME, soundInfo);
+    command.value = newVolume;
+    command.fadeSampleLength = fadeSampleLength;
+    submit(command);
+    soundInfo.setVolume(newVolume); // update the SoundInfo's volume
+}
+
+void AudioEngine::doUpdateSoundLoopVolume(SoundInfo soundInfo, float newVolume, unsigned int fadeSampleLength) {
     if (soundIsPlaying(soundInfo)) {
-        FMOD::Channel* channel = loopsPlaying[soundInfo.getUniqueID()];
-        if (fadeSampleLength <= 64) // 64 samples is default volume fade out
-            ERRCHECK( channel->setVolume(newVolume) );
-        else {
-            bool fadeUp = newVolume > soundInfo.getVolume();
-            // get current audio clock time
-            unsigned long long parentclock = 0;
-			ERRCHECK(channel->getDSPClock(NULL, &parentclock));
+        int voiceID = loopsPlaying[soundInfo.getUniqueID()];
+        AudioCommand* deferred = findDeferredVoice(voiceID);
+        if (deferred) { // the loop starts at the new volume once its file has loaded
+            deferred->volume = newVolume;
+            return;
+        }
+        voiceManager.setVolume(voiceID, newVolume);
+        // a virtual voice has no channel to fade, it starts at the new volume when it becomes real
+        FMOD::Channel* channel = voiceManager.getChannel(voiceID);
+        if (channel) {
+            if (fadeSampleLength <= 64) // 64 samples is default volume fade out
+                ERRCHECK( channel->setVolume(newVolume) );
+            else {
+                bool fadeUp = newVolume > soundInfo.getVolume();
+                // get current audio clock time
+                unsigned long long parentclock = 0;
+                ERRCHECK(channel->getDSPClock(NULL, &parentclock));
             
-            float targetFadeVol = fadeUp ? 1.0f : newVolume;
+                float targetFadeVol = fadeUp ? 1.0f : newVolume;
                 
-            if (fadeUp) ERRCHECK(channel->setVolume(newVolume));
+                if (fadeUp) ERRCHECK(channel->setVolume(newVolume));
             
-            ERRCHECK(channel->addFadePoint(parentclock, soundInfo.getVolume()));
-            ERRCHECK(channel->addFadePoint(parentclock + fadeSampleLength, targetFadeVol));
-            //std::cout << "Current DSP Clock: " << parentclock << ", fade length in samples  = " << fadeSampleLength << "\n";
+                ERRCHECK(channel->addFadePoint(parentclock, soundInfo.getVolume()));
+                ERRCHECK(channel->addFadePoint(parentclock + fadeSampleLength, targetFadeVol));
+                //std::cout << "Current DSP Clock: " << parentclock << ", fade length in samples  = " << fadeSampleLength << "\n";
+            }
         }
-        //std::cout << "Updating with new soundinfo vol \n";
-        soundInfo.setVolume(newVolume); // update the SoundInfo's volume
     }
     else
         std::cout << "AudioEngine: Can't update sound loop volume! (It isn't playing or might not be loaded)\n";
@@ -108,100 +435,282 @@ void AudioEngine::updateSoundLoopVolume(SoundInfo& soundInfo, float newVolume, u
 
 
 
+void AudioEngine::fadeSoundLoopVolumeAt(SoundInfo& soundInfo, float newVolume, unsigned long long startClock, unsigned long long lengthSamples) {
+    AudioCommand command = AudioCommand::make(AUDIO_COMMAND_FADE_LOOP_VOLUME, soundInfo);
+    command.value = newVolume;
+    command.clock = startClock;
+    command.fadeSampleLength = (unsigned int)lengthSamples;
+    submit(command);
+    soundInfo.setVolume(newVolume);
+}
+
+void AudioEngine::doFadeSoundLoopVolume(SoundInfo soundInfo, float newVolume, unsigned long long startClock, unsigned long long lengthSamples) {
+    if (!soundIsPlaying(soundInfo)) {
+        std::cout << "AudioEngine: Can't fade sound loop volume! (It isn't playing or might not be loaded)\n";
+        return;
+    }
+    int voiceID = loopsPlaying[soundInfo.getUniqueID()];
+    AudioCommand* deferred = findDeferredVoice(voiceID);
+    if (deferred)
+        deferred->volume = newVolume;
+    else
+        voiceManager.fadeVolume(voiceID, soundInfo.getVolume(), newVolume, startClock, lengthSamples);
+}
+
 void AudioEngine::update3DSoundPosition(SoundInfo soundInfo) {
-    if (soundIsPlaying(soundInfo)) 
-        set3dChannelPosition(soundInfo, loopsPlaying[soundInfo.getUniqueID()]);
+    submit(AudioCommand::make(AUDIO_COMMAND_UPDATE_3D_POSITION, soundInfo));
+}
+
+void AudioEngine::doUpdate3DSoundPosition(SoundInfo soundInfo) {
+    AudioCommand* deferred = soundIsPlaying(soundInfo) ? findDeferredVoice(loopsPlaying[soundInfo.getUniqueID()]) : nullptr;
+    if (deferred)
+        deferred->x = soundInfo.getX(), deferred->y = soundInfo.getY(), deferred->z = soundInfo.getZ();
+    else if (soundIsPlaying(soundInfo)) 
+        voiceManager.set3DPosition(loopsPlaying[soundInfo.getUniqueID()], get3DPosition(soundInfo));
     else
         std::cout << "Audio Engine: Can't update sound position!\n";
 
 }
 
 bool AudioEngine::soundIsPlaying(SoundInfo soundInfo) {
-	return soundInfo.isLoop() && loopsPlaying.count(soundInfo.getUniqueID());
+	if (shouldQueue()) {
+		std::lock_guard<std::mutex> lock(snapshotMutex);
+		return soundInfo.isLoop() && snapshotLoopsPlaying.count(soundInfo.getUniqueID());
+	}
+	if (!soundInfo.isLoop() || !loopsPlaying.count(soundInfo.getUniqueID()))
+		return false;
+	// the loop's voice may have been stolen by the voice manager
+	int voiceID = loopsPlaying[soundInfo.getUniqueID()];
+	if (!voiceManager.isActive(voiceID) && !findDeferredVoice(voiceID)) {
+		loopsPlaying.erase(soundInfo.getUniqueID());
+		return false;
+	}
+	return true;
 }
 
 void AudioEngine::set3DListenerPosition(float posX, float posY, float posZ, float forwardX, float forwardY, float forwardZ, float upX, float upY, float upZ) {
-    listenerpos = { posX,     posY,     posZ };
-    forward =     { forwardX, forwardY, forwardZ };
-    up =          { upX,      upY,      upZ };
+    AudioCommand command = AudioCommand::make(AUDIO_COMMAND_SET_LISTENER);
+    float listener[9] = { posX, posY, posZ, forwardX, forwardY, forwardZ, upX, upY, upZ };
+    std::copy(listener, listener + 9, command.listener);
+    submit(command);
+}
+
+void AudioEngine::doSet3DListenerPosition(const float* listener) {
+    listenerpos = { listener[0], listener[1], listener[2] };
+    forward =     { listener[3], listener[4], listener[5] };
+    up =          { listener[6], listener[7], listener[8] };
     ERRCHECK(lowLevelSystem->set3DListenerAttributes(0, &listenerpos, 0, &forward, &up));
+    // Studio events are spatialized by Studio's own listener
+    FMOD_3D_ATTRIBUTES attributes = { listenerpos, { 0, 0, 0 }, forward, up };
+    ERRCHECK(studioSystem->setListenerAttributes(0, &attributes));
+    voiceManager.setListenerPosition(listenerpos);
+    updateReverbZone();
 }
 
 unsigned int AudioEngine::getSoundLengthInMS(SoundInfo soundInfo) {
+	if (shouldQueue()) {
+		{
+			std::lock_guard<std::mutex> lock(snapshotMutex);
+			auto cached = soundLengthsMS.find(soundInfo.getUniqueID());
+			if (cached != soundLengthsMS.end())
+				return cached->second;
+		}
+		// the sound may still be loading in the queue
+		return getSoundLengthInMSAsync(soundInfo).get();
+	}
+	while (getSoundLoadState(soundInfo) == SOUND_LOAD_STATE_LOADING) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		pollLoadingSounds();
+	}
 	unsigned int length = 0;
 	if (sounds.count(soundInfo.getUniqueID()))
 		ERRCHECK(sounds[soundInfo.getUniqueID()]->getLength(&length, FMOD_TIMEUNIT_MS));
 	return length;
 }
 
+std::future<unsigned int> AudioEngine::getSoundLengthInMSAsync(SoundInfo soundInfo) {
+	if (!shouldQueue()) {
+		std::promise<unsigned int> length;
+		length.set_value(getSoundLengthInMS(soundInfo));
+		return length.get_future();
+	}
+	AudioCommand command = AudioCommand::make(AUDIO_COMMAND_QUERY_SOUND_LENGTH, soundInfo);
+	std::future<unsigned int> length;
+	{
+		std::lock_guard<std::mutex> lock(queryMutex);
+		command.id = nextQueryID++;
+		length = lengthQueries[command.id].get_future();
+	}
+	submit(command);
+	return length;
+}
+
+void AudioEngine::addOcclusionBox(const glm::mat4& modelMatrix, glm::vec3 boxMin, glm::vec3 boxMax) {
+    if (audioThreadRunning) {
+        std::cout << "Audio Engine: Can't add occlusion boxes while the audio thread runs\n";
+        return;
+    }
+    occlusion.addBox(modelMatrix, boxMin, boxMax);
+    voiceManager.setOcclusion(&occlusion, occlusionRayBudget);
+}
+
+void AudioEngine::setOcclusionRayBudget(int raysPerUpdate) {
+    if (audioThreadRunning) {
+        std::cout << "Audio Engine: Can't change the occlusion ray budget while the audio thread runs\n";
+        return;
+    }
+    occlusionRayBudget = raysPerUpdate;
+    voiceManager.setOcclusion(&occlusion, occlusionRayBudget);
+}
+
+bool AudioEngine::loadAudioPack(const char* filePath) {
+    AudioPack pack;
+    if (!pack.open(filePath))
+        return false;
+    std::cout << "Audio Engine: Loaded audio pack " << filePath << " with " << pack.getEntries().size() << " sounds\n";
+    audioPacks.push_back(std::move(pack));
+    return true;
+}
+
 void AudioEngine::loadFMODStudioBank(const char* filepath) {
     std::cout << "Audio Engine: Loading FMOD Studio Sound Bank " << filepath << '\n';
     FMOD::Studio::Bank* bank = NULL;
-    ERRCHECK(studioSystem->loadBankFile(filepath, FMOD_STUDIO_LOAD_BANK_NORMAL, &bank));
+    // the bank loads on FMOD Studio's loading thread
+    ERRCHECK(studioSystem->loadBankFile(filepath, FMOD_STUDIO_LOAD_BANK_NONBLOCKING, &bank));
     soundBanks.insert({ filepath, bank });
 }
 
-void AudioEngine::loadFMODStudioEvent(const char* eventName, std::vector<std::pair<const char*, float>> paramsValues) { // std::vector<std::map<const char*, float>> perInstanceParameterValues) {
-    std::cout << "AudioEngine: Loading FMOD Studio Event " << eventName << '\n';
+bool AudioEngine::bankIsLoaded(const char* filepath) {
+    if (!soundBanks.count(filepath))
+        return false;
+    FMOD_STUDIO_LOADING_STATE state = FMOD_STUDIO_LOADING_STATE_UNLOADED;
+    ERRCHECK(soundBanks[filepath]->getLoadingState(&state));
+    return state == FMOD_STUDIO_LOADING_STATE_LOADED;
+}
+
+int AudioEngine::loadFMODStudioEvent(const char* eventName, std::vector<std::pair<const char*, float>> paramsValues, int instanceCapacity) {
+    std::cout << "AudioEngine: Loading FMOD Studio Event " << eventName << " with " << instanceCapacity << " instances\n";
+    waitForBankLoads();
+    auto handle = eventHandles.find(eventName);
+    if (handle != eventHandles.end()) {
+        std::cout << "AudioEngine: Event " << eventName << " was already loaded\n";
+        return handle->second;
+    }
     FMOD::Studio::EventDescription* eventDescription = NULL;
     ERRCHECK(studioSystem->getEvent(eventName, &eventDescription));
-    // Create an instance of the event
-    FMOD::Studio::EventInstance* eventInstance = NULL;
-    ERRCHECK(eventDescription->createInstance(&eventInstance));
+    if (!eventDescription)
+        return -1;
     // DEBUG TODO remove
     //printEventInfo(eventDescription);
+    // Create the instances of the event up front, playing the event reuses them
+    eventPools.emplace_back();
+    EventInstancePool& pool = eventPools.back();
+    pool.init(eventDescription, instanceCapacity);
     for (const auto& parVal : paramsValues) {
         std::cout << "AudioEngine: Setting Event Instance Parameter " << parVal.first << "to value: " << parVal.second << '\n';
-        // Set the parameter values of the event instance
-        ERRCHECK(eventInstance->setParameterByName(parVal.first, parVal.second));
+        // Set the parameter values of every instance of the event
+        pool.setDefaultParameter(parVal.first, parVal.second);
     }
-    eventInstances.insert({ eventName, eventInstance });
     eventDescriptions.insert({ eventName, eventDescription });
+    eventHandles.insert({ eventName, (int)eventPools.size() - 1 });
+    return (int)eventPools.size() - 1;
 }
 
-void AudioEngine::setFMODEventParamValue(const char* eventName, const char* parameterName, float value) {
-    if (eventInstances.count(eventName) > 0) 
-        ERRCHECK(eventInstances[eventName]->setParameterByName(parameterName, value));
-    else
-        std::cout << "AudioEngine: Event " << eventName << " was not in event instance cache, can't set param \n";
+int AudioEngine::getEventHandle(const char* eventName) {
+    auto handle = eventHandles.find(eventName);
+    return handle != eventHandles.end() ? handle->second : -1;
+}
 
+void AudioEngine::setFMODEventParamValue(const char* eventName, const char* parameterName, float value, int instanceID) {
+    if (EventInstancePool* pool = findEventPool(eventName, "can't set param")) {
+        if (instanceID == -1)
+            pool->setDefaultParameter(parameterName, value);
+        else
+            pool->setParameter(instanceID, parameterName, value);
+    }
 }
 
-void AudioEngine::playEvent(const char* eventName, int instanceIndex) {
+int AudioEngine::playEvent(const char* eventName, int instanceID) {
     // printEventInfo(eventDescriptions[eventName]);
-    auto eventInstance = eventInstances[eventName];
-    if (eventInstances.count(eventName) > 0) 
-        ERRCHECK(eventInstances[eventName]->start());
-    else
-        std::cout << "AudioEngine: Event " << eventName << " was not in event instance cache, cannot play \n";
+    EventInstancePool* pool = findEventPool(eventName, "cannot play");
+    if (!pool)
+        return -1;
+    if (instanceID == -1)
+        return pool->start();
+    return pool->restart(instanceID) ? instanceID : -1;
 }
 
-void AudioEngine::stopEvent(const char* eventName, int instanceIndex) {
-    if(eventInstances.count(eventName) > 0)
-        ERRCHECK( eventInstances[eventName]->stop(FMOD_STUDIO_STOP_ALLOWFADEOUT) );
-    else
-        std::cout << "AudioEngine: Event " << eventName << " was not in event instance cache, cannot stop \n";
+int AudioEngine::playEvent3D(const char* eventName, float x, float y, float z) {
+    return playEventByHandle(getEventHandle(eventName), x, y, z);
+}
+
+int AudioEngine::playEventByHandle(int eventHandle, float x, float y, float z, float volume) {
+    if (eventHandle < 0 || eventHandle >= (int)eventPools.size()) {
+        std::cout << "AudioEngine: Event handle " << eventHandle << " isn't loaded, cannot play \n";
+        return -1;
+    }
+    FMOD_3D_ATTRIBUTES attributes = { { x * DISTANCEFACTOR, y * DISTANCEFACTOR, z * DISTANCEFACTOR }, { 0, 0, 0 }, { 0, 0, 1 }, { 0, 1, 0 } };
+    return eventPools[eventHandle].start(&attributes, volume);
 }
 
-void AudioEngine::setEventVolume(const char* eventName, float volume0to1) {
+void AudioEngine::setEventInstance3DPosition(const char* eventName, int instanceID, float x, float y, float z) {
+    FMOD_3D_ATTRIBUTES attributes = { { x * DISTANCEFACTOR, y * DISTANCEFACTOR, z * DISTANCEFACTOR }, { 0, 0, 0 }, { 0, 0, 1 }, { 0, 1, 0 } };
+    if (EventInstancePool* pool = findEventPool(eventName, "cannot move"))
+        pool->set3DAttributes(instanceID, attributes);
+}
+
+void AudioEngine::stopEvent(const char* eventName, int instanceID) {
+    if (EventInstancePool* pool = findEventPool(eventName, "cannot stop")) {
+        if (instanceID == -1)
+            pool->stopAll();
+        else
+            pool->stop(instanceID);
+    }
+}
+
+void AudioEngine::setEventVolume(const char* eventName, float volume0to1, int instanceID) {
     std::cout << "AudioEngine: Setting Event Volume\n";
-    ERRCHECK( eventInstances[eventName]->setVolume(volume0to1) );
+    if (EventInstancePool* pool = findEventPool(eventName, "cannot set volume")) {
+        if (instanceID == -1)
+            pool->setDefaultVolume(volume0to1);
+        else
+            pool->setVolume(instanceID, volume0to1);
+    }
 }
 
-bool AudioEngine::eventIsPlaying(const char* eventName, int instance /*= 0*/) {
-	FMOD_STUDIO_PLAYBACK_STATE playbackState; 
-	ERRCHECK(eventInstances[eventName]->getPlaybackState(&playbackState));
-	return playbackState == FMOD_STUDIO_PLAYBACK_PLAYING;
+bool AudioEngine::eventIsPlaying(const char* eventName, int instanceID /*= -1*/) {
+	EventInstancePool* pool = findEventPool(eventName, "cannot check playback");
+	return pool && pool->isPlaying(instanceID);
+}
+
+EventPoolStats AudioEngine::getEventPoolStats(const char* eventName) {
+    EventInstancePool* pool = findEventPool(eventName, "has no stats");
+    return pool ? pool->getStats() : EventPoolStats();
+}
+
+void AudioEngine::printEventPoolStats() {
+    for (auto& handle : eventHandles)
+        eventPools[handle.second].printStats(handle.first.c_str());
+}
+
+EventInstancePool* AudioEngine::findEventPool(const char* eventName, const char* action) {
+    auto handle = eventHandles.find(eventName);
+    if (handle != eventHandles.end())
+        return &eventPools[handle->second];
+    std::cout << "AudioEngine: Event " << eventName << " was not loaded, " << action << " \n";
+    return nullptr;
 }
 
 
 void AudioEngine::muteAllSounds() {
-	ERRCHECK(mastergroup->setMute(true));
+	AudioCommand command = AudioCommand::make(AUDIO_COMMAND_SET_MUTE);
+	command.value = 1.0f;
+	submit(command);
 	muted = true;
 }
 
 void AudioEngine::unmuteAllSound() {
-	ERRCHECK(mastergroup->setMute(false));
+	submit(AudioCommand::make(AUDIO_COMMAND_SET_MUTE));
 	muted = false;
 }
 
@@ -209,6 +718,28 @@ bool AudioEngine::isMuted() {
 	return muted;
 }
 
+void AudioEngine::setVoiceCategorySettings(SOUND_CATEGORY category, VoiceCategorySettings settings) {
+	AudioCommand command = AudioCommand::make(AUDIO_COMMAND_SET_CATEGORY_SETTINGS);
+	command.category = category;
+	command.categorySettings = settings;
+	submit(command);
+}
+
+VoiceStats AudioEngine::getVoiceStats() {
+	if (!shouldQueue())
+		return voiceManager.getStats();
+	std::lock_guard<std::mutex> lock(snapshotMutex);
+	return snapshotVoiceStats;
+}
+
+void AudioEngine::printVoiceStats() {
+	submit(AudioCommand::make(AUDIO_COMMAND_PRINT_VOICE_STATS));
+}
+
+void AudioEngine::printSoundMemoryReport() {
+    submit(AudioCommand::make(AUDIO_COMMAND_PRINT_SOUND_MEMORY));
+}
+
 // TODO Fix
 //void AudioEngine::setSoundLoopCount(SoundInfo& soundInfo, int loopCount) {
 //    if (/*soundInfo.isLoaded() */ sounds.count(soundInfo.getUniqueID()) > 0) {
@@ -226,22 +757,387 @@ bool AudioEngine::isMuted() {
 //}
 
 // Private definitions 
+void AudioEngine::submit(const AudioCommand& command) {
+    if (!shouldQueue()) {
+        executeCommand(command);
+        return;
+    }
+    if (std::this_thread::get_id() != producerThreadID)
+        std::cout << "Audio Engine: Called from a thread other than the one that started the audio thread!\n";
+    commandQueueStalls += commandQueue.push(command);
+}
+
+bool AudioEngine::shouldQueue() {
+    return audioThreadRunning && !onAudioThread;
+}
+
+void AudioEngine::executeCommand(const AudioCommand& command) {
+    switch (command.type) {
+    case AUDIO_COMMAND_LOAD_SOUND:          doLoadSound(command.getSoundInfo(), command.handle); break;
+    case AUDIO_COMMAND_PLAY_SOUND:          doPlaySound(command.getSoundInfo(), command.id, command.clock); break;
+    case AUDIO_COMMAND_STOP_SOUND:          doStopSound(command.getSoundInfo(), command.clock); break;
+    case AUDIO_COMMAND_UPDATE_LOOP_VOLUME:  doUpdateSoundLoopVolume(command.getSoundInfo(), command.value, command.fadeSampleLength); break;
+    case AUDIO_COMMAND_FADE_LOOP_VOLUME:
+        doFadeSoundLoopVolume(command.getSoundInfo(), command.value, command.clock, command.fadeSampleLength);
+        break;
+    case AUDIO_COMMAND_UPDATE_3D_POSITION:  doUpdate3DSoundPosition(command.getSoundInfo()); break;
+    case AUDIO_COMMAND_PLAY_VOICE:          doPlayVoice(command.getSoundInfo(), command.id, command.pitch); break;
+    case AUDIO_COMMAND_PLAY_HANDLE:         doPlayHandle(command); break;
+    case AUDIO_COMMAND_STOP_VOICE:
+        if (!cancelDeferredVoice(command.id))
+            voiceManager.stop(command.id);
+        break;
+    case AUDIO_COMMAND_SET_VOICE_POSITION:
+        if (AudioCommand* deferred = findDeferredVoice(command.id))
+            deferred->x = command.x, deferred->y = command.y, deferred->z = command.z;
+        voiceManager.set3DPosition(command.id, { command.x * DISTANCEFACTOR, command.y * DISTANCEFACTOR, command.z * DISTANCEFACTOR });
+        break;
+    case AUDIO_COMMAND_SET_VOICE_VOLUME:    doSetVoiceVolume(command.id, command.value); break;
+    case AUDIO_COMMAND_SET_LISTENER:        doSet3DListenerPosition(command.listener); break;
+    case AUDIO_COMMAND_SET_MUTE:            ERRCHECK(mastergroup->setMute(command.value != 0.0f)); break;
+    case AUDIO_COMMAND_SET_CATEGORY_SETTINGS: voiceManager.setCategorySettings(command.category, command.categorySettings); break;
+    case AUDIO_COMMAND_QUERY_SOUND_LENGTH:  doQuerySoundLength(command.getSoundInfo(), command.id); break;
+    case AUDIO_COMMAND_PRINT_VOICE_STATS:   voiceManager.printStats(); break;
+    case AUDIO_COMMAND_PRINT_SOUND_MEMORY:  doPrintSoundMemoryReport(); break;
+    }
+}
+
+void AudioEngine::audioThreadLoop() {
+    onAudioThread = true;
+    auto nextUpdate = std::chrono::steady_clock::now();
+    AudioCommand command;
+    while (audioThreadRunning) {
+        while (commandQueue.pop(command))
+            executeCommand(command);
+        auto now = std::chrono::steady_clock::now();
+        if (now >= nextUpdate) {
+            doUpdate();
+            publishSnapshot();
+            nextUpdate += std::chrono::duration_cast<std::chrono::steady_clock::duration>(audioThreadUpdatePeriod);
+            if (nextUpdate < now) // don't try to catch up after a stall
+                nextUpdate = now;
+        }
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+    // execute what the game thread queued before stopping the thread
+    while (commandQueue.pop(command))
+        executeCommand(command);
+    publishSnapshot();
+    onAudioThread = false;
+}
+
+void AudioEngine::publishSnapshot() {
+    std::lock_guard<std::mutex> lock(snapshotMutex);
+    snapshotLoopsPlaying.clear();
+    for (const auto& loop : loopsPlaying)
+        if (voiceManager.isActive(loop.second))
+            snapshotLoopsPlaying.insert(loop.first);
+    voiceManager.getActiveVoiceIDs(snapshotActiveVoices);
+    // voices waiting for their sound to load count as playing
+    for (const auto& deferred : deferredCommands)
+        for (const AudioCommand& command : deferred.second)
+            if (command.type != AUDIO_COMMAND_QUERY_SOUND_LENGTH)
+                snapshotActiveVoices.push_back(command.id);
+    std::sort(snapshotActiveVoices.begin(), snapshotActiveVoices.end());
+    snapshotLastVoiceID = lastVoiceID;
+    snapshotVoiceStats = voiceManager.getStats();
+    snapshotDSPClock = voiceManager.getDSPClock();
+    snapshotClockTime = std::chrono::steady_clock::now();
+}
+
+void AudioEngine::doPrintSoundMemoryReport() {
+    static const char* LOAD_MODES[] = { "decompressed", "compressed", "stream" };
+    unsigned long long totalPCMBytes = 0;
+    std::cout << "Audio Engine Sound Memory:\n";
+    for (auto& sound : sounds) {
+        FMOD_OPENSTATE openState;
+        if (sound.second->getOpenState(&openState, nullptr, nullptr, nullptr) != FMOD_OK || openState != FMOD_OPENSTATE_READY)
+            continue;
+        unsigned int pcmBytes = 0;
+        int channels = 0, bits = 0;
+        ERRCHECK(sound.second->getLength(&pcmBytes, FMOD_TIMEUNIT_PCMBYTES));
+        ERRCHECK(sound.second->getFormat(nullptr, nullptr, &channels, &bits));
+        const AudioPackEntry* packEntry = nullptr;
+        for (const AudioPack& audioPack : audioPacks)
+            if ((packEntry = audioPack.find(sound.first)) != nullptr)
+                break;
+        std::cout << "  " << sound.first << ": " << channels << " channels, " << bits << " bit, " << pcmBytes / 1024 << " KB decoded, ";
+        if (packEntry)
+            std::cout << "packed " << packEntry->size / 1024 << " KB " << LOAD_MODES[packEntry->loadMode] << '\n';
+        else
+            std::cout << "loose file\n";
+        totalPCMBytes += pcmBytes;
+    }
+    int currentBytes = 0, maxBytes = 0;
+    ERRCHECK(FMOD::Memory_GetStats(&currentBytes, &maxBytes, false));
+    std::cout << "  " << sounds.size() << " sounds, " << totalPCMBytes / 1024 << " KB decoded, FMOD memory " << currentBytes / 1024
+        << " KB current / " << maxBytes / 1024 << " KB peak\n";
+}
+
+void AudioEngine::doUpdate() {
+    pollLoadingSounds();
+    updateOneShotPools();
+    voiceManager.update();
+    ERRCHECK(studioSystem->update()); // also updates the low level system
+}
+
+void AudioEngine::doQuerySoundLength(SoundInfo soundInfo, int queryID) {
+    AudioCommand command = AudioCommand::make(AUDIO_COMMAND_QUERY_SOUND_LENGTH, soundInfo);
+    command.id = queryID;
+    if (deferUntilLoaded(command))
+        return;
+    unsigned int length = getSoundLengthInMS(soundInfo);
+    std::lock_guard<std::mutex> lock(queryMutex);
+    auto query = lengthQueries.find(queryID);
+    if (query != lengthQueries.end()) {
+        query->second.set_value(length);
+        lengthQueries.erase(query);
+    }
+}
+
+void AudioEngine::pollLoadingSounds() {
+    for (int i = 0; i < (int)loadingSounds.size(); ) {
+        SoundInfo soundInfo = loadingSounds[i];
+        FMOD::Sound* sound = sounds[soundInfo.getUniqueID()];
+        FMOD_OPENSTATE openState = FMOD_OPENSTATE_LOADING;
+        FMOD_RESULT result = sound->getOpenState(&openState, nullptr, nullptr, nullptr);
+        if (openState == FMOD_OPENSTATE_LOADING) {
+            i++;
+            continue;
+        }
+        loadingSounds.erase(loadingSounds.begin() + i);
+
+        bool loaded = openState != FMOD_OPENSTATE_ERROR && result == FMOD_OK;
+        unsigned int msLength = 0;
+        if (loaded) {
+            ERRCHECK(sound->set3DMinMaxDistance(MIN_DISTANCE * DISTANCEFACTOR, MAX_DISTANCE * DISTANCEFACTOR));
+            ERRCHECK(sound->getLength(&msLength, FMOD_TIMEUNIT_MS));
+            handleSounds[handlesByPath[soundInfo.getUniqueID()]] = sound;
+        }
+        else {
+            std::cout << "Audio Engine: Failed to load sound from file " << soundInfo.getFilePath() << '\n';
+            ERRCHECK(result);
+            sound->release();
+            sounds.erase(soundInfo.getUniqueID());
+        }
+        {
+            std::lock_guard<std::mutex> lock(snapshotMutex);
+            soundLoadStates[soundInfo.getUniqueID()] = loaded ? SOUND_LOAD_STATE_READY : SOUND_LOAD_STATE_FAILED;
+            if (loaded)
+                soundLengthsMS[soundInfo.getUniqueID()] = msLength;
+            completedSoundLoads.push_back({ soundInfo, loaded });
+        }
+        pendingSoundLoads--;
+        if (loadingSounds.empty())
+            std::cout << "Audio Engine: Sounds finished loading in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - soundLoadStartTime).count() << " ms\n";
+
+        // start the sounds played while the file loaded. Plays of a failed sound print that it isn't loaded
+        auto deferred = deferredCommands.find(soundInfo.getUniqueID());
+        if (deferred != deferredCommands.end()) {
+            std::vector<AudioCommand> commands;
+            commands.swap(deferred->second);
+            deferredCommands.erase(deferred);
+            for (const AudioCommand& command : commands)
+                executeCommand(command);
+        }
+    }
+}
+
+bool AudioEngine::deferUntilLoaded(const AudioCommand& command) {
+    if (getSoundLoadState(command.getSoundInfo()) != SOUND_LOAD_STATE_LOADING)
+        return false;
+    deferredCommands[command.filePath].push_back(command);
+    return true;
+}
+
+AudioCommand* AudioEngine::findDeferredVoice(int voiceID) {
+    for (auto& deferred : deferredCommands)
+        for (AudioCommand& command : deferred.second)
+            if (command.id == voiceID && command.type != AUDIO_COMMAND_QUERY_SOUND_LENGTH)
+                return &command;
+    return nullptr;
+}
+
+bool AudioEngine::cancelDeferredVoice(int voiceID) {
+    for (auto& deferred : deferredCommands)
+        for (auto command = deferred.second.begin(); command != deferred.second.end(); command++)
+            if (command->id == voiceID && command->type != AUDIO_COMMAND_QUERY_SOUND_LENGTH) {
+                deferred.second.erase(command);
+                return true;
+            }
+    return false;
+}
+
+void AudioEngine::dispatchLoadCallbacks() {
+    std::vector<std::pair<SoundInfo, bool>> completed;
+    {
+        std::lock_guard<std::mutex> lock(snapshotMutex);
+        completed.swap(completedSoundLoads);
+    }
+    for (auto& load : completed) {
+        auto callbacks = soundLoadCallbacks.equal_range(load.first.getUniqueID());
+        std::vector<SoundLoadCallback> onLoaded;
+        for (auto callback = callbacks.first; callback != callbacks.second; callback++)
+            onLoaded.push_back(callback->second);
+        soundLoadCallbacks.erase(callbacks.first, callbacks.second);
+        // callbacks may load more sounds, so they are called after being removed
+        for (auto& callback : onLoaded)
+            callback(load.first, load.second);
+    }
+}
+
+void AudioEngine::waitForBankLoads() {
+    for (auto& bank : soundBanks) {
+        FMOD_STUDIO_LOADING_STATE state = FMOD_STUDIO_LOADING_STATE_LOADING;
+        while (true) {
+            ERRCHECK(bank.second->getLoadingState(&state));
+            if (state != FMOD_STUDIO_LOADING_STATE_LOADING)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (state == FMOD_STUDIO_LOADING_STATE_ERROR)
+            std::cout << "AudioEngine: Failed to load FMOD Studio Sound Bank " << bank.first << '\n';
+    }
+}
+
 bool AudioEngine::soundLoaded(SoundInfo soundInfo) {
     //std::cout << "Checking sound " << soundInfo.getUniqueID() << " exists\n";
     return sounds.count(soundInfo.getUniqueID()) > 0;
 }
 
-void AudioEngine::set3dChannelPosition(SoundInfo soundInfo, FMOD::Channel* channel) {
-    FMOD_VECTOR position = { soundInfo.getX() * DISTANCEFACTOR, soundInfo.getY() * DISTANCEFACTOR, soundInfo.getZ() * DISTANCEFACTOR };
-    FMOD_VECTOR velocity = { 0.0f, 0.0f, 0.0f }; // TODO Add dopplar (velocity) support
-    ERRCHECK(channel->set3DAttributes(&position, &velocity));
+FMOD_VECTOR AudioEngine::get3DPosition(SoundInfo& soundInfo) {
+    // TODO Add dopplar (velocity) support
+    return { soundInfo.getX() * DISTANCEFACTOR, soundInfo.getY() * DISTANCEFACTOR, soundInfo.getZ() * DISTANCEFACTOR };
 }
 
 void AudioEngine::initReverb() {
-	ERRCHECK(lowLevelSystem->createReverb3D(&reverb));
-	FMOD_REVERB_PROPERTIES prop2 = FMOD_PRESET_CONCERTHALL;
-	ERRCHECK(reverb->setProperties(&prop2));
-	ERRCHECK(reverb->set3DAttributes(&revPos, revMinDist, revMaxDist));
+    int sampleRate = AUDIO_SAMPLE_RATE;
+    unsigned int bufferLength = 1024;
+    ERRCHECK(lowLevelSystem->getSoftwareFormat(&sampleRate, 0, 0));
+    ERRCHECK(lowLevelSystem->getDSPBufferSize(&bufferLength, 0));
+    // one tail job per mixer callback
+    int blocksPerTailJob = std::max(1, (int)bufferLength / ConvolutionReverb::DEFAULT_BLOCK_SIZE);
+    convolutionReverb.init(sampleRate, MAX_REVERB_SECONDS, ConvolutionReverb::DEFAULT_BLOCK_SIZE, blocksPerTailJob);
+    reverbDSP = convolutionReverb.createDSP(lowLevelSystem);
+    // voices send to the DSP at the input end of the reverb group, whose output is mixed into the master group
+    ERRCHECK(lowLevelSystem->createChannelGroup("Convolution Reverb", &reverbGroup));
+    ERRCHECK(mastergroup->addGroup(reverbGroup));
+    ERRCHECK(reverbGroup->addDSP(FMOD_CHANNELCONTROL_DSP_TAIL, reverbDSP));
+    voiceManager.setReverbInput(reverbDSP);
+}
+
+void AudioEngine::updateReverbZone() {
+    int zone = -1;
+    glm::vec3 listener(listenerpos.x, listenerpos.y, listenerpos.z);
+    for (int i = 0; i < (int)reverbZones.size(); i++) {
+        const ReverbZone& candidate = reverbZones[i];
+        bool isDefault = candidate.radius <= 0.0f;
+        if (!isDefault && glm::length(listener - candidate.position) > candidate.radius)
+            continue;
+        // the smallest zone wins, and the default zone only applies if no other zone does
+        if (zone < 0 || (!isDefault && (reverbZones[zone].radius <= 0.0f || candidate.radius < reverbZones[zone].radius)))
+            zone = i;
+    }
+    if (zone == currentReverbZone)
+        return;
+    currentReverbZone = zone;
+    snapshotReverbZone = zone;
+    convolutionReverb.setImpulseResponse(zone >= 0 ? reverbZones[zone].impulseResponse : -1);
+}
+
+int AudioEngine::addReverbImpulseResponse(const ImpulseResponse& impulseResponse, float wetLevel) {
+    return convolutionReverb.addImpulseResponse(impulseResponse, wetLevel);
+}
+
+void AudioEngine::addReverbZone(const char* name, glm::vec3 position, float radius, int impulseResponse) {
+    if (audioThreadRunning) {
+        std::cout << "Audio Engine: Can't add reverb zones while the audio thread runs\n";
+        return;
+    }
+    reverbZones.push_back({ name, position, radius, impulseResponse });
+    updateReverbZone();
+}
+
+ConvolutionReverbStats AudioEngine::getReverbStats() {
+    return convolutionReverb.getStats();
+}
+
+void AudioEngine::printReverbStats() {
+    int zone = snapshotReverbZone;
+    std::cout << "Reverb Zone: " << (zone >= 0 ? reverbZones[zone].name : std::string("none")) << '\n';
+    convolutionReverb.printStats();
+}
+
+int AudioEngine::createOneShotPool(SoundInfo& soundInfo, int channels) {
+    if (audioThreadRunning) {
+        std::cout << "Audio Engine: Can't create one-shot pools while the audio thread runs\n";
+        return -1;
+    }
+    int handle = getSoundHandle(soundInfo);
+    if (handle < 0) {
+        std::cout << "Audio Engine: Can't create one-shot pool, sound was not loaded from " << soundInfo.getFilePath() << '\n';
+        return -1;
+    }
+    channels = std::min(channels, MAX_ONE_SHOT_CHANNELS - oneShotChannels);
+    if (channels <= 0) {
+        std::cout << "Audio Engine: Can't create one-shot pool for " << soundInfo.getFilePath() << ", all one-shot channels are used\n";
+        return -1;
+    }
+    OneShotPoolEntry entry;
+    entry.pool.reset(new OneShotPool());
+    entry.pool->init(lowLevelSystem, channels, reverbDSP, soundInfo.getReverbAmount());
+    entry.handle = handle;
+    entry.filePath = soundInfo.getFilePath();
+    entry.is3D = soundInfo.is3D();
+    oneShotPools.push_back(std::move(entry));
+    // primed channels are real channels, so the voice manager's voices get fewer
+    oneShotChannels += channels;
+    voiceManager.setMaxRealVoices(MAX_REAL_VOICES - oneShotChannels);
+    return (int)oneShotPools.size() - 1;
+}
+
+bool AudioEngine::playOneShot(int pool, float volume, float pitch, float x, float y, float z, std::chrono::steady_clock::time_point eventTime) {
+    if (pool < 0 || pool >= (int)oneShotPools.size()) {
+        std::cout << "Audio Engine: Can't play one-shot, invalid pool " << pool << '\n';
+        return false;
+    }
+    OneShotPoolEntry& entry = oneShotPools[pool];
+    FMOD_VECTOR position = { x * DISTANCEFACTOR, y * DISTANCEFACTOR, z * DISTANCEFACTOR };
+    // FMOD's API is thread-safe, so the trigger doesn't wait for the audio thread's next update
+    if (entry.pool->trigger(volume, pitch, entry.is3D ? &position : nullptr, eventTime))
+        return true;
+    entry.pool->countMiss();
+    playVoice(entry.handle, volume, pitch, x, y, z);
+    return true;
+}
+
+OneShotPoolStats AudioEngine::getOneShotStats(int pool) {
+    if (pool < 0 || pool >= (int)oneShotPools.size())
+        return OneShotPoolStats();
+    return oneShotPools[pool].pool->getStats();
+}
+
+void AudioEngine::printOneShotStats() {
+    if (oneShotPools.empty())
+        return;
+    int sampleRate = AUDIO_SAMPLE_RATE, bufferCount = 0;
+    unsigned int bufferLength = 0;
+    ERRCHECK(lowLevelSystem->getSoftwareFormat(&sampleRate, 0, 0));
+    ERRCHECK(lowLevelSystem->getDSPBufferSize(&bufferLength, &bufferCount));
+    // a mixed block is heard once the blocks buffered ahead of it have played
+    std::cout << "One-Shots: mixer blocks of " << bufferLength << " samples (" << bufferLength * 1000.0f / sampleRate << " ms), "
+        << bufferCount << " buffered, so the mix is heard up to " << bufferLength * bufferCount * 1000.0f / sampleRate << " ms later\n";
+    for (OneShotPoolEntry& entry : oneShotPools)
+        entry.pool->printStats(entry.filePath.c_str());
+}
+
+void AudioEngine::updateOneShotPools() {
+    for (OneShotPoolEntry& entry : oneShotPools) {
+        if (!entry.pool->hasSound() && entry.handle < (int)handleSounds.size() && handleSounds[entry.handle])
+            entry.pool->setSound(handleSounds[entry.handle]);
+        entry.pool->update();
+    }
 }
 
 // Error checking/debugging function definitions
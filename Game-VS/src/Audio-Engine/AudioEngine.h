@@ -17,7 +17,20 @@
 #include <vector>
 #include <list>
 #include <map>
+#include <set>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
 #include "SoundInfo.h"
+#include "VoiceManager.h"
+#include "AudioCommandQueue.h"
+#include "AudioPack.h"
+#include "EventInstancePool.h"
+#include "ConvolutionReverb.h"
+#include "OneShotPool.h"
 
 /**
  * Error Handling Function for FMOD Errors
@@ -26,13 +39,43 @@
 void ERRCHECK_fn(FMOD_RESULT result, const char* file, int line);
 #define ERRCHECK(_result) ERRCHECK_fn(_result, __FILE__, __LINE__)
 
+/**
+ * Settings of AudioEngine::init()
+ */
+struct AudioEngineInitOptions {
+    // the FMOD output to mix to, see AudioEngine::init()
+    FMOD_OUTPUTTYPE outputType = FMOD_OUTPUTTYPE_AUTODETECT;
+    // the wav file written by the FMOD_OUTPUTTYPE_WAVWRITER and WAVWRITER_NRT outputs
+    const char* outputFilePath = nullptr;
+    // samples per mixer block, and blocks buffered by the output. Smaller and fewer buffers lower the latency
+    // from a sound being played to it being heard, at a higher CPU cost and risk of dropouts. 0 keeps FMOD's
+    // defaults, 1024 samples and 4 buffers, which add about 93 ms of output latency at 44.1 kHz.
+    unsigned int dspBufferLength = 0;
+    int dspBufferCount = 0;
+};
+
 /**
  * A class that handles the process of loading and playing sounds by wrapping FMOD's functionality.
  * Deals with all FMOD calls so that FMOD-specific code does not need to be used outside this class.
  * Only one AudioEngine should be constructed for an application.
+ *
+ * Every call that changes audio state is turned into an AudioCommand. Normally commands are executed immediately.
+ * Once startAudioThread() is called, they are pushed to a lock-free queue and executed on the audio thread, so the
+ * game thread never waits on FMOD. Queries are then answered from a snapshot of the audio state that the audio thread
+ * publishes after each update. Only the thread that started the audio thread may call the engine while it runs.
+ * FMOD Studio bank/event methods are not queued, and must only be called from that thread.
+ *
+ * Sound files and banks are loaded asynchronously by FMOD's loading thread. Sounds played before their file has
+ * finished loading are deferred, and start once it is ready.
  */
 class AudioEngine {
 public:
+    /**
+     * Called on the game thread, during update(), when a sound file passed to loadSound() finishes loading
+     * @param loaded - false if the file couldn't be loaded
+     */
+    typedef std::function<void(SoundInfo soundInfo, bool loaded)> SoundLoadCallback;
+
     /**
      * Default AudioEngine constructor. 
      * AudioEngine::init() must be called before using the Audio Engine 
@@ -41,8 +84,22 @@ public:
 
     /**
      * Initializes Audio Engine Studio and Core systems to default values. 
+     * @param outputType - the FMOD output to mix to. FMOD_OUTPUTTYPE_NOSOUND_NRT mixes without an audio device,
+     *                     one mix per update(), which allows voice management to be tested without sound hardware.
+     *                     FMOD_OUTPUTTYPE_WAVWRITER_NRT also writes the mix to a wav file.
+     * @param outputFilePath - the wav file written by the FMOD_OUTPUTTYPE_WAVWRITER and WAVWRITER_NRT outputs
+     */
+    void init(FMOD_OUTPUTTYPE outputType = FMOD_OUTPUTTYPE_AUTODETECT, const char* outputFilePath = nullptr);
+
+    /**
+     * Initializes Audio Engine Studio and Core systems, with the mixer's buffering set by the options
+     */
+    void init(const AudioEngineInitOptions& options);
+
+    /**
+     * Returns true if the output mixes once per update() instead of in realtime, as fast as the CPU allows
      */
-    void init();
+    bool isNonRealtime();
 
     /**
      * Method that is called to deactivate the audio engine after use.
@@ -51,20 +108,68 @@ public:
 
     /**
     * Method which should be called every frame of the game loop
+    * Calls the callbacks of finished sound loads. While the audio thread runs, it updates FMOD itself.
     */
     void update();
+
+    /**
+     * Starts the audio thread, which executes all following commands and updates FMOD at a fixed rate.
+     * Must be called from the game thread, after init().
+     */
+    void startAudioThread(float updatesPerSecond = 100.0f);
+
+    /**
+     * Executes any queued commands and stops the audio thread. Commands are executed immediately again afterwards.
+     */
+    void stopAudioThread();
+
+    /**
+     * Returns true if the audio thread is running
+     */
+    bool isThreaded();
+
+    /**
+     * Measures the average game-thread cost of common audio engine calls, both with the calls executed immediately
+     * and queued to the audio thread, and prints the results. Leaves the audio thread in the state it was in.
+     * @param loopSound - a looping sound that is currently playing, used for the loop calls
+     */
+    void benchmarkCallCost(SoundInfo loopSound, int calls = 1000);
     
     /**
-     * Loads a sound from disk using provided settings
+     * Starts loading a sound from disk using provided settings, without waiting for the file to be read and decoded
      * Prepares for later playback with playSound()
      * Only reads the audio file and loads into the audio engine
      * if the sound file has already been added to the cache
+     * @param onLoaded - optional callback, called from update() once the sound is ready or failed to load
+     * @returns the sound's handle, which plays the sound with playVoice() without copying its SoundInfo
+     */
+    int loadSound(SoundInfo soundInfo, SoundLoadCallback onLoaded = nullptr);
+
+    /**
+     * Returns the handle of a sound passed to loadSound(), or -1 if it was never loaded
+     */
+    int getSoundHandle(SoundInfo& soundInfo);
+
+    /**
+     * Returns the load state of a sound's file
+     */
+    SOUND_LOAD_STATE getSoundLoadState(SoundInfo soundInfo);
+
+    /**
+     * Returns the number of sounds passed to loadSound() which haven't finished loading
+     */
+    int getPendingSoundLoads();
+
+    /**
+     * Blocks until all sounds passed to loadSound() have finished loading, and calls their callbacks
      */
-    void loadSound(SoundInfo soundInfo);
+    void waitForSoundLoads();
 
     /**
     * Plays a sound file using FMOD's low level audio system. If the sound file has not been
-    * previously loaded using loadSoundFile(), a console message is displayed
+    * previously loaded using loadSoundFile(), a console message is displayed. If it is still loading,
+    * the sound starts once it has loaded.
+    * The sound plays as a voice of the SoundInfo's category, and may be virtualized or rejected by the voice manager.
     *
     * @param filename - relative path to file from project directory. (Can be .OGG, .WAV, .MP3,
     *                 or any other FMOD-supported audio format)
@@ -76,6 +181,70 @@ public:
      */
     void stopSound(SoundInfo soundInfo);
 
+    /**
+     * Returns the current DSP clock of the mixer, in output samples. While the audio thread runs this is estimated
+     * from the clock published at the last audio update, so scheduled calls should leave some lookahead.
+     */
+    unsigned long long getDSPClock();
+
+    /**
+     * Plays a sound starting exactly at a DSP clock, independent of when the game thread makes the call.
+     * If the clock has already passed, the sound starts immediately.
+     */
+    void playSoundAt(SoundInfo soundInfo, unsigned long long startClock);
+
+    /**
+     * Stops a looping sound exactly at a DSP clock. It keeps playing until then.
+     */
+    void stopSoundAt(SoundInfo soundInfo, unsigned long long endClock);
+
+    /**
+     * Fades the volume of a playing sound loop between two DSP clocks, starting from the SoundInfo's current volume,
+     * which is then set to the new volume.
+     */
+    void fadeSoundLoopVolumeAt(SoundInfo& soundInfo, float newVolume, unsigned long long startClock, unsigned long long lengthSamples);
+
+    /**
+     * Plays a loaded sound as an individually controlled voice, so that several voices of the same sound file
+     * can be moved and stopped separately.
+     * @returns the voice ID. If the sound isn't loaded or the voice is rejected, voiceIsPlaying() returns false for it.
+     */
+    int playVoice(SoundInfo soundInfo);
+
+    /**
+     * Plays a loaded sound as a voice by its handle, using the settings of the SoundInfo it was loaded with.
+     * Doesn't allocate, so it is suited to sounds triggered at a high rate.
+     * @param pitch - playback speed, 1 for the original pitch
+     * @param x, y, z - position of the voice, ignored for 2D sounds
+     * @returns the voice ID
+     */
+    int playVoice(int soundHandle, float volume, float pitch = 1.0f, float x = 0.0f, float y = 0.0f, float z = 0.0f);
+
+    /**
+     * Stops a voice started with playVoice()
+     */
+    void stopVoice(int voiceID);
+
+    /**
+     * Checks if a voice started with playVoice() is still playing, either as a real or virtual voice
+     */
+    bool voiceIsPlaying(int voiceID);
+
+    /**
+     * Moves a 3D voice started with playVoice()
+     */
+    void setVoice3DPosition(int voiceID, float x, float y, float z);
+
+    /**
+     * Sets the volume of a voice started with playVoice(). Voices at volume 0 may be virtualized.
+     */
+    void setVoiceVolume(int voiceID, float volume);
+
+    /**
+     * Returns the gain of a 3D sound at a distance from the listener, following the engine's rolloff settings
+     */
+    float getDistanceAttenuation(float distance);
+
     /**
      * Method that updates the volume of a soundloop that is playing. This can be used to create audio 'fades'
      * where the volume ramps up or down to the provided new volume
@@ -111,50 +280,173 @@ public:
 
     /**
     * Utility method that returns the length of a SoundInfo's audio file in milliseconds
-    * If the sound hasn't been loaded, returns 0
+    * If the sound hasn't been loaded, returns 0. If it is still loading, waits for it to load.
+    * While the audio thread runs, lengths of loaded sounds are cached. Otherwise this waits for the audio thread.
     */
     unsigned int getSoundLengthInMS(SoundInfo soundInfo);
 
     /**
-     * Loads an FMOD Studio soundbank 
+     * Returns the length of a SoundInfo's audio file in milliseconds, without waiting for the audio thread
+     */
+    std::future<unsigned int> getSoundLengthInMSAsync(SoundInfo soundInfo);
+
+    /**
+     * Adds a static box that occludes 3D sounds behind it, e.g. the walls of a building.
+     * Defined by an object-space box and the model matrix that places it in the world, like the occlusion culler's
+     * occluder boxes. Must be called before startAudioThread().
+     */
+    void addOcclusionBox(const glm::mat4& modelMatrix, glm::vec3 boxMin, glm::vec3 boxMax);
+
+    /**
+     * Sets how many occlusion rays are traced per update, which bounds the cost of occlusion.
+     * Must be called before startAudioThread().
+     */
+    void setOcclusionRayBudget(int raysPerUpdate);
+
+    /**
+     * Adds an impulse response to the convolution reverb, for reverb zones. Partitioning it takes a few milliseconds.
+     * @param wetLevel - output gain of the reverb with this IR
+     * @returns the IR index for addReverbZone(), or -1 if it can't be added
+     */
+    int addReverbImpulseResponse(const ImpulseResponse& impulseResponse, float wetLevel = 1.0f);
+
+    /**
+     * Adds a spherical reverb zone. While the listener is inside it, sounds reverberate with its impulse response,
+     * which is crossfaded when the listener moves into another zone. Where zones overlap the smallest one wins.
+     * Must be called before startAudioThread().
+     * @param radius - 0 for the default zone, which applies outside all other zones
+     */
+    void addReverbZone(const char* name, glm::vec3 position, float radius, int impulseResponse);
+
+    /**
+     * Returns the convolution reverb counters, and the zone the listener is in
+     */
+    ConvolutionReverbStats getReverbStats();
+
+    /**
+     * Prints the convolution reverb counters and the listener's reverb zone to the console
+     */
+    void printReverbStats();
+
+    /**
+     * Creates a pool of paused channels of a loaded sound, for one-shots that must start with the lowest latency,
+     * such as footsteps or pickups. The pool's channels are taken from the voice manager's real voice budget.
+     * Must be called before startAudioThread().
+     * @param channels - one-shots of the sound that can overlap before triggers fall back to playVoice()
+     * @returns the pool for playOneShot(), or -1 if the sound wasn't loaded
+     */
+    int createOneShotPool(SoundInfo& soundInfo, int channels = 2);
+
+    /**
+     * Starts a one-shot from a pool right away on the calling thread, instead of queuing it to the audio thread.
+     * Plays the sound with playVoice() if all the pool's channels are playing.
+     * @param x, y, z - position of the one-shot, ignored for 2D sounds
+     * @param eventTime - when the game event that triggered the sound happened, for the latency measurement
+     * @returns false if the pool doesn't exist
+     */
+    bool playOneShot(int pool, float volume, float pitch = 1.0f, float x = 0.0f, float y = 0.0f, float z = 0.0f,
+        std::chrono::steady_clock::time_point eventTime = std::chrono::steady_clock::now());
+
+    OneShotPoolStats getOneShotStats(int pool);
+
+    /**
+     * Prints the counters and game event to mix latencies of the one-shot pools, and the output's buffering latency
+     */
+    void printOneShotStats();
+
+    /**
+     * Opens an audio pack written by the packaging step (see AudioPackBuilder). Sounds loaded afterwards whose file
+     * path is in the pack are loaded from it, in the format and load mode the asset was packed with.
+     * Sounds missing from every pack are loaded from their own files. Must be called before startAudioThread().
+     * @returns false if the pack can't be opened
+     */
+    bool loadAudioPack(const char* filePath);
+
+    /**
+     * Starts loading an FMOD Studio soundbank, without waiting for it to load
      * TODO Fix
      */
     void loadFMODStudioBank(const char* filePath);
+
+    /**
+     * Checks if a soundbank passed to loadFMODStudioBank() has finished loading
+     */
+    bool bankIsLoaded(const char* filePath);
     
     /**
-     * Loads an FMOD Studio Event. The Soundbank that this event is in must have been loaded before
-     * calling this method.
-     * TODO Fix
+     * Loads an FMOD Studio Event and creates a pool of its instances. The Soundbank that this event is in must have
+     * been passed to loadFMODStudioBank() before calling this method, which waits for the soundbanks to finish loading.
+     * @param paramsValues - parameter values of every instance of the event
+     * @param instanceCapacity - max instances of the event playing at the same time, when another is played
+     *                           the oldest one is stopped
+     * @returns the event handle, for playing the event without looking up its name
      */
-    void loadFMODStudioEvent(const char* eventName, std::vector<std::pair<const char*, float>> paramsValues = { });
+    int loadFMODStudioEvent(const char* eventName, std::vector<std::pair<const char*, float>> paramsValues = { }, int instanceCapacity = 1);
+
+    /**
+     * Returns the handle of an event passed to loadFMODStudioEvent(), or -1 if it hasn't been loaded
+     */
+    int getEventHandle(const char* eventName);
     
     /**
      * Sets the parameter of an FMOD Soundbank Event Instance.
+     * @param instanceID - instance returned by playEvent(), or -1 for every instance, including the ones played later
      */
-    void setFMODEventParamValue(const char* eventName, const char* parameterName, float value);
+    void setFMODEventParamValue(const char* eventName, const char* parameterName, float value, int instanceID = -1);
     
     /**
-     * Plays the specified instance of an event
-     * TODO support playback of multiple event instances
-     * TODO Fix playback
+     * Plays an instance of an event
+     * @param instanceID - -1 to play a free instance from the event's pool, or an instance returned by an earlier
+     *                     call to restart it
+     * @returns the ID of the instance, or -1 if it couldn't be played
+     */
+    int playEvent(const char* eventName, int instanceID = -1);
+
+    /**
+     * Plays a free instance of a 3D event at a position
+     * @returns the ID of the instance, or -1 if it couldn't be played
+     */
+    int playEvent3D(const char* eventName, float x, float y, float z);
+
+    /**
+     * Plays a free instance of an event by handle, without any string lookups, for events triggered many times a frame
+     * @returns the ID of the instance, or -1 if it couldn't be played
+     */
+    int playEventByHandle(int eventHandle, float x = 0.0f, float y = 0.0f, float z = 0.0f, float volume = 1.0f);
+
+    /**
+     * Moves a playing instance of a 3D event
      */
-    void playEvent(const char* eventName, int instanceIndex = 0);
+    void setEventInstance3DPosition(const char* eventName, int instanceID, float x, float y, float z);
     
     /**
-     * Stops the specified instance of an event, if it is playing.
+     * Stops an instance of an event, if it is playing. It is reused once it has faded out.
+     * @param instanceID - instance returned by playEvent(), or -1 for every instance
      */
-    void stopEvent(const char* eventName, int instanceIndex = 0);
+    void stopEvent(const char* eventName, int instanceID = -1);
  
     /**
      * Sets the volume of an event.
      * @param volume0to1 - volume of the event, from 0 (min vol) to 1 (max vol)
+     * @param instanceID - instance returned by playEvent(), or -1 for every instance, including the ones played later
      */
-    void setEventVolume(const char* eventName, float volume0to1 = .75f);
+    void setEventVolume(const char* eventName, float volume0to1 = .75f, int instanceID = -1);
 
     /**
      * Checks if an event is playing.
+     * @param instanceID - instance returned by playEvent(), or -1 for any instance
      */
-    bool eventIsPlaying(const char* eventName, int instance = 0);
+    bool eventIsPlaying(const char* eventName, int instanceID = -1);
+
+    /**
+     * Returns the counters of an event's instance pool
+     */
+    EventPoolStats getEventPoolStats(const char* eventName);
+
+    /**
+     * Prints the counters of every event's instance pool to the console
+     */
+    void printEventPoolStats();
 
     /**
      * Mutes all sounds for the audio engine
@@ -171,6 +463,26 @@ public:
      */
 	bool isMuted();
 
+    /**
+     * Sets the voice limits and steal policy of a sound category
+     */
+    void setVoiceCategorySettings(SOUND_CATEGORY category, VoiceCategorySettings settings);
+
+    /**
+     * Returns the voice counters and mixer CPU usage of the most recent update()
+     */
+    VoiceStats getVoiceStats();
+
+    /**
+     * Prints the voice counters and mixer CPU usage of the most recent update() to the console
+     */
+    void printVoiceStats();
+
+    /**
+     * Prints the format and sample memory of every loaded sound, and FMOD's total memory use, to the console
+     */
+    void printSoundMemoryReport();
+
 	// TODO: Fix
     //void setSoundLoopCount(SoundInfo& soundInfo, int loopCount);
     // TODO: Fix
@@ -181,21 +493,99 @@ public:
 
 private:  
 
+    // Commands the game thread can queue before it has to wait for the audio thread
+    static const unsigned int COMMAND_QUEUE_CAPACITY = 4096;
+
+    /**
+     * Executes a command immediately, or queues it if the audio thread runs
+     */
+    void submit(const AudioCommand& command);
+
+    /**
+     * Returns true if calls on the current thread must be queued to the audio thread
+     */
+    bool shouldQueue();
+
+    /**
+     * Executes a command on the current thread
+     */
+    void executeCommand(const AudioCommand& command);
+
+    /**
+     * Main loop of the audio thread
+     */
+    void audioThreadLoop();
+
+    /**
+     * Copies the state answered by queries while the audio thread runs
+     */
+    void publishSnapshot();
+
+    // Command implementations, run by executeCommand()
+    void doUpdate();
+    void doLoadSound(SoundInfo soundInfo, int handle);
+    void doPrintSoundMemoryReport();
+    void doPlaySound(SoundInfo soundInfo, int voiceID, unsigned long long startClock = 0);
+    void doStopSound(SoundInfo soundInfo, unsigned long long endClock = 0);
+    void doFadeSoundLoopVolume(SoundInfo soundInfo, float newVolume, unsigned long long startClock, unsigned long long lengthSamples);
+    void doPlayVoice(SoundInfo soundInfo, int voiceID, float pitch = 1.0f);
+    void doPlayHandle(const AudioCommand& command);
+    void doUpdateSoundLoopVolume(SoundInfo soundInfo, float newVolume, unsigned int fadeSampleLength);
+    void doUpdate3DSoundPosition(SoundInfo soundInfo);
+    void doSetVoiceVolume(int voiceID, float volume);
+    void doSet3DListenerPosition(const float* listener);
+    void doQuerySoundLength(SoundInfo soundInfo, int queryID);
+
+    /**
+     * Finishes sounds whose files have loaded, and executes the commands deferred until they loaded
+     */
+    void pollLoadingSounds();
+
+    /**
+     * Defers a command until the sound it plays or queries has loaded. Returns false if the sound isn't loading.
+     */
+    bool deferUntilLoaded(const AudioCommand& command);
+
+    /**
+     * Returns the deferred play command of a voice, or nullptr if the voice isn't waiting for its sound to load
+     */
+    AudioCommand* findDeferredVoice(int voiceID);
+
+    /**
+     * Drops the deferred play command of a voice. Returns false if the voice wasn't deferred.
+     */
+    bool cancelDeferredVoice(int voiceID);
+
+    /**
+     * Calls the callbacks of sounds which finished loading. Called on the game thread.
+     */
+    void dispatchLoadCallbacks();
+
+    /**
+     * Blocks until all soundbanks have finished loading
+     */
+    void waitForBankLoads();
+
     /**
      * Checks if a sound file is in the soundCache
      */
     bool soundLoaded(SoundInfo soundInfo);
 
     /**
-     * Sets the 3D position of a sound
+     * Gets the 3D position of a sound in FMOD units
      */
-    void set3dChannelPosition(SoundInfo soundInfo, FMOD::Channel* channel);
+    FMOD_VECTOR get3DPosition(SoundInfo& soundInfo);
 
     /**
-     * Initializes the reverb effect
+     * Creates the convolution reverb DSP and the channel group it mixes into
      */
     void initReverb();
 
+    /**
+     * Selects the impulse response of the reverb zone the listener is in
+     */
+    void updateReverbZone();
+
     /**
      * Prints debug info about an FMOD event description
      */
@@ -206,12 +596,28 @@ private:
     
     // FMOD's low-level audio system which plays audio files and is obtained from Studio System
     FMOD::System* lowLevelSystem = nullptr;          
+    // Output the low-level system mixes to
+    FMOD_OUTPUTTYPE outputType = FMOD_OUTPUTTYPE_AUTODETECT;
 
     // Max FMOD::Channels for the audio engine 
     static const unsigned int MAX_AUDIO_CHANNELS = 1024; 
+
+    // Max real (audible) voices, enforced by the voice manager. The rest of the channels are virtual
+    static const int MAX_REAL_VOICES = 64;
+    // Most real channels that one-shot pools may take from the voice manager's budget
+    static const int MAX_ONE_SHOT_CHANNELS = 32;
+
+    // Assigns real channels to the most important voices
+    VoiceManager voiceManager;
+    // Static geometry 3D voices are occluded by, and the rays traced against it per update
+    AudioOcclusion occlusion;
+    int occlusionRayBudget = VoiceManager::DEFAULT_OCCLUSION_RAYS_PER_UPDATE;
     
     // Units per meter.  I.e feet would = 3.28.  centimeters would = 100.
     const float DISTANCEFACTOR = 1.0f;  
+
+    // 3D attenuation: sounds are at full volume within MIN_DISTANCE, and roll off with ROLLOFF_SCALE beyond it
+    const float MIN_DISTANCE = 0.5f, MAX_DISTANCE = 5000.0f, ROLLOFF_SCALE = 0.5f;
  
     // Listener head position, initialized to default value
     FMOD_VECTOR listenerpos = { 0.0f, 0.0f, -1.0f * DISTANCEFACTOR };
@@ -225,17 +631,80 @@ private:
     // Main group for low level system which all sounds go though
     FMOD::ChannelGroup* mastergroup = 0;
 
-    // Low-level system reverb TODO add multi-reverb support
-	FMOD::Reverb3D* reverb;
-
-	// Reverb origin position
-	FMOD_VECTOR revPos = { 0.0f, 0.0f, 0.0f };
-
-	// reverb min, max distances
-	float revMinDist = 10.0f, revMaxDist = 50.0f;
+    // Convolution reverb which every sound's reverb send goes to, run by a DSP on its own group under the master group
+    ConvolutionReverb convolutionReverb;
+    FMOD::DSP* reverbDSP = nullptr;
+    FMOD::ChannelGroup* reverbGroup = nullptr;
+    // Longest impulse response of the reverb, which sets the size of its delay line
+    static constexpr float MAX_REVERB_SECONDS = 3.0f;
+
+    // Reverb zones, which select the reverb's impulse response by listener position. Read-only once the audio thread runs.
+    struct ReverbZone {
+        std::string name;
+        glm::vec3 position;
+        float radius;
+        int impulseResponse;
+    };
+    std::vector<ReverbZone> reverbZones;
+    // index of the zone the listener is in, only used by the thread executing commands
+    int currentReverbZone = -1;
+    std::atomic<int> snapshotReverbZone{ -1 };
 
     // flag tracking if the Audio Engin is muted
-    bool muted = false;
+    std::atomic<bool> muted{ false };
+
+    // voice IDs are handed out on the calling thread, so playVoice() can return before the voice is played
+    std::atomic<int> nextVoiceID{ 0 };
+
+    // Audio thread and the queue of commands from the game thread
+    std::thread audioThread;
+    std::atomic<bool> audioThreadRunning{ false };
+    std::thread::id producerThreadID;
+    std::chrono::duration<double> audioThreadUpdatePeriod{ 0.01 };
+    SPSCQueue<AudioCommand, COMMAND_QUEUE_CAPACITY> commandQueue;
+    // times the game thread found the queue full, and had to wait
+    unsigned long long commandQueueStalls = 0;
+
+    // Snapshot of the audio state published by the audio thread, guarded by snapshotMutex
+    std::mutex snapshotMutex;
+    std::set<std::string> snapshotLoopsPlaying;
+    std::vector<int> snapshotActiveVoices;
+    int snapshotLastVoiceID = -1; // voices with a larger ID haven't been played by the audio thread yet
+    VoiceStats snapshotVoiceStats;
+    // DSP clock at the last audio update, and when it was read
+    unsigned long long snapshotDSPClock = 0;
+    std::chrono::steady_clock::time_point snapshotClockTime;
+    std::map<std::string, unsigned int> soundLengthsMS;
+    // ID of the last voice played, only used by the thread executing commands
+    int lastVoiceID = -1;
+
+    // Load state of each sound file, guarded by snapshotMutex
+    std::map<std::string, SOUND_LOAD_STATE> soundLoadStates;
+    // Sounds which finished loading since the last dispatch, and whether they loaded, guarded by snapshotMutex
+    std::vector<std::pair<SoundInfo, bool>> completedSoundLoads;
+    // Callbacks of sounds being loaded, only used by the game thread
+    std::multimap<std::string, SoundLoadCallback> soundLoadCallbacks;
+    // Sounds passed to loadSound() which haven't finished loading
+    std::atomic<int> pendingSoundLoads{ 0 };
+
+    // Sounds whose files are loading, and commands waiting for them, only used by the thread executing commands
+    std::vector<SoundInfo> loadingSounds;
+    std::map<std::string, std::vector<AudioCommand>> deferredCommands;
+    // time the first of the currently loading sounds started loading
+    std::chrono::steady_clock::time_point soundLoadStartTime;
+
+    // Handles of loaded sounds by file path, only used by the game thread
+    std::map<std::string, int> soundHandles;
+    int nextSoundHandle = 0;
+    // SoundInfo each handle was loaded with, and its sound once ready. Only used by the thread executing commands
+    std::vector<SoundInfo> handleSoundInfos;
+    std::vector<FMOD::Sound*> handleSounds;
+    std::map<std::string, int> handlesByPath;
+
+    // Pending sound length queries, guarded by queryMutex
+    std::mutex queryMutex;
+    std::map<int, std::promise<unsigned int>> lengthQueries;
+    int nextQueryID = 0;
 
     /*
      * Map which caches FMOD Low-Level sounds
@@ -246,11 +715,16 @@ private:
     std::map<std::string, FMOD::Sound*> sounds;
 
     /*
-     * Map which stores the current playback channels of any playing sound loop
+     * Map which stores the voices of any playing sound loop
      * Key is the SoundInfo's uniqueKey field.
-     * Value is the FMOD::Channel* the FMOD::Sound* is playing back on.
+     * Value is the voice manager ID of the voice the FMOD::Sound* is playing back on.
+     */
+    std::map<std::string, int> loopsPlaying;
+
+    /*
+     * Audio packs opened with loadAudioPack(), searched in order when loading sounds
      */
-    std::map<std::string, FMOD::Channel*> loopsPlaying;
+    std::vector<AudioPack> audioPacks;
 
     /*
      * Map which stores the soundbanks loaded with loadFMODStudioBank()
@@ -263,16 +737,32 @@ private:
     std::map<std::string, FMOD::Studio::EventDescription*> eventDescriptions;
     
     /*
-     * Map which stores event instances created during loadFMODStudioEvent()
+     * Instance pools created during loadFMODStudioEvent(), indexed by event handle
      */
-    std::map<std::string, FMOD::Studio::EventInstance*> eventInstances;
-    
-   /* struct FMODEventInstanceCache {
-        std::map<std::string, std::vector<FMOD::Studio::EventInstance*>> eventInstances;
+    std::vector<EventInstancePool> eventPools;
+    std::map<std::string, int> eventHandles;
 
+    /*
+     * One-shot pools created by createOneShotPool(), and the sound handle and file of each. Fixed once the audio
+     * thread runs; the pools are triggered on the game thread and re-primed by the thread executing commands.
+     */
+    struct OneShotPoolEntry {
+        std::unique_ptr<OneShotPool> pool;
+        int handle;
+        std::string filePath;
+        bool is3D;
     };
+    std::vector<OneShotPoolEntry> oneShotPools;
+    int oneShotChannels = 0;
+
+    /*
+     * Sets the sounds of one-shot pools whose sound has loaded, and re-primes their finished channels
+     */
+    void updateOneShotPools();
 
-    FMODEventInstanceCache fmodEventInstanceCache;*/
-    // TODO 
+    /*
+     * Returns the instance pool of an event, or nullptr after printing an error if it hasn't been loaded
+     */
+    EventInstancePool* findEventPool(const char* eventName, const char* action);
     
 };
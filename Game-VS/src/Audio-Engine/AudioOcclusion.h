@@ -0,0 +1,112 @@
+#pragma once
+///
+/// @file AudioOcclusion.h
+///
+/// Static collision geometry for audio occlusion. Buildings are represented by the same simplified boxes the
+/// occlusion culler uses, and sounds are occluded by the boxes between them and the listener.
+///
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+#include <glm/glm.hpp>
+
+/**
+ * Set of oriented boxes which rays between the listener and 3D voices are traced against.
+ * Read-only once the boxes are added, so the audio thread can trace while the game thread runs.
+ */
+class AudioOcclusion {
+public:
+    /**
+     * Adds a box, defined by an object-space box and the model matrix that places it in the world
+     * @param occlusion - how much of the direct sound the box blocks, from 0 (none) to 1 (all)
+     */
+    void addBox(const glm::mat4& modelMatrix, glm::vec3 boxMin, glm::vec3 boxMax, float occlusion = DEFAULT_BOX_OCCLUSION) {
+        Box box;
+        box.worldToLocal = glm::inverse(modelMatrix);
+        box.localMin = boxMin;
+        box.localMax = boxMax;
+        box.occlusion = occlusion;
+        // world space bounds of the box's corners, which most rays are rejected by
+        box.worldMin = glm::vec3(FLT_MAX);
+        box.worldMax = glm::vec3(-FLT_MAX);
+        for (int i = 0; i < 8; i++) {
+            glm::vec3 corner(i & 1 ? boxMax.x : boxMin.x, i & 2 ? boxMax.y : boxMin.y, i & 4 ? boxMax.z : boxMin.z);
+            glm::vec3 world = glm::vec3(modelMatrix * glm::vec4(corner, 1.0f));
+            box.worldMin = glm::min(box.worldMin, world);
+            box.worldMax = glm::max(box.worldMax, world);
+        }
+        boxes.push_back(box);
+    }
+
+    /**
+     * Removes all boxes
+     */
+    void clear() {
+        boxes.clear();
+    }
+
+    bool isEmpty() const {
+        return boxes.empty();
+    }
+
+    int getBoxCount() const {
+        return (int)boxes.size();
+    }
+
+    /**
+     * Traces the segment between two points
+     * @returns the occlusion of the boxes the segment passes through, from 0 (clear) to 1 (fully blocked)
+     */
+    float trace(glm::vec3 from, glm::vec3 to) const {
+        glm::vec3 direction = to - from;
+        float occlusion = 0.0f;
+        for (const Box& box : boxes) {
+            if (!segmentHitsBox(from, direction, box.worldMin, box.worldMax))
+                continue;
+            // the segment in the box's object space, where the box is axis aligned
+            glm::vec3 localFrom = glm::vec3(box.worldToLocal * glm::vec4(from, 1.0f));
+            glm::vec3 localDirection = glm::vec3(box.worldToLocal * glm::vec4(direction, 0.0f));
+            if (segmentHitsBox(localFrom, localDirection, box.localMin, box.localMax)) {
+                occlusion += box.occlusion;
+                if (occlusion >= 1.0f)
+                    return 1.0f;
+            }
+        }
+        return occlusion;
+    }
+
+    // Occlusion of a single box; sound diffracts around buildings, so one building doesn't block it completely
+    static constexpr float DEFAULT_BOX_OCCLUSION = 0.7f;
+
+private:
+    struct Box {
+        glm::mat4 worldToLocal;
+        glm::vec3 localMin, localMax;
+        glm::vec3 worldMin, worldMax;
+        float occlusion;
+    };
+    std::vector<Box> boxes;
+
+    // Slab test of the segment origin + t * direction, t in [0, 1], against an axis aligned box
+    static bool segmentHitsBox(glm::vec3 origin, glm::vec3 direction, glm::vec3 boxMin, glm::vec3 boxMax) {
+        float tMin = 0.0f, tMax = 1.0f;
+        for (int axis = 0; axis < 3; axis++) {
+            if (std::abs(direction[axis]) < 1e-8f) {
+                if (origin[axis] < boxMin[axis] || origin[axis] > boxMax[axis])
+                    return false;
+                continue;
+            }
+            float inverse = 1.0f / direction[axis];
+            float t0 = (boxMin[axis] - origin[axis]) * inverse;
+            float t1 = (boxMax[axis] - origin[axis]) * inverse;
+            if (t0 > t1)
+                std::swap(t0, t1);
+            tMin = std::max(tMin, t0);
+            tMax = std::min(tMax, t1);
+            if (tMin > tMax)
+                return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,405 @@
+///
+/// @file AudioPack.cpp
+///
+#include "AudioPack.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+static const char AUDIO_PACK_MAGIC[8] = { 'F', 'S', 'Q', 'A', 'P', 'A', 'K', '1' };
+
+// IMA ADPCM block size per channel, 1017 samples per block
+static const int ADPCM_BLOCK_BYTES_PER_CHANNEL = 512;
+
+static const int ADPCM_STEP_TABLE[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060,
+    1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
+    7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+static const int ADPCM_INDEX_TABLE[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+// Decoded samples of a wav file
+struct PCMData {
+    int channels = 0, sampleRate = 0;
+    std::vector<int16_t> samples; // interleaved
+};
+
+static uint16_t readU16(const uint8_t* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static uint32_t readU32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+static void writeU16(std::vector<uint8_t>& out, uint16_t v) { out.push_back(v & 0xFF); out.push_back(v >> 8); }
+static void writeU32(std::vector<uint8_t>& out, uint32_t v) { for (int i = 0; i < 4; i++) out.push_back((v >> (8 * i)) & 0xFF); }
+static void writeTag(std::vector<uint8_t>& out, const char* tag) { out.insert(out.end(), tag, tag + 4); }
+
+static bool readFile(const std::string& path, std::vector<uint8_t>& bytes) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+    bytes.resize((size_t)file.tellg());
+    file.seekg(0);
+    file.read((char*)bytes.data(), bytes.size());
+    return (bool)file;
+}
+
+// Decodes a PCM (8/16/24/32 bit) or 32 bit float wav file to 16 bit samples
+static bool decodeWav(const std::vector<uint8_t>& bytes, PCMData& pcm) {
+    if (bytes.size() < 12 || memcmp(bytes.data(), "RIFF", 4) != 0 || memcmp(bytes.data() + 8, "WAVE", 4) != 0)
+        return false;
+    int format = 0, bits = 0;
+    const uint8_t* data = nullptr;
+    size_t dataSize = 0;
+    for (size_t pos = 12; pos + 8 <= bytes.size(); ) {
+        const uint8_t* chunk = bytes.data() + pos;
+        size_t size = std::min<size_t>(readU32(chunk + 4), bytes.size() - pos - 8);
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+            format = readU16(chunk + 8);
+            pcm.channels = readU16(chunk + 10);
+            pcm.sampleRate = readU32(chunk + 12);
+            bits = readU16(chunk + 22);
+            // WAVE_FORMAT_EXTENSIBLE keeps the format in the first bytes of the sub format GUID
+            if (format == 0xFFFE && size >= 26)
+                format = readU16(chunk + 32);
+        }
+        else if (memcmp(chunk, "data", 4) == 0) {
+            data = chunk + 8;
+            dataSize = size;
+        }
+        pos += 8 + size + (size & 1);
+    }
+    bool pcmFormat = format == 1 && (bits == 8 || bits == 16 || bits == 24 || bits == 32);
+    bool floatFormat = format == 3 && bits == 32;
+    if (!data || pcm.channels <= 0 || (!pcmFormat && !floatFormat))
+        return false;
+
+    int bytesPerSample = bits / 8;
+    size_t count = dataSize / bytesPerSample;
+    pcm.samples.resize(count - count % pcm.channels);
+    for (size_t i = 0; i < pcm.samples.size(); i++) {
+        const uint8_t* s = data + i * bytesPerSample;
+        int32_t value;
+        if (floatFormat) {
+            float f;
+            memcpy(&f, s, 4);
+            value = (int32_t)std::lround(std::max(-1.0f, std::min(1.0f, f)) * 32767.0f);
+        }
+        else if (bits == 8)
+            value = ((int)s[0] - 128) << 8;
+        else if (bits == 16)
+            value = (int16_t)readU16(s);
+        else if (bits == 24)
+            value = (int16_t)(s[1] | (s[2] << 8));
+        else
+            value = (int16_t)readU16(s + 2);
+        pcm.samples[i] = (int16_t)value;
+    }
+    return true;
+}
+
+bool readWavFile(const char* filePath, int& channels, int& sampleRate, std::vector<int16_t>& samples) {
+    std::vector<uint8_t> bytes;
+    PCMData pcm;
+    if (!readFile(filePath, bytes) || !decodeWav(bytes, pcm))
+        return false;
+    channels = pcm.channels;
+    sampleRate = pcm.sampleRate;
+    samples = std::move(pcm.samples);
+    return true;
+}
+
+static void downmixToMono(PCMData& pcm) {
+    if (pcm.channels <= 1)
+        return;
+    size_t frames = pcm.samples.size() / pcm.channels;
+    for (size_t f = 0; f < frames; f++) {
+        int sum = 0;
+        for (int c = 0; c < pcm.channels; c++)
+            sum += pcm.samples[f * pcm.channels + c];
+        pcm.samples[f] = (int16_t)(sum / pcm.channels);
+    }
+    pcm.samples.resize(frames);
+    pcm.channels = 1;
+}
+
+static void writeWavHeader(std::vector<uint8_t>& out, uint16_t format, const PCMData& pcm, uint32_t byteRate, uint16_t blockAlign,
+    uint16_t bits, uint32_t dataSize, uint16_t samplesPerBlock = 0) {
+    bool adpcm = samplesPerBlock != 0;
+    uint32_t fmtSize = adpcm ? 20 : 16;
+    uint32_t riffSize = 4 + (8 + fmtSize) + (adpcm ? 12 : 0) + 8 + dataSize;
+    writeTag(out, "RIFF");
+    writeU32(out, riffSize);
+    writeTag(out, "WAVE");
+    writeTag(out, "fmt ");
+    writeU32(out, fmtSize);
+    writeU16(out, format);
+    writeU16(out, (uint16_t)pcm.channels);
+    writeU32(out, pcm.sampleRate);
+    writeU32(out, byteRate);
+    writeU16(out, blockAlign);
+    writeU16(out, bits);
+    if (adpcm) {
+        writeU16(out, 2);
+        writeU16(out, samplesPerBlock);
+        // the fact chunk holds the length in samples, since the last block is padded
+        writeTag(out, "fact");
+        writeU32(out, 4);
+        writeU32(out, (uint32_t)(pcm.samples.size() / pcm.channels));
+    }
+    writeTag(out, "data");
+    writeU32(out, dataSize);
+}
+
+static void encodePCM16(const PCMData& pcm, std::vector<uint8_t>& out) {
+    uint32_t dataSize = (uint32_t)(pcm.samples.size() * 2);
+    writeWavHeader(out, 1, pcm, pcm.sampleRate * pcm.channels * 2, (uint16_t)(pcm.channels * 2), 16, dataSize);
+    for (int16_t s : pcm.samples)
+        writeU16(out, (uint16_t)s);
+}
+
+// Encodes one sample, updating the channel's predictor and step index, and returns its 4 bit code
+static uint8_t encodeADPCMSample(int sample, int& predictor, int& index) {
+    int diff = sample - predictor;
+    uint8_t code = 0;
+    if (diff < 0) {
+        code = 8;
+        diff = -diff;
+    }
+    int step = ADPCM_STEP_TABLE[index];
+    int delta = step >> 3;
+    if (diff >= step) { code |= 4; diff -= step; delta += step; }
+    step >>= 1;
+    if (diff >= step) { code |= 2; diff -= step; delta += step; }
+    step >>= 1;
+    if (diff >= step) { code |= 1; delta += step; }
+    predictor = std::max(-32768, std::min(32767, predictor + ((code & 8) ? -delta : delta)));
+    index = std::max(0, std::min(88, index + ADPCM_INDEX_TABLE[code & 7]));
+    return code;
+}
+
+// Encodes Microsoft IMA ADPCM: per block, a header per channel, then 8 samples per channel in 4 byte groups
+static void encodeIMAADPCM(const PCMData& pcm, std::vector<uint8_t>& out) {
+    int channels = pcm.channels;
+    int blockAlign = ADPCM_BLOCK_BYTES_PER_CHANNEL * channels;
+    int samplesPerBlock = (blockAlign - 4 * channels) * 8 / (4 * channels) + 1;
+    size_t frames = pcm.samples.size() / channels;
+    size_t blocks = (frames + samplesPerBlock - 1) / samplesPerBlock;
+    uint32_t dataSize = (uint32_t)(blocks * blockAlign);
+    writeWavHeader(out, 0x11, pcm, (uint32_t)((uint64_t)pcm.sampleRate * blockAlign / samplesPerBlock), (uint16_t)blockAlign, 4, dataSize,
+        (uint16_t)samplesPerBlock);
+
+    auto sampleAt = [&](size_t frame, int channel) -> int {
+        return frame < frames ? pcm.samples[frame * channels + channel] : 0;
+    };
+    std::vector<int> predictors(channels, 0), indices(channels, 0);
+    for (size_t b = 0; b < blocks; b++) {
+        size_t first = b * samplesPerBlock;
+        // the first sample of the block is stored uncompressed in the header
+        for (int c = 0; c < channels; c++) {
+            predictors[c] = sampleAt(first, c);
+            writeU16(out, (uint16_t)(int16_t)predictors[c]);
+            out.push_back((uint8_t)indices[c]);
+            out.push_back(0);
+        }
+        for (int group = 0; group < (samplesPerBlock - 1) / 8; group++) {
+            for (int c = 0; c < channels; c++) {
+                for (int i = 0; i < 8; i += 2) {
+                    size_t frame = first + 1 + group * 8 + i;
+                    uint8_t low = encodeADPCMSample(sampleAt(frame, c), predictors[c], indices[c]);
+                    uint8_t high = encodeADPCMSample(sampleAt(frame + 1, c), predictors[c], indices[c]);
+                    out.push_back(low | (high << 4));
+                }
+            }
+        }
+    }
+}
+
+bool AudioPack::open(const char* filePath) {
+    std::ifstream file(filePath, std::ios::binary);
+    char magic[8];
+    uint32_t count = 0;
+    uint64_t directoryOffset = 0;
+    if (!file.read(magic, 8) || memcmp(magic, AUDIO_PACK_MAGIC, 8) != 0
+        || !file.read((char*)&count, 4) || !file.read((char*)&directoryOffset, 8)) {
+        std::cout << "Audio Pack: Can't open " << filePath << '\n';
+        return false;
+    }
+    // a corrupt count or name length must not size a vector beyond the file; each entry has at least its fixed fields
+    const uint64_t ENTRY_FIXED_SIZE = 4 + 8 + 8 + 4 + 8 + 8;
+    file.seekg(0, std::ios::end);
+    uint64_t fileSize = (uint64_t)file.tellg();
+    if (directoryOffset > fileSize || count > (fileSize - directoryOffset) / ENTRY_FIXED_SIZE) {
+        std::cout << "Audio Pack: Directory of " << filePath << " is corrupt\n";
+        return false;
+    }
+    this->filePath = filePath;
+    entries.resize(count);
+    file.seekg(directoryOffset);
+    for (uint32_t i = 0; i < count && file; i++) {
+        AudioPackEntry& entry = entries[i];
+        uint32_t nameLength = 0, loadMode = 0;
+        file.read((char*)&nameLength, 4);
+        if (!file || nameLength > fileSize - (uint64_t)file.tellg()) {
+            file.setstate(std::ios::failbit);
+            break;
+        }
+        entry.name.resize(nameLength);
+        file.read(&entry.name[0], nameLength);
+        file.read((char*)&entry.offset, 8);
+        file.read((char*)&entry.size, 8);
+        file.read((char*)&loadMode, 4);
+        file.read((char*)&entry.sourceSize, 8);
+        file.read((char*)&entry.pcmSize, 8);
+        entry.loadMode = (AUDIO_PACK_LOAD_MODE)loadMode;
+        entriesByName[entry.name] = i;
+    }
+    if (!file) {
+        std::cout << "Audio Pack: Directory of " << filePath << " is truncated\n";
+        entries.clear();
+        entriesByName.clear();
+        return false;
+    }
+    return true;
+}
+
+const AudioPackEntry* AudioPack::find(const std::string& name) const {
+    auto entry = entriesByName.find(name);
+    return entry != entriesByName.end() ? &entries[entry->second] : nullptr;
+}
+
+bool AudioPackBuilder::readManifest(const char* manifestPath) {
+    std::ifstream manifest(manifestPath);
+    if (!manifest) {
+        std::cout << "Audio Pack: Can't read manifest " << manifestPath << '\n';
+        return false;
+    }
+    std::string line;
+    while (std::getline(manifest, line)) {
+        std::istringstream words(line);
+        AudioPackAssetSettings settings;
+        if (!(words >> settings.sourcePath) || settings.sourcePath[0] == '#')
+            continue;
+        std::string option;
+        while (words >> option) {
+            if (option == "mono")                settings.mono = true;
+            else if (option == "pcm16")          settings.format = AUDIO_PACK_FORMAT_PCM16;
+            else if (option == "adpcm")          settings.format = AUDIO_PACK_FORMAT_IMA_ADPCM;
+            else if (option == "raw")            settings.format = AUDIO_PACK_FORMAT_RAW;
+            else if (option == "decompressed")   settings.loadMode = AUDIO_PACK_LOAD_DECOMPRESSED;
+            else if (option == "compressed")     settings.loadMode = AUDIO_PACK_LOAD_COMPRESSED;
+            else if (option == "stream")         settings.loadMode = AUDIO_PACK_LOAD_STREAM;
+            else
+                std::cout << "Audio Pack: Unknown option " << option << " for " << settings.sourcePath << '\n';
+        }
+        addAsset(settings);
+    }
+    return true;
+}
+
+bool AudioPackBuilder::addAsset(const AudioPackAssetSettings& settings) {
+    Asset asset;
+    asset.settings = settings;
+    asset.entry.name = settings.sourcePath;
+    asset.entry.loadMode = settings.loadMode;
+    std::vector<uint8_t> source;
+    if (!readFile(settings.sourcePath, source)) {
+        std::cout << "Audio Pack: Can't read " << settings.sourcePath << '\n';
+        return false;
+    }
+    asset.entry.sourceSize = source.size();
+
+    if (settings.format == AUDIO_PACK_FORMAT_RAW) {
+        asset.data = std::move(source);
+        asset.entry.pcmSize = asset.data.size();
+    }
+    else {
+        PCMData pcm;
+        if (!decodeWav(source, pcm)) {
+            std::cout << "Audio Pack: " << settings.sourcePath << " isn't a PCM or float wav file, pack it as raw\n";
+            return false;
+        }
+        asset.sourceChannels = pcm.channels;
+        if (settings.mono)
+            downmixToMono(pcm);
+        asset.channels = pcm.channels;
+        asset.entry.pcmSize = pcm.samples.size() * 2;
+        if (settings.format == AUDIO_PACK_FORMAT_IMA_ADPCM)
+            encodeIMAADPCM(pcm, asset.data);
+        else
+            encodePCM16(pcm, asset.data);
+    }
+    asset.entry.size = asset.data.size();
+    assets.push_back(std::move(asset));
+    return true;
+}
+
+bool AudioPackBuilder::write(const char* packPath) {
+    std::ofstream file(packPath, std::ios::binary);
+    if (!file) {
+        std::cout << "Audio Pack: Can't write " << packPath << '\n';
+        return false;
+    }
+    uint32_t count = (uint32_t)assets.size();
+    uint64_t directoryOffset = 0;
+    file.write(AUDIO_PACK_MAGIC, 8);
+    file.write((const char*)&count, 4);
+    file.write((const char*)&directoryOffset, 8);
+
+    // aligned entries keep streamed reads on sector boundaries
+    static const char padding[AudioPack::AUDIO_PACK_ALIGNMENT] = { };
+    uint64_t offset = 20;
+    for (Asset& asset : assets) {
+        uint64_t aligned = (offset + AudioPack::AUDIO_PACK_ALIGNMENT - 1) / AudioPack::AUDIO_PACK_ALIGNMENT * AudioPack::AUDIO_PACK_ALIGNMENT;
+        file.write(padding, aligned - offset);
+        asset.entry.offset = aligned;
+        file.write((const char*)asset.data.data(), asset.data.size());
+        offset = aligned + asset.data.size();
+    }
+
+    directoryOffset = offset;
+    for (Asset& asset : assets) {
+        const AudioPackEntry& entry = asset.entry;
+        uint32_t nameLength = (uint32_t)entry.name.size(), loadMode = entry.loadMode;
+        file.write((const char*)&nameLength, 4);
+        file.write(entry.name.data(), nameLength);
+        file.write((const char*)&entry.offset, 8);
+        file.write((const char*)&entry.size, 8);
+        file.write((const char*)&loadMode, 4);
+        file.write((const char*)&entry.sourceSize, 8);
+        file.write((const char*)&entry.pcmSize, 8);
+    }
+    file.seekp(12);
+    file.write((const char*)&directoryOffset, 8);
+    if (!file) {
+        std::cout << "Audio Pack: Failed writing " << packPath << '\n';
+        return false;
+    }
+    std::cout << "Audio Pack: Wrote " << count << " assets to " << packPath << '\n';
+    return true;
+}
+
+void AudioPackBuilder::printReport() {
+    static const char* FORMAT_NAMES[] = { "pcm16", "adpcm", "raw" };
+    static const char* LOAD_MODE_NAMES[] = { "decompressed", "compressed", "stream" };
+    uint64_t sourceTotal = 0, packedTotal = 0, residentBefore = 0, residentAfter = 0;
+    std::cout << "Audio Pack Report:\n";
+    for (Asset& asset : assets) {
+        const AudioPackEntry& entry = asset.entry;
+        // resident sample memory of packed assets, as set by their load mode
+        uint64_t resident = entry.loadMode == AUDIO_PACK_LOAD_DECOMPRESSED ? entry.pcmSize : entry.loadMode == AUDIO_PACK_LOAD_COMPRESSED ? entry.size : 0;
+        // loose files were loaded as they are on disk, e.g. 24 bit PCM
+        uint64_t sourcePCM = entry.sourceSize;
+        std::cout << "  " << entry.name << ": " << entry.sourceSize / 1024 << " KB -> " << entry.size / 1024 << " KB, "
+            << asset.sourceChannels << " -> " << asset.channels << " channels, " << FORMAT_NAMES[asset.settings.format] << ", "
+            << LOAD_MODE_NAMES[entry.loadMode] << ", resident " << sourcePCM / 1024 << " KB -> " << resident / 1024 << " KB\n";
+        sourceTotal += entry.sourceSize;
+        packedTotal += entry.size;
+        residentBefore += sourcePCM;
+        residentAfter += resident;
+    }
+    std::cout << "  total: " << assets.size() << " files, " << sourceTotal / 1024 << " KB -> 1 file, " << packedTotal / 1024
+        << " KB on disk (" << (sourceTotal ? 100.0 * packedTotal / sourceTotal : 0.0) << "%), resident sample memory "
+        << residentBefore / 1024 << " KB -> " << residentAfter / 1024 << " KB (streams excluded)\n";
+}
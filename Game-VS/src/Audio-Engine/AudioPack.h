@@ -0,0 +1,126 @@
+///
+/// @file AudioPack.h
+///
+/// Packed audio asset files: one file holding many conditioned sounds, which the AudioEngine loads by name
+///
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Reads a PCM (8/16/24/32 bit) or 32 bit float wav file as 16 bit samples
+ * @returns false if the file can't be read or has another format
+ */
+bool readWavFile(const char* filePath, int& channels, int& sampleRate, std::vector<int16_t>& samples);
+
+// How an asset's samples are stored in an audio pack
+typedef enum {
+    AUDIO_PACK_FORMAT_PCM16,      // 16 bit PCM wav
+    AUDIO_PACK_FORMAT_IMA_ADPCM,  // 4 bit IMA ADPCM wav, a quarter of the size of PCM16, decoded by FMOD
+    AUDIO_PACK_FORMAT_RAW         // the source file's bytes unchanged, e.g. Ogg Vorbis or FSB files encoded by FMOD's fsbank
+} AUDIO_PACK_FORMAT;
+
+// How the AudioEngine loads an asset, stored with each pack entry
+typedef enum {
+    AUDIO_PACK_LOAD_DECOMPRESSED = 0,  // decoded to PCM in memory on load, the cheapest to play
+    AUDIO_PACK_LOAD_COMPRESSED   = 1,  // kept compressed in memory and decoded while playing (FMOD_CREATECOMPRESSEDSAMPLE)
+    AUDIO_PACK_LOAD_STREAM       = 2   // streamed from the pack while playing (FMOD_CREATESTREAM)
+} AUDIO_PACK_LOAD_MODE;
+
+/**
+ * Per-asset settings of the packaging step, one line of the pack manifest:
+ *     <source path> [mono] [pcm16|adpcm|raw] [decompressed|compressed|stream]
+ * The source path is also the name the asset is looked up by, so SoundInfos keep using their file paths.
+ */
+struct AudioPackAssetSettings {
+    std::string sourcePath;
+    // downmix to one channel, for 3D point sources which FMOD downmixes when panning anyway
+    bool mono = false;
+    AUDIO_PACK_FORMAT format = AUDIO_PACK_FORMAT_PCM16;
+    AUDIO_PACK_LOAD_MODE loadMode = AUDIO_PACK_LOAD_DECOMPRESSED;
+};
+
+/**
+ * An asset in an audio pack, a complete sound file at an offset of the pack file
+ */
+struct AudioPackEntry {
+    std::string name;
+    uint64_t offset = 0, size = 0;
+    AUDIO_PACK_LOAD_MODE loadMode = AUDIO_PACK_LOAD_DECOMPRESSED;
+    // size of the source file, and its samples as 16 bit PCM, for reports
+    uint64_t sourceSize = 0, pcmSize = 0;
+};
+
+/**
+ * Directory of an audio pack file.
+ * File layout: "FSQAPAK1", entry count (uint32), directory offset (uint64), the entries' files aligned to
+ * AUDIO_PACK_ALIGNMENT bytes, and the directory of entry names, offsets and sizes.
+ */
+class AudioPack {
+public:
+    static const uint32_t AUDIO_PACK_ALIGNMENT = 2048;
+
+    /**
+     * Reads the directory of a pack file
+     * @returns false if the file doesn't exist or isn't an audio pack
+     */
+    bool open(const char* filePath);
+
+    /**
+     * Returns the entry of an asset by name, or nullptr if the pack doesn't contain it
+     */
+    const AudioPackEntry* find(const std::string& name) const;
+
+    /**
+     * Returns the path of the pack file, which entries are loaded from
+     */
+    const std::string& getFilePath() const { return filePath; }
+
+    const std::vector<AudioPackEntry>& getEntries() const { return entries; }
+
+private:
+    std::string filePath;
+    std::vector<AudioPackEntry> entries;
+    std::unordered_map<std::string, size_t> entriesByName;
+};
+
+/**
+ * Offline packaging step which conditions sound files and packs them into an AudioPack file.
+ * Reads PCM and float wav files, downmixes them and converts them to PCM16 or IMA ADPCM per asset.
+ */
+class AudioPackBuilder {
+public:
+    /**
+     * Reads a pack manifest, one AudioPackAssetSettings per line. Lines starting with # are comments.
+     * @returns false if the manifest can't be read
+     */
+    bool readManifest(const char* manifestPath);
+
+    /**
+     * Adds an asset to the pack, converting it right away
+     * @returns false if the source file can't be read or converted
+     */
+    bool addAsset(const AudioPackAssetSettings& settings);
+
+    /**
+     * Writes the pack file
+     * @returns false if the file can't be written
+     */
+    bool write(const char* packPath);
+
+    /**
+     * Prints the source and packed size of every asset, and the totals, to the console
+     */
+    void printReport();
+
+private:
+    struct Asset {
+        AudioPackAssetSettings settings;
+        AudioPackEntry entry;
+        std::vector<uint8_t> data;
+        int sourceChannels = 0, channels = 0;
+    };
+    std::vector<Asset> assets;
+};
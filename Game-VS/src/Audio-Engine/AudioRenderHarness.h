@@ -0,0 +1,179 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <glm/glm.hpp>
+#include "AudioEngine.h"
+#include "AmbientEmitterManager.h"
+#include "CoinChallengeSoundController.h"
+#include "FootstepSoundController.h"
+#include "../GameData.h"
+
+/**
+ * Results of an offline render, in mixed (DSP clock) time and wall clock time
+ */
+struct AudioRenderReport {
+	double mixedSeconds = 0.0, wallSeconds = 0.0;
+	// wall clock time spent in AudioEngine::update(), which mixes the audio in non-realtime output modes
+	double updateSeconds = 0.0;
+	int updates = 0;
+	// FMOD DSP CPU usage in percent, averaged over and peak of all updates
+	float avgCPUDSP = 0.0f, peakCPUDSP = 0.0f;
+	// voice counts averaged over and peak of all updates
+	float avgRealVoices = 0.0f, avgVirtualVoices = 0.0f;
+	int peakRealVoices = 0, peakVirtualVoices = 0, peakFMODChannels = 0;
+	unsigned long long steals = 0;
+	int footsteps = 0, coinsPickedUp = 0;
+
+	// mixed seconds per wall clock second, how many times faster than realtime the mix ran
+	double realtimeFactor() const {
+		return wallSeconds > 0.0 ? mixedSeconds / wallSeconds : 0.0;
+	}
+
+	// milliseconds of mixing per second of mixed audio
+	double updateMSPerMixedSecond() const {
+		return mixedSeconds > 0.0 ? 1000.0 * updateSeconds / mixedSeconds : 0.0;
+	}
+
+	void print() const {
+		std::cout << "Audio Render: " << mixedSeconds << " s mixed in " << wallSeconds << " s (" << realtimeFactor() << "x realtime), "
+			<< updates << " updates\n";
+		std::cout << "  mixing cost: " << updateMSPerMixedSecond() << " ms CPU per mixed second, FMOD DSP " << avgCPUDSP << "% avg / "
+			<< peakCPUDSP << "% peak\n";
+		std::cout << "  voices: " << avgRealVoices << " real / " << avgVirtualVoices << " virtual avg, " << peakRealVoices << " real / "
+			<< peakVirtualVoices << " virtual peak, " << peakFMODChannels << " FMOD channels peak, " << steals << " steals\n";
+		std::cout << "  script: " << footsteps << " footsteps, " << coinsPickedUp << " coins picked up\n";
+	}
+};
+
+/**
+ * Drives the game's sound controllers through a scripted play-through, for rendering the audio without a sound card.
+ * The listener walks from the start of the square to the NPC, which plays its dialogue, and then runs from coin to coin
+ * until the coin challenge is complete. The script runs on the DSP clock, so with a non-realtime output
+ * (FMOD_OUTPUTTYPE_NOSOUND_NRT or FMOD_OUTPUTTYPE_WAVWRITER_NRT) it mixes as fast as the CPU allows and produces
+ * the same mix on every run. The audio thread must not be running.
+ */
+class AudioRenderHarness {
+public:
+	/**
+	 * @param audioEngine Shared audio engine with the game's sounds loaded. Must be initialized.
+	 */
+	AudioRenderHarness(std::shared_ptr<AudioEngine> audioEngine, FootstepSoundController* footstepController,
+		CoinChallengeSoundController* coinSoundController)
+		: audioEngine(audioEngine), footstepController(footstepController), coinSoundController(coinSoundController), birds(audioEngine) {
+		// without the models' bounds, the bird song emitters are placed at the trees' translations
+		int birdSoundType = birds.addSoundType(soundTreeBirds, BIRD_EMITTERS_ACTIVE);
+		for (glm::vec3 tree : { tranPine, tranCooltree, tranWillowtree, tranGreenPine, tranfir1, tranfir2, tranfir4, tranfir5, tranfir6, tranfirback1, tranfirback5 })
+			birds.addEmitter(birdSoundType, tree * GLOBAL_POSITION_SCALE + glm::vec3(0.0f, 3.0f, 0.0f));
+	}
+
+	/**
+	 * Renders the play-through, plus a tail after the coin challenge is complete
+	 * @param maxSeconds Mixed seconds after which the render stops, even if the script hasn't finished
+	 */
+	AudioRenderReport run(double maxSeconds = 120.0, double tailSeconds = 5.0) {
+		AudioRenderReport report;
+		if (audioEngine->isThreaded()) {
+			std::cout << "Audio Render: Can't render while the audio thread runs\n";
+			return report;
+		}
+		// the footstep timing is randomized with rand(), seed it so every render is identical
+		srand(1);
+		audioEngine->playSound(fountainSoundLoop);
+
+		glm::vec3 position = STARTING_PLAYER_LOCATION, front(0.0f, 0.0f, -1.0f);
+		int nextCoin = 0;
+		bool dialogueStarted = false, running = false;
+		double dialogueEndTime = -1.0, scoreStartTime = -1.0, finishedTime = -1.0;
+		unsigned long long startClock = audioEngine->getDSPClock();
+		double realVoiceSum = 0.0, virtualVoiceSum = 0.0, cpuSum = 0.0;
+		auto wallStart = std::chrono::steady_clock::now();
+		double t = 0.0, lastT = 0.0;
+
+		while (t < maxSeconds && (finishedTime < 0.0 || t < finishedTime + tailSeconds)) {
+			float dt = (float)(t - lastT);
+			lastT = t;
+
+			// walk to the NPC, wait for its dialogue, then run to every coin in turn
+			glm::vec3 target = position;
+			if (!dialogueStarted)
+				target = npcSoundLocation;
+			else if (scoreStartTime >= 0.0 && nextCoin < (int)coinTranslations.size())
+				target = coinTranslations[nextCoin];
+			glm::vec3 toTarget = glm::vec3(target.x - position.x, 0.0f, target.z - position.z);
+			float distance = glm::length(toTarget);
+			if (running != dialogueStarted) {
+				running = dialogueStarted;
+				footstepController->setRunning(running);
+			}
+			if (distance > ARRIVAL_DISTANCE) {
+				front = toTarget / distance;
+				position += front * std::min(distance, (running ? RUN_SPEED : WALK_SPEED) * dt);
+				footstepController->processFootstepKey((float)t);
+			}
+			else if (!dialogueStarted) {
+				dialogueStarted = true;
+				audioEngine->playSound(dialogue);
+				dialogueEndTime = t + audioEngine->getSoundLengthInMS(dialogue) / 1000.0;
+			}
+			else if (scoreStartTime >= 0.0 && nextCoin < (int)coinTranslations.size()) {
+				coinSoundController->characterPickedUpCoin();
+				report.coinsPickedUp++;
+				if (++nextCoin == (int)coinTranslations.size())
+					finishedTime = t;
+			}
+			if (dialogueEndTime >= 0.0 && t >= dialogueEndTime) {
+				dialogueEndTime = -1.0;
+				scoreStartTime = t;
+				coinSoundController->startScore();
+			}
+
+			// same per-frame audio updates as the render loop, each update mixes one DSP buffer in non-realtime output modes
+			birds.update(position);
+			auto updateStart = std::chrono::steady_clock::now();
+			audioEngine->update();
+			report.updateSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - updateStart).count();
+			// X and Y of the front and up vectors are swapped, as in the render loop
+			audioEngine->set3DListenerPosition(position.x, position.y, position.z, front.y, front.x, front.z, 1.0f, 0.0f, 0.0f);
+
+			VoiceStats stats = audioEngine->getVoiceStats();
+			report.updates++;
+			realVoiceSum += stats.realVoices;
+			virtualVoiceSum += stats.virtualVoices;
+			cpuSum += stats.cpuDSP;
+			report.peakCPUDSP = std::max(report.peakCPUDSP, stats.cpuDSP);
+			report.peakRealVoices = std::max(report.peakRealVoices, stats.realVoices);
+			report.peakVirtualVoices = std::max(report.peakVirtualVoices, stats.virtualVoices);
+			report.peakFMODChannels = std::max(report.peakFMODChannels, stats.fmodChannels);
+			report.steals = stats.steals;
+
+			// in realtime output modes the clock advances with the wall clock, so pace the updates like frames
+			if (!audioEngine->isNonRealtime())
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			t = (double)(audioEngine->getDSPClock() - startClock) / AudioEngine::AUDIO_SAMPLE_RATE;
+		}
+
+		report.mixedSeconds = t;
+		report.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+		report.footsteps = footstepController->getFootstepCount();
+		if (report.updates > 0) {
+			report.avgRealVoices = (float)(realVoiceSum / report.updates);
+			report.avgVirtualVoices = (float)(virtualVoiceSum / report.updates);
+			report.avgCPUDSP = (float)(cpuSum / report.updates);
+		}
+		birds.stopAll();
+		return report;
+	}
+
+private:
+	std::shared_ptr<AudioEngine> audioEngine;
+	FootstepSoundController* footstepController;
+	CoinChallengeSoundController* coinSoundController;
+	AmbientEmitterManager birds;
+
+	// Listener speeds and how close it must get to the NPC and coins, in world units and seconds
+	const float WALK_SPEED = 2.5f, RUN_SPEED = 6.0f, ARRIVAL_DISTANCE = 1.0f;
+};
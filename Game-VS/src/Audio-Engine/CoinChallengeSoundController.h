@@ -1,11 +1,12 @@
 #pragma once
 #include "AudioEngine.h"
+#include "MusicScheduler.h"
 #include "SoundInfo.h"
 #include "../GameData.h"
 
 /**
  * Class which manages all sounds associated with the Game's coin challenge,
- * including SFX and music.
+ * including SFX and music. Music changes are scheduled on beats and bars of the playing song.
  */
 class CoinChallengeSoundController {
 	
@@ -19,7 +20,7 @@ public:
 	 * @param nTotalCoins The total number of coins in the coin challenge
 	 */
 	CoinChallengeSoundController(std::shared_ptr<AudioEngine> audioEngine, int nTotalCoins)
-		: audioEngine(audioEngine), nTotalCoins(nTotalCoins) {
+		: audioEngine(audioEngine), nTotalCoins(nTotalCoins), musicScheduler(audioEngine) {
 		init();
 	}
 
@@ -27,39 +28,33 @@ public:
 	void startScore() {
 		std::cout << "Starting Coin Challenge Score\n";
 		
-		audioEngine->playSound(musicLayer_BeforeChallenge);
-		audioEngine->playSound(musicLayer_StartedChallenge);
-		audioEngine->playSound(musicLayer_ChallengeIntensity2);
-		// fade in music	
-		audioEngine->updateSoundLoopVolume(musicLayer_BeforeChallenge, defVolume, 2 * beatSampleLength * timeSignatureNumerator);
+		musicScheduler.playTrack(song1);
+		// fade in music over the first 2 bars
+		musicScheduler.fadeLayerAtBeat(song1, musicLayer_BeforeChallenge, defVolume, 0.0, 2.0 * timeSignatureNumerator);
 	}
 
 
 	void characterPickedUpCoin() {
 		nCharacterCoins++;
 		std::cout << "Character picked up a coin\n";
-		audioEngine->playSound(stinger_CoinPickup);
+		// the stinger and layer changes land on the next beat
+		musicScheduler.playStinger(stinger_CoinPickup);
 		// start search with intensity level 1
 		if (nCharacterCoins <= nTotalCoins / 2) 
-			audioEngine->updateSoundLoopVolume(musicLayer_StartedChallenge, defVolume / (nTotalCoins / 2) * nCharacterCoins, timeSignatureNumerator * beatSampleLength / 2);
+			musicScheduler.fadeLayer(musicLayer_StartedChallenge, defVolume / (nTotalCoins / 2) * nCharacterCoins, MUSIC_QUANTIZE_BEAT, timeSignatureNumerator / 2.0);
 		// intensity level 2
 		else if ( nCharacterCoins < nTotalCoins)
-			audioEngine->updateSoundLoopVolume(musicLayer_ChallengeIntensity2, defVolume / (nTotalCoins / 2) * nCharacterCoins, timeSignatureNumerator * beatSampleLength / 2);
+			musicScheduler.fadeLayer(musicLayer_ChallengeIntensity2, defVolume / (nTotalCoins / 2) * nCharacterCoins, MUSIC_QUANTIZE_BEAT, timeSignatureNumerator / 2.0);
 		// success
 		else if (nCharacterCoins == nTotalCoins) {
 			std::cout << "Completed challenge\n";
-			// stop song 1 layers
-			unsigned long fadeLength = beat2SampleLength / 2;
-			audioEngine->updateSoundLoopVolume(musicLayer_BeforeChallenge, 0.0f, fadeLength);
-			audioEngine->updateSoundLoopVolume(musicLayer_StartedChallenge, 0.0f, fadeLength);
-			audioEngine->updateSoundLoopVolume(musicLayer_ChallengeIntensity2, 0.0f, fadeLength);
-			// play success sound TODO update sound
-			audioEngine->playSound(stinger_Success);
-			// play new music
-			audioEngine->playSound(musicSection2_FullMix);
+			// play success sound on the next bar TODO update sound
+			musicScheduler.playStinger(stinger_Success, MUSIC_QUANTIZE_BAR);
+			// crossfade song 1 layers into the new music on the same bar
+			musicScheduler.transitionTo(song2, MUSIC_QUANTIZE_BAR, 0.5);
 			// set 'Winning' music to fade out
 			int remainingLoops = 30;
-			audioEngine->updateSoundLoopVolume(musicSection2_FullMix, 0.0f, beat2SampleLength * timeSignatureNumerator * remainingLoops);
+			musicScheduler.fadeLayerAtBeat(song2, musicSection2_FullMix, 0.0f, 0.5, (double)timeSignatureNumerator * remainingLoops);
 			// TODO fade back into 'regular' ambient music (non-coin challenge)?
 		}
 
@@ -72,10 +67,7 @@ public:
 	}
 	void reset() {
 		nCharacterCoins = 0;
-		audioEngine->stopSound(musicLayer_BeforeChallenge);
-		audioEngine->stopSound(musicLayer_ChallengeIntensity2);
-		audioEngine->stopSound(musicLayer_StartedChallenge);
-		audioEngine->stopSound(musicSection2_FullMix);
+		musicScheduler.stopAll();
 		initLoopingSoundInfoVolumes();
 		startScore();
 	}
@@ -94,9 +86,9 @@ private:
 	const float bpm = 158.f, bpm2 = 109.f;
 	// Rythmn information about the songs
 	unsigned int timeSignatureNumerator = 4, timeSignatureDenominator = 4;
-	// calculated time length, in audio samples, of a musical beat (ie 'quarter note') in the songs
-	unsigned int beatSampleLength = AudioEngine::AUDIO_SAMPLE_RATE * 60 / bpm;
-	unsigned int beat2SampleLength = AudioEngine::AUDIO_SAMPLE_RATE * 60 / bpm2;
+	// Schedules the songs on their beats and bars, using a tempo map per song
+	MusicScheduler musicScheduler;
+	int song1 = -1, song2 = -1;
 
 
 	// Music assets/info 
@@ -125,12 +117,19 @@ private:
 	// 
 	void init() {
 		initLoopingSoundInfoVolumes();
+		// music layers use the music voice budget, stingers are one-shot effects that must not be stolen by other effects
+		for (SoundInfo* sound : { &musicLayer_BeforeChallenge, &musicLayer_StartedChallenge, &musicLayer_ChallengeIntensity2, &musicSection2_FullMix })
+			sound->setCategory(SOUND_CATEGORY_MUSIC);
+		stinger_CoinPickup.setPriority(0);
+		stinger_Success.setPriority(0);
 		audioEngine->loadSound(stinger_CoinPickup);
 		audioEngine->loadSound(musicLayer_BeforeChallenge);
 		audioEngine->loadSound(musicLayer_StartedChallenge);
 		audioEngine->loadSound(musicLayer_ChallengeIntensity2);
 		audioEngine->loadSound(stinger_Success);
 		audioEngine->loadSound(musicSection2_FullMix);
+		song1 = musicScheduler.addTrack(TempoMap(bpm, timeSignatureNumerator), { &musicLayer_BeforeChallenge, &musicLayer_StartedChallenge, &musicLayer_ChallengeIntensity2 });
+		song2 = musicScheduler.addTrack(TempoMap(bpm2, timeSignatureNumerator), { &musicSection2_FullMix });
 	}
 	
 };
\ No newline at end of file
@@ -0,0 +1,637 @@
+///
+/// @file ConvolutionReverb.cpp
+///
+#include "ConvolutionReverb.h"
+#include "AudioEngine.h"
+#include "AudioPack.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CONVOLUTION_USE_SSE
+#endif
+
+static const float PI = 3.14159265358979f;
+
+/**
+ * FFT of real signals of a power of two size, computed as a complex FFT of half the size.
+ * The spectrum has size / 2 + 1 bins, stored as separate real and imaginary arrays.
+ */
+class RealFFT {
+public:
+    explicit RealFFT(int size) : size(size), half(size / 2) {
+        bitReverse.resize(half);
+        int bits = 0;
+        while ((1 << bits) < half)
+            bits++;
+        for (int i = 0; i < half; i++) {
+            int reversed = 0;
+            for (int b = 0; b < bits; b++)
+                reversed |= ((i >> b) & 1) << (bits - 1 - b);
+            bitReverse[i] = reversed;
+        }
+        // e^(-2 pi i k / half) for the complex FFT, e^(-2 pi i k / size) to split its output into the real spectrum
+        for (int k = 0; k < half / 2; k++) {
+            twiddleRe.push_back(std::cos(2.0 * PI * k / half));
+            twiddleIm.push_back(-std::sin(2.0 * PI * k / half));
+        }
+        for (int k = 0; k <= half; k++) {
+            splitRe.push_back(std::cos(2.0 * PI * k / size));
+            splitIm.push_back(-std::sin(2.0 * PI * k / size));
+        }
+        workRe.resize(half);
+        workIm.resize(half);
+    }
+
+    /**
+     * Transforms size real samples to size / 2 + 1 bins
+     */
+    void forward(const float* input, float* re, float* im) {
+        // even samples are the real part, odd samples the imaginary part
+        for (int i = 0; i < half; i++) {
+            workRe[bitReverse[i]] = input[2 * i];
+            workIm[bitReverse[i]] = input[2 * i + 1];
+        }
+        complexFFT(false);
+        for (int k = 0; k <= half; k++) {
+            int a = k % half, b = (half - k) % half;
+            // spectra of the even (e) and odd (o) samples
+            float eRe = 0.5f * (workRe[a] + workRe[b]), eIm = 0.5f * (workIm[a] - workIm[b]);
+            float oRe = 0.5f * (workIm[a] + workIm[b]), oIm = -0.5f * (workRe[a] - workRe[b]);
+            re[k] = eRe + splitRe[k] * oRe - splitIm[k] * oIm;
+            im[k] = eIm + splitRe[k] * oIm + splitIm[k] * oRe;
+        }
+    }
+
+    /**
+     * Transforms size / 2 + 1 bins back to size real samples
+     */
+    void inverse(const float* re, const float* im, float* output) {
+        for (int k = 0; k < half; k++) {
+            int b = half - k;
+            float eRe = 0.5f * (re[k] + re[b]), eIm = 0.5f * (im[k] - im[b]);
+            float dRe = 0.5f * (re[k] - re[b]), dIm = 0.5f * (im[k] + im[b]);
+            // odd spectrum, the difference rotated by the conjugate split twiddle
+            float oRe = dRe * splitRe[k] + dIm * splitIm[k], oIm = dIm * splitRe[k] - dRe * splitIm[k];
+            workRe[bitReverse[k]] = eRe - oIm;
+            workIm[bitReverse[k]] = eIm + oRe;
+        }
+        complexFFT(true);
+        float scale = 1.0f / half;
+        for (int i = 0; i < half; i++) {
+            output[2 * i] = workRe[i] * scale;
+            output[2 * i + 1] = workIm[i] * scale;
+        }
+    }
+
+private:
+    int size, half;
+    std::vector<int> bitReverse;
+    std::vector<float> twiddleRe, twiddleIm, splitRe, splitIm;
+    std::vector<float> workRe, workIm;
+
+    // In place radix-2 FFT of the bit reversed work arrays
+    void complexFFT(bool inverse) {
+        float sign = inverse ? -1.0f : 1.0f;
+        for (int length = 2; length <= half; length <<= 1) {
+            int halfLength = length / 2, step = half / length;
+            for (int start = 0; start < half; start += length)
+                for (int k = 0; k < halfLength; k++) {
+                    float wRe = twiddleRe[k * step], wIm = sign * twiddleIm[k * step];
+                    int a = start + k, b = a + halfLength;
+                    float tRe = workRe[b] * wRe - workIm[b] * wIm;
+                    float tIm = workRe[b] * wIm + workIm[b] * wRe;
+                    workRe[b] = workRe[a] - tRe;
+                    workIm[b] = workIm[a] - tIm;
+                    workRe[a] += tRe;
+                    workIm[a] += tIm;
+                }
+        }
+    }
+};
+
+// Adds the bin-wise complex product of x and h to acc. Spectra are count real floats followed by count imaginary
+// floats, and count is a multiple of 8.
+static void complexMultiplyAccumulate(float* acc, const float* x, const float* h, int count) {
+    float* accRe = acc, * accIm = acc + count;
+    const float* xRe = x, * xIm = x + count, * hRe = h, * hIm = h + count;
+#if defined(__AVX__)
+    for (int i = 0; i < count; i += 8) {
+        __m256 xr = _mm256_loadu_ps(xRe + i), xi = _mm256_loadu_ps(xIm + i);
+        __m256 hr = _mm256_loadu_ps(hRe + i), hi = _mm256_loadu_ps(hIm + i);
+        __m256 re = _mm256_sub_ps(_mm256_mul_ps(xr, hr), _mm256_mul_ps(xi, hi));
+        __m256 im = _mm256_add_ps(_mm256_mul_ps(xr, hi), _mm256_mul_ps(xi, hr));
+        _mm256_storeu_ps(accRe + i, _mm256_add_ps(_mm256_loadu_ps(accRe + i), re));
+        _mm256_storeu_ps(accIm + i, _mm256_add_ps(_mm256_loadu_ps(accIm + i), im));
+    }
+#elif defined(CONVOLUTION_USE_SSE)
+    for (int i = 0; i < count; i += 4) {
+        __m128 xr = _mm_loadu_ps(xRe + i), xi = _mm_loadu_ps(xIm + i);
+        __m128 hr = _mm_loadu_ps(hRe + i), hi = _mm_loadu_ps(hIm + i);
+        __m128 re = _mm_sub_ps(_mm_mul_ps(xr, hr), _mm_mul_ps(xi, hi));
+        __m128 im = _mm_add_ps(_mm_mul_ps(xr, hi), _mm_mul_ps(xi, hr));
+        _mm_storeu_ps(accRe + i, _mm_add_ps(_mm_loadu_ps(accRe + i), re));
+        _mm_storeu_ps(accIm + i, _mm_add_ps(_mm_loadu_ps(accIm + i), im));
+    }
+#else
+    for (int i = 0; i < count; i++) {
+        accRe[i] += xRe[i] * hRe[i] - xIm[i] * hIm[i];
+        accIm[i] += xRe[i] * hIm[i] + xIm[i] * hRe[i];
+    }
+#endif
+}
+
+bool ImpulseResponse::loadWav(const char* filePath) {
+    std::vector<int16_t> pcm;
+    int fileChannels = 0;
+    if (!readWavFile(filePath, fileChannels, sampleRate, pcm)) {
+        std::cout << "ImpulseResponse: Can't read " << filePath << '\n';
+        return false;
+    }
+    name = filePath;
+    channels = std::min(fileChannels, 2);
+    size_t frames = pcm.size() / fileChannels;
+    samples.resize(frames * channels);
+    for (size_t f = 0; f < frames; f++)
+        for (int c = 0; c < channels; c++)
+            samples[f * channels + c] = pcm[f * fileChannels + c] / 32768.0f;
+    return true;
+}
+
+ImpulseResponse ImpulseResponse::synthesize(const char* name, const ImpulseResponseSettings& settings, int sampleRate) {
+    ImpulseResponse ir;
+    ir.name = name;
+    ir.channels = 2;
+    ir.sampleRate = sampleRate;
+    int preDelay = (int)(settings.preDelayMS * 0.001f * sampleRate);
+    int earlyLength = std::max(1, (int)(settings.earlyReflectionsMS * 0.001f * sampleRate));
+    int length = preDelay + (int)(settings.decaySeconds * sampleRate) + 1;
+    ir.samples.assign((size_t)length * 2, 0.0f);
+
+    std::mt19937 random(settings.seed);
+    std::uniform_real_distribution<float> noise(-1.0f, 1.0f), unit(0.0f, 1.0f);
+    // amplitude falls by 60 dB over decaySeconds
+    float decayRate = 6.908f / (settings.decaySeconds * sampleRate);
+    for (int c = 0; c < 2; c++) {
+        float lowpass = 0.0f, energy = 0.0f;
+        for (int i = preDelay; i < length; i++) {
+            int t = i - preDelay;
+            // the tail darkens as it decays, and builds up over the early reflections
+            float coefficient = std::min(0.95f, settings.damping * t / (settings.decaySeconds * sampleRate) + 0.1f);
+            lowpass += (1.0f - coefficient) * (noise(random) - lowpass);
+            float buildUp = std::min(1.0f, (float)t / earlyLength);
+            ir.samples[(size_t)i * 2 + c] = lowpass * std::exp(-decayRate * t) * buildUp;
+        }
+        // the reflections arrive at slightly different times at each ear
+        for (int r = 0; r < settings.earlyReflections; r++) {
+            int i = preDelay + (int)(unit(random) * earlyLength);
+            float sign = noise(random) < 0.0f ? -1.0f : 1.0f;
+            ir.samples[(size_t)i * 2 + c] += sign * settings.earlyReflectionsLevel * std::exp(-decayRate * (i - preDelay));
+        }
+        // unit energy, so IRs of different lengths are about as loud
+        for (int i = 0; i < length; i++)
+            energy += ir.samples[(size_t)i * 2 + c] * ir.samples[(size_t)i * 2 + c];
+        float scale = energy > 0.0f ? 1.0f / std::sqrt(energy) : 0.0f;
+        for (int i = 0; i < length; i++)
+            ir.samples[(size_t)i * 2 + c] *= scale;
+    }
+    return ir;
+}
+
+ConvolutionReverb::ConvolutionReverb() {}
+
+ConvolutionReverb::~ConvolutionReverb() {
+    release();
+}
+
+void ConvolutionReverb::init(int sampleRate, float maxImpulseResponseSeconds, int blockSize, int blocksPerTailJob, bool threadedTail) {
+    release();
+    this->sampleRate = sampleRate;
+    this->blockSize = blockSize;
+    this->blocksPerTailJob = std::max(1, blocksPerTailJob);
+    this->threadedTail = threadedTail;
+    fftSize = 2 * blockSize;
+    binStride = (blockSize + 1 + 7) & ~7;
+    fft.reset(new RealFFT(fftSize));
+    maxPartitions = std::max(1, (int)std::ceil(maxImpulseResponseSeconds * sampleRate / blockSize));
+    // the tail of a block only uses input from before the previous tail job was posted
+    headPartitions = 2 * this->blocksPerTailJob;
+    // the worker reads input spectra up to maxPartitions old while the mixer adds a tail job's worth
+    fdlSize = maxPartitions + 2 * this->blocksPerTailJob;
+
+    fdl.assign((size_t)fdlSize * 2 * binStride, 0.0f);
+    inputWindow.assign(fftSize, 0.0f);
+    inputBlock.assign(blockSize, 0.0f);
+    outputBlock.assign((size_t)blockSize * MAX_OUTPUT_CHANNELS, 0.0f);
+    accumulator.assign(2 * binStride, 0.0f);
+    timeScratch.assign(fftSize, 0.0f);
+    tailSums.assign((size_t)2 * this->blocksPerTailJob * 2 * MAX_OUTPUT_CHANNELS * 2 * binStride, 0.0f);
+    blockFill = 0;
+    blockIndex = 0;
+    silentBlocks = 0;
+    jobIRs[0] = jobIRs[1] = JobIRs();
+    postedTailJob = finishedTailJob = 0;
+    setCrossfadeTime(0.5f);
+
+    if (threadedTail) {
+        tailThreadRunning = true;
+        tailThread = std::thread(&ConvolutionReverb::tailThreadLoop, this);
+    }
+}
+
+void ConvolutionReverb::release() {
+    if (tailThreadRunning) {
+        tailThreadRunning = false;
+        tailCondition.notify_one();
+        tailThread.join();
+    }
+    for (auto& ir : impulseResponses)
+        ir.reset();
+    impulseResponseCount = 0;
+    fft.reset();
+}
+
+int ConvolutionReverb::addImpulseResponse(const ImpulseResponse& impulseResponse, float wetLevel) {
+    int index = impulseResponseCount.load();
+    if (!fft || index >= MAX_IMPULSE_RESPONSES || impulseResponse.getLength() == 0) {
+        std::cout << "ConvolutionReverb: Can't add impulse response " << impulseResponse.name << '\n';
+        return -1;
+    }
+    // resample to the mixer rate
+    int channels = std::min(impulseResponse.channels, MAX_OUTPUT_CHANNELS);
+    double rateRatio = (double)impulseResponse.sampleRate / sampleRate;
+    int length = (int)(impulseResponse.getLength() / rateRatio);
+    if (length > maxPartitions * blockSize) {
+        std::cout << "ConvolutionReverb: Impulse response " << impulseResponse.name << " is truncated to "
+            << (float)maxPartitions * blockSize / sampleRate << " seconds\n";
+        length = maxPartitions * blockSize;
+    }
+    std::vector<float> samples((size_t)length * channels);
+    for (int i = 0; i < length; i++) {
+        double position = i * rateRatio;
+        int i0 = std::min((int)position, impulseResponse.getLength() - 1), i1 = std::min(i0 + 1, impulseResponse.getLength() - 1);
+        float t = (float)(position - i0);
+        for (int c = 0; c < channels; c++)
+            samples[(size_t)i * channels + c] = impulseResponse.samples[(size_t)i0 * impulseResponse.channels + c] * (1.0f - t)
+                + impulseResponse.samples[(size_t)i1 * impulseResponse.channels + c] * t;
+    }
+
+    // each partition's spectrum is the FFT of blockSize IR samples padded with zeros
+    std::unique_ptr<PartitionedIR> partitioned(new PartitionedIR());
+    partitioned->channels = channels;
+    partitioned->partitions = (length + blockSize - 1) / blockSize;
+    partitioned->wetLevel = wetLevel;
+    partitioned->spectra.assign((size_t)channels * partitioned->partitions * 2 * binStride, 0.0f);
+    // the mixer thread uses the reverb's FFT
+    RealFFT irFFT(fftSize);
+    std::vector<float> window(fftSize);
+    for (int c = 0; c < channels; c++)
+        for (int p = 0; p < partitioned->partitions; p++) {
+            std::fill(window.begin(), window.end(), 0.0f);
+            for (int i = 0; i < blockSize && p * blockSize + i < length; i++)
+                window[i] = samples[((size_t)p * blockSize + i) * channels + c];
+            float* spectrum = const_cast<float*>(irSpectrum(*partitioned, c, p));
+            irFFT.forward(window.data(), spectrum, spectrum + binStride);
+        }
+    impulseResponses[index] = std::move(partitioned);
+    impulseResponseCount.store(index + 1, std::memory_order_release);
+    return index;
+}
+
+void ConvolutionReverb::setImpulseResponse(int index) {
+    requestedImpulseResponse = index;
+}
+
+void ConvolutionReverb::setCrossfadeTime(float seconds) {
+    crossfadeBlocks = std::max(1, (int)(seconds * sampleRate / std::max(1, blockSize)));
+}
+
+void ConvolutionReverb::process(const float* input, float* output, unsigned int length, int inChannels, int outChannels) {
+    auto start = std::chrono::steady_clock::now();
+    float inputScale = 1.0f / std::max(1, inChannels);
+    for (unsigned int i = 0; i < length; i++) {
+        float sum = 0.0f;
+        for (int c = 0; c < inChannels; c++)
+            sum += input[i * inChannels + c];
+        // the output lags the input by one block, the block being filled is convolved once it is complete
+        const float* wet = &outputBlock[(size_t)blockFill * MAX_OUTPUT_CHANNELS];
+        float* out = output + (size_t)i * outChannels;
+        for (int c = 0; c < outChannels; c++)
+            out[c] = c < MAX_OUTPUT_CHANNELS ? wet[c] : 0.0f;
+        inputBlock[blockFill] = sum * inputScale;
+        if (++blockFill == blockSize) {
+            processBlock();
+            blockFill = 0;
+        }
+    }
+    mixNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool ConvolutionReverb::isRungOut() const {
+    // once this many blocks are silent, every input spectrum and tail sum is zero
+    return silentBlocks > (unsigned long long)(fdlSize + 2 * blocksPerTailJob);
+}
+
+void ConvolutionReverb::processBlock() {
+    unsigned long long block = blockIndex;
+    bool silent = true;
+    for (float sample : inputBlock)
+        if (std::abs(sample) > 1e-9f) {
+            silent = false;
+            break;
+        }
+    silentBlocks = silent ? silentBlocks + 1 : 0;
+
+    bool jobStart = block % blocksPerTailJob == 0;
+    if (jobStart) {
+        if (block == 0)
+            jobIRs[0] = nextJobIRs(JobIRs(), 0);
+        else
+            waitForTailJob(block);
+    }
+
+    // overlap-save: the FFT window is the previous and the new block
+    std::memmove(inputWindow.data(), inputWindow.data() + blockSize, blockSize * sizeof(float));
+    std::memcpy(inputWindow.data() + blockSize, inputBlock.data(), blockSize * sizeof(float));
+    float* spectrum = fdlSpectrum(block);
+    fft->forward(inputWindow.data(), spectrum, spectrum + binStride);
+
+    if (jobStart) {
+        unsigned long long nextJob = block + blocksPerTailJob;
+        jobIRs[(nextJob / blocksPerTailJob) % 2] = nextJobIRs(jobIRs[(block / blocksPerTailJob) % 2], nextJob);
+        postTailJob(nextJob);
+    }
+
+    const JobIRs& irs = jobIRs[(block / blocksPerTailJob) % 2];
+    activeImpulseResponse = irs.currentIndex;
+    std::fill(outputBlock.begin(), outputBlock.end(), 0.0f);
+    for (int slot = 0; slot < 2; slot++) {
+        const PartitionedIR* ir = slot == 0 ? irs.current : irs.previous;
+        if (!ir)
+            continue;
+        // equal power crossfade, the IRs are uncorrelated
+        float fadeStart = 0.0f, fadeStep = 0.0f;
+        if (irs.crossfading) {
+            fadeStart = (float)(block - irs.crossfadeStartBlock) / crossfadeBlocks;
+            fadeStep = 1.0f / ((float)crossfadeBlocks * blockSize);
+        }
+        float* out = outputBlock.data();
+        for (int c = 0; c < ir->channels; c++) {
+            convolveHead(*ir, slot, c, timeScratch.data());
+            const float* wet = timeScratch.data() + blockSize;
+            for (int i = 0; i < blockSize; i++) {
+                float gain = ir->wetLevel;
+                if (irs.crossfading) {
+                    float t = std::min(1.0f, fadeStart + i * fadeStep);
+                    gain *= slot == 0 ? std::sin(t * 0.5f * PI) : std::cos(t * 0.5f * PI);
+                }
+                out[i * MAX_OUTPUT_CHANNELS + c] += gain * wet[i];
+                // mono IRs feed both outputs
+                if (ir->channels == 1)
+                    out[i * MAX_OUTPUT_CHANNELS + 1] += gain * wet[i];
+            }
+        }
+    }
+    blockIndex++;
+    statBlocks++;
+}
+
+void ConvolutionReverb::convolveHead(const PartitionedIR& ir, int irSlot, int channel, float* timeOut) {
+    float* acc = accumulator.data();
+    std::memcpy(acc, tailSum(blockIndex, irSlot, channel), 2 * binStride * sizeof(float));
+    int head = (int)std::min<unsigned long long>(std::min(headPartitions, ir.partitions), blockIndex + 1);
+    for (int p = 0; p < head; p++)
+        complexMultiplyAccumulate(acc, fdlSpectrum(blockIndex - p), irSpectrum(ir, channel, p), binStride);
+    fft->inverse(acc, acc + binStride, timeOut);
+}
+
+void ConvolutionReverb::runTailJob(unsigned long long firstBlock) {
+    const JobIRs& irs = jobIRs[(firstBlock / blocksPerTailJob) % 2];
+    for (unsigned long long block = firstBlock; block < firstBlock + blocksPerTailJob; block++)
+        for (int slot = 0; slot < 2; slot++) {
+            const PartitionedIR* ir = slot == 0 ? irs.current : irs.previous;
+            if (!ir)
+                continue;
+            for (int c = 0; c < ir->channels; c++) {
+                float* acc = tailSum(block, slot, c);
+                std::fill(acc, acc + 2 * binStride, 0.0f);
+                // blocks before the first one are silent
+                int last = (int)std::min<unsigned long long>(ir->partitions - 1, block);
+                for (int p = headPartitions; p <= last; p++)
+                    complexMultiplyAccumulate(acc, fdlSpectrum(block - p), irSpectrum(*ir, c, p), binStride);
+            }
+        }
+}
+
+void ConvolutionReverb::postTailJob(unsigned long long firstBlock) {
+    if (!tailThreadRunning) {
+        auto start = std::chrono::steady_clock::now();
+        runTailJob(firstBlock);
+        tailNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        statTailJobs++;
+        return;
+    }
+    postedTailJob.store(firstBlock + 1, std::memory_order_release);
+    tailCondition.notify_one();
+}
+
+void ConvolutionReverb::waitForTailJob(unsigned long long firstBlock) {
+    if (!tailThreadRunning || finishedTailJob.load(std::memory_order_acquire) == firstBlock + 1)
+        return;
+    statLateTailJobs++;
+    while (finishedTailJob.load(std::memory_order_acquire) != firstBlock + 1)
+        std::this_thread::yield();
+}
+
+void ConvolutionReverb::tailThreadLoop() {
+    unsigned long long finished = 0;
+    while (tailThreadRunning) {
+        unsigned long long posted = postedTailJob.load(std::memory_order_acquire);
+        if (posted == finished) {
+            // the mixer doesn't lock the mutex when it posts a job, so a missed wake up only costs the timeout
+            std::unique_lock<std::mutex> lock(tailMutex);
+            tailCondition.wait_for(lock, std::chrono::milliseconds(1),
+                [&]() { return !tailThreadRunning || postedTailJob.load(std::memory_order_acquire) != finished; });
+            continue;
+        }
+        auto start = std::chrono::steady_clock::now();
+        runTailJob(posted - 1);
+        tailNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        statTailJobs++;
+        finished = posted;
+        finishedTailJob.store(posted, std::memory_order_release);
+    }
+}
+
+ConvolutionReverb::JobIRs ConvolutionReverb::nextJobIRs(const JobIRs& current, unsigned long long firstBlock) {
+    JobIRs next = current;
+    if (next.crossfading && firstBlock >= next.crossfadeStartBlock + crossfadeBlocks) {
+        next.crossfading = false;
+        next.previous = nullptr;
+    }
+    // a new IR is only faded in once the previous crossfade is done
+    int requested = requestedImpulseResponse.load();
+    if (requested >= impulseResponseCount.load(std::memory_order_acquire))
+        requested = -1;
+    if (requested != next.currentIndex && !next.crossfading) {
+        next.previous = next.current;
+        next.current = requested >= 0 ? impulseResponses[requested].get() : nullptr;
+        next.currentIndex = requested;
+        next.crossfading = true;
+        next.crossfadeStartBlock = firstBlock;
+        statCrossfades++;
+    }
+    return next;
+}
+
+FMOD::DSP* ConvolutionReverb::createDSP(FMOD::System* system) {
+    FMOD_DSP_DESCRIPTION description;
+    memset(&description, 0, sizeof(description));
+    description.pluginsdkversion = FMOD_PLUGIN_SDK_VERSION;
+    strncpy(description.name, "Convolution Reverb", sizeof(description.name) - 1);
+    description.version = 0x00010000;
+    description.numinputbuffers = 1;
+    description.numoutputbuffers = 1;
+    description.read = dspRead;
+    description.shouldiprocess = dspShouldIProcess;
+    description.userdata = this;
+    FMOD::DSP* dsp = nullptr;
+    ERRCHECK(system->createDSP(&description, &dsp));
+    return dsp;
+}
+
+FMOD_RESULT F_CALLBACK ConvolutionReverb::dspRead(FMOD_DSP_STATE* dspState, float* inBuffer, float* outBuffer, unsigned int length, int inChannels, int* outChannels) {
+    void* userData = nullptr;
+    FMOD_DSP_GETUSERDATA(dspState, &userData);
+    ConvolutionReverb* reverb = (ConvolutionReverb*)userData;
+    if (!reverb->fft) {
+        memset(outBuffer, 0, length * *outChannels * sizeof(float));
+        return FMOD_OK;
+    }
+    reverb->process(inBuffer, outBuffer, length, inChannels, *outChannels);
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_CALLBACK ConvolutionReverb::dspShouldIProcess(FMOD_DSP_STATE* dspState, FMOD_BOOL inputsIdle, unsigned int length, FMOD_CHANNELMASK inMask, int inChannels, FMOD_SPEAKERMODE speakerMode) {
+    void* userData = nullptr;
+    FMOD_DSP_GETUSERDATA(dspState, &userData);
+    ConvolutionReverb* reverb = (ConvolutionReverb*)userData;
+    // nothing is sent to the reverb and its tail has died out, so FMOD can skip it and output silence
+    if (inputsIdle && reverb->isRungOut()) {
+        reverb->statIdleCallbacks++;
+        return FMOD_ERR_DSP_DONTPROCESS;
+    }
+    return FMOD_OK;
+}
+
+ConvolutionReverbStats ConvolutionReverb::getStats() {
+    ConvolutionReverbStats stats;
+    stats.impulseResponses = impulseResponseCount;
+    stats.currentImpulseResponse = activeImpulseResponse;
+    stats.blockSize = blockSize;
+    stats.partitions = maxPartitions;
+    stats.headPartitions = headPartitions;
+    stats.blocks = statBlocks;
+    stats.tailJobs = statTailJobs;
+    stats.lateTailJobs = statLateTailJobs;
+    stats.crossfades = statCrossfades;
+    stats.idleCallbacks = statIdleCallbacks;
+    if (stats.blocks > 0) {
+        stats.mixMSPerBlock = (float)(mixNanoseconds / 1e6 / stats.blocks);
+        stats.tailMSPerBlock = (float)(tailNanoseconds / 1e6 / stats.blocks);
+    }
+    return stats;
+}
+
+void ConvolutionReverb::printStats() {
+    ConvolutionReverbStats stats = getStats();
+    std::cout << "Convolution Reverb: IR " << stats.currentImpulseResponse << " of " << stats.impulseResponses << ", "
+        << stats.blocks << " blocks of " << stats.blockSize << ", " << stats.headPartitions << " head / " << stats.partitions
+        << " partitions, " << std::fixed << std::setprecision(3) << stats.mixMSPerBlock << " ms mixer + " << stats.tailMSPerBlock
+        << " ms worker per block, " << stats.tailJobs << " tail jobs (" << stats.lateTailJobs << " late), " << stats.crossfades
+        << " crossfades, " << stats.idleCallbacks << " idle callbacks\n" << std::defaultfloat;
+}
+
+void ConvolutionReverb::runBenchmark(int sampleRate) {
+    const int CALLBACK_LENGTH = 1024;
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+
+    // check against direct convolution of a short IR, delayed by the reverb's one block of latency
+    {
+        ImpulseResponseSettings settings;
+        settings.decaySeconds = 0.1f;
+        ImpulseResponse ir = ImpulseResponse::synthesize("check", settings, sampleRate);
+        ConvolutionReverb reverb;
+        reverb.init(sampleRate, 1.0f, DEFAULT_BLOCK_SIZE, DEFAULT_BLOCKS_PER_TAIL_JOB, true);
+        reverb.setCrossfadeTime(0.0f);
+        reverb.setImpulseResponse(reverb.addImpulseResponse(ir));
+        int frames = 16 * CALLBACK_LENGTH;
+        std::vector<float> input((size_t)frames * 2), output((size_t)frames * 2);
+        for (float& sample : input)
+            sample = noise(random);
+        for (int i = 0; i < frames; i += CALLBACK_LENGTH)
+            reverb.process(&input[(size_t)i * 2], &output[(size_t)i * 2], CALLBACK_LENGTH, 2, 2);
+        double maxError = 0.0, maxValue = 0.0;
+        // the first output samples are faded in
+        for (int i = reverb.crossfadeBlocks * DEFAULT_BLOCK_SIZE + DEFAULT_BLOCK_SIZE; i < frames; i++)
+            for (int c = 0; c < 2; c++) {
+                double expected = 0.0;
+                for (int j = 0; j < ir.getLength() && j <= i - DEFAULT_BLOCK_SIZE; j++) {
+                    int n = i - DEFAULT_BLOCK_SIZE - j;
+                    expected += 0.5 * (input[(size_t)n * 2] + input[(size_t)n * 2 + 1]) * ir.samples[(size_t)j * 2 + c];
+                }
+                maxError = std::max(maxError, std::abs(expected - output[(size_t)i * 2 + c]));
+                maxValue = std::max(maxValue, std::abs(expected));
+            }
+        std::cout << "Convolution reverb check: max error " << maxError << " of peak " << maxValue << '\n';
+    }
+
+    std::cout << "Convolution reverb benchmark: " << sampleRate << " Hz, " << DEFAULT_BLOCK_SIZE << " sample partitions, "
+        << CALLBACK_LENGTH << " sample callbacks, cost per second of audio\n";
+    const float IR_SECONDS[] = { 0.5f, 1.0f, 2.0f, 4.0f };
+    const int SECONDS = 5;
+    std::vector<float> input((size_t)CALLBACK_LENGTH * 2), output((size_t)CALLBACK_LENGTH * 2);
+    for (float irSeconds : IR_SECONDS)
+        for (int channels = 1; channels <= 2; channels++)
+            for (int threaded = 0; threaded < 2; threaded++) {
+                ImpulseResponseSettings settings;
+                settings.decaySeconds = irSeconds;
+                settings.preDelayMS = 0.0f;
+                ImpulseResponse ir = ImpulseResponse::synthesize("benchmark", settings, sampleRate);
+                if (channels == 1) {
+                    for (int i = 0; i < ir.getLength(); i++)
+                        ir.samples[i] = ir.samples[(size_t)i * 2];
+                    ir.samples.resize(ir.getLength());
+                    ir.channels = 1;
+                }
+                ConvolutionReverb reverb;
+                reverb.init(sampleRate, irSeconds, DEFAULT_BLOCK_SIZE, CALLBACK_LENGTH / DEFAULT_BLOCK_SIZE, threaded != 0);
+                reverb.setImpulseResponse(reverb.addImpulseResponse(ir));
+                int callbacks = SECONDS * sampleRate / CALLBACK_LENGTH;
+                for (int i = 0; i < callbacks; i++) {
+                    for (float& sample : input)
+                        sample = noise(random);
+                    reverb.process(input.data(), output.data(), CALLBACK_LENGTH, 2, 2);
+                    // the worker sums the tail while the mixer waits for its next callback, which isn't timed here
+                    while (threaded && reverb.finishedTailJob.load() != reverb.postedTailJob.load())
+                        std::this_thread::yield();
+                }
+                ConvolutionReverbStats stats = reverb.getStats();
+                double blocksPerSecond = (double)sampleRate / DEFAULT_BLOCK_SIZE;
+                double mixMS = stats.mixMSPerBlock * blocksPerSecond, tailMS = stats.tailMSPerBlock * blocksPerSecond;
+                // without the worker, the mixer's time includes the tail
+                double totalMS = threaded ? mixMS + tailMS : mixMS;
+                std::cout << std::fixed << std::setprecision(2) << "  IR " << irSeconds << " s (" << ir.getLength() / DEFAULT_BLOCK_SIZE + 1
+                    << " partitions), " << channels << " ch, " << (threaded ? "worker tail: " : "inline tail: ") << mixMS << " ms mixer"
+                    << (threaded ? " + " + std::to_string(tailMS).substr(0, 6) + " ms worker" : "") << ", " << totalMS / channels
+                    << " ms per channel, " << totalMS / 10.0 << "% of a core, " << stats.lateTailJobs << " late tail jobs\n" << std::defaultfloat;
+            }
+}
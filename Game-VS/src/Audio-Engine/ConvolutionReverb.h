@@ -0,0 +1,261 @@
+#pragma once
+///
+/// @file ConvolutionReverb.h
+///
+/// Convolution reverb run as a custom FMOD DSP. Sounds are convolved with recorded or synthesized impulse responses
+/// (IRs) of the spaces around the listener, using uniformly partitioned FFT convolution (overlap-save):
+///  - The IR is split into partitions of BLOCK samples, and the spectrum of each partition is computed once when the
+///    IR is added. Each block of input is transformed once, kept in a frequency-domain delay line (FDL), and the
+///    output spectrum is the sum of the FDL spectra times the IR partition spectra, a complex multiply-accumulate
+///    done with SSE.
+///  - The first partitions (the head) are summed in the mixer callback. The rest (the tail) only need input that
+///    arrived at least one callback ago, so a worker thread sums them for the next callback while this one mixes.
+///  - Switching IRs crossfades the outputs of the old and new IR, which share the FDL, so moving between reverb
+///    zones doesn't click.
+///
+#include <FMOD/fmod.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Parameters of a synthesized impulse response: early reflections followed by an exponentially decaying,
+ * darkening noise tail
+ */
+struct ImpulseResponseSettings {
+    // seconds for the tail to decay by 60 dB (RT60)
+    float decaySeconds = 1.5f;
+    // delay before the first reflection
+    float preDelayMS = 10.0f;
+    // discrete early reflections, spread over earlyReflectionsMS after the pre-delay
+    int earlyReflections = 8;
+    float earlyReflectionsMS = 40.0f;
+    float earlyReflectionsLevel = 0.5f;
+    // how much faster high frequencies decay than low ones, 0 = not at all
+    float damping = 0.5f;
+    unsigned int seed = 1;
+};
+
+/**
+ * Impulse response of a space, with one (mono) or two (stereo) channels
+ */
+struct ImpulseResponse {
+    std::string name;
+    int channels = 0, sampleRate = 0;
+    std::vector<float> samples; // interleaved
+
+    int getLength() const { return channels > 0 ? (int)(samples.size() / channels) : 0; }
+
+    /**
+     * Reads a mono or stereo PCM/float wav file. Files with more channels keep their first two.
+     * @returns false if the file can't be read
+     */
+    bool loadWav(const char* filePath);
+
+    /**
+     * Creates a stereo impulse response whose channels have decorrelated tails
+     */
+    static ImpulseResponse synthesize(const char* name, const ImpulseResponseSettings& settings, int sampleRate);
+};
+
+/**
+ * Counters of a convolution reverb
+ */
+struct ConvolutionReverbStats {
+    int impulseResponses = 0, currentImpulseResponse = -1;
+    int blockSize = 0, partitions = 0, headPartitions = 0;
+    // totals since the reverb was created
+    unsigned long long blocks = 0, tailJobs = 0, crossfades = 0;
+    // tail jobs which weren't finished when the mixer needed them, so the mixer waited
+    unsigned long long lateTailJobs = 0;
+    // callbacks which were skipped because the input and the reverb tail were silent
+    unsigned long long idleCallbacks = 0;
+    // average milliseconds of mixer thread and worker thread time per block
+    float mixMSPerBlock = 0.0f, tailMSPerBlock = 0.0f;
+};
+
+class RealFFT;
+
+/**
+ * Uniformly partitioned FFT convolution reverb. Mono input, mono or stereo IRs, and up to two output channels.
+ * Its impulse responses are added up front and selected by index; process() may run on another thread meanwhile.
+ */
+class ConvolutionReverb {
+public:
+    // samples per partition; the FFT size is twice as large. The reverb adds one block of latency.
+    static const int DEFAULT_BLOCK_SIZE = 256;
+    // blocks per tail job, which should match the mixer's buffer size (1024 samples by default)
+    static const int DEFAULT_BLOCKS_PER_TAIL_JOB = 4;
+    static const int MAX_IMPULSE_RESPONSES = 8;
+    static const int MAX_OUTPUT_CHANNELS = 2;
+
+    ConvolutionReverb();
+    ~ConvolutionReverb();
+    ConvolutionReverb(const ConvolutionReverb&) = delete;
+    ConvolutionReverb& operator=(const ConvolutionReverb&) = delete;
+
+    /**
+     * Allocates the reverb's buffers, and starts the tail worker thread
+     * @param maxImpulseResponseSeconds - longer impulse responses are truncated
+     * @param threadedTail - if false, the tail partitions are summed in the callback, e.g. for comparison
+     */
+    void init(int sampleRate, float maxImpulseResponseSeconds, int blockSize = DEFAULT_BLOCK_SIZE,
+        int blocksPerTailJob = DEFAULT_BLOCKS_PER_TAIL_JOB, bool threadedTail = true);
+
+    /**
+     * Stops the worker thread and releases the buffers
+     */
+    void release();
+
+    /**
+     * Partitions an impulse response and computes the spectra of its partitions. IRs with another sample rate are
+     * resampled. Safe to call while process() runs on another thread, since the IR is only published once it is built.
+     * @param wetLevel - output gain of the IR, to balance IRs of different loudness
+     * @returns the IR index for setImpulseResponse(), or -1 if MAX_IMPULSE_RESPONSES IRs were added
+     */
+    int addImpulseResponse(const ImpulseResponse& impulseResponse, float wetLevel = 1.0f);
+
+    /**
+     * Crossfades to an impulse response, or to silence with -1. Takes effect at the start of the next tail job.
+     */
+    void setImpulseResponse(int index);
+
+    /**
+     * Sets the length of crossfades between impulse responses
+     */
+    void setCrossfadeTime(float seconds);
+
+    /**
+     * Convolves interleaved input. The input channels are mixed to mono, and the IR channels are written to the
+     * first two output channels, the other output channels are silent.
+     */
+    void process(const float* input, float* output, unsigned int length, int inChannels, int outChannels);
+
+    /**
+     * Returns true once the input has been silent long enough for the reverb tail to have died out, so the
+     * reverb can be skipped until the input starts again
+     */
+    bool isRungOut() const;
+
+    /**
+     * Creates an FMOD DSP that runs this reverb. The reverb must outlive the DSP.
+     */
+    FMOD::DSP* createDSP(FMOD::System* system);
+
+    ConvolutionReverbStats getStats();
+
+    /**
+     * Prints the reverb's counters to the console
+     */
+    void printStats();
+
+    /**
+     * Measures the cost of convolving one second of stereo input into one and two output channels, for a range
+     * of IR lengths, with and without the tail worker thread, and prints the results to the console.
+     * Also checks the output against direct convolution.
+     */
+    static void runBenchmark(int sampleRate = 44100);
+
+private:
+    // Spectra of the partitions of an impulse response, [channel][partition][spectrum]
+    struct PartitionedIR {
+        int channels = 0, partitions = 0;
+        float wetLevel = 1.0f;
+        std::vector<float> spectra;
+    };
+    // Impulse responses used by the blocks of one tail job. During a crossfade both IRs are convolved.
+    struct JobIRs {
+        const PartitionedIR* current = nullptr;
+        const PartitionedIR* previous = nullptr;
+        int currentIndex = -1;
+        bool crossfading = false;
+        unsigned long long crossfadeStartBlock = 0;
+    };
+
+    int sampleRate = 44100;
+    int blockSize = 0, fftSize = 0;
+    // floats per real or imaginary half of a spectrum: blockSize + 1 bins, padded to a multiple of 8 for SIMD
+    int binStride = 0;
+    int maxPartitions = 0, headPartitions = 0, blocksPerTailJob = 0, fdlSize = 0;
+    std::unique_ptr<RealFFT> fft;
+
+    std::unique_ptr<PartitionedIR> impulseResponses[MAX_IMPULSE_RESPONSES];
+    std::atomic<int> impulseResponseCount{ 0 };
+    std::atomic<int> requestedImpulseResponse{ -1 };
+    int crossfadeBlocks = 1;
+
+    // Mixer thread state
+    std::vector<float> fdl;              // fdlSize input spectra, block k is at k % fdlSize
+    std::vector<float> inputWindow;      // the last two input blocks, which each FFT transforms
+    std::vector<float> inputBlock;       // mono input gathered until a block is complete
+    std::vector<float> outputBlock;      // output of the latest block, MAX_OUTPUT_CHANNELS interleaved
+    std::vector<float> accumulator, timeScratch;
+    int blockFill = 0;
+    unsigned long long blockIndex = 0;
+    unsigned long long silentBlocks = 0;
+    JobIRs jobIRs[2];
+    std::atomic<int> activeImpulseResponse{ -1 };
+
+    // Tail sums of the blocks of the two most recent tail jobs, [job % 2][block][IR][channel][spectrum]
+    std::vector<float> tailSums;
+    std::thread tailThread;
+    std::mutex tailMutex;
+    std::condition_variable tailCondition;
+    std::atomic<bool> tailThreadRunning{ false };
+    bool threadedTail = true;
+    // first block of the latest posted tail job, and of the latest finished one, + 1 so 0 means none
+    std::atomic<unsigned long long> postedTailJob{ 0 }, finishedTailJob{ 0 };
+
+    // counters, written on the mixer and worker threads
+    std::atomic<unsigned long long> statBlocks{ 0 }, statTailJobs{ 0 }, statLateTailJobs{ 0 }, statCrossfades{ 0 }, statIdleCallbacks{ 0 };
+    std::atomic<unsigned long long> mixNanoseconds{ 0 }, tailNanoseconds{ 0 };
+
+    // spectrum offsets
+    float* fdlSpectrum(unsigned long long block) { return &fdl[(size_t)(block % fdlSize) * 2 * binStride]; }
+    const float* irSpectrum(const PartitionedIR& ir, int channel, int partition) const {
+        return &ir.spectra[((size_t)channel * ir.partitions + partition) * 2 * binStride];
+    }
+    float* tailSum(unsigned long long block, int irSlot, int channel) {
+        size_t job = (size_t)(block / blocksPerTailJob) % 2, blockInJob = (size_t)(block % blocksPerTailJob);
+        return &tailSums[(((job * blocksPerTailJob + blockInJob) * 2 + irSlot) * MAX_OUTPUT_CHANNELS + channel) * 2 * binStride];
+    }
+
+    /**
+     * Convolves the complete input block
+     */
+    void processBlock();
+
+    /**
+     * Sums the head partitions of an IR channel onto its tail sum, and transforms the result to the output
+     */
+    void convolveHead(const PartitionedIR& ir, int irSlot, int channel, float* timeOut);
+
+    /**
+     * Sums the tail partitions of the blocks of a tail job
+     */
+    void runTailJob(unsigned long long firstBlock);
+
+    /**
+     * Hands the next tail job to the worker, or runs it right away without the worker
+     */
+    void postTailJob(unsigned long long firstBlock);
+
+    /**
+     * Waits until the tail job of a block has finished
+     */
+    void waitForTailJob(unsigned long long firstBlock);
+
+    void tailThreadLoop();
+
+    /**
+     * Selects the IRs of the next tail job's blocks, starting a crossfade if a new IR was requested
+     */
+    JobIRs nextJobIRs(const JobIRs& current, unsigned long long firstBlock);
+
+    static FMOD_RESULT F_CALLBACK dspRead(FMOD_DSP_STATE* dspState, float* inBuffer, float* outBuffer, unsigned int length, int inChannels, int* outChannels);
+    static FMOD_RESULT F_CALLBACK dspShouldIProcess(FMOD_DSP_STATE* dspState, FMOD_BOOL inputsIdle, unsigned int length, FMOD_CHANNELMASK inMask, int inChannels, FMOD_SPEAKERMODE speakerMode);
+};
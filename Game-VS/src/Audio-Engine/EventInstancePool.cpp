@@ -0,0 +1,199 @@
+///
+/// @file EventInstancePool.cpp
+///
+#include "EventInstancePool.h"
+#include "AudioEngine.h"
+#include <algorithm>
+
+void EventInstancePool::init(FMOD::Studio::EventDescription* eventDescription, int capacity, bool stealOldest) {
+    this->eventDescription = eventDescription;
+    this->stealOldest = stealOldest;
+    capacity = std::max(1, std::min(capacity, 1 << SLOT_BITS));
+    ERRCHECK(eventDescription->loadSampleData());
+    slots.resize(capacity);
+    freeSlots.reserve(capacity);
+    activeSlots.reserve(capacity);
+    // free slots are taken from the back, so the first instances are used first
+    for (int i = capacity - 1; i >= 0; i--) {
+        ERRCHECK(eventDescription->createInstance(&slots[i].instance));
+        freeSlots.push_back(i);
+    }
+    stats.capacity = capacity;
+}
+
+void EventInstancePool::release() {
+    for (Slot& slot : slots)
+        if (slot.instance) {
+            ERRCHECK(slot.instance->stop(FMOD_STUDIO_STOP_IMMEDIATE));
+            ERRCHECK(slot.instance->release());
+        }
+    slots.clear();
+    freeSlots.clear();
+    activeSlots.clear();
+}
+
+int EventInstancePool::start(const FMOD_3D_ATTRIBUTES* attributes, float volume) {
+    if (slots.empty())
+        return -1;
+    if (freeSlots.empty()) {
+        if (!stealOldest) {
+            stats.rejected++;
+            return -1;
+        }
+        // the instance's slot is reused right away, its old ID becomes stale
+        auto oldest = std::min_element(activeSlots.begin(), activeSlots.end(),
+            [this](int a, int b) { return slots[a].startCount < slots[b].startCount; });
+        int stolen = *oldest;
+        ERRCHECK(slots[stolen].instance->stop(FMOD_STUDIO_STOP_IMMEDIATE));
+        deactivate(stolen);
+        stats.stolen++;
+    }
+    int slotIndex = freeSlots.back();
+    freeSlots.pop_back();
+    Slot& slot = slots[slotIndex];
+    slot.active = true;
+    slot.seenPlaying = false;
+    slot.updatesSinceStart = 0;
+    slot.startCount = ++stats.started;
+    activeSlots.push_back(slotIndex);
+    stats.active = (int)activeSlots.size();
+    stats.peakActive = std::max(stats.peakActive, stats.active);
+
+    applyDefaults(slot.instance);
+    if (volume != 1.0f)
+        ERRCHECK(slot.instance->setVolume(defaultVolume * volume));
+    if (attributes)
+        ERRCHECK(slot.instance->set3DAttributes(attributes));
+    ERRCHECK(slot.instance->start());
+    return makeID(slotIndex);
+}
+
+bool EventInstancePool::restart(int instanceID) {
+    Slot* slot = findSlot(instanceID);
+    if (!slot)
+        return false;
+    slot->startCount = ++stats.started;
+    slot->seenPlaying = false;
+    slot->updatesSinceStart = 0;
+    ERRCHECK(slot->instance->start());
+    return true;
+}
+
+void EventInstancePool::stop(int instanceID, bool allowFadeOut) {
+    if (Slot* slot = findSlot(instanceID))
+        ERRCHECK(slot->instance->stop(allowFadeOut ? FMOD_STUDIO_STOP_ALLOWFADEOUT : FMOD_STUDIO_STOP_IMMEDIATE));
+}
+
+void EventInstancePool::stopAll(bool allowFadeOut) {
+    for (int slot : activeSlots)
+        ERRCHECK(slots[slot].instance->stop(allowFadeOut ? FMOD_STUDIO_STOP_ALLOWFADEOUT : FMOD_STUDIO_STOP_IMMEDIATE));
+}
+
+void EventInstancePool::set3DAttributes(int instanceID, const FMOD_3D_ATTRIBUTES& attributes) {
+    if (Slot* slot = findSlot(instanceID))
+        ERRCHECK(slot->instance->set3DAttributes(&attributes));
+}
+
+void EventInstancePool::setParameter(int instanceID, const char* parameterName, float value) {
+    if (Slot* slot = findSlot(instanceID))
+        ERRCHECK(slot->instance->setParameterByName(parameterName, value));
+}
+
+void EventInstancePool::setParameter(int instanceID, FMOD_STUDIO_PARAMETER_ID parameterID, float value) {
+    if (Slot* slot = findSlot(instanceID))
+        ERRCHECK(slot->instance->setParameterByID(parameterID, value));
+}
+
+void EventInstancePool::setDefaultParameter(const char* parameterName, float value) {
+    FMOD_STUDIO_PARAMETER_ID parameterID;
+    if (!getParameterID(parameterName, parameterID)) {
+        std::cout << "EventInstancePool: Event has no parameter " << parameterName << '\n';
+        return;
+    }
+    auto parameter = std::find_if(defaultParameters.begin(), defaultParameters.end(), [&](const std::pair<FMOD_STUDIO_PARAMETER_ID, float>& p) {
+        return p.first.data1 == parameterID.data1 && p.first.data2 == parameterID.data2;
+    });
+    if (parameter != defaultParameters.end())
+        parameter->second = value;
+    else
+        defaultParameters.push_back({ parameterID, value });
+    for (int slot : activeSlots)
+        ERRCHECK(slots[slot].instance->setParameterByID(parameterID, value));
+}
+
+void EventInstancePool::setVolume(int instanceID, float volume) {
+    if (Slot* slot = findSlot(instanceID))
+        ERRCHECK(slot->instance->setVolume(volume));
+}
+
+void EventInstancePool::setDefaultVolume(float volume) {
+    defaultVolume = volume;
+    for (int slot : activeSlots)
+        ERRCHECK(slots[slot].instance->setVolume(volume));
+}
+
+bool EventInstancePool::getParameterID(const char* parameterName, FMOD_STUDIO_PARAMETER_ID& parameterID) {
+    FMOD_STUDIO_PARAMETER_DESCRIPTION description;
+    if (!eventDescription || eventDescription->getParameterDescriptionByName(parameterName, &description) != FMOD_OK)
+        return false;
+    parameterID = description.id;
+    return true;
+}
+
+bool EventInstancePool::isPlaying(int instanceID) {
+    if (instanceID == -1)
+        return !activeSlots.empty();
+    Slot* slot = findSlot(instanceID);
+    if (!slot)
+        return false;
+    FMOD_STUDIO_PLAYBACK_STATE playbackState;
+    ERRCHECK(slot->instance->getPlaybackState(&playbackState));
+    return playbackState != FMOD_STUDIO_PLAYBACK_STOPPED;
+}
+
+void EventInstancePool::update() {
+    for (size_t i = 0; i < activeSlots.size(); ) {
+        int slotIndex = activeSlots[i];
+        Slot& slot = slots[slotIndex];
+        FMOD_STUDIO_PLAYBACK_STATE playbackState = FMOD_STUDIO_PLAYBACK_STOPPED;
+        ERRCHECK(slot.instance->getPlaybackState(&playbackState));
+        if (playbackState != FMOD_STUDIO_PLAYBACK_STOPPED)
+            slot.seenPlaying = true;
+        slot.updatesSinceStart++;
+        if (playbackState == FMOD_STUDIO_PLAYBACK_STOPPED && (slot.seenPlaying || slot.updatesSinceStart > START_TIMEOUT_UPDATES)) {
+            deactivate(slotIndex);
+            stats.recycled++;
+        }
+        else
+            i++;
+    }
+}
+
+void EventInstancePool::printStats(const char* eventName) {
+    std::cout << "Event Pool " << eventName << ": " << stats.active << " / " << stats.capacity << " active, " << stats.peakActive
+        << " peak, " << stats.started << " started, " << stats.recycled << " recycled, " << stats.stolen << " stolen, "
+        << stats.rejected << " rejected\n";
+}
+
+EventInstancePool::Slot* EventInstancePool::findSlot(int instanceID) {
+    int slotIndex = instanceID & ((1 << SLOT_BITS) - 1);
+    if (instanceID < 0 || slotIndex >= (int)slots.size() || makeID(slotIndex) != instanceID || !slots[slotIndex].active)
+        return nullptr;
+    return &slots[slotIndex];
+}
+
+void EventInstancePool::applyDefaults(FMOD::Studio::EventInstance* instance) {
+    for (const auto& parameter : defaultParameters)
+        ERRCHECK(instance->setParameterByID(parameter.first, parameter.second));
+    ERRCHECK(instance->setVolume(defaultVolume));
+}
+
+void EventInstancePool::deactivate(int slotIndex) {
+    Slot& slot = slots[slotIndex];
+    slot.active = false;
+    // IDs handed out for this use of the slot no longer match
+    slot.generation = (slot.generation + 1) & 0x7FFF;
+    activeSlots.erase(std::find(activeSlots.begin(), activeSlots.end(), slotIndex));
+    freeSlots.push_back(slotIndex);
+    stats.active = (int)activeSlots.size();
+}
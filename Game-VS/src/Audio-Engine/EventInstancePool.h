@@ -0,0 +1,149 @@
+#pragma once
+///
+/// @file EventInstancePool.h
+///
+/// Pools of FMOD Studio event instances. Each pool creates its instances when the event is loaded, and hands out
+/// stopped ones for every trigger, so an event can have many overlapping instances without createInstance/release
+/// churn. Instances are referred to by IDs that include a generation count, so the ID of a recycled instance is stale.
+///
+#include <FMOD/fmod_studio.hpp>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Counters of an event instance pool
+ */
+struct EventPoolStats {
+    int capacity = 0;
+    // instances started and not yet stopped, and the peak since the pool was created
+    int active = 0, peakActive = 0;
+    // totals since the pool was created
+    unsigned long long started = 0, recycled = 0, stolen = 0, rejected = 0;
+};
+
+/**
+ * Fixed capacity pool of the instances of one FMOD Studio event
+ */
+class EventInstancePool {
+public:
+    /**
+     * Creates the pool's instances, and loads the event's sample data so the first start doesn't wait for it
+     * @param capacity - max instances playing at the same time
+     * @param stealOldest - if true, starting an instance while all are playing stops the oldest one,
+     *                      otherwise the new instance is rejected
+     */
+    void init(FMOD::Studio::EventDescription* eventDescription, int capacity, bool stealOldest = true);
+
+    /**
+     * Releases the pool's instances
+     */
+    void release();
+
+    /**
+     * Starts a free instance
+     * @param attributes - 3D position of the instance, or nullptr for a 2D event
+     * @returns the instance ID, or -1 if all instances are playing and stealing is disabled
+     */
+    int start(const FMOD_3D_ATTRIBUTES* attributes = nullptr, float volume = 1.0f);
+
+    /**
+     * Restarts a specific instance, e.g. an instance that should only ever play once at a time
+     * @returns false if the instance ID is stale
+     */
+    bool restart(int instanceID);
+
+    /**
+     * Stops an instance. It returns to the pool once it has finished fading out.
+     */
+    void stop(int instanceID, bool allowFadeOut = true);
+
+    /**
+     * Stops every instance
+     */
+    void stopAll(bool allowFadeOut = true);
+
+    /**
+     * Sets the 3D position of a playing instance
+     */
+    void set3DAttributes(int instanceID, const FMOD_3D_ATTRIBUTES& attributes);
+
+    /**
+     * Sets a parameter of a playing instance. Looking up a parameter by ID avoids the name comparisons.
+     */
+    void setParameter(int instanceID, const char* parameterName, float value);
+    void setParameter(int instanceID, FMOD_STUDIO_PARAMETER_ID parameterID, float value);
+
+    /**
+     * Sets a parameter of every instance, including the ones started later
+     */
+    void setDefaultParameter(const char* parameterName, float value);
+
+    /**
+     * Sets the volume of a playing instance
+     */
+    void setVolume(int instanceID, float volume);
+
+    /**
+     * Sets the volume of every instance, including the ones started later
+     */
+    void setDefaultVolume(float volume);
+
+    /**
+     * Returns the ID of a parameter of the event, for setParameter()
+     * @returns false if the event has no such parameter
+     */
+    bool getParameterID(const char* parameterName, FMOD_STUDIO_PARAMETER_ID& parameterID);
+
+    /**
+     * Checks if an instance is playing, or any instance if instanceID is -1
+     */
+    bool isPlaying(int instanceID = -1);
+
+    /**
+     * Returns instances which have stopped to the pool. Must be called after FMOD Studio has updated.
+     */
+    void update();
+
+    const EventPoolStats& getStats() { return stats; }
+
+    /**
+     * Prints the pool counters to the console
+     */
+    void printStats(const char* eventName);
+
+private:
+    struct Slot {
+        FMOD::Studio::EventInstance* instance = nullptr;
+        int generation = 0;
+        bool active = false;
+        // Studio starts instances in its next update, so a STOPPED state only means finished once the instance
+        // was seen playing. Instances that are never seen playing, e.g. because they failed to start, time out.
+        bool seenPlaying = false;
+        int updatesSinceStart = 0;
+        // start order, for stealing the oldest instance
+        unsigned long long startCount = 0;
+    };
+
+    FMOD::Studio::EventDescription* eventDescription = nullptr;
+    std::vector<Slot> slots;
+    // indices of the slots which aren't active
+    std::vector<int> freeSlots;
+    // indices of the active slots, checked for stopped instances by update()
+    std::vector<int> activeSlots;
+    // parameter values and volume applied to every started instance, since recycled instances keep their old values
+    std::vector<std::pair<FMOD_STUDIO_PARAMETER_ID, float>> defaultParameters;
+    float defaultVolume = 1.0f;
+    bool stealOldest = true;
+    EventPoolStats stats;
+
+    // instance IDs are the slot index in the low 16 bits and the slot generation above them
+    static const int SLOT_BITS = 16;
+    // updates after which an instance that was never seen playing is recycled
+    static const int START_TIMEOUT_UPDATES = 30;
+    int makeID(int slot) { return (slots[slot].generation << SLOT_BITS) | slot; }
+    Slot* findSlot(int instanceID);
+    void applyDefaults(FMOD::Studio::EventInstance* instance);
+    void deactivate(int slot);
+};
@@ -1,6 +1,6 @@
 #pragma once
 #include "AudioEngine.h"
-#include "IndexRandomizer.h"
+#include "SoundContainer.h"
 #include "../GameData.h"
 
 /**
@@ -14,7 +14,7 @@ public:
 	 * @param audioEngine Shared audio engine used to load and play sounds. 
 	 *                    Must be initialized before passing into this constructor
 	 */
-	FootstepSoundController(std::shared_ptr<AudioEngine> audioEngine) : audioEngine(audioEngine), indexRandomizer(soundsFootsteps.size()) {
+	FootstepSoundController(std::shared_ptr<AudioEngine> audioEngine) : audioEngine(audioEngine), footsteps(audioEngine, SOUND_CONTAINER_SHUFFLE) {
 		init();
 	}
 
@@ -28,7 +28,8 @@ public:
 			this->currFrame = currFrame;
 			if (lastFootstepTime + footstepWaitingTIME < currFrame) {
 				// play the footstep sound effect
-				audioEngine->playSound(soundsFootsteps[indexRandomizer.getNextIndex()]);
+				footsteps.play(footstepInstance);
+				footstepCount++;
 				lastFootstepTime = currFrame; // track the last frame
 				// set the amount of time to wait before the next footstep
 				setFootstepTimeRandomely();
@@ -46,6 +47,20 @@ public:
 		setFootstepTimeRandomely();
 	}
 
+	/**
+	 * Sets the surface the player walks on, which selects the switch group of footstep sounds
+	 */
+	void setSurface(int surface) {
+		footstepInstance.switchValue = surface;
+	}
+
+	/**
+	 * Returns the number of footsteps played since the controller was created
+	 */
+	int getFootstepCount() {
+		return footstepCount;
+	}
+
 private:
 	std::shared_ptr<AudioEngine> audioEngine;
 
@@ -62,7 +77,7 @@ private:
 	// footstep default sound values
 	float footstepVolume = 0.3f, footstepReverb = 0.4f;
 
-	// the list of footstep sounds
+	// the footstep sounds of the square's ground surface
 	std::vector<SoundInfo> soundsFootsteps{
 		SoundInfo(SFX_FOOTSTEP1, footstepVolume, footstepReverb),
 		SoundInfo(SFX_FOOTSTEP2, footstepVolume, footstepReverb),
@@ -75,15 +90,27 @@ private:
 	};
 
 	/**
-	 * Loads the sound effects associated with this container and sets the first footstep audio file index.
+	 * Loads the sound effects associated with this container into the footstep sound container
 	 */
 	void init() {
-		for (SoundInfo sound : soundsFootsteps) 
-			audioEngine->loadSound(sound);		
+		// footsteps follow the key presses closely, so they skip the voice path. Shuffled sounds don't repeat
+		// back to back, so one primed channel per sound is enough.
+		footsteps.enableOneShotPools(1);
+		for (SoundInfo& sound : soundsFootsteps) {
+			sound.setCategory(SOUND_CATEGORY_FOOTSTEP);
+			footsteps.addSound(sound, SURFACE_GROUND);
+		}
+		// slight variation on every step, so repeated samples don't sound mechanical
+		footsteps.setVolumeRandomization(0.85f, 1.0f);
+		footsteps.setPitchRandomization(1.0f);
 	}
 
-	// Utility which generates a random index without repeating a specific index 
-	IndexRandomizer indexRandomizer;
+	// Surface switch values of the footstep container
+	static const int SURFACE_GROUND = 0;
+
+	// Plays a shuffled footstep without repeating recent ones, and the player's state in it
+	SoundContainer footsteps;
+	SoundContainerInstance footstepInstance = footsteps.createInstance(0x5EED1234u);
 	
 	// Footstep Timing information
 	const float MIN_FOOTSTEP_TIME_WALKING = 0.5f, MIN_FOOTSTEP_TIME_RUNNING = 0.25f;
@@ -91,6 +118,7 @@ private:
 	float lastFootstepTime = 0.0f;
 	float currFrame = 0.0f;
 	bool isRunning = false;
+	int footstepCount = 0;
 
 	/**
 	 * Sets the time to wait before playing the next footstep if the player continues moving.
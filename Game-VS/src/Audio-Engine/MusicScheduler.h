@@ -0,0 +1,312 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "AudioEngine.h"
+#include "SoundInfo.h"
+
+// Musical boundaries that scheduled music events are quantized to
+typedef enum {
+	MUSIC_QUANTIZE_IMMEDIATE, // as soon as the lookahead allows
+	MUSIC_QUANTIZE_BEAT,
+	MUSIC_QUANTIZE_BAR
+} MUSIC_QUANTIZE;
+
+/**
+ * Tempo and time signature changes of a music track, used to convert between beats and time in the track.
+ * Each section starts on a bar line and keeps its tempo until the next section.
+ */
+class TempoMap {
+public:
+	/**
+	 * Creates a tempo map with a single section from the start of the track
+	 */
+	TempoMap(float bpm, int beatsPerBar = 4) {
+		sections.push_back({ 0, 0.0, 0.0, bpm, beatsPerBar });
+	}
+
+	/**
+	 * Changes the tempo and time signature from a bar on. Sections must be added in bar order.
+	 */
+	void addSection(int startBar, float bpm, int beatsPerBar = 4) {
+		const Section& previous = sections.back();
+		double startBeat = previous.startBeat + (double)(startBar - previous.startBar) * previous.beatsPerBar;
+		double startSeconds = previous.startSeconds + (startBeat - previous.startBeat) * 60.0 / previous.bpm;
+		sections.push_back({ startBar, startBeat, startSeconds, bpm, beatsPerBar });
+	}
+
+	/**
+	 * Converts a beat position in the track to seconds from the start of the track
+	 */
+	double beatToSeconds(double beat) const {
+		const Section& section = findSectionByBeat(beat);
+		return section.startSeconds + (beat - section.startBeat) * 60.0 / section.bpm;
+	}
+
+	/**
+	 * Converts seconds from the start of the track to a beat position
+	 */
+	double secondsToBeat(double seconds) const {
+		const Section* section = &sections[0];
+		for (const Section& s : sections)
+			if (s.startSeconds <= seconds)
+				section = &s;
+		return section->startBeat + (seconds - section->startSeconds) * section->bpm / 60.0;
+	}
+
+	/**
+	 * Returns the first beat position at or after a beat position that lies on a boundary
+	 */
+	double nextBoundary(double beat, MUSIC_QUANTIZE quantize) const {
+		// tolerance so that a position computed from a boundary's sample clock is still on that boundary
+		const double epsilon = 1e-6;
+		if (quantize == MUSIC_QUANTIZE_IMMEDIATE)
+			return beat;
+		if (quantize == MUSIC_QUANTIZE_BEAT)
+			return std::ceil(beat - epsilon);
+		const Section& section = findSectionByBeat(beat);
+		double bar = std::ceil((beat - section.startBeat) / section.beatsPerBar - epsilon);
+		double boundary = section.startBeat + bar * section.beatsPerBar;
+		// a bar can't run past the next section, which starts on a bar line
+		for (const Section& s : sections)
+			if (s.startBeat > beat - epsilon && s.startBeat < boundary)
+				return s.startBeat;
+		return boundary;
+	}
+
+	/**
+	 * Returns the length of a beat, in seconds, at a beat position
+	 */
+	double getBeatSeconds(double beat) const {
+		return 60.0 / findSectionByBeat(beat).bpm;
+	}
+
+	/**
+	 * Returns the number of beats in the bar at a beat position
+	 */
+	int getBeatsPerBar(double beat) const {
+		return findSectionByBeat(beat).beatsPerBar;
+	}
+
+private:
+	struct Section {
+		int startBar;
+		double startBeat, startSeconds;
+		float bpm;
+		int beatsPerBar;
+	};
+	std::vector<Section> sections;
+
+	const Section& findSectionByBeat(double beat) const {
+		const Section* section = &sections[0];
+		for (const Section& s : sections)
+			if (s.startBeat <= beat)
+				section = &s;
+		return *section;
+	}
+};
+
+/**
+ * Class which schedules music on the audio engine's DSP clock, so layer starts, stops, fades and stingers land
+ * exactly on beats and bars no matter when the game thread asks for them.
+ *
+ * Each track has a tempo map, and is made of sound loops (layers) which all start on the same sample. Events are
+ * quantized to a boundary of the current track that is at least the lookahead in the future, which leaves the audio
+ * engine time to receive the event before the mixer reaches it. The actual start, stop and fade are then applied
+ * sample-accurately with Channel::setDelay and fade points.
+ */
+class MusicScheduler {
+public:
+	// Default time between a scheduling call and the earliest sample it may affect
+	static constexpr float DEFAULT_LOOKAHEAD_MS = 100.0f;
+
+	/**
+	 * Constructs a music scheduler
+	 * @param audioEngine Shared audio engine used to play the music. Must be initialized.
+	 */
+	MusicScheduler(std::shared_ptr<AudioEngine> audioEngine, float lookaheadMS = DEFAULT_LOOKAHEAD_MS)
+		: audioEngine(audioEngine), tracks() {
+		lookaheadSamples = (unsigned long long)(lookaheadMS / 1000.0f * AudioEngine::AUDIO_SAMPLE_RATE);
+	}
+
+	/**
+	 * Adds a track made of sound loops that play in sync. The loops must be loaded by the audio engine.
+	 * @returns the track index
+	 */
+	int addTrack(TempoMap tempoMap, std::vector<SoundInfo*> layers) {
+		tracks.push_back({ tempoMap, layers, 0, false });
+		return (int)tracks.size() - 1;
+	}
+
+	/**
+	 * Starts all layers of a track at the next boundary of the current track, or after the lookahead if no track
+	 * is playing. Layers start at their SoundInfo's volume. The started track becomes the current track.
+	 * @returns the DSP clock the track starts at
+	 */
+	unsigned long long playTrack(int track, MUSIC_QUANTIZE quantize = MUSIC_QUANTIZE_BAR) {
+		unsigned long long startClock = getNextBoundaryClock(quantize);
+		Track& t = tracks[track];
+		for (SoundInfo* layer : t.layers)
+			audioEngine->playSoundAt(*layer, startClock);
+		t.startClock = startClock;
+		t.playing = true;
+		currentTrack = track;
+		return startClock;
+	}
+
+	/**
+	 * Fades out and stops all layers of a track at the next boundary of the current track
+	 * @param fadeBeats Length of the fade out, in beats of the track being stopped. 0 stops without a fade.
+	 * @returns the DSP clock the fade starts at
+	 */
+	unsigned long long stopTrack(int track, MUSIC_QUANTIZE quantize = MUSIC_QUANTIZE_BAR, double fadeBeats = 0.0) {
+		unsigned long long fadeClock = getNextBoundaryClock(quantize);
+		Track& t = tracks[track];
+		unsigned long long fadeSamples = beatsToSamples(t, fadeClock, fadeBeats);
+		for (SoundInfo* layer : t.layers) {
+			if (fadeSamples > 0)
+				audioEngine->fadeSoundLoopVolumeAt(*layer, 0.0f, fadeClock, fadeSamples);
+			audioEngine->stopSoundAt(*layer, fadeClock + fadeSamples);
+		}
+		t.playing = false;
+		if (currentTrack == track)
+			currentTrack = -1;
+		return fadeClock;
+	}
+
+	/**
+	 * Stops all tracks immediately, without waiting for a boundary
+	 */
+	void stopAll() {
+		for (Track& t : tracks) {
+			if (!t.playing)
+				continue;
+			for (SoundInfo* layer : t.layers)
+				audioEngine->stopSound(*layer);
+			t.playing = false;
+		}
+		currentTrack = -1;
+	}
+
+	/**
+	 * Crossfades from the current track to another track. At the next boundary of the current track the new track
+	 * starts and fades in, while the current track fades out and stops.
+	 * @param fadeBeats Length of the crossfade, in beats of the new track
+	 * @returns the DSP clock the new track starts at
+	 */
+	unsigned long long transitionTo(int track, MUSIC_QUANTIZE quantize = MUSIC_QUANTIZE_BAR, double fadeBeats = 1.0) {
+		unsigned long long transitionClock = getNextBoundaryClock(quantize);
+		Track& to = tracks[track];
+		to.startClock = transitionClock;
+		unsigned long long fadeSamples = beatsToSamples(to, transitionClock, fadeBeats);
+		if (currentTrack >= 0 && currentTrack != track) {
+			Track& from = tracks[currentTrack];
+			for (SoundInfo* layer : from.layers) {
+				audioEngine->fadeSoundLoopVolumeAt(*layer, 0.0f, transitionClock, fadeSamples);
+				audioEngine->stopSoundAt(*layer, transitionClock + fadeSamples);
+			}
+			from.playing = false;
+		}
+		for (SoundInfo* layer : to.layers) {
+			// each layer fades in to the volume it was set to, from silence
+			float volume = layer->getVolume();
+			layer->setVolume(0.0f);
+			audioEngine->playSoundAt(*layer, transitionClock);
+			if (volume > 0.0f)
+				audioEngine->fadeSoundLoopVolumeAt(*layer, volume, transitionClock, fadeSamples);
+		}
+		to.playing = true;
+		currentTrack = track;
+		return transitionClock;
+	}
+
+	/**
+	 * Fades a layer of the current track to a new volume, starting at the next boundary of the current track
+	 * @param fadeBeats Length of the fade, in beats of the current track
+	 */
+	void fadeLayer(SoundInfo& layer, float volume, MUSIC_QUANTIZE quantize = MUSIC_QUANTIZE_BEAT, double fadeBeats = 1.0) {
+		unsigned long long fadeClock = getNextBoundaryClock(quantize);
+		unsigned long long fadeSamples = currentTrack >= 0 ? beatsToSamples(tracks[currentTrack], fadeClock, fadeBeats) : 0;
+		audioEngine->fadeSoundLoopVolumeAt(layer, volume, fadeClock, fadeSamples);
+	}
+
+	/**
+	 * Fades a layer of a track to a new volume, starting a number of beats after the track started.
+	 * Used to shape a track's volume from its start, before the game thread reaches that point.
+	 */
+	void fadeLayerAtBeat(int track, SoundInfo& layer, float volume, double startBeat, double fadeBeats) {
+		Track& t = tracks[track];
+		unsigned long long fadeClock = beatToClock(t, startBeat);
+		audioEngine->fadeSoundLoopVolumeAt(layer, volume, fadeClock, beatToClock(t, startBeat + fadeBeats) - fadeClock);
+	}
+
+	/**
+	 * Plays a one-shot stinger at the next boundary of the current track
+	 * @returns the DSP clock the stinger starts at
+	 */
+	unsigned long long playStinger(SoundInfo stinger, MUSIC_QUANTIZE quantize = MUSIC_QUANTIZE_BEAT) {
+		unsigned long long startClock = getNextBoundaryClock(quantize);
+		audioEngine->playSoundAt(stinger, startClock);
+		return startClock;
+	}
+
+	/**
+	 * Returns the first DSP clock after the lookahead that lies on a boundary of the current track.
+	 * Without a current track, returns the clock after the lookahead.
+	 */
+	unsigned long long getNextBoundaryClock(MUSIC_QUANTIZE quantize) {
+		unsigned long long earliest = audioEngine->getDSPClock() + lookaheadSamples;
+		if (currentTrack < 0 || quantize == MUSIC_QUANTIZE_IMMEDIATE)
+			return earliest;
+		Track& t = tracks[currentTrack];
+		double earliestBeat = clockToBeat(t, earliest);
+		return beatToClock(t, t.tempoMap.nextBoundary(earliestBeat, quantize));
+	}
+
+	/**
+	 * Returns the beat position the current track is playing at, or -1 if no track is playing
+	 */
+	double getCurrentBeat() {
+		return currentTrack >= 0 ? clockToBeat(tracks[currentTrack], audioEngine->getDSPClock()) : -1.0;
+	}
+
+	/**
+	 * Returns the index of the current track, or -1 if no track is playing
+	 */
+	int getCurrentTrack() {
+		return currentTrack;
+	}
+
+private:
+	struct Track {
+		TempoMap tempoMap;
+		std::vector<SoundInfo*> layers;
+		// DSP clock the track's beat 0 is at
+		unsigned long long startClock;
+		bool playing;
+	};
+
+	std::shared_ptr<AudioEngine> audioEngine;
+	std::vector<Track> tracks;
+	int currentTrack = -1;
+	unsigned long long lookaheadSamples;
+
+	unsigned long long beatToClock(const Track& t, double beat) {
+		return t.startClock + (unsigned long long)std::llround(t.tempoMap.beatToSeconds(beat) * AudioEngine::AUDIO_SAMPLE_RATE);
+	}
+
+	double clockToBeat(const Track& t, unsigned long long clock) {
+		double seconds = clock > t.startClock ? (double)(clock - t.startClock) / AudioEngine::AUDIO_SAMPLE_RATE : 0.0;
+		return t.tempoMap.secondsToBeat(seconds);
+	}
+
+	// Length in samples of a number of beats of a track, starting at a clock
+	unsigned long long beatsToSamples(const Track& t, unsigned long long clock, double beats) {
+		if (beats <= 0.0)
+			return 0;
+		double beat = clockToBeat(t, clock);
+		return beatToClock(t, beat + beats) - beatToClock(t, beat);
+	}
+};
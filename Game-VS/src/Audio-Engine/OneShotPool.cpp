@@ -0,0 +1,216 @@
+///
+/// @file OneShotPool.cpp
+///
+#include "OneShotPool.h"
+#include "AudioEngine.h"
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+
+void OneShotPool::init(FMOD::System* system, int channels, FMOD::DSP* reverbInput, float reverbAmount) {
+    this->system = system;
+    this->reverbInput = reverbInput;
+    this->reverbAmount = reverbAmount;
+    ERRCHECK(system->getMasterChannelGroup(&masterGroup));
+    slotCount = std::max(1, channels);
+    slots.reset(new Slot[slotCount]);
+    // one probe per channel, which knows its slot through the description's user data
+    for (int i = 0; i < slotCount; i++) {
+        FMOD_DSP_DESCRIPTION description;
+        memset(&description, 0, sizeof(description));
+        description.pluginsdkversion = FMOD_PLUGIN_SDK_VERSION;
+        strncpy(description.name, "One-Shot Latency Probe", sizeof(description.name) - 1);
+        description.version = 0x00010000;
+        description.numinputbuffers = 1;
+        description.numoutputbuffers = 1;
+        description.read = probeRead;
+        description.userdata = &slots[i];
+        ERRCHECK(system->createDSP(&description, &slots[i].probe));
+    }
+}
+
+void OneShotPool::release() {
+    for (int i = 0; i < slotCount; i++) {
+        disconnectReverbSend(slots[i]);
+        if (slots[i].channel)
+            slots[i].channel->stop(); // may return FMOD_ERR_INVALID_HANDLE if the channel ended, which is fine
+        if (slots[i].probe)
+            ERRCHECK(slots[i].probe->release());
+    }
+    slots.reset();
+    slotCount = 0;
+    sound = nullptr;
+}
+
+void OneShotPool::setSound(FMOD::Sound* sound) {
+    this->sound = sound;
+}
+
+bool OneShotPool::trigger(float volume, float pitch, const FMOD_VECTOR* position, std::chrono::steady_clock::time_point eventTime) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < slotCount; i++) {
+        Slot& slot = slots[i];
+        int expected = SLOT_PRIMED;
+        if (!slot.state.compare_exchange_strong(expected, SLOT_PLAYING, std::memory_order_acquire))
+            continue;
+        FMOD::Channel* channel = slot.channel;
+        channel->setVolume(volume);
+        if (pitch != 1.0f)
+            channel->setPitch(pitch);
+        if (position) {
+            FMOD_VECTOR velocity = { 0.0f, 0.0f, 0.0f };
+            channel->set3DAttributes(position, &velocity);
+        }
+        unsigned long long clock = 0;
+        masterGroup->getDSPClock(&clock, 0);
+        slot.mixTime.store(0, std::memory_order_relaxed);
+        slot.triggerClock.store(clock, std::memory_order_relaxed);
+        slot.triggerTime.store(nanosecondsOf(eventTime), std::memory_order_release);
+        // a primed channel stolen by FMOD is re-primed by update(), the next slot may still be valid; the slot stays
+        // PLAYING, since update() may already be emptying and re-priming it, and is the only one to move it out of PLAYING
+        if (channel->setPaused(false) != FMOD_OK) {
+            slot.triggerTime.store(0);
+            continue;
+        }
+        triggered++;
+        triggerNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        return true;
+    }
+    return false;
+}
+
+void OneShotPool::update() {
+    bool measured = false;
+    int primed = 0;
+    for (int i = 0; i < slotCount; i++) {
+        Slot& slot = slots[i];
+        int state = slot.state.load(std::memory_order_acquire);
+        if (state == SLOT_PLAYING) {
+            if (slot.triggerTime.load() && slot.mixTime.load()) {
+                collectLatency(slot);
+                measured = true;
+            }
+            bool playing = false;
+            slot.channel->isPlaying(&playing); // fails with FMOD_ERR_INVALID_HANDLE once the channel has ended
+            if (playing)
+                continue;
+            disconnectReverbSend(slot);
+            slot.state.store(SLOT_EMPTY, std::memory_order_release);
+            state = SLOT_EMPTY;
+        }
+        else if (state == SLOT_PRIMED) {
+            // a paused channel can still be stolen by FMOD if it runs out of channels
+            bool playing = false;
+            slot.channel->isPlaying(&playing);
+            int expected = SLOT_PRIMED;
+            if (!playing && slot.state.compare_exchange_strong(expected, SLOT_EMPTY)) {
+                disconnectReverbSend(slot);
+                state = SLOT_EMPTY;
+            }
+        }
+        if (state == SLOT_EMPTY && sound)
+            prime(slot);
+        if (slot.state.load() == SLOT_PRIMED)
+            primed++;
+    }
+    primedCount = primed;
+    if (measured)
+        publishLatencyStats();
+}
+
+void OneShotPool::prime(Slot& slot) {
+    FMOD::Channel* channel = nullptr;
+    if (system->playSound(sound, 0, true /* start paused */, &channel) != FMOD_OK)
+        return;
+    // the most important priority, so FMOD steals other channels before the primed ones
+    ERRCHECK(channel->setPriority(0));
+    // the probe is detached from the previous channel when it ended
+    ERRCHECK(slot.probe->disconnectAll(true, true));
+    ERRCHECK(channel->addDSP(FMOD_CHANNELCONTROL_DSP_HEAD, slot.probe));
+    if (reverbInput) {
+        ERRCHECK(channel->getDSP(FMOD_CHANNELCONTROL_DSP_HEAD, &slot.channelHead));
+        ERRCHECK(reverbInput->addInput(slot.channelHead, &slot.reverbSend, FMOD_DSPCONNECTION_TYPE_SEND));
+        ERRCHECK(slot.reverbSend->setMix(reverbAmount));
+    }
+    slot.channel = channel;
+    slot.state.store(SLOT_PRIMED, std::memory_order_release);
+}
+
+void OneShotPool::disconnectReverbSend(Slot& slot) {
+    if (!slot.reverbSend)
+        return;
+    // FMOD reuses the head DSP for the channel's next sound, which must not inherit the send
+    reverbInput->disconnectFrom(slot.channelHead, slot.reverbSend); // may fail if the channel just ended, which is fine
+    slot.channelHead = nullptr;
+    slot.reverbSend = nullptr;
+}
+
+void OneShotPool::collectLatency(Slot& slot) {
+    long long triggerTime = slot.triggerTime.load(std::memory_order_acquire);
+    long long mixTime = slot.mixTime.load(std::memory_order_acquire);
+    slot.triggerTime.store(0);
+    float latency = std::max(0.0f, (float)((mixTime - triggerTime) / 1e6));
+    unsigned long long triggerClock = slot.triggerClock.load(), mixClock = slot.mixClock.load();
+    latencyMS[latencyNext] = latency;
+    latencyNext = (latencyNext + 1) % LATENCY_HISTORY;
+    latencyCount = std::min(latencyCount + 1, LATENCY_HISTORY);
+    latencyTotalMS += latency;
+    latencyTotalDSPSamples += mixClock > triggerClock ? (double)(mixClock - triggerClock) : 0.0;
+    latencyMinMS = latencyMeasured == 0 ? latency : std::min(latencyMinMS, latency);
+    latencyMaxMS = std::max(latencyMaxMS, latency);
+    latencyMeasured++;
+}
+
+void OneShotPool::publishLatencyStats() {
+    float sorted[LATENCY_HISTORY];
+    std::copy(latencyMS, latencyMS + latencyCount, sorted);
+    std::sort(sorted, sorted + latencyCount);
+    std::lock_guard<std::mutex> lock(statsMutex);
+    latencyStats.latencySamples = latencyMeasured;
+    latencyStats.averageLatencyMS = (float)(latencyTotalMS / latencyMeasured);
+    latencyStats.averageLatencyDSPSamples = (float)(latencyTotalDSPSamples / latencyMeasured);
+    latencyStats.minLatencyMS = latencyMinMS;
+    latencyStats.maxLatencyMS = latencyMaxMS;
+    latencyStats.p95LatencyMS = sorted[std::min(latencyCount - 1, latencyCount * 95 / 100)];
+}
+
+OneShotPoolStats OneShotPool::getStats() {
+    OneShotPoolStats stats;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats = latencyStats;
+    }
+    stats.channels = slotCount;
+    stats.primed = primedCount;
+    stats.triggered = triggered;
+    stats.missed = missed;
+    if (stats.triggered > 0)
+        stats.triggerMicroseconds = (float)(triggerNanoseconds / 1e3 / stats.triggered);
+    return stats;
+}
+
+void OneShotPool::printStats(const char* soundName) {
+    OneShotPoolStats stats = getStats();
+    std::cout << "One-Shot Pool " << soundName << ": " << stats.primed << " / " << stats.channels << " primed, " << stats.triggered
+        << " triggered, " << stats.missed << " missed, " << std::fixed << std::setprecision(2) << stats.triggerMicroseconds
+        << " us per trigger, event to mix latency " << stats.averageLatencyMS << " ms average (" << stats.averageLatencyDSPSamples
+        << " DSP samples), " << stats.minLatencyMS << " min, " << stats.p95LatencyMS << " p95, " << stats.maxLatencyMS
+        << " max over " << stats.latencySamples << " triggers\n" << std::defaultfloat;
+}
+
+FMOD_RESULT F_CALLBACK OneShotPool::probeRead(FMOD_DSP_STATE* dspState, float* inBuffer, float* outBuffer, unsigned int length, int inChannels, int* outChannels) {
+    void* userData = nullptr;
+    FMOD_DSP_GETUSERDATA(dspState, &userData);
+    Slot* slot = (Slot*)userData;
+    // the first block mixed after a trigger
+    if (slot->triggerTime.load(std::memory_order_acquire) != 0 && slot->mixTime.load(std::memory_order_relaxed) == 0) {
+        unsigned long long clock = 0;
+        unsigned int offset = 0, blockLength = 0;
+        FMOD_DSP_GETCLOCK(dspState, &clock, &offset, &blockLength);
+        slot->mixClock.store(clock, std::memory_order_relaxed);
+        slot->mixTime.store(nanosecondsOf(std::chrono::steady_clock::now()), std::memory_order_release);
+    }
+    *outChannels = inChannels;
+    memcpy(outBuffer, inBuffer, length * inChannels * sizeof(float));
+    return FMOD_OK;
+}
@@ -0,0 +1,134 @@
+#pragma once
+///
+/// @file OneShotPool.h
+///
+/// Low-latency playback of hot one-shot sounds, like footsteps and pickups. Each pool keeps channels of its sound
+/// created and paused at the start of the sound, so a trigger only sets the channel's volume and position and
+/// unpauses it, instead of going through the command queue and playSound(). Finished channels are re-primed off
+/// the trigger path. Every channel has a small probe DSP which timestamps the first mix after a trigger, to measure
+/// the latency from the game event to the mixer. Like voices, the channels send to the reverb.
+///
+#include <FMOD/fmod.hpp>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+/**
+ * Counters and trigger-to-mix latencies of a one-shot pool
+ */
+struct OneShotPoolStats {
+    int channels = 0, primed = 0;
+    // totals since the pool was created
+    unsigned long long triggered = 0;
+    // triggers which found no primed channel, and were played through the regular voice path instead
+    unsigned long long missed = 0;
+    // latency from the game event to the mixer's first block with the sound, over the measured triggers
+    int latencySamples = 0;
+    float averageLatencyMS = 0.0f, minLatencyMS = 0.0f, maxLatencyMS = 0.0f, p95LatencyMS = 0.0f;
+    // the same latency in DSP clock samples, from the mixer clock at the trigger to the clock of that block
+    float averageLatencyDSPSamples = 0.0f;
+    // average cost of a trigger on the calling thread
+    float triggerMicroseconds = 0.0f;
+};
+
+/**
+ * Pool of paused channels of one sound
+ */
+class OneShotPool {
+public:
+    /**
+     * Creates the pool's probe DSPs. The channels are primed by update() once the sound is set.
+     * @param channels - max overlapping one-shots with low latency, each uses one real channel while primed
+     * @param reverbInput, reverbAmount - DSP the channels send to, and the send level
+     */
+    void init(FMOD::System* system, int channels, FMOD::DSP* reverbInput = nullptr, float reverbAmount = 0.0f);
+
+    /**
+     * Stops the pool's channels and releases its DSPs
+     */
+    void release();
+
+    /**
+     * Sets the sound, once it has loaded
+     */
+    void setSound(FMOD::Sound* sound);
+
+    bool hasSound() const { return sound != nullptr; }
+
+    /**
+     * Starts a primed channel. Thread-safe, may be called while update() runs on another thread.
+     * @param position - 3D position, or nullptr for 2D sounds
+     * @param eventTime - time of the game event which triggered the sound, e.g. the key press, for the latency
+     * @returns false if no channel was primed, so the caller has to play the sound another way
+     */
+    bool trigger(float volume, float pitch, const FMOD_VECTOR* position, std::chrono::steady_clock::time_point eventTime);
+
+    /**
+     * Re-primes channels which finished playing, and collects latency measurements.
+     * Must be called by the thread that updates FMOD.
+     */
+    void update();
+
+    /**
+     * Counts a trigger that the caller played another way, because trigger() had no primed channel
+     */
+    void countMiss() { missed++; }
+
+    OneShotPoolStats getStats();
+
+    /**
+     * Prints the pool counters and latencies to the console
+     */
+    void printStats(const char* soundName);
+
+    // Latencies kept for the percentile
+    static const int LATENCY_HISTORY = 256;
+
+private:
+    typedef enum { SLOT_EMPTY, SLOT_PRIMED, SLOT_PLAYING } SLOT_STATE;
+    struct Slot {
+        std::atomic<int> state{ SLOT_EMPTY };
+        FMOD::Channel* channel = nullptr;
+        FMOD::DSP* probe = nullptr;
+        // the channel's head DSP and its send to the reverb
+        FMOD::DSP* channelHead = nullptr;
+        FMOD::DSPConnection* reverbSend = nullptr;
+        // steady clock nanoseconds of the trigger's game event (0 once collected), and of the first mix after it (0 until mixed)
+        std::atomic<long long> triggerTime{ 0 }, mixTime{ 0 };
+        // mixer DSP clock at the trigger, and of the block the sound was first mixed in
+        std::atomic<unsigned long long> triggerClock{ 0 }, mixClock{ 0 };
+    };
+
+    FMOD::System* system = nullptr;
+    FMOD::ChannelGroup* masterGroup = nullptr;
+    FMOD::Sound* sound = nullptr;
+    FMOD::DSP* reverbInput = nullptr;
+    float reverbAmount = 0.0f;
+    std::unique_ptr<Slot[]> slots;
+    int slotCount = 0;
+
+    std::atomic<unsigned long long> triggered{ 0 }, missed{ 0 }, triggerNanoseconds{ 0 };
+    // latency history, only used by the thread calling update()
+    float latencyMS[LATENCY_HISTORY] = { };
+    int latencyCount = 0, latencyNext = 0;
+    double latencyTotalMS = 0.0, latencyTotalDSPSamples = 0.0;
+    int latencyMeasured = 0;
+    float latencyMinMS = 0.0f, latencyMaxMS = 0.0f;
+    // latency part of the stats, published by update() for getStats() on other threads
+    std::mutex statsMutex;
+    OneShotPoolStats latencyStats;
+    std::atomic<int> primedCount{ 0 };
+
+    void prime(Slot& slot);
+    void disconnectReverbSend(Slot& slot);
+    void collectLatency(Slot& slot);
+    void publishLatencyStats();
+
+    static long long nanosecondsOf(std::chrono::steady_clock::time_point time) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    static FMOD_RESULT F_CALLBACK probeRead(FMOD_DSP_STATE* dspState, float* inBuffer, float* outBuffer, unsigned int length, int inChannels, int* outChannels);
+};
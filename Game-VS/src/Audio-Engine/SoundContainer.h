@@ -0,0 +1,231 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "AudioEngine.h"
+#include "SoundInfo.h"
+
+// How a sound container selects the next sound to play
+typedef enum {
+	SOUND_CONTAINER_RANDOM,   // any sound except the last one played
+	SOUND_CONTAINER_SHUFFLE,  // every sound once in random order, then reshuffled, never repeating across reshuffles
+	SOUND_CONTAINER_SEQUENCE  // the sounds in the order they were added
+} SOUND_CONTAINER_TYPE;
+
+/**
+ * Per-user playback state of a SoundContainer, e.g. one per character whose footsteps use the container.
+ * Fixed size plain data, so it can be stored in any number of game objects without allocating.
+ */
+struct SoundContainerInstance {
+	// Switch value selecting the group of sounds to play from, e.g. the surface walked on
+	int switchValue = 0;
+	// random number generator state, must not be 0
+	uint32_t rngState = 0x9E3779B9u;
+
+	struct GroupState {
+		uint8_t bag[16];        // shuffle bag, the first 'remaining' entries haven't been played this round
+		uint8_t remaining = 0;
+		uint8_t position = 0;   // next entry of a sequence
+		int8_t last = -1;       // last entry played
+	};
+	GroupState groups[8];
+};
+
+/**
+ * Data-driven container of interchangeable sounds, such as footstep or impact variations.
+ * Sounds are added into groups by switch value, e.g. one group per surface type. Each trigger selects a sound of
+ * the instance's switch group in O(1) time, and randomizes its volume and pitch. The sounds are played by handle,
+ * so triggering the container doesn't allocate, and one container can be shared by many instances.
+ */
+class SoundContainer {
+public:
+	// Sounds per switch group, and switch groups per container
+	static const int MAX_SOUNDS_PER_SWITCH = 16, MAX_SWITCH_VALUES = 8;
+	// Returned by play() for sounds started from a one-shot pool, which have no voice ID
+	static const int ONE_SHOT_PLAYED = -2;
+	static_assert(sizeof(SoundContainerInstance::GroupState::bag) == MAX_SOUNDS_PER_SWITCH
+		&& sizeof(SoundContainerInstance::groups) / sizeof(SoundContainerInstance::GroupState) == MAX_SWITCH_VALUES,
+		"SoundContainerInstance must hold state for every sound and switch group");
+
+	/**
+	 * Constructs an empty sound container
+	 * @param audioEngine Shared audio engine used to load and play the sounds. Must be initialized.
+	 */
+	SoundContainer(std::shared_ptr<AudioEngine> audioEngine, SOUND_CONTAINER_TYPE type = SOUND_CONTAINER_SHUFFLE)
+		: audioEngine(audioEngine), type(type), entries() {
+		entries.reserve(MAX_SOUNDS_PER_SWITCH * MAX_SWITCH_VALUES);
+	}
+
+	/**
+	 * Loads a sound and adds it to a switch group
+	 * @returns false if the group is full
+	 */
+	bool addSound(SoundInfo soundInfo, int switchValue = 0) {
+		if (switchValue < 0 || switchValue >= MAX_SWITCH_VALUES || groups[switchValue].count >= MAX_SOUNDS_PER_SWITCH) {
+			std::cout << "Sound Container: Can't add sound " << soundInfo.getFilePath() << " to switch " << switchValue << '\n';
+			return false;
+		}
+		int handle = audioEngine->loadSound(soundInfo);
+		int oneShotPool = oneShotChannels > 0 ? audioEngine->createOneShotPool(soundInfo, oneShotChannels) : -1;
+		Group& group = groups[switchValue];
+		group.entries[group.count++] = (uint8_t)entries.size();
+		entries.push_back({ handle, oneShotPool, soundInfo.getVolume() });
+		return true;
+	}
+
+	/**
+	 * Plays the sounds added afterwards from one-shot pools, which start them with lower latency than voices,
+	 * at the cost of keeping channels of every sound primed. Must be called before the audio thread starts.
+	 * @param channelsPerSound - overlapping triggers of the same sound with low latency, 0 to use voices again
+	 */
+	void enableOneShotPools(int channelsPerSound) {
+		oneShotChannels = channelsPerSound;
+	}
+
+	/**
+	 * Sets the range each trigger scales the sound's volume by, e.g. 0.8 to 1.0
+	 */
+	void setVolumeRandomization(float minScale, float maxScale) {
+		volumeScaleMin = minScale;
+		volumeScaleMax = maxScale;
+	}
+
+	/**
+	 * Sets how far each trigger may shift the sound's pitch, up or down, in semitones
+	 */
+	void setPitchRandomization(float semitones) {
+		pitchSemitones = semitones;
+	}
+
+	/**
+	 * Creates playback state for a new user of the container
+	 * @param seed Seed of the instance's random choices, so instances don't play the same sequence
+	 */
+	SoundContainerInstance createInstance(uint32_t seed) {
+		SoundContainerInstance instance;
+		instance.rngState = seed ? seed : 1u;
+		return instance;
+	}
+
+	/**
+	 * Selects the next sound of an instance's switch group
+	 * @returns the index of the sound in the order sounds were added, or -1 if the group is empty
+	 */
+	int select(SoundContainerInstance& instance) {
+		if (instance.switchValue < 0 || instance.switchValue >= MAX_SWITCH_VALUES)
+			return -1;
+		const Group& group = groups[instance.switchValue];
+		SoundContainerInstance::GroupState& state = instance.groups[instance.switchValue];
+		int n = group.count;
+		if (n == 0)
+			return -1;
+		int choice = 0;
+		switch (type) {
+		case SOUND_CONTAINER_RANDOM:
+			// pick among the other n - 1 entries and skip over the last one, which avoids rejection sampling
+			if (n == 1 || state.last < 0)
+				choice = (int)(nextRandom(instance) % n);
+			else {
+				choice = (int)(nextRandom(instance) % (n - 1));
+				if (choice >= state.last)
+					choice++;
+			}
+			break;
+		case SOUND_CONTAINER_SHUFFLE: {
+			if (state.remaining == 0) {
+				for (int i = 0; i < n; i++)
+					state.bag[i] = (uint8_t)i;
+				state.remaining = (uint8_t)n;
+			}
+			// incremental Fisher-Yates: draw one unplayed entry and move it out of the unplayed range
+			int draw = (int)(nextRandom(instance) % state.remaining);
+			// the first draw of a new round may not repeat the last entry of the previous round
+			if (state.bag[draw] == state.last && state.remaining > 1 && state.remaining == n)
+				draw = (draw + 1) % state.remaining;
+			choice = state.bag[draw];
+			state.bag[draw] = state.bag[state.remaining - 1];
+			state.bag[state.remaining - 1] = (uint8_t)choice;
+			state.remaining--;
+			break;
+		}
+		case SOUND_CONTAINER_SEQUENCE:
+			choice = state.position % n;
+			state.position = (uint8_t)((choice + 1) % n);
+			break;
+		}
+		state.last = (int8_t)choice;
+		return group.entries[choice];
+	}
+
+	/**
+	 * Plays the next sound of an instance as a 2D voice
+	 * @returns the voice ID, or -1 if the instance's switch group is empty
+	 */
+	int play(SoundContainerInstance& instance) {
+		return play(instance, 0.0f, 0.0f, 0.0f);
+	}
+
+	/**
+	 * Plays the next sound of an instance at a 3D position. Ignored for 2D sounds.
+	 * @returns the voice ID, ONE_SHOT_PLAYED if the sound was started from its one-shot pool,
+	 *          or -1 if the instance's switch group is empty
+	 */
+	int play(SoundContainerInstance& instance, float x, float y, float z) {
+		int entry = select(instance);
+		if (entry < 0)
+			return -1;
+		float volume = entries[entry].volume * lerp(volumeScaleMin, volumeScaleMax, nextUnit(instance));
+		float pitch = pitchSemitones > 0.0f ? std::exp2(lerp(-pitchSemitones, pitchSemitones, nextUnit(instance)) / 12.0f) : 1.0f;
+		if (entries[entry].oneShotPool >= 0) {
+			audioEngine->playOneShot(entries[entry].oneShotPool, volume, pitch, x, y, z);
+			return ONE_SHOT_PLAYED;
+		}
+		return audioEngine->playVoice(entries[entry].handle, volume, pitch, x, y, z);
+	}
+
+	/**
+	 * Returns the number of sounds in a switch group
+	 */
+	int getSoundCount(int switchValue = 0) {
+		return switchValue >= 0 && switchValue < MAX_SWITCH_VALUES ? groups[switchValue].count : 0;
+	}
+
+private:
+	struct Entry {
+		int handle;      // audio engine sound handle
+		int oneShotPool; // audio engine one-shot pool, or -1 to play the sound as a voice
+		float volume;    // volume of the SoundInfo the sound was added with
+	};
+	struct Group {
+		uint8_t entries[MAX_SOUNDS_PER_SWITCH] = { };
+		int count = 0;
+	};
+
+	std::shared_ptr<AudioEngine> audioEngine;
+	SOUND_CONTAINER_TYPE type;
+	std::vector<Entry> entries;
+	Group groups[MAX_SWITCH_VALUES];
+	float volumeScaleMin = 1.0f, volumeScaleMax = 1.0f;
+	float pitchSemitones = 0.0f;
+	int oneShotChannels = 0;
+
+	// xorshift32, small enough to keep in every instance
+	static uint32_t nextRandom(SoundContainerInstance& instance) {
+		uint32_t x = instance.rngState;
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		return instance.rngState = x;
+	}
+
+	// random float in [0, 1)
+	static float nextUnit(SoundContainerInstance& instance) {
+		return (nextRandom(instance) >> 8) * (1.0f / 16777216.0f);
+	}
+
+	static float lerp(float a, float b, float t) {
+		return a + (b - a) * t;
+	}
+};
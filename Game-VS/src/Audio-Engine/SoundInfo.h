@@ -17,6 +17,22 @@ typedef enum {
     SOUND_NOT_LOADED,
     SOUND_LOADED
 } SOUND_LOAD_INFO;
+// Load states of a sound file in the AudioEngine, which loads sound files asynchronously
+typedef enum {
+    SOUND_LOAD_STATE_UNLOADED,
+    SOUND_LOAD_STATE_LOADING,
+    SOUND_LOAD_STATE_READY,
+    SOUND_LOAD_STATE_FAILED
+} SOUND_LOAD_STATE;
+// Sound Categories, used by the VoiceManager to apply per-category voice limits
+typedef enum {
+    SOUND_CATEGORY_SFX,
+    SOUND_CATEGORY_FOOTSTEP,
+    SOUND_CATEGORY_AMBIENT,
+    SOUND_CATEGORY_MUSIC,
+    SOUND_CATEGORY_DIALOGUE,
+    SOUND_CATEGORY_COUNT
+} SOUND_CATEGORY;
 
 /**
  * Container class for all data about an audio file and its intended implentation.
@@ -98,6 +114,28 @@ public:
         this->volume = vol;
     }
 
+    SOUND_CATEGORY getCategory() {
+        return category;
+    }
+
+    /**
+     * Sets the category the sound's voices are counted in
+     */
+    void setCategory(SOUND_CATEGORY category) {
+        this->category = category;
+    }
+
+    int getPriority() {
+        return priority;
+    }
+
+    /**
+     * Sets the voice priority of the sound, from 0 (most important) to 256 (least important)
+     */
+    void setPriority(int priority) {
+        this->priority = priority;
+    }
+
     //// TODO FIX
     //void setMSLength(unsigned int msLength) {
     //    this->msLength = msLength;
@@ -116,6 +154,8 @@ private:
     SOUND_POSITION_TYPE soundPositionType;
     SOUND_PLAYBACK_TYPE soundPlaybackType;
     SOUND_LOAD_INFO     soundLoadInfo;
+    SOUND_CATEGORY      category = SOUND_CATEGORY_SFX;
+    int                 priority = 128;
 
     
     float reverbAmount;
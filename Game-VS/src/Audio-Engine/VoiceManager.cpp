@@ -0,0 +1,493 @@
+///
+/// @file VoiceManager.cpp
+///
+#include "VoiceManager.h"
+#include "AudioEngine.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+VoiceManager::VoiceManager() : voices(), voiceOrder() {
+    // defaults sized for the game: a few music layers and lines of dialogue, many ambient emitters
+    categorySettings[SOUND_CATEGORY_SFX]      = { 32,  16, VOICE_STEAL_QUIETEST,        true  };
+    categorySettings[SOUND_CATEGORY_FOOTSTEP] = { 4,   4,  VOICE_STEAL_OLDEST,          false };
+    categorySettings[SOUND_CATEGORY_AMBIENT]  = { 512, 24, VOICE_STEAL_LOWEST_PRIORITY, true  };
+    // music layers play at volume 0 until faded in, and must stay sample-aligned, so they are never virtualized
+    categorySettings[SOUND_CATEGORY_MUSIC]    = { 8,   8,  VOICE_STEAL_OLDEST,          false };
+    categorySettings[SOUND_CATEGORY_DIALOGUE] = { 2,   2,  VOICE_STEAL_OLDEST,          false };
+}
+
+void VoiceManager::init(FMOD::System* system, float minDistance, float rolloffScale, int maxRealVoices) {
+    this->system = system;
+    this->minDistance = minDistance;
+    this->rolloffScale = rolloffScale;
+    this->maxRealVoices = maxRealVoices;
+    ERRCHECK(system->getMasterChannelGroup(&masterGroup));
+    ERRCHECK(system->getSoftwareFormat(&outputRate, 0, 0));
+}
+
+void VoiceManager::setMaxRealVoices(int maxRealVoices) {
+    this->maxRealVoices = std::max(0, maxRealVoices);
+}
+
+bool VoiceManager::play(FMOD::Sound* sound, SoundInfo& soundInfo, FMOD_VECTOR position, int voiceID, unsigned long long startClock, float pitch) {
+    Voice voice;
+    voice.id = voiceID;
+    voice.sound = sound;
+    voice.channel = nullptr;
+    voice.category = soundInfo.getCategory();
+    voice.priority = soundInfo.getPriority();
+    voice.is3D = soundInfo.is3D();
+    voice.loop = soundInfo.isLoop();
+    voice.position = position;
+    voice.volume = soundInfo.getVolume();
+    voice.reverbAmount = soundInfo.getReverbAmount();
+    voice.pitch = pitch > 0.0f ? pitch : 1.0f;
+    voice.audibility = computeAudibility(voice);
+    voice.startClock = startClock ? startClock : getDSPClock();
+    voice.endClock = 0;
+    voice.occlusion = voice.occlusionTarget = 0.0f;
+    voice.appliedOcclusion = -1.0f;
+    voice.occlusionClock = 0;
+    voice.occlusionSample = 0;
+    voice.channelHead = nullptr;
+    voice.reverbSend = nullptr;
+    // a new voice starts at its traced occlusion instead of fading into it, if the update's ray budget allows
+    if (voice.is3D && occlusionGeometry && occlusionRaysThisUpdate < occlusionRaysPerUpdate) {
+        traceOcclusion(voice, voice.startClock);
+        voice.occlusion = voice.occlusionTarget;
+        voice.audibility = computeAudibility(voice);
+    }
+    unsigned int lengthMS = 0;
+    ERRCHECK(sound->getLength(&lengthMS, FMOD_TIMEUNIT_MS));
+    voice.lengthSamples = (unsigned long long)(lengthMS * (double)outputRate / 1000.0 / voice.pitch);
+
+    // make room in the category if it is full
+    int categoryVoices = 0;
+    for (const Voice& v : voices)
+        categoryVoices += v.category == voice.category;
+    if (categoryVoices >= categorySettings[voice.category].maxVoices) {
+        int victim = findVoiceToSteal(voice.category, voice);
+        if (victim < 0) {
+            stats.rejected++;
+            return false;
+        }
+        removeVoice(victim);
+        stats.steals++;
+    }
+
+    voices.push_back(voice);
+    // the new voice starts virtual, and is made real here if it's important enough
+    assignRealVoices();
+    return true;
+}
+
+void VoiceManager::stop(int voiceID) {
+    int index = findVoice(voiceID);
+    if (index >= 0)
+        removeVoice(index);
+}
+
+void VoiceManager::stopAt(int voiceID, unsigned long long endClock) {
+    int index = findVoice(voiceID);
+    if (index < 0)
+        return;
+    voices[index].endClock = endClock;
+    if (voices[index].channel)
+        applySchedule(voices[index]);
+}
+
+void VoiceManager::fadeVolume(int voiceID, float fromVolume, float toVolume, unsigned long long startClock, unsigned long long lengthSamples) {
+    int index = findVoice(voiceID);
+    if (index < 0)
+        return;
+    Voice& voice = voices[index];
+    auto& points = voice.fadePoints;
+    points.erase(std::remove_if(points.begin(), points.end(), [startClock](const std::pair<unsigned long long, float>& point) {
+        return point.first >= startClock;
+    }), points.end());
+    points.push_back({ startClock, fromVolume });
+    points.push_back({ startClock + std::max(lengthSamples, 1ULL), toVolume });
+    voice.volume = toVolume;
+    voice.audibility = computeAudibility(voice);
+    if (voice.channel)
+        applySchedule(voice);
+}
+
+bool VoiceManager::isActive(int voiceID) {
+    return findVoice(voiceID) >= 0;
+}
+
+void VoiceManager::getActiveVoiceIDs(std::vector<int>& voiceIDs) {
+    voiceIDs.clear();
+    for (const Voice& voice : voices)
+        voiceIDs.push_back(voice.id);
+    std::sort(voiceIDs.begin(), voiceIDs.end());
+}
+
+FMOD::Channel* VoiceManager::getChannel(int voiceID) {
+    int index = findVoice(voiceID);
+    return index >= 0 ? voices[index].channel : nullptr;
+}
+
+void VoiceManager::setVolume(int voiceID, float volume) {
+    int index = findVoice(voiceID);
+    if (index >= 0) {
+        Voice& voice = voices[index];
+        voice.volume = volume;
+        voice.audibility = computeAudibility(voice);
+        if (!voice.fadePoints.empty()) {
+            voice.fadePoints.clear();
+            if (voice.channel) {
+                ERRCHECK(voice.channel->removeFadePoints(0, ~0ULL));
+                ERRCHECK(voice.channel->setVolume(volume));
+            }
+        }
+    }
+}
+
+void VoiceManager::set3DPosition(int voiceID, FMOD_VECTOR position) {
+    int index = findVoice(voiceID);
+    if (index < 0)
+        return;
+    Voice& voice = voices[index];
+    voice.position = position;
+    voice.audibility = computeAudibility(voice);
+    if (voice.channel && voice.is3D) {
+        FMOD_VECTOR velocity = { 0.0f, 0.0f, 0.0f };
+        ERRCHECK(voice.channel->set3DAttributes(&voice.position, &velocity));
+    }
+}
+
+void VoiceManager::setListenerPosition(FMOD_VECTOR position) {
+    listenerPosition = position;
+}
+
+void VoiceManager::setOcclusion(const AudioOcclusion* occlusion, int raysPerUpdate) {
+    occlusionGeometry = occlusion && !occlusion->isEmpty() ? occlusion : nullptr;
+    occlusionRaysPerUpdate = std::max(1, raysPerUpdate);
+    if (!occlusionGeometry)
+        for (Voice& voice : voices) {
+            voice.occlusion = voice.occlusionTarget = 0.0f;
+            applyOcclusion(voice);
+        }
+}
+
+void VoiceManager::update() {
+    unsigned long long clock = getDSPClock();
+    for (int i = (int)voices.size() - 1; i >= 0; i--) {
+        Voice& voice = voices[i];
+        bool playing = true;
+        if (voice.endClock && clock >= voice.endClock)
+            playing = false;
+        else if (voice.channel) {
+            if (voice.channel->isPlaying(&playing) != FMOD_OK)
+                playing = false; // fails with FMOD_ERR_INVALID_HANDLE once the channel has ended
+        }
+        else if (!voice.loop && clock > voice.startClock)
+            playing = clock - voice.startClock < voice.lengthSamples;
+        if (!playing) {
+            removeVoice(i);
+            continue;
+        }
+        // once a fade is over, the channel holds the final volume without fade points
+        if (!voice.fadePoints.empty() && clock >= voice.fadePoints.back().first) {
+            voice.fadePoints.clear();
+            if (voice.channel) {
+                ERRCHECK(voice.channel->removeFadePoints(0, ~0ULL));
+                ERRCHECK(voice.channel->setVolume(voice.volume));
+            }
+        }
+    }
+    // occlusion lowers the audibility used to pick the real voices
+    updateOcclusion(clock);
+    for (Voice& voice : voices)
+        voice.audibility = computeAudibility(voice);
+    assignRealVoices();
+
+    ERRCHECK(system->getChannelsPlaying(&stats.fmodChannels, &stats.fmodRealChannels));
+    float geometry;
+    ERRCHECK(system->getCPUUsage(&stats.cpuDSP, &stats.cpuStream, &geometry, &stats.cpuUpdate, &stats.cpuTotal));
+}
+
+void VoiceManager::setCategorySettings(SOUND_CATEGORY category, VoiceCategorySettings settings) {
+    categorySettings[category] = settings;
+}
+
+void VoiceManager::setAudibilityThreshold(float threshold) {
+    audibilityThreshold = threshold;
+}
+
+const VoiceStats& VoiceManager::getStats() {
+    return stats;
+}
+
+void VoiceManager::printStats() {
+    const char* categoryNames[SOUND_CATEGORY_COUNT] = { "SFX", "Footstep", "Ambient", "Music", "Dialogue" };
+    std::cout << "Voice Manager: " << stats.realVoices << " real voices (budget " << maxRealVoices << "), "
+        << stats.virtualVoices << " virtual voices, FMOD channels " << stats.fmodRealChannels << " real / " << stats.fmodChannels << " total\n";
+    for (int c = 0; c < SOUND_CATEGORY_COUNT; c++)
+        std::cout << "  " << categoryNames[c] << ": " << stats.categoryRealVoices[c] << " real / " << stats.categoryVoices[c]
+            << " voices (limits " << categorySettings[c].maxRealVoices << " / " << categorySettings[c].maxVoices << ")\n";
+    std::cout << "  steals " << stats.steals << ", rejected " << stats.rejected << ", virtualized " << stats.virtualizations
+        << ", devirtualized " << stats.devirtualizations << '\n'
+        << "  FMOD CPU: DSP " << stats.cpuDSP << "%, stream " << stats.cpuStream << "%, update " << stats.cpuUpdate
+        << "%, total " << stats.cpuTotal << "%\n";
+    if (occlusionGeometry)
+        std::cout << "  occlusion: " << stats.occlusionRays << " rays (budget " << occlusionRaysPerUpdate << ") against "
+            << occlusionGeometry->getBoxCount() << " boxes in " << stats.occlusionMS << " ms, " << stats.occludedVoices
+            << " voices occluded, oldest trace " << stats.maxOcclusionAge << " s\n";
+}
+
+// Private definitions
+
+int VoiceManager::findVoice(int voiceID) {
+    for (int i = 0; i < (int)voices.size(); i++)
+        if (voices[i].id == voiceID)
+            return i;
+    return -1;
+}
+
+float VoiceManager::computeAudibility(const Voice& voice) {
+    if (!voice.is3D)
+        return voice.volume;
+    float dx = voice.position.x - listenerPosition.x;
+    float dy = voice.position.y - listenerPosition.y;
+    float dz = voice.position.z - listenerPosition.z;
+    float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+    // FMOD's direct occlusion attenuates the direct path by the occlusion amount
+    float volume = voice.volume * (1.0f - voice.occlusion);
+    if (distance <= minDistance)
+        return volume;
+    return volume * minDistance / (minDistance + rolloffScale * (distance - minDistance));
+}
+
+void VoiceManager::traceOcclusion(Voice& voice, unsigned long long clock) {
+    // rotate between the voice's position and points beside and above it
+    static const glm::vec3 SAMPLE_OFFSETS[5] = { { 0, 0, 0 }, { 1, 0, 0 }, { 0, 1, 0 }, { -1, 0, 0 }, { 0, 0, 1 } };
+    glm::vec3 target = glm::vec3(voice.position.x, voice.position.y, voice.position.z)
+        + SAMPLE_OFFSETS[voice.occlusionSample++ % 5] * OCCLUSION_SAMPLE_RADIUS;
+    voice.occlusionTarget = occlusionGeometry->trace(glm::vec3(listenerPosition.x, listenerPosition.y, listenerPosition.z), target);
+    voice.occlusionClock = clock;
+    occlusionRaysThisUpdate++;
+}
+
+void VoiceManager::updateOcclusion(unsigned long long clock) {
+    stats.occlusionRays = stats.occludedVoices = 0;
+    stats.occlusionMS = stats.maxOcclusionAge = 0.0f;
+    if (!occlusionGeometry) {
+        occlusionRaysThisUpdate = 0;
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    // rays traced for voices played since the last update count towards this update's budget
+    int n = (int)voices.size();
+    for (int k = 0; k < n && occlusionRaysThisUpdate < occlusionRaysPerUpdate; k++) {
+        Voice& voice = voices[(occlusionCursor + k) % n];
+        if (voice.is3D)
+            traceOcclusion(voice, clock);
+        if (occlusionRaysThisUpdate >= occlusionRaysPerUpdate)
+            occlusionCursor = (occlusionCursor + k + 1) % n;
+    }
+
+    float dt = occlusionSmoothClock && clock > occlusionSmoothClock ? (float)(clock - occlusionSmoothClock) / outputRate : 0.0f;
+    occlusionSmoothClock = clock;
+    float blend = 1.0f - std::exp(-dt / OCCLUSION_SMOOTHING_SECONDS);
+    for (Voice& voice : voices) {
+        if (!voice.is3D)
+            continue;
+        voice.occlusion += (voice.occlusionTarget - voice.occlusion) * blend;
+        applyOcclusion(voice);
+        stats.occludedVoices += voice.occlusion > 0.05f;
+        if (voice.occlusionClock && clock > voice.occlusionClock)
+            stats.maxOcclusionAge = std::max(stats.maxOcclusionAge, (float)(clock - voice.occlusionClock) / outputRate);
+    }
+    stats.occlusionRays = occlusionRaysThisUpdate;
+    occlusionRaysThisUpdate = 0;
+    stats.occlusionMS = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void VoiceManager::applyOcclusion(Voice& voice, bool force) {
+    if (!voice.channel || !voice.is3D || (!force && std::abs(voice.occlusion - voice.appliedOcclusion) < 0.01f))
+        return;
+    ERRCHECK(voice.channel->set3DOcclusion(voice.occlusion, voice.occlusion * OCCLUSION_REVERB_SCALE));
+    // a reverb DSP send is taken after the channel's direct occlusion, so it is raised back to the reverb occlusion
+    if (voice.reverbSend) {
+        float direct = 1.0f - voice.occlusion, reverb = 1.0f - voice.occlusion * OCCLUSION_REVERB_SCALE;
+        ERRCHECK(voice.reverbSend->setMix(voice.reverbAmount * reverb / std::max(direct, 0.25f)));
+    }
+    voice.appliedOcclusion = voice.occlusion;
+}
+
+void VoiceManager::setReverbInput(FMOD::DSP* reverbInput) {
+    this->reverbInput = reverbInput;
+}
+
+void VoiceManager::connectReverbSend(Voice& voice) {
+    if (!reverbInput) {
+        ERRCHECK(voice.channel->setReverbProperties(0, voice.reverbAmount));
+        return;
+    }
+    if (voice.reverbAmount <= 0.0f)
+        return;
+    ERRCHECK(voice.channel->getDSP(FMOD_CHANNELCONTROL_DSP_HEAD, &voice.channelHead));
+    ERRCHECK(reverbInput->addInput(voice.channelHead, &voice.reverbSend, FMOD_DSPCONNECTION_TYPE_SEND));
+    ERRCHECK(voice.reverbSend->setMix(voice.reverbAmount));
+}
+
+void VoiceManager::disconnectReverbSend(Voice& voice) {
+    if (!voice.reverbSend)
+        return;
+    // FMOD reuses the head DSP for the channel's next sound, which must not inherit the send
+    reverbInput->disconnectFrom(voice.channelHead, voice.reverbSend); // may fail if the channel just ended, which is fine
+    voice.channelHead = nullptr;
+    voice.reverbSend = nullptr;
+}
+
+unsigned long long VoiceManager::getDSPClock() {
+    unsigned long long clock = 0;
+    ERRCHECK(masterGroup->getDSPClock(&clock, 0));
+    return clock;
+}
+
+bool VoiceManager::isMoreImportant(const Voice& a, const Voice& b) {
+    if (a.priority != b.priority)
+        return a.priority < b.priority;
+    if (a.audibility != b.audibility)
+        return a.audibility > b.audibility;
+    return a.id < b.id; // older voices first, so that equally important voices don't swap every update
+}
+
+int VoiceManager::findVoiceToSteal(SOUND_CATEGORY category, const Voice& newVoice) {
+    int victim = -1;
+    for (int i = 0; i < (int)voices.size(); i++) {
+        const Voice& v = voices[i];
+        if (v.category != category)
+            continue;
+        if (victim < 0) {
+            victim = i;
+            continue;
+        }
+        switch (categorySettings[category].stealPolicy) {
+        case VOICE_STEAL_OLDEST:
+            if (v.startClock < voices[victim].startClock) victim = i;
+            break;
+        case VOICE_STEAL_QUIETEST:
+            if (v.audibility < voices[victim].audibility) victim = i;
+            break;
+        case VOICE_STEAL_LOWEST_PRIORITY:
+            if (isMoreImportant(voices[victim], v)) victim = i;
+            break;
+        default:
+            break;
+        }
+    }
+    if (victim < 0)
+        return -1;
+    switch (categorySettings[category].stealPolicy) {
+    case VOICE_STEAL_NONE:
+        return -1;
+    case VOICE_STEAL_QUIETEST:
+        return voices[victim].audibility <= newVoice.audibility ? victim : -1;
+    case VOICE_STEAL_LOWEST_PRIORITY:
+        return voices[victim].priority > newVoice.priority
+            || (voices[victim].priority == newVoice.priority && voices[victim].audibility <= newVoice.audibility) ? victim : -1;
+    default:
+        return victim;
+    }
+}
+
+void VoiceManager::assignRealVoices() {
+    voiceOrder.resize(voices.size());
+    for (int i = 0; i < (int)voices.size(); i++)
+        voiceOrder[i] = i;
+    std::sort(voiceOrder.begin(), voiceOrder.end(), [this](int a, int b) { return isMoreImportant(voices[a], voices[b]); });
+
+    // the most important voices that are audible get the real voices, within the global and category budgets
+    VoiceStats newStats = stats;
+    newStats.realVoices = newStats.virtualVoices = 0;
+    for (int c = 0; c < SOUND_CATEGORY_COUNT; c++)
+        newStats.categoryVoices[c] = newStats.categoryRealVoices[c] = 0;
+    std::vector<bool> wantReal(voices.size(), false);
+    for (int index : voiceOrder) {
+        const Voice& voice = voices[index];
+        const VoiceCategorySettings& settings = categorySettings[voice.category];
+        bool audible = !settings.virtualizeInaudible || voice.audibility >= audibilityThreshold;
+        newStats.categoryVoices[voice.category]++;
+        if (audible && newStats.realVoices < maxRealVoices && newStats.categoryRealVoices[voice.category] < settings.maxRealVoices) {
+            wantReal[index] = true;
+            newStats.realVoices++;
+            newStats.categoryRealVoices[voice.category]++;
+        }
+        else
+            newStats.virtualVoices++;
+    }
+
+    // free channels before starting new ones, so FMOD's real channel count never exceeds the budget
+    for (int i = 0; i < (int)voices.size(); i++)
+        if (voices[i].channel && !wantReal[i]) {
+            makeVirtual(voices[i]);
+            newStats.virtualizations++;
+        }
+    for (int i = 0; i < (int)voices.size(); i++)
+        if (!voices[i].channel && wantReal[i]) {
+            makeReal(voices[i]);
+            newStats.devirtualizations++;
+        }
+    stats = newStats;
+}
+
+void VoiceManager::makeReal(Voice& voice) {
+    FMOD::Channel* channel;
+    ERRCHECK(system->playSound(voice.sound, 0, true /* start paused */, &channel));
+    // resume where the voice would be if it had been playing all along
+    unsigned long long clock = getDSPClock();
+    unsigned long long elapsed = clock > voice.startClock ? clock - voice.startClock : 0;
+    if (voice.loop && voice.lengthSamples > 0)
+        elapsed %= voice.lengthSamples;
+    if (elapsed > 0 && elapsed < voice.lengthSamples)
+        ERRCHECK(channel->setPosition((unsigned int)(elapsed * voice.pitch * 1000.0 / outputRate), FMOD_TIMEUNIT_MS));
+    if (voice.is3D) {
+        FMOD_VECTOR velocity = { 0.0f, 0.0f, 0.0f };
+        ERRCHECK(channel->set3DAttributes(&voice.position, &velocity));
+    }
+    ERRCHECK(channel->setVolume(voice.volume));
+    if (voice.pitch != 1.0f)
+        ERRCHECK(channel->setPitch(voice.pitch));
+    ERRCHECK(channel->setPriority(std::min(std::max(voice.priority, 0), 256)));
+    voice.channel = channel;
+    connectReverbSend(voice);
+    applyOcclusion(voice, true);
+    applySchedule(voice);
+    ERRCHECK(channel->setPaused(false));
+}
+
+void VoiceManager::applySchedule(Voice& voice) {
+    unsigned long long clock = getDSPClock();
+    // a start in the future is delayed on the master group's clock, which is the channel's parent clock
+    unsigned long long startDelay = voice.startClock > clock ? voice.startClock : 0;
+    if (startDelay || voice.endClock)
+        ERRCHECK(voice.channel->setDelay(startDelay, voice.endClock, true));
+    if (!voice.fadePoints.empty() && voice.fadePoints.back().first > clock) {
+        // fade points scale the channel volume, so the channel plays at full volume while it fades
+        ERRCHECK(voice.channel->removeFadePoints(0, ~0ULL));
+        ERRCHECK(voice.channel->setVolume(1.0f));
+        for (const auto& point : voice.fadePoints)
+            ERRCHECK(voice.channel->addFadePoint(point.first, point.second));
+    }
+}
+
+void VoiceManager::makeVirtual(Voice& voice) {
+    disconnectReverbSend(voice);
+    voice.channel->stop(); // may return FMOD_ERR_INVALID_HANDLE if the channel just ended, which is fine
+    voice.channel = nullptr;
+}
+
+void VoiceManager::removeVoice(int index) {
+    if (voices[index].channel) {
+        disconnectReverbSend(voices[index]);
+        voices[index].channel->stop();
+    }
+    voices[index] = voices.back();
+    voices.pop_back();
+}
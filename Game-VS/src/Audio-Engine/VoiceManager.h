@@ -0,0 +1,310 @@
+#pragma once
+///
+/// @file VoiceManager.h
+///
+/// Voice budget management for the AudioEngine. Every sound played through the AudioEngine becomes a voice,
+/// which is either real (playing on an FMOD::Channel) or virtual (tracked by playback time only, with no channel).
+/// Each update the most important, most audible voices are made real within the global and per-category budgets,
+/// and the rest are virtualized, so mixer cost stays bounded no matter how many emitters are active.
+///
+#include <FMOD/fmod.hpp>
+#include <iostream>
+#include <vector>
+#include "SoundInfo.h"
+#include "AudioOcclusion.h"
+
+// What to do when a category is at its voice limit and another voice is played in it
+typedef enum {
+    VOICE_STEAL_NONE,            // the new voice is rejected
+    VOICE_STEAL_OLDEST,          // the longest playing voice is stopped
+    VOICE_STEAL_QUIETEST,        // the least audible voice is stopped, if it is quieter than the new voice
+    VOICE_STEAL_LOWEST_PRIORITY  // the least important voice is stopped, if it is less important than the new voice
+} VOICE_STEAL_POLICY;
+
+/**
+ * Voice limits and policies of a sound category
+ */
+struct VoiceCategorySettings {
+    // max voices (real and virtual) in the category
+    int maxVoices = 32;
+    // max real voices in the category
+    int maxRealVoices = 16;
+    VOICE_STEAL_POLICY stealPolicy = VOICE_STEAL_QUIETEST;
+    // if true, voices whose audibility is below the VoiceManager's threshold are virtualized
+    bool virtualizeInaudible = true;
+};
+
+/**
+ * Voice counters of the most recent VoiceManager update, and the FMOD mixer CPU usage
+ */
+struct VoiceStats {
+    int realVoices = 0, virtualVoices = 0;
+    int categoryVoices[SOUND_CATEGORY_COUNT] = { }, categoryRealVoices[SOUND_CATEGORY_COUNT] = { };
+    // totals since the VoiceManager was initialized
+    unsigned long long steals = 0, rejected = 0, virtualizations = 0, devirtualizations = 0;
+    // channels FMOD reports as playing, and how many of those are real
+    int fmodChannels = 0, fmodRealChannels = 0;
+    // FMOD CPU usage in percent
+    float cpuDSP = 0.0f, cpuStream = 0.0f, cpuUpdate = 0.0f, cpuTotal = 0.0f;
+    // occlusion rays traced in the update and the time they took, 3D voices currently occluded,
+    // and the longest time since a voice's occlusion was last traced, in seconds
+    int occlusionRays = 0, occludedVoices = 0;
+    float occlusionMS = 0.0f, maxOcclusionAge = 0.0f;
+};
+
+/**
+ * Class which limits the number of real FMOD channels by priority, audibility and per-category budgets.
+ * Used by the AudioEngine; voices are referred to by integer IDs which the AudioEngine allocates.
+ */
+class VoiceManager {
+public:
+    // Default budget of real voices across all categories
+    static const int DEFAULT_MAX_REAL_VOICES = 64;
+    // Default audibility (volume * distance attenuation) below which voices are virtualized
+    static constexpr float DEFAULT_AUDIBILITY_THRESHOLD = 0.005f;
+    // Default number of occlusion rays per update
+    static const int DEFAULT_OCCLUSION_RAYS_PER_UPDATE = 16;
+
+    VoiceManager();
+
+    /**
+     * Initializes the voice manager. Must be called once the FMOD system has been initialized.
+     * @param minDistance, rolloffScale - 3D attenuation settings used for sounds, used to estimate audibility
+     */
+    void init(FMOD::System* system, float minDistance, float rolloffScale, int maxRealVoices = DEFAULT_MAX_REAL_VOICES);
+
+    /**
+     * Changes the budget of real voices, e.g. when channels are reserved for other uses. Takes effect on the next update.
+     */
+    void setMaxRealVoices(int maxRealVoices);
+
+    /**
+     * Plays a sound as a new voice, stealing a voice if the sound's category is full.
+     * @param position - 3D position of the voice, ignored for 2D sounds
+     * @param voiceID - ID of the new voice, allocated by the caller so it can be handed out before the voice is played
+     * @param startClock - DSP clock at which the voice starts, sample-accurately. 0 starts the voice immediately.
+     * @param pitch - playback speed, 1 for the original pitch
+     * @returns false if the voice was rejected
+     */
+    bool play(FMOD::Sound* sound, SoundInfo& soundInfo, FMOD_VECTOR position, int voiceID, unsigned long long startClock = 0, float pitch = 1.0f);
+
+    /**
+     * Stops and removes a voice
+     */
+    void stop(int voiceID);
+
+    /**
+     * Stops a voice at a DSP clock, sample-accurately. The voice stays active until then.
+     */
+    void stopAt(int voiceID, unsigned long long endClock);
+
+    /**
+     * Fades the volume of a voice between two DSP clocks, sample-accurately. Replaces the part of earlier fades
+     * from startClock on, so fades can be chained.
+     * @param fromVolume - volume at startClock, the voice is at this volume until the fade starts
+     */
+    void fadeVolume(int voiceID, float fromVolume, float toVolume, unsigned long long startClock, unsigned long long lengthSamples);
+
+    /**
+     * Checks if a voice is still playing, either as a real or virtual voice
+     */
+    bool isActive(int voiceID);
+
+    /**
+     * Fills a list with the IDs of all active voices, in ascending order
+     */
+    void getActiveVoiceIDs(std::vector<int>& voiceIDs);
+
+    /**
+     * Gets the channel of a voice, or nullptr if the voice is virtual or no longer active
+     */
+    FMOD::Channel* getChannel(int voiceID);
+
+    /**
+     * Sets the volume of a voice. The channel volume is only set by the voice manager when a voice becomes real,
+     * so callers updating a real voice's channel volume should call this as well. Cancels a scheduled fade.
+     */
+    void setVolume(int voiceID, float volume);
+
+    /**
+     * Sets the 3D position of a voice, updating its channel if it is real
+     */
+    void set3DPosition(int voiceID, FMOD_VECTOR position);
+
+    /**
+     * Sets the listener position used to estimate the audibility of 3D voices
+     */
+    void setListenerPosition(FMOD_VECTOR position);
+
+    /**
+     * Enables occlusion of 3D voices by the boxes between them and the listener.
+     * Each update traces at most raysPerUpdate rays, refreshing the voices' occlusion in turn, and the occlusion of
+     * each voice moves smoothly towards its latest traced value. It is applied with Channel::set3DOcclusion().
+     * @param occlusion - geometry to trace against, or nullptr to disable occlusion. Must not change while in use.
+     */
+    void setOcclusion(const AudioOcclusion* occlusion, int raysPerUpdate = DEFAULT_OCCLUSION_RAYS_PER_UPDATE);
+
+    /**
+     * Sends real voices to a reverb DSP instead of FMOD's built-in reverb. Each real channel gets a send connection
+     * to the DSP, at the voice's reverb amount.
+     * @param reverbInput - DSP to send to, or nullptr for the built-in reverb
+     */
+    void setReverbInput(FMOD::DSP* reverbInput);
+
+    /**
+     * Removes finished voices and reassigns the real voices. Should be called every frame before the FMOD update.
+     */
+    void update();
+
+    /**
+     * Sets the limits and policies of a sound category
+     */
+    void setCategorySettings(SOUND_CATEGORY category, VoiceCategorySettings settings);
+
+    /**
+     * Sets the audibility below which voices of categories with virtualizeInaudible are virtualized
+     */
+    void setAudibilityThreshold(float threshold);
+
+    /**
+     * Returns the counters of the most recent update
+     */
+    const VoiceStats& getStats();
+
+    /**
+     * Prints the counters of the most recent update to the console
+     */
+    void printStats();
+
+    /**
+     * Returns the current DSP clock of the master channel group, in output samples.
+     * Start, stop and fade clocks of voices are on this clock.
+     */
+    unsigned long long getDSPClock();
+
+private:
+    struct Voice {
+        int id;
+        FMOD::Sound* sound;
+        FMOD::Channel* channel; // nullptr while the voice is virtual
+        SOUND_CATEGORY category;
+        int priority;
+        bool is3D, loop;
+        FMOD_VECTOR position;
+        float volume, reverbAmount, pitch;
+        float audibility;
+        // DSP clock at which playback started, and the length of the sound at the voice's pitch, in output samples
+        unsigned long long startClock;
+        unsigned long long lengthSamples;
+        // DSP clock at which the voice is stopped, or 0 if it plays until it ends
+        unsigned long long endClock;
+        // scheduled fade points (DSP clock, volume), ending at the voice's volume. Empty without a fade
+        std::vector<std::pair<unsigned long long, float>> fadePoints;
+        // smoothed occlusion, the value of the latest ray it moves towards, and the occlusion set on the channel
+        float occlusion, occlusionTarget, appliedOcclusion;
+        // DSP clock of the latest ray, or 0 if none was traced, and which point around the voice the next ray goes to
+        unsigned long long occlusionClock;
+        int occlusionSample;
+        // the channel's head DSP and its send to the reverb DSP, while the voice is real
+        FMOD::DSP* channelHead;
+        FMOD::DSPConnection* reverbSend;
+    };
+
+    FMOD::System* system = nullptr;
+    FMOD::ChannelGroup* masterGroup = nullptr;
+    int outputRate = 44100;
+    float minDistance = 1.0f, rolloffScale = 1.0f;
+    int maxRealVoices = DEFAULT_MAX_REAL_VOICES;
+    float audibilityThreshold = DEFAULT_AUDIBILITY_THRESHOLD;
+    FMOD_VECTOR listenerPosition = { 0.0f, 0.0f, 0.0f };
+    VoiceCategorySettings categorySettings[SOUND_CATEGORY_COUNT];
+
+    std::vector<Voice> voices;
+    const AudioOcclusion* occlusionGeometry = nullptr;
+    FMOD::DSP* reverbInput = nullptr;
+    int occlusionRaysPerUpdate = DEFAULT_OCCLUSION_RAYS_PER_UPDATE;
+    // index of the voice whose occlusion is refreshed next, rays traced since the start of the update,
+    // and the DSP clock the occlusion was last smoothed at
+    int occlusionCursor = 0, occlusionRaysThisUpdate = 0;
+    unsigned long long occlusionSmoothClock = 0;
+    // seconds for the smoothed occlusion to move most of the way (63%) to a new traced value
+    static constexpr float OCCLUSION_SMOOTHING_SECONDS = 0.15f;
+    // rays are traced to points this far around a voice in turn, so the smoothed value is partial at building edges
+    static constexpr float OCCLUSION_SAMPLE_RADIUS = 0.75f;
+    // share of the occlusion applied to the reverb send, which reaches the listener around buildings
+    static constexpr float OCCLUSION_REVERB_SCALE = 0.5f;
+    // scratch list of voice indices sorted by importance, kept to avoid reallocating every update
+    std::vector<int> voiceOrder;
+    VoiceStats stats;
+
+    /**
+     * Returns the index of a voice in the voices list, or -1 if it is not active
+     */
+    int findVoice(int voiceID);
+
+    /**
+     * Estimates how loud a voice is at the listener, using FMOD's inverse rolloff model
+     */
+    float computeAudibility(const Voice& voice);
+
+    /**
+     * Traces a ray from the listener to a point around a voice, and sets the voice's target occlusion
+     */
+    void traceOcclusion(Voice& voice, unsigned long long clock);
+
+    /**
+     * Traces the update's occlusion rays, smooths the voices' occlusion and applies it to their channels
+     */
+    void updateOcclusion(unsigned long long clock);
+
+    /**
+     * Sets a real voice's occlusion on its channel, if it changed noticeably
+     */
+    void applyOcclusion(Voice& voice, bool force = false);
+
+    /**
+     * Sends a new real voice's channel to the reverb
+     */
+    void connectReverbSend(Voice& voice);
+
+    /**
+     * Removes a real voice's reverb send, before its channel is stopped
+     */
+    void disconnectReverbSend(Voice& voice);
+
+    /**
+     * Returns true if voice a is more important than voice b
+     */
+    static bool isMoreImportant(const Voice& a, const Voice& b);
+
+    /**
+     * Finds the voice in a category to stop for a new voice, according to the category's steal policy.
+     * @returns the index of the voice, or -1 if no voice should be stolen
+     */
+    int findVoiceToSteal(SOUND_CATEGORY category, const Voice& newVoice);
+
+    /**
+     * Selects which voices are real, then virtualizes and devirtualizes voices accordingly
+     */
+    void assignRealVoices();
+
+    /**
+     * Starts a channel for a virtual voice at its current playback position
+     */
+    void makeReal(Voice& voice);
+
+    /**
+     * Applies a voice's scheduled start, stop and fade to its channel
+     */
+    void applySchedule(Voice& voice);
+
+    /**
+     * Stops the channel of a real voice while its playback time continues to be tracked
+     */
+    void makeVirtual(Voice& voice);
+
+    /**
+     * Stops a voice's channel and removes it from the voices list
+     */
+    void removeVoice(int index);
+};
@@ -63,10 +63,42 @@ public:
         return m;
     }
 
+    /**
+     * Gets the object-space bounding box of the model.
+     */
+    void getLocalBounds(glm::vec3& localMin, glm::vec3& localMax) {
+        localMin = model.boundsMin;
+        localMax = model.boundsMax;
+    }
+
+    /**
+     * Gets the world-space axis-aligned bounding box of the model, using the current model matrix.
+     */
+    void getWorldBounds(glm::vec3& worldMin, glm::vec3& worldMax) {
+        glm::mat4 m = getModel();
+        worldMin = glm::vec3(FLT_MAX);
+        worldMax = glm::vec3(-FLT_MAX);
+        for (int i = 0; i < 8; i++) {
+            glm::vec3 corner(i & 1 ? model.boundsMax.x : model.boundsMin.x,
+                             i & 2 ? model.boundsMax.y : model.boundsMin.y,
+                             i & 4 ? model.boundsMax.z : model.boundsMin.z);
+            glm::vec3 p = glm::vec3(m * glm::vec4(corner, 1.0f));
+            worldMin = glm::min(worldMin, p);
+            worldMax = glm::max(worldMax, p);
+        }
+    }
+
     void setScale(glm::vec3 scale) {
         this->scale = scale;
     }
 
+    /**
+     * Gets the meshes of this object's model, e.g. to submit them to a RenderQueue.
+     */
+    std::vector<Mesh>& getMeshes() {
+        return model.meshes;
+    }
+
     const char* getObjFilePath() {
         return filepath;
     }
@@ -0,0 +1,444 @@
+#pragma once
+#include <glad.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include "GameObject.h"
+#include "Mesh.h"
+#include "RenderQueue.h"
+#include "Shader.h"
+#include "ShaderVariants.h"
+
+/**
+ * Per-frame counters of an IndirectRenderer
+ */
+struct IndirectStats {
+	int commands = 0, opaqueCommands = 0, transparentCommands = 0; // one draw command per mesh
+	int multiDraws = 0;    // glMultiDrawElementsIndirect calls, one per run of commands with the same GL state
+	int programBinds = 0, textureBinds = 0, vaoBinds = 0, blendChanges = 0;
+	double flushMS = 0.0;  // CPU time to sort, upload and issue the commands
+};
+
+/**
+ * A draw command in the GL_DRAW_INDIRECT_BUFFER, laid out as glMultiDrawElementsIndirect reads it
+ */
+struct DrawElementsIndirectCommand {
+	unsigned int count, instanceCount, firstIndex;
+	int baseVertex;
+	unsigned int baseInstance;
+};
+
+/**
+ * Per-draw data in the shader storage buffer, laid out as the DrawData struct of model.vs (std430)
+ */
+struct IndirectDrawData {
+	glm::mat4 model;
+	glm::vec4 materialLayers; // xyz: layers of the diffuse, specular and normal textures
+};
+
+/**
+ * GL 4.3 rendering path for static game objects, an alternative to the RenderQueue.
+ *
+ * build() suballocates the vertices and indices of every mesh into a few shared buffers (pools), so that all meshes
+ * in a pool share a VAO. Each frame, the submitted meshes become draw commands in a GL_DRAW_INDIRECT_BUFFER, sorted
+ * like the RenderQueue's draws, and their model matrices and texture layers go into a shader storage buffer. Each
+ * run of commands with the same program, textures and pool is issued with one glMultiDrawElementsIndirect call.
+ * With texture arrays (see MaterialPacker.h), meshes of many materials share their textures, so runs are long.
+ *
+ * A command's baseInstance is its index in the storage buffer; the shaders (the INDIRECT feature) read it through a
+ * per-instance draw id attribute, since gl_BaseInstance needs GLSL 4.6.
+ */
+class IndirectRenderer {
+public:
+	// vertices per pool; meshes that don't fit in the current pool start a new one
+	static const unsigned int MAX_POOL_VERTICES = 1 << 20;
+	// attribute location of the draw id, after those of the mesh vertices and of instanced objects
+	static const unsigned int DRAW_ID_LOCATION = 7;
+
+	/**
+	 * Returns true if the current context supports this renderer (GL 4.3)
+	 */
+	static bool supported() {
+		return GLAD_GL_VERSION_4_3 != 0;
+	}
+
+	/**
+	 * Copies the vertices and indices of the objects' meshes into the shared buffers. Call after the objects'
+	 * textures are packed, if they are. Meshes of objects not built here are not drawn.
+	 */
+	void build(const std::vector<GameObject*>& objects) {
+		release();
+		std::vector<Mesh*> meshes;
+		for (GameObject* object : objects)
+			for (Mesh& mesh : object->getMeshes()) {
+				if (records.count(&mesh) || mesh.vertices.empty() || mesh.indices.empty())
+					continue;
+				unsigned int vertexCount = (unsigned int)mesh.vertices.size();
+				if (pools.empty() || (pools.back().vertexCount > 0 && pools.back().vertexCount + vertexCount > MAX_POOL_VERTICES))
+					pools.push_back(Pool());
+				Pool& pool = pools.back();
+				MeshRecord record;
+				record.pool = (unsigned int)pools.size() - 1;
+				record.firstIndex = pool.indexCount;
+				record.indexCount = (unsigned int)mesh.indices.size();
+				record.baseVertex = (int)pool.vertexCount;
+				record.materialID = getMaterialID(mesh, false);
+				record.arrayMaterialID = mesh.materialIndex ? getMaterialID(mesh, true) : 0;
+				pool.vertexCount += vertexCount;
+				pool.indexCount += record.indexCount;
+				records[&mesh] = record;
+				meshes.push_back(&mesh);
+			}
+
+		for (Pool& pool : pools) {
+			glGenVertexArrays(1, &pool.VAO);
+			glGenBuffers(1, &pool.VBO);
+			glGenBuffers(1, &pool.EBO);
+			glBindVertexArray(pool.VAO);
+			glBindBuffer(GL_ARRAY_BUFFER, pool.VBO);
+			glBufferData(GL_ARRAY_BUFFER, pool.vertexCount * sizeof(Vertex), nullptr, GL_STATIC_DRAW);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.EBO);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, pool.indexCount * sizeof(unsigned int), nullptr, GL_STATIC_DRAW);
+			// the same vertex attributes as Mesh::setupMesh()
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+			glEnableVertexAttribArray(3);
+			glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+			glEnableVertexAttribArray(4);
+			glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+		}
+		for (Mesh* mesh : meshes) {
+			const MeshRecord& record = records[mesh];
+			Pool& pool = pools[record.pool];
+			glBindVertexArray(pool.VAO);
+			glBindBuffer(GL_ARRAY_BUFFER, pool.VBO);
+			glBufferSubData(GL_ARRAY_BUFFER, record.baseVertex * sizeof(Vertex), mesh->vertices.size() * sizeof(Vertex), &mesh->vertices[0]);
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, record.firstIndex * sizeof(unsigned int), record.indexCount * sizeof(unsigned int), &mesh->indices[0]);
+		}
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		glGenBuffers(1, &commandBuffer);
+		glGenBuffers(1, &drawBuffer);
+		reserveDrawIDs((unsigned int)meshes.size());
+	}
+
+	/**
+	 * Deletes the shared buffers
+	 */
+	void release() {
+		for (Pool& pool : pools) {
+			glDeleteVertexArrays(1, &pool.VAO);
+			glDeleteBuffers(1, &pool.VBO);
+			glDeleteBuffers(1, &pool.EBO);
+		}
+		pools.clear();
+		records.clear();
+		materialIDs.clear();
+		unsigned int buffers[] = { commandBuffer, drawBuffer, drawIDBuffer };
+		if (commandBuffer)
+			glDeleteBuffers(3, buffers);
+		commandBuffer = drawBuffer = drawIDBuffer = 0;
+		drawIDCapacity = 0;
+	}
+
+	/**
+	 * Enables or disables drawing packed meshes from their texture arrays, as RenderQueue::setTextureArrays()
+	 */
+	void setTextureArrays(bool enabled) {
+		textureArrays = enabled;
+	}
+
+	/**
+	 * Adds all meshes of a game object to the frame, each drawn with the INDIRECT variant of its features.
+	 * Destroyed objects are skipped.
+	 * @param cameraPosition used to compute the sort depth of the object
+	 */
+	void submit(GameObject& gameObject, ShaderVariants& variants, glm::vec3 cameraPosition) {
+		if (gameObject.isDestroyed())
+			return;
+		glm::vec3 boundsMin, boundsMax;
+		gameObject.getWorldBounds(boundsMin, boundsMax);
+		float distance = glm::length(0.5f * (boundsMin + boundsMax) - cameraPosition);
+		glm::mat4 model = gameObject.getModel();
+		for (Mesh& mesh : gameObject.getMeshes()) {
+			auto record = records.find(&mesh);
+			if (record == records.end())
+				continue;
+			unsigned int features = mesh.shaderFeatures | variants.getSceneFeatures() | SHADER_INDIRECT;
+			if (!textureArrays)
+				features &= ~SHADER_TEXTURE_ARRAY;
+			features = ShaderVariants::resolve(features);
+			DrawItem item;
+			item.mesh = &mesh;
+			item.record = &record->second;
+			item.shader = variants.get(features);
+			item.features = features;
+			item.material = (features & SHADER_TEXTURE_ARRAY) ? record->second.arrayMaterialID : record->second.materialID;
+			item.key = makeKey(item, mesh.translucent, distance);
+			item.draw = (unsigned int)draws.size();
+			items.push_back(item);
+			draws.push_back({ model, glm::vec4(mesh.materialLayers, 0.0f) });
+		}
+	}
+
+	/**
+	 * Sorts the frame's commands, uploads them and their draw data, and draws them, then empties the frame.
+	 * Leaves blending in the state of the last pass drawn.
+	 */
+	void flush(const glm::mat4& projection, const glm::mat4& view) {
+		auto start = std::chrono::high_resolution_clock::now();
+		stats = IndirectStats();
+		stateCache.invalidate();
+		std::sort(items.begin(), items.end(), [](const DrawItem& a, const DrawItem& b) { return a.key < b.key; });
+
+		// commands and draw data in sorted order, so each command's baseInstance is its own index
+		commands.clear();
+		sortedDraws.clear();
+		for (unsigned int i = 0; i < items.size(); i++) {
+			const MeshRecord& record = *items[i].record;
+			commands.push_back({ record.indexCount, 1, record.firstIndex, record.baseVertex, i });
+			sortedDraws.push_back(draws[items[i].draw]);
+		}
+		if (!commands.empty()) {
+			reserveDrawIDs((unsigned int)commands.size());
+			// orphan the buffers, so the driver doesn't wait for the previous frame's draws to finish reading them
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+			glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+			glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sortedDraws.size() * sizeof(IndirectDrawData), nullptr, GL_STREAM_DRAW);
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sortedDraws.size() * sizeof(IndirectDrawData), sortedDraws.data());
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, drawBuffer);
+		}
+
+		Shader* currentShader = nullptr;
+		for (size_t first = 0; first < items.size();) {
+			const DrawItem& item = items[first];
+			bool transparent = (item.key >> PASS_SHIFT) == PASS_TRANSPARENT;
+			size_t last = first + 1;
+			while (last < items.size() && sameState(items[last], item))
+				last++;
+			stats.blendChanges += stateCache.setBlend(transparent);
+			if (item.shader != currentShader) {
+				currentShader = item.shader;
+				stats.programBinds += stateCache.useProgram(currentShader->ID);
+				currentShader->setMat4("projection", projection);
+				currentShader->setMat4("view", view);
+			}
+			// the meshes of a run have the same textures (or texture arrays) in the same order
+			Mesh& mesh = *item.mesh;
+			bool packed = (item.features & SHADER_TEXTURE_ARRAY) != 0;
+			for (unsigned int i = 0; i < mesh.textures.size(); i++) {
+				if (mesh.samplerFeatures[i] & ~item.features)
+					continue;
+				stateCache.setSampler(currentShader->ID, mesh.samplerIDs[i], mesh.samplerNames[i], i);
+				if (packed)
+					stats.textureBinds += stateCache.bindTexture(i, mesh.textures[i].arrayID, GL_TEXTURE_2D_ARRAY);
+				else
+					stats.textureBinds += stateCache.bindTexture(i, mesh.textures[i].id);
+			}
+			stats.vaoBinds += stateCache.bindVertexArray(pools[item.record->pool].VAO);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(first * sizeof(DrawElementsIndirectCommand)), (GLsizei)(last - first), 0);
+			stats.multiDraws++;
+			(transparent ? stats.transparentCommands : stats.opaqueCommands) += (int)(last - first);
+			first = last;
+		}
+		stats.commands = (int)items.size();
+		glBindVertexArray(0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		items.clear();
+		draws.clear();
+		stats.flushMS = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	/**
+	 * Returns the counters of the most recent flush()
+	 */
+	const IndirectStats& getStats() const {
+		return stats;
+	}
+
+	/**
+	 * Prints the counters of the most recent flush() to the console
+	 */
+	void printStats() const {
+		size_t vertices = 0, indices = 0;
+		for (const Pool& pool : pools) {
+			vertices += pool.vertexCount;
+			indices += pool.indexCount;
+		}
+		std::cout << "Indirect Renderer: " << stats.commands << " commands (" << stats.opaqueCommands << " opaque, "
+		          << stats.transparentCommands << " transparent) in " << stats.multiDraws << " multi-draws, " << pools.size()
+		          << " pools (" << std::fixed << std::setprecision(1) << (vertices * sizeof(Vertex) + indices * sizeof(unsigned int)) / (1024.0 * 1024.0)
+		          << " MB), texture arrays " << (textureArrays ? "on" : "off") << '\n'
+		          << "  program binds " << stats.programBinds << ", texture binds " << stats.textureBinds << ", VAO binds "
+		          << stats.vaoBinds << ", blend changes " << stats.blendChanges << ", flush " << std::setprecision(3)
+		          << stats.flushMS << " ms\n" << std::defaultfloat;
+	}
+
+	/**
+	 * Draws the objects with a RenderQueue (the GL 3.3 path) and with this renderer into offscreen framebuffers from
+	 * each eye position, compares the images and prints the differences. The renderer must be built with the objects.
+	 * @param tolerance - fraction of pixels that may differ by more than 2/255, e.g. where coplanar faces are drawn in
+	 *                    another order
+	 * @returns true if the images of every view match
+	 */
+	bool validate(const std::vector<GameObject*>& objects, ShaderVariants& variants, const std::vector<glm::vec3>& eyes,
+	              glm::vec3 target, int width, int height, float tolerance = 0.001f) {
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		unsigned int framebuffer, renderbuffers[2];
+		glGenFramebuffers(1, &framebuffer);
+		glGenRenderbuffers(2, renderbuffers);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+		glViewport(0, 0, width, height);
+		glEnable(GL_DEPTH_TEST);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+		RenderQueue queue;
+		queue.setTextureArrays(textureArrays);
+		glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)width / (float)height, 0.1f, 100.0f);
+		std::vector<unsigned char> expected((size_t)width * height * 4), actual(expected.size());
+		bool passed = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		for (size_t e = 0; e < eyes.size() && passed; e++) {
+			glm::mat4 view = glm::lookAt(eyes[e], target, glm::vec3(0.0f, 1.0f, 0.0f));
+			for (int path = 0; path < 2; path++) {
+				glClearColor(0.1f, 0.2f, 0.3f, 1.0f);
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				for (GameObject* object : objects)
+					path == 0 ? queue.submit(*object, variants, eyes[e]) : submit(*object, variants, eyes[e]);
+				path == 0 ? queue.flush(projection, view) : flush(projection, view);
+				glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, path == 0 ? expected.data() : actual.data());
+			}
+			int differing = 0, maxDifference = 0;
+			for (size_t p = 0; p < expected.size(); p += 4) {
+				int difference = 0;
+				for (int c = 0; c < 4; c++)
+					difference = std::max(difference, std::abs((int)expected[p + c] - (int)actual[p + c]));
+				differing += difference > 2;
+				maxDifference = std::max(maxDifference, difference);
+			}
+			float fraction = (float)differing / (width * height);
+			passed = fraction <= tolerance;
+			std::cout << "View " << e << ": " << queue.getStats().drawCalls << " draw calls, " << stats.commands << " commands in "
+			          << stats.multiDraws << " multi-draws, " << differing << " pixels differ (" << std::fixed << std::setprecision(3)
+			          << 100.0f * fraction << "%), max difference " << maxDifference << (passed ? "" : " FAILED") << '\n' << std::defaultfloat;
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteRenderbuffers(2, renderbuffers);
+		glDeleteFramebuffers(1, &framebuffer);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+		glDisable(GL_BLEND);
+		return passed;
+	}
+
+private:
+	struct Pool {
+		unsigned int VAO = 0, VBO = 0, EBO = 0;
+		unsigned int vertexCount = 0, indexCount = 0;
+	};
+
+	// where a mesh is in the pools
+	struct MeshRecord {
+		unsigned int pool, firstIndex, indexCount;
+		int baseVertex;
+		unsigned int materialID, arrayMaterialID; // ids of the mesh's 2D textures and of its texture arrays
+	};
+
+	struct DrawItem {
+		unsigned long long key;
+		Mesh* mesh;
+		const MeshRecord* record;
+		Shader* shader;
+		unsigned int features;
+		unsigned int material;
+		unsigned int draw; // index into draws
+	};
+
+	// Sort key layout, from the most significant bit, as the RenderQueue's with the pool in place of the VAO:
+	//   opaque:      pass(2) | shader(8) | material(16) | pool(8) | depth(22, near first)
+	//   transparent: pass(2) | depth(22, far first) | shader(8) | material(16) | pool(8)
+	static const int PASS_SHIFT = 62;
+	static const unsigned long long PASS_OPAQUE = 0, PASS_TRANSPARENT = 1;
+	static const unsigned int DEPTH_BITS = 22;
+	// distance at which the depth part of the key saturates; matches the far plane used in Main
+	const float MAX_SORT_DISTANCE = 100.0f;
+
+	std::vector<Pool> pools;
+	std::unordered_map<const Mesh*, MeshRecord> records;
+	std::map<std::vector<unsigned int>, unsigned int> materialIDs;
+	unsigned int commandBuffer = 0, drawBuffer = 0, drawIDBuffer = 0, drawIDCapacity = 0;
+	std::vector<DrawItem> items;
+	std::vector<IndirectDrawData> draws, sortedDraws;
+	std::vector<DrawElementsIndirectCommand> commands;
+	RenderStateCache stateCache;
+	IndirectStats stats;
+	bool textureArrays = true;
+
+	unsigned long long makeKey(const DrawItem& item, bool translucent, float distance) const {
+		const unsigned long long depthMax = (1ull << DEPTH_BITS) - 1;
+		unsigned long long depth = (unsigned long long)(std::min(std::max(distance / MAX_SORT_DISTANCE, 0.0f), 1.0f) * depthMax);
+		unsigned long long program = item.shader->ID & 0xFF, material = item.material & 0xFFFF, pool = item.record->pool & 0xFF;
+		if (translucent)
+			return (PASS_TRANSPARENT << PASS_SHIFT) | ((depthMax - depth) << 32) | (program << 24) | (material << 8) | pool;
+		return (PASS_OPAQUE << PASS_SHIFT) | (program << 46) | (material << 30) | (pool << 22) | depth;
+	}
+
+	static bool sameState(const DrawItem& a, const DrawItem& b) {
+		return (a.key >> PASS_SHIFT) == (b.key >> PASS_SHIFT) && a.shader == b.shader && a.material == b.material && a.record->pool == b.record->pool;
+	}
+
+	// Meshes that use the same textures in the same order share a material id; with texture arrays, the same arrays
+	unsigned int getMaterialID(const Mesh& mesh, bool packed) {
+		std::vector<unsigned int> textureIDs;
+		for (const Texture& texture : mesh.textures)
+			textureIDs.push_back(packed ? texture.arrayID : texture.id);
+		auto it = materialIDs.find(textureIDs);
+		if (it != materialIDs.end())
+			return it->second;
+		unsigned int id = (unsigned int)materialIDs.size() + 1;
+		materialIDs[textureIDs] = id;
+		return id;
+	}
+
+	// The draw id attribute reads 0, 1, 2... from this buffer, offset by the command's baseInstance (divisor 1)
+	void reserveDrawIDs(unsigned int count) {
+		if (count <= drawIDCapacity)
+			return;
+		drawIDCapacity = std::max(count, drawIDCapacity * 2);
+		std::vector<unsigned int> ids(drawIDCapacity);
+		for (unsigned int i = 0; i < drawIDCapacity; i++)
+			ids[i] = i;
+		if (!drawIDBuffer)
+			glGenBuffers(1, &drawIDBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, drawIDBuffer);
+		glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(unsigned int), ids.data(), GL_STATIC_DRAW);
+		for (Pool& pool : pools) {
+			glBindVertexArray(pool.VAO);
+			glEnableVertexAttribArray(DRAW_ID_LOCATION);
+			glVertexAttribIPointer(DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, sizeof(unsigned int), (void*)0);
+			glVertexAttribDivisor(DRAW_ID_LOCATION, 1);
+		}
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		// the VAO bindings changed behind the state cache
+		stateCache.invalidate();
+	}
+};
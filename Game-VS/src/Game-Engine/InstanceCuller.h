@@ -0,0 +1,643 @@
+#pragma once
+#include <glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#include "IndirectRenderer.h"
+#include "InstancedObject.h"
+#include "Shader.h"
+
+/**
+ * Counters of an InstanceCuller. The culled counts are read back from the GPU a few frames after the culling.
+ */
+struct InstanceCullStats {
+	int objects = 0, instances = 0;           // culled by the most recent cull()
+	int outsideView = 0, occluded = 0, visible = 0; // of the most recent frame read back
+	int readbackLatency = 0; // frames between that culling and its readback
+	int stalls = 0;          // readbacks that waited for the GPU, since every counter buffer was in use
+	bool hiz = false;        // if the most recent cull() tested against a Hi-Z pyramid
+	double cullMS = 0.0, hizMS = 0.0; // CPU time to issue the culling and the pyramid building
+};
+
+/**
+ * GL 4.3 culling of the instances of instanced objects (e.g. grass) on the GPU, for counts too large to cull one
+ * by one on the CPU. A compute shader (res/shaders/cull.comp) tests the world bounding sphere of each instance
+ * against the view frustum and, optionally, against a max-depth Hi-Z pyramid built from the depth buffer of the
+ * previous frame (res/shaders/hiz.comp), with the same test as the OcclusionCuller's. The visible instances'
+ * matrices are compacted into a buffer that the object's instance attributes read, and counted in the
+ * instanceCount of a DrawElementsIndirectCommand per mesh, so the draws use the result without the CPU reading it
+ * back. Prefix sums place the visible instances in their original order, so blended instances draw in the same
+ * order every frame.
+ *
+ * The totals of the culling go into an atomic counter buffer, one of a ring that is read back once its fence has
+ * signaled, a few frames later. cullReference() is the CPU version of the shader, and validate() compares the two.
+ */
+class InstanceCuller {
+public:
+	// Hi-Z pyramid resolution, powers of two so that every level halves cleanly, as the OcclusionCuller's
+	static const int HIZ_WIDTH = 512, HIZ_HEIGHT = 256;
+	// counter buffers in flight; more hide more latency, a readback stalls only if all are in use
+	static const int COUNTER_BUFFERS = 4;
+	// local size of cull.comp
+	static const int WORKGROUP_SIZE = 64;
+
+	/**
+	 * Returns true if the current context supports this culler (GL 4.3)
+	 */
+	static bool supported() {
+		return GLAD_GL_VERSION_4_3 != 0;
+	}
+
+	/**
+	 * Compiles the compute shaders and makes the Hi-Z pyramid. Requires a current GL 4.3 context.
+	 */
+	InstanceCuller(const char* cullPath = "res/shaders/cull.comp", const char* hizPath = "res/shaders/hiz.comp")
+		: cullShader(Shader::fromComputeFile(cullPath)), hizShader(Shader::fromComputeFile(hizPath)) {
+		for (int w = HIZ_WIDTH, h = HIZ_HEIGHT; w >= 1 && h >= 1; w /= 2, h /= 2)
+			hizSizes.push_back(glm::ivec2(w, h));
+		glGenTextures(1, &hizTexture);
+		glBindTexture(GL_TEXTURE_2D, hizTexture);
+		glTexStorage2D(GL_TEXTURE_2D, (GLsizei)hizSizes.size(), GL_R32F, HIZ_WIDTH, HIZ_HEIGHT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glGenBuffers(COUNTER_BUFFERS, counterBuffers);
+		for (int i = 0; i < COUNTER_BUFFERS; i++) {
+			glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counterBuffers[i]);
+			glBufferData(GL_ATOMIC_COUNTER_BUFFER, COUNTERS * sizeof(unsigned int), nullptr, GL_DYNAMIC_READ);
+			fences[i] = nullptr;
+			slotFrames[i] = 0;
+		}
+		glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+	}
+
+	/**
+	 * Adds a set of instances to cull every frame
+	 * @param matrices, count - the model matrices of the instances, which must not change afterward
+	 * @param boundsMin, boundsMax - object-space bounding box of the instanced model
+	 * @param indexCounts - the number of indices of each mesh of the model, which gets a draw command each
+	 * @returns the index of the set
+	 */
+	int add(const glm::mat4* matrices, int count, glm::vec3 boundsMin, glm::vec3 boundsMax, const std::vector<unsigned int>& indexCounts) {
+		InstanceSet set;
+		set.count = count;
+		set.matrices.assign(matrices, matrices + count);
+		// the sphere around the bounding box, scaled by the largest scale of each instance
+		glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+		float radius = glm::length(boundsMax - boundsMin) * 0.5f;
+		for (const glm::mat4& matrix : set.matrices) {
+			float scale = std::max(glm::length(glm::vec3(matrix[0])), std::max(glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2]))));
+			set.spheres.push_back(glm::vec4(glm::vec3(matrix * glm::vec4(center, 1.0f)), radius * scale));
+		}
+		for (unsigned int indexCount : indexCounts)
+			set.commands.push_back(DrawElementsIndirectCommand{ indexCount, 0, 0, 0, 0 });
+		if (set.commands.empty())
+			set.commands.push_back(DrawElementsIndirectCommand{ 0, 0, 0, 0, 0 }); // counts the visible instances, draws nothing
+
+		unsigned int buffers[7];
+		glGenBuffers(7, buffers);
+		set.sphereBuffer = buffers[0], set.matrixBuffer = buffers[1], set.visibleMatrixBuffer = buffers[2];
+		set.visibleIndexBuffer = buffers[3], set.commandBuffer = buffers[4], set.groupBuffer = buffers[5], set.slotBuffer = buffers[6];
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, set.sphereBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, count * sizeof(glm::vec4), set.spheres.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, set.matrixBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, count * sizeof(glm::mat4), set.matrices.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, set.visibleMatrixBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, count * sizeof(glm::mat4), nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, set.visibleIndexBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, count * sizeof(unsigned int), nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, set.commandBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, set.commands.size() * sizeof(DrawElementsIndirectCommand), set.commands.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, set.groupBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, (count + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE * sizeof(unsigned int), nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, set.slotBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, count * sizeof(unsigned int), nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		sets.push_back(set);
+		return (int)sets.size() - 1;
+	}
+
+	/**
+	 * Adds the instances of an instanced object, to be drawn with InstancedObject::drawInstancesIndirect()
+	 * @returns the index of the set
+	 */
+	int add(const InstancedObject& object) {
+		std::vector<unsigned int> indexCounts;
+		for (const Mesh& mesh : object.getModel().meshes)
+			indexCounts.push_back((unsigned int)mesh.indices.size());
+		return add(object.getModelMatrices(), object.getInstanceCount(), object.getModel().boundsMin, object.getModel().boundsMax, indexCounts);
+	}
+
+	/**
+	 * Deletes the sets and the GL objects of the culler
+	 */
+	void release() {
+		for (InstanceSet& set : sets) {
+			unsigned int buffers[7] = { set.sphereBuffer, set.matrixBuffer, set.visibleMatrixBuffer, set.visibleIndexBuffer,
+			                            set.commandBuffer, set.groupBuffer, set.slotBuffer };
+			glDeleteBuffers(7, buffers);
+		}
+		sets.clear();
+		for (int i = 0; i < COUNTER_BUFFERS; i++)
+			if (fences[i]) {
+				glDeleteSync(fences[i]);
+				fences[i] = nullptr;
+			}
+		glDeleteBuffers(COUNTER_BUFFERS, counterBuffers);
+		glDeleteTextures(1, &hizTexture);
+		if (depthTexture)
+			glDeleteTextures(1, &depthTexture);
+		hizTexture = depthTexture = 0;
+		hizValid = false;
+	}
+
+	/**
+	 * Enables or disables testing against the Hi-Z pyramid, leaving only the frustum test
+	 */
+	void setOcclusion(bool enabled) {
+		occlusion = enabled;
+		hizValid = hizValid && enabled;
+	}
+
+	bool occlusionEnabled() const {
+		return occlusion;
+	}
+
+	/**
+	 * Culls every set against the view frustum, and against the Hi-Z pyramid of the previous frame if occlusion is
+	 * enabled and updateHiZ() was called, leaving the visible instances and the draw commands for this frame's draws
+	 * @param viewProjection - the combined projection * view matrix of the camera
+	 */
+	void cull(const glm::mat4& viewProjection) {
+		auto start = std::chrono::high_resolution_clock::now();
+		// read back the counters of earlier frames that have finished, waiting only if the next buffer is still in use
+		int slot = (int)(frame % COUNTER_BUFFERS);
+		collectCounters(-1);
+		if (fences[slot]) {
+			stats.stalls++;
+			collectCounters(slotFrames[slot]);
+		}
+		unsigned int zeros[COUNTERS] = { 0 };
+		glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counterBuffers[slot]);
+		glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(zeros), zeros);
+		glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, counterBuffers[slot]);
+
+		glm::vec4 planes[6];
+		frustumPlanes(viewProjection, planes);
+		stats.hiz = occlusion && hizValid;
+		cullShader.use();
+		for (int p = 0; p < 6; p++)
+			cullShader.setVec4("frustumPlanes[" + std::to_string(p) + "]", planes[p]);
+		cullShader.setBool("hizEnabled", stats.hiz);
+		if (stats.hiz) {
+			cullShader.setMat4("hizViewProjection", hizViewProjection);
+			glUniform2i(glGetUniformLocation(cullShader.ID, "hizSize"), HIZ_WIDTH, HIZ_HEIGHT);
+			cullShader.setInt("hizLevels", (int)hizSizes.size());
+			cullShader.setInt("hiz", 0);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, hizTexture);
+		}
+		stats.objects = (int)sets.size();
+		stats.instances = 0;
+		for (const InstanceSet& set : sets) {
+			if (set.count == 0)
+				continue; // its commands keep the instanceCount of 0 they were made with
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, set.sphereBuffer);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, set.matrixBuffer);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, set.visibleMatrixBuffer);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, set.visibleIndexBuffer);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, set.commandBuffer);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, set.groupBuffer);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, set.slotBuffer);
+			int groups = (set.count + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+			cullShader.setInt("instanceCount", set.count);
+			cullShader.setInt("groupCount", groups);
+			cullShader.setInt("commandCount", (int)set.commands.size());
+			// test the instances, sum the visible ones of each workgroup, then place each workgroup's after the
+			// previous workgroups', each stage reading what the previous one wrote
+			cullShader.setInt("stage", 0);
+			glDispatchCompute(groups, 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			cullShader.setInt("stage", 1);
+			glDispatchCompute(1, 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			cullShader.setInt("stage", 2);
+			glDispatchCompute(groups, 1, 1);
+			stats.instances += set.count;
+		}
+		// the draws read the commands and matrices, and readbacks the counters
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+		fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		slotFrames[slot] = frame++;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+		glUseProgram(0);
+		stats.cullMS = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	/**
+	 * Builds the Hi-Z pyramid from the depth buffer of the read framebuffer, for the next cull(). Call once the
+	 * frame's opaque objects are drawn, e.g. before swapping buffers. Does nothing if occlusion is disabled.
+	 * @param viewProjection - the matrix the frame was drawn with
+	 * @param width, height - size of the depth buffer
+	 */
+	void updateHiZ(const glm::mat4& viewProjection, int width, int height) {
+		if (!occlusion || width <= 0 || height <= 0)
+			return;
+		auto start = std::chrono::high_resolution_clock::now();
+		glActiveTexture(GL_TEXTURE0);
+		if (width != depthWidth || height != depthHeight) {
+			if (!depthTexture)
+				glGenTextures(1, &depthTexture);
+			glBindTexture(GL_TEXTURE_2D, depthTexture);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+			depthWidth = width, depthHeight = height;
+		}
+		glBindTexture(GL_TEXTURE_2D, depthTexture);
+		glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+
+		hizShader.use();
+		hizShader.setInt("depthTexture", 0);
+		glUniform2i(glGetUniformLocation(hizShader.ID, "depthSize"), width, height);
+		for (int level = 0; level < (int)hizSizes.size(); level++) {
+			glBindImageTexture(0, hizTexture, std::max(level - 1, 0), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+			glBindImageTexture(1, hizTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+			hizShader.setInt("sourceLevel", level - 1);
+			glUniform2i(glGetUniformLocation(hizShader.ID, "destinationSize"), hizSizes[level].x, hizSizes[level].y);
+			glDispatchCompute((hizSizes[level].x + 7) / 8, (hizSizes[level].y + 7) / 8, 1);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		}
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glUseProgram(0);
+		hizViewProjection = viewProjection;
+		hizValid = true;
+		stats.hizMS = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	/**
+	 * Waits for the culling of every frame so far and reads back its counters
+	 */
+	void finish() {
+		collectCounters(frame);
+	}
+
+	// the model matrices of the visible instances of a set, after cull()
+	unsigned int getVisibleMatrixBuffer(int set) const {
+		return sets[set].visibleMatrixBuffer;
+	}
+
+	// the draw commands of a set, one per mesh, after cull()
+	unsigned int getCommandBuffer(int set) const {
+		return sets[set].commandBuffer;
+	}
+
+	// the world bounding spheres of the instances of a set (xyz: center, w: radius)
+	const std::vector<glm::vec4>& getSpheres(int set) const {
+		return sets[set].spheres;
+	}
+
+	const InstanceCullStats& getStats() const {
+		return stats;
+	}
+
+	/**
+	 * Prints the counters to the console
+	 */
+	void printStats() const {
+		std::cout << "Instance Culler: " << stats.visible << " visible, " << stats.occluded << " occluded, " << stats.outsideView
+		          << " outside view, of " << stats.instances << " instances in " << stats.objects << " objects (read back "
+		          << stats.readbackLatency << " frames late, " << stats.stalls << " stalls)\n  Hi-Z " << (stats.hiz ? "on" : "off")
+		          << ", cull " << std::fixed << std::setprecision(3) << stats.cullMS << " ms, hi-z " << stats.hizMS << " ms\n"
+		          << std::defaultfloat;
+	}
+
+	/**
+	 * Sets the planes of the view frustum, normalized and facing inward: left, right, bottom, top, near, far
+	 */
+	static void frustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]) {
+		glm::vec4 rows[4];
+		for (int i = 0; i < 4; i++)
+			rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+		for (int i = 0; i < 6; i++) {
+			planes[i] = i % 2 == 0 ? rows[3] + rows[i / 2] : rows[3] - rows[i / 2];
+			planes[i] /= glm::length(glm::vec3(planes[i]));
+		}
+	}
+
+	/**
+	 * CPU version of cull.comp, for testing it
+	 * @param hizLevels - the Hi-Z pyramid, as buildHiZReference() or readHiZ() return it, or empty for no occlusion test
+	 * @param counts - set to the number of spheres outside the view, occluded and visible
+	 * @returns the indices of the visible spheres, in order
+	 */
+	static std::vector<unsigned int> cullReference(const std::vector<glm::vec4>& spheres, const glm::mat4& viewProjection,
+	                                               const std::vector<std::vector<float>>& hizLevels, const glm::mat4& hizViewProjection,
+	                                               InstanceCullStats& counts) {
+		glm::vec4 planes[6];
+		frustumPlanes(viewProjection, planes);
+		std::vector<unsigned int> visible;
+		counts.outsideView = counts.occluded = counts.visible = 0;
+		for (unsigned int i = 0; i < spheres.size(); i++) {
+			const glm::vec4& sphere = spheres[i];
+			bool outside = false;
+			for (int p = 0; p < 6 && !outside; p++)
+				outside = glm::dot(glm::vec3(planes[p]), glm::vec3(sphere)) + planes[p].w < -sphere.w;
+			if (outside)
+				counts.outsideView++;
+			else if (!hizLevels.empty() && occludedReference(glm::vec3(sphere), sphere.w, hizLevels, hizViewProjection))
+				counts.occluded++;
+			else
+				visible.push_back(i);
+		}
+		counts.visible = (int)visible.size();
+		return visible;
+	}
+
+	/**
+	 * CPU version of hiz.comp, for testing it: the Hi-Z pyramid of a depth buffer (row 0 is the bottom of the screen)
+	 */
+	static std::vector<std::vector<float>> buildHiZReference(const std::vector<float>& depth, int width, int height) {
+		std::vector<std::vector<float>> levels;
+		for (int w = HIZ_WIDTH, h = HIZ_HEIGHT; w >= 1 && h >= 1; w /= 2, h /= 2) {
+			std::vector<float> level((size_t)w * h, 0.0f);
+			for (int y = 0; y < h; y++)
+				for (int x = 0; x < w; x++) {
+					float& d = level[(size_t)y * w + x];
+					if (levels.empty()) {
+						int x1 = std::min(((x + 1) * width + w - 1) / w, width), y1 = std::min(((y + 1) * height + h - 1) / h, height);
+						for (int sy = y * height / h; sy < y1; sy++)
+							for (int sx = x * width / w; sx < x1; sx++)
+								d = std::max(d, depth[(size_t)sy * width + sx]);
+					}
+					else {
+						const std::vector<float>& src = levels.back();
+						const float* s0 = &src[(size_t)(2 * y) * (2 * w) + 2 * x], * s1 = s0 + 2 * w;
+						d = std::max(std::max(s0[0], s0[1]), std::max(s1[0], s1[1]));
+					}
+				}
+			levels.push_back(level);
+		}
+		return levels;
+	}
+
+	/**
+	 * Reads back the depth buffer copied by the most recent updateHiZ(), for testing
+	 */
+	std::vector<float> readDepth() const {
+		std::vector<float> depth((size_t)depthWidth * depthHeight);
+		glBindTexture(GL_TEXTURE_2D, depthTexture);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, GL_FLOAT, depth.data());
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return depth;
+	}
+
+	/**
+	 * Reads back the Hi-Z pyramid, for testing
+	 */
+	std::vector<std::vector<float>> readHiZ() const {
+		std::vector<std::vector<float>> levels;
+		glBindTexture(GL_TEXTURE_2D, hizTexture);
+		for (int level = 0; level < (int)hizSizes.size(); level++) {
+			levels.push_back(std::vector<float>((size_t)hizSizes[level].x * hizSizes[level].y));
+			glGetTexImage(GL_TEXTURE_2D, level, GL_RED, GL_FLOAT, levels.back().data());
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return levels;
+	}
+
+	/**
+	 * Reads back the results of the most recent cull() for a set, for testing: the indices of the visible instances,
+	 * their matrices and the instance count of each draw command. Waits for the GPU.
+	 */
+	void readVisible(int set, std::vector<unsigned int>& indices, std::vector<glm::mat4>& matrices, std::vector<unsigned int>& instanceCounts) const {
+		const InstanceSet& s = sets[set];
+		std::vector<DrawElementsIndirectCommand> commands(s.commands.size());
+		glBindBuffer(GL_COPY_READ_BUFFER, s.commandBuffer);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+		instanceCounts.clear();
+		for (const DrawElementsIndirectCommand& command : commands)
+			instanceCounts.push_back(command.instanceCount);
+		unsigned int count = std::min(instanceCounts[0], (unsigned int)s.count);
+		indices.resize(count);
+		matrices.resize(count);
+		glBindBuffer(GL_COPY_READ_BUFFER, s.visibleIndexBuffer);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, count * sizeof(unsigned int), indices.data());
+		glBindBuffer(GL_COPY_READ_BUFFER, s.visibleMatrixBuffer);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, count * sizeof(glm::mat4), matrices.data());
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+
+	/**
+	 * Culls random instances on the GPU and with cullReference() from several views, against walls of depth in an
+	 * offscreen depth buffer, compares the results and prints the differences. Requires a current GL 4.3 context.
+	 * @param tolerance - fraction of instances that may be culled differently, e.g. spheres touching a frustum plane
+	 * @returns true if every view matches
+	 */
+	static bool validate(int instanceCount = 100000, float tolerance = 0.0f) {
+		const int width = 640, height = 360, views = 6;
+		InstanceCuller culler;
+		std::mt19937 random(5910);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::vector<glm::mat4> matrices;
+		for (int i = 0; i < instanceCount; i++) {
+			glm::vec3 position(unit(random) * 100.0f - 50.0f, unit(random) * 10.0f, unit(random) * 100.0f - 50.0f);
+			glm::mat4 matrix = glm::translate(glm::mat4(1.0f), position);
+			matrix = glm::rotate(matrix, unit(random) * 6.2832f, glm::vec3(0.0f, 1.0f, 0.0f));
+			matrices.push_back(glm::scale(matrix, glm::vec3(0.2f + unit(random) * 1.8f)));
+		}
+		// a cube and a quad, to check that every command gets the count
+		culler.add(matrices.data(), instanceCount, glm::vec3(-0.5f), glm::vec3(0.5f), { 36, 6 });
+
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		unsigned int framebuffer, depthBuffer;
+		glGenFramebuffers(1, &framebuffer);
+		glGenRenderbuffers(1, &depthBuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		glViewport(0, 0, width, height);
+
+		bool passed = true;
+		glm::mat4 projection = glm::perspective(glm::radians(60.0f), (float)width / height, 0.1f, 100.0f);
+		for (int v = 0; v < views; v++) {
+			// the previous frame: walls of depth in front of the camera, as rectangles of cleared depth
+			float angle = v * 6.2832f / views;
+			glm::vec3 eye(std::cos(angle) * 40.0f, 2.0f + v, std::sin(angle) * 40.0f);
+			glm::mat4 previous = projection * glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+			glClearDepth(1.0);
+			glClear(GL_DEPTH_BUFFER_BIT);
+			glEnable(GL_SCISSOR_TEST);
+			for (int wall = 0; wall < 4; wall++) {
+				int x = (int)(unit(random) * width * 0.8f), y = (int)(unit(random) * height * 0.5f);
+				glScissor(x, y, (int)(width * (0.1f + unit(random) * 0.3f)), (int)(height * (0.2f + unit(random) * 0.5f)));
+				glClearDepth(0.99 + unit(random) * 0.009);
+				glClear(GL_DEPTH_BUFFER_BIT);
+			}
+			glDisable(GL_SCISSOR_TEST);
+			glClearDepth(1.0);
+			culler.setOcclusion(v != 0); // the first view tests only the frustum
+			culler.updateHiZ(previous, width, height);
+
+			// this frame: the camera moved a little
+			glm::mat4 current = projection * glm::lookAt(eye + glm::vec3(0.2f, 0.0f, 0.1f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+			culler.cull(current);
+			std::vector<unsigned int> indices, instanceCounts;
+			std::vector<glm::mat4> visibleMatrices;
+			culler.readVisible(0, indices, visibleMatrices, instanceCounts);
+
+			// the pyramid against the one built on the CPU from the same depth, within a step of the 24 bit depth buffer
+			// since shaders and readbacks may round it differently to float, then the culling against the CPU's with
+			// the GPU's pyramid
+			std::vector<std::vector<float>> hiz, reference;
+			int pyramidDifferences = 0;
+			if (culler.occlusionEnabled()) {
+				hiz = culler.readHiZ();
+				reference = buildHiZReference(culler.readDepth(), width, height);
+				for (size_t level = 0; level < hiz.size(); level++)
+					for (size_t i = 0; i < hiz[level].size(); i++)
+						pyramidDifferences += std::abs(hiz[level][i] - reference[level][i]) > 1.0f / 16777215.0f;
+			}
+			InstanceCullStats counts;
+			std::vector<unsigned int> expected = cullReference(culler.getSpheres(0), current, hiz, previous, counts);
+			bool commandsMatch = true, matricesMatch = true, ordered = true;
+			for (unsigned int instances : instanceCounts)
+				commandsMatch = commandsMatch && instances == indices.size();
+			for (size_t i = 0; i < indices.size(); i++)
+				matricesMatch = matricesMatch && indices[i] < matrices.size() && visibleMatrices[i] == matrices[indices[i]];
+			for (size_t i = 1; i < indices.size(); i++)
+				ordered = ordered && indices[i - 1] < indices[i];
+			std::vector<unsigned int> differences;
+			std::set_symmetric_difference(indices.begin(), indices.end(), expected.begin(), expected.end(), std::back_inserter(differences));
+			bool match = differences.size() <= tolerance * instanceCount && pyramidDifferences == 0 && commandsMatch && matricesMatch && ordered;
+			std::cout << "View " << v << (v == 0 ? " (frustum only)" : "") << ": " << counts.outsideView << " outside view, "
+			          << counts.occluded << " occluded, " << counts.visible << " visible; GPU " << indices.size() << " visible, "
+			          << differences.size() << " culled differently, " << pyramidDifferences << " Hi-Z texels differ"
+			          << (commandsMatch ? "" : ", commands disagree") << (matricesMatch ? "" : ", matrices disagree")
+			          << (ordered ? "" : ", out of order")
+			          << (match ? "" : " - FAILED") << '\n';
+			passed = passed && match;
+
+			// the counters of the last view, read back through the ring
+			if (v == views - 1) {
+				culler.finish();
+				const InstanceCullStats& stats = culler.getStats();
+				bool countersMatch = stats.visible == (int)indices.size() && stats.outsideView + stats.occluded + stats.visible == instanceCount;
+				std::cout << "Counters: " << stats.outsideView << " outside view, " << stats.occluded << " occluded, " << stats.visible
+				          << " visible" << (countersMatch ? "" : " - FAILED") << '\n';
+				passed = passed && countersMatch;
+			}
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteRenderbuffers(1, &depthBuffer);
+		glDeleteFramebuffers(1, &framebuffer);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+		culler.release();
+		return passed;
+	}
+
+private:
+	// counters of the atomic counter buffer, in cull.comp's order
+	static const int COUNTERS = 3;
+
+	struct InstanceSet {
+		int count = 0;
+		std::vector<glm::mat4> matrices;
+		std::vector<glm::vec4> spheres;
+		std::vector<DrawElementsIndirectCommand> commands; // as made, with no instances; cull() writes their instanceCount
+		unsigned int sphereBuffer = 0, matrixBuffer = 0, visibleMatrixBuffer = 0, visibleIndexBuffer = 0, commandBuffer = 0;
+		unsigned int groupBuffer = 0, slotBuffer = 0; // the visible instances of each workgroup, and of each instance in it
+	};
+
+	Shader cullShader, hizShader;
+	std::vector<InstanceSet> sets;
+	std::vector<glm::ivec2> hizSizes;
+	unsigned int hizTexture = 0, depthTexture = 0;
+	int depthWidth = 0, depthHeight = 0;
+	glm::mat4 hizViewProjection = glm::mat4(1.0f);
+	bool occlusion = true, hizValid = false;
+	unsigned int counterBuffers[COUNTER_BUFFERS];
+	GLsync fences[COUNTER_BUFFERS];
+	long long slotFrames[COUNTER_BUFFERS];
+	long long frame = 0;
+	InstanceCullStats stats;
+
+	/**
+	 * Reads back the counters of the culled frames whose fences have signaled, oldest first, into the stats
+	 * @param waitFrame - also waits for the frames up to this one
+	 */
+	void collectCounters(long long waitFrame) {
+		for (long long f = std::max(frame - COUNTER_BUFFERS, 0LL); f < frame; f++) {
+			int slot = (int)(f % COUNTER_BUFFERS);
+			if (!fences[slot] || slotFrames[slot] != f)
+				continue;
+			bool wait = f <= waitFrame;
+			GLenum status = glClientWaitSync(fences[slot], wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000ull : 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				return;
+			unsigned int counters[COUNTERS];
+			glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counterBuffers[slot]);
+			glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(counters), counters);
+			glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+			glDeleteSync(fences[slot]);
+			fences[slot] = nullptr;
+			stats.outsideView = (int)counters[0];
+			stats.occluded = (int)counters[1];
+			stats.visible = (int)counters[2];
+			stats.readbackLatency = (int)(frame - f);
+		}
+	}
+
+	// CPU version of occluded() in cull.comp
+	static bool occludedReference(glm::vec3 center, float radius, const std::vector<std::vector<float>>& hizLevels, const glm::mat4& hizViewProjection) {
+		const float NEAR_W = 1e-4f;
+		glm::vec2 minS(3.4e38f), maxS(-3.4e38f);
+		float nearestZ = 3.4e38f;
+		for (int i = 0; i < 8; i++) {
+			glm::vec3 corner = center + radius * glm::vec3(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f);
+			glm::vec4 clip = hizViewProjection * glm::vec4(corner, 1.0f);
+			if (clip.w < NEAR_W || clip.z < -clip.w)
+				return false;
+			float invW = 1.0f / clip.w;
+			glm::vec2 s = (glm::vec2(clip) * invW * 0.5f + 0.5f) * glm::vec2(HIZ_WIDTH, HIZ_HEIGHT);
+			minS = glm::min(minS, s);
+			maxS = glm::max(maxS, s);
+			nearestZ = std::min(nearestZ, clip.z * invW * 0.5f + 0.5f);
+		}
+		if (nearestZ > 1.0f)
+			return false;
+		int x0 = (int)std::floor(glm::clamp(minS.x, 0.0f, (float)HIZ_WIDTH)), x1 = (int)std::floor(glm::clamp(maxS.x, -1.0f, HIZ_WIDTH - 1.0f));
+		int y0 = (int)std::floor(glm::clamp(minS.y, 0.0f, (float)HIZ_HEIGHT)), y1 = (int)std::floor(glm::clamp(maxS.y, -1.0f, HIZ_HEIGHT - 1.0f));
+		if (x0 > x1 || y0 > y1)
+			return false;
+		int level = 0, extent = std::max(x1 - x0, y1 - y0);
+		while (extent > 1 && level + 1 < (int)hizLevels.size()) {
+			extent >>= 1;
+			level++;
+		}
+		int levelWidth = HIZ_WIDTH >> level;
+		for (int y = y0 >> level; y <= y1 >> level; y++)
+			for (int x = x0 >> level; x <= x1 >> level; x++)
+				if (nearestZ <= hizLevels[level][(size_t)y * levelWidth + x])
+					return false;
+		return true;
+	}
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include "GameObject.h"
+#include "IndirectRenderer.h"
 /**
  * Base abstract class for an instanced object. Can be implemented to allow for efficient instanced rendering of a model.
  */
@@ -17,17 +18,32 @@ public:
 	 * Draws the instanced object using the provided project and view matrices
 	 */
 	void drawInstances(glm::mat4 projection, glm::mat4 view) {
-		shader->use();
-		shader->setMat4("projection", projection);
-		shader->setMat4("view", view);
-		shader->setInt("texture_diffuse1", 0);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, model.textures_loaded[0].id);
-		for (unsigned int i = 0; i < model.meshes.size(); i++) {
-			glBindVertexArray(model.meshes[i].VAO);
-			glDrawElementsInstanced(GL_TRIANGLES, model.meshes[i].indices.size(), GL_UNSIGNED_INT, 0, numInstances);
-			glBindVertexArray(0);
-		}
+		bindInstanceAttributes(instanceBuffer);
+		draw(projection, view, 0);
+	}
+
+	/**
+	 * Draws the instances chosen on the GPU, e.g. by an InstanceCuller, without reading their number back
+	 * @param matrixBuffer - the model matrices of the instances to draw
+	 * @param commandBuffer - a DrawElementsIndirectCommand per mesh (see IndirectRenderer.h), with the instance count
+	 */
+	void drawInstancesIndirect(glm::mat4 projection, glm::mat4 view, unsigned int matrixBuffer, unsigned int commandBuffer) {
+		bindInstanceAttributes(matrixBuffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+		draw(projection, view, commandBuffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	const Model& getModel() const {
+		return model;
+	}
+
+	unsigned int getInstanceCount() const {
+		return numInstances;
+	}
+
+	const glm::mat4* getModelMatrices() const {
+		return modelMatrices;
 	}
 protected:
 
@@ -37,6 +53,8 @@ protected:
 	unsigned int numInstances;
 	glm::mat4* modelMatrices;// size = numInstances
 	float* rotAngs; // array holding the rotation (euler) angles of the instances. size = numInstances. Not necisarily used by inheriting class 
+	unsigned int instanceBuffer = 0;  // the model matrices, as made by configureInstancedArray()
+	unsigned int attributeBuffer = 0; // the buffer the instance matrix attributes read, instanceBuffer or a culled copy
 
 	/**
 	 * Method that can be implemented by the inheriting class to generate the locations of the instances in a custom way.
@@ -47,10 +65,48 @@ protected:
 	void configureInstancedArray() {
 		// configure instanced array
 		// -------------------------
-		unsigned int buffer;
-		glGenBuffers(1, &buffer);
-		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glGenBuffers(1, &instanceBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
 		glBufferData(GL_ARRAY_BUFFER, numInstances * sizeof(glm::mat4), &modelMatrices[0], GL_STATIC_DRAW);
+		bindInstanceAttributes(instanceBuffer);
+	}
+
+private:
+	/**
+	 * Draws each mesh with all instances, or with the instance count of its indirect command if commandBuffer is bound
+	 */
+	void draw(glm::mat4 projection, glm::mat4 view, unsigned int commandBuffer) {
+		shader->use();
+		shader->setMat4("projection", projection);
+		shader->setMat4("view", view);
+		shader->setInt("texture_diffuse1", 0);
+		glActiveTexture(GL_TEXTURE0);
+		// each mesh's diffuse texture (the first of its textures), binding it only when it changes
+		unsigned int boundTexture = 0;
+		for (unsigned int i = 0; i < model.meshes.size(); i++) {
+			const std::vector<Texture>& textures = model.meshes[i].textures;
+			unsigned int texture = !textures.empty() ? textures[0].id : !model.textures_loaded.empty() ? model.textures_loaded[0].id : 0;
+			if (texture != boundTexture || i == 0) {
+				glBindTexture(GL_TEXTURE_2D, texture);
+				boundTexture = texture;
+			}
+			glBindVertexArray(model.meshes[i].VAO);
+			if (commandBuffer)
+				glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(i * sizeof(DrawElementsIndirectCommand)));
+			else
+				glDrawElementsInstanced(GL_TRIANGLES, model.meshes[i].indices.size(), GL_UNSIGNED_INT, 0, numInstances);
+			glBindVertexArray(0);
+		}
+	}
+
+	/**
+	 * Points the instance matrix attributes of the meshes at a buffer of matrices, unless they already read it
+	 */
+	void bindInstanceAttributes(unsigned int buffer) {
+		if (buffer == attributeBuffer)
+			return;
+		attributeBuffer = buffer;
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
 
 		// set transformation matrices as an instance vertex attribute (with divisor 1)
 		// note: we're cheating a little by taking the, now publicly declared, VAO of the model's mesh(es) and adding new vertexAttribPointers
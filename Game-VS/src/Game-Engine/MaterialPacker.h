@@ -0,0 +1,177 @@
+#pragma once
+#include <glad.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <utility>
+#include <vector>
+#include "Mesh.h"
+#include "Shader.h"
+
+/**
+ * Counters of the most recent MaterialPacker::pack()
+ */
+struct MaterialPackerStats {
+	int textures = 0;         // distinct textures copied into arrays
+	int arrays = 0;           // texture arrays made
+	int materials = 0;        // distinct materials (texture arrays and layers) of the packed meshes
+	int packedMeshes = 0, unpackedMeshes = 0; // unpacked: meshes without textures, or with a texture that failed to load
+	double megabytes = 0.0;   // GPU memory of the arrays, with mipmaps
+	double packMS = 0.0;
+};
+
+/**
+ * Packs the textures of many meshes into a few GL_TEXTURE_2D_ARRAYs, one per texture size, so that meshes whose
+ * textures have the same sizes share the same bound textures and differ only by a uniform holding their layers.
+ *
+ * Arrays rather than atlases, since the models tile their textures (GL_REPEAT) with UVs outside 0..1, which an
+ * atlas region can't wrap. All layers are stored as RGBA8, so one-channel and RGB textures read as before.
+ * The original 2D textures are kept, for Mesh::Draw(), instanced objects and drawing with texture arrays disabled.
+ */
+class MaterialPacker {
+public:
+	/**
+	 * Registers meshes to be packed by the next pack()
+	 */
+	void add(std::vector<Mesh>& meshes) {
+		for (Mesh& mesh : meshes)
+			this->meshes.push_back(&mesh);
+	}
+
+	/**
+	 * Copies the textures of the registered meshes into texture arrays, then gives each mesh the layers of its
+	 * textures, a compact material index and the SHADER_TEXTURE_ARRAY feature. Requires a current GL context.
+	 */
+	void pack() {
+		auto start = std::chrono::high_resolution_clock::now();
+		release();
+		GLint maxLayers = 256;
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+		// group the distinct textures by size, splitting groups larger than an array can hold
+		std::map<std::pair<int, int>, std::vector<unsigned int>> sizes;
+		std::map<unsigned int, bool> seen;
+		for (Mesh* mesh : meshes)
+			for (const Texture& texture : mesh->textures) {
+				if (seen.count(texture.id))
+					continue;
+				seen[texture.id] = true;
+				GLint width = 0, height = 0;
+				glBindTexture(GL_TEXTURE_2D, texture.id);
+				glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+				glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+				if (width > 0 && height > 0)
+					sizes[std::make_pair(width, height)].push_back(texture.id);
+			}
+
+		// copy each group into its array, through client memory since copies between textures need GL 4.3
+		std::map<unsigned int, std::pair<unsigned int, int>> placements; // 2D texture id -> array id, layer
+		std::vector<unsigned char> pixels;
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		for (auto& size : sizes) {
+			int width = size.first.first, height = size.first.second;
+			const std::vector<unsigned int>& ids = size.second;
+			pixels.resize((size_t)width * height * 4);
+			for (size_t first = 0; first < ids.size(); first += maxLayers) {
+				int layers = (int)std::min(ids.size() - first, (size_t)maxLayers);
+				unsigned int array;
+				glGenTextures(1, &array);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+				for (int layer = 0; layer < layers; layer++) {
+					glBindTexture(GL_TEXTURE_2D, ids[first + layer]);
+					glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+					glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+					placements[ids[first + layer]] = std::make_pair(array, layer);
+				}
+				glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+				arrays.push_back(array);
+				stats.megabytes += width * height * 4.0 * layers * 4.0 / 3.0 / (1024.0 * 1024.0);
+			}
+			stats.textures += (int)ids.size();
+		}
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		// meshes with the same arrays and layers share a material
+		std::map<std::vector<unsigned int>, unsigned int> materialIndices;
+		for (Mesh* mesh : meshes) {
+			bool packed = !mesh->textures.empty();
+			for (const Texture& texture : mesh->textures)
+				packed = packed && placements.count(texture.id);
+			if (!packed) {
+				stats.unpackedMeshes++;
+				continue;
+			}
+			std::vector<unsigned int> material;
+			for (unsigned int i = 0; i < mesh->textures.size(); i++) {
+				Texture& texture = mesh->textures[i];
+				texture.arrayID = placements[texture.id].first;
+				texture.layer = placements[texture.id].second;
+				material.push_back(texture.arrayID);
+				material.push_back(texture.layer);
+				if (mesh->samplerNames[i] == "texture_diffuse1")
+					mesh->materialLayers.x = (float)texture.layer;
+				else if (mesh->samplerNames[i] == "texture_specular1")
+					mesh->materialLayers.y = (float)texture.layer;
+				else if (mesh->samplerNames[i] == "texture_normal1")
+					mesh->materialLayers.z = (float)texture.layer;
+			}
+			auto it = materialIndices.find(material);
+			if (it == materialIndices.end())
+				it = materialIndices.emplace(material, (unsigned int)materialIndices.size() + 1).first;
+			mesh->materialIndex = it->second;
+			mesh->shaderFeatures |= SHADER_TEXTURE_ARRAY;
+			stats.packedMeshes++;
+		}
+		stats.arrays = (int)arrays.size();
+		stats.materials = (int)materialIndices.size();
+		stats.packMS = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	/**
+	 * Deletes the texture arrays and returns the registered meshes to their 2D textures
+	 */
+	void release() {
+		if (!arrays.empty())
+			glDeleteTextures((GLsizei)arrays.size(), arrays.data());
+		arrays.clear();
+		for (Mesh* mesh : meshes) {
+			for (Texture& texture : mesh->textures) {
+				texture.arrayID = 0;
+				texture.layer = 0;
+			}
+			mesh->materialIndex = 0;
+			mesh->materialLayers = glm::vec3(0.0f);
+			mesh->shaderFeatures &= ~SHADER_TEXTURE_ARRAY;
+		}
+		stats = MaterialPackerStats();
+	}
+
+	const MaterialPackerStats& getStats() const {
+		return stats;
+	}
+
+	/**
+	 * Prints the counters of the most recent pack() to the console
+	 */
+	void printStats() const {
+		std::cout << "Material Packer: " << stats.textures << " textures in " << stats.arrays << " texture arrays ("
+		          << std::fixed << std::setprecision(1) << stats.megabytes << " MB), " << stats.materials << " materials for "
+		          << stats.packedMeshes << " meshes (" << stats.unpackedMeshes << " unpacked), packed in "
+		          << std::setprecision(2) << stats.packMS << " ms\n" << std::defaultfloat;
+	}
+
+private:
+	std::vector<Mesh*> meshes;
+	std::vector<unsigned int> arrays;
+	MaterialPackerStats stats;
+};
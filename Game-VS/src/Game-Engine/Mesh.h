@@ -3,6 +3,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include "Shader.h"
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -26,6 +27,10 @@ struct Texture {
     unsigned int id;
     std::string type;
     std::string path;
+    bool translucent = false; // true if any texel has alpha < 1, so the texture needs alpha blending
+    // texture array holding a copy of the texture and its layer, if packed by a MaterialPacker (0 = not packed)
+    unsigned int arrayID = 0;
+    int layer = 0;
 };
 
 /**
@@ -39,6 +44,24 @@ public:
     std::vector<unsigned int> indices;
     std::vector<Texture>      textures;
     unsigned int VAO;
+    // sampler uniform name of each texture (e.g. texture_diffuse1), in the same order as textures
+    std::vector<std::string>  samplerNames;
+    // id of each sampler uniform name (see samplerID()), in the same order as textures
+    std::vector<unsigned int> samplerIDs;
+    // shader feature that samples each texture (0 if every variant does, SHADER_NEVER if none), in the same order as textures
+    std::vector<unsigned int> samplerFeatures;
+    // shader features the mesh's textures call for (see ShaderFeature in Shader.h)
+    unsigned int shaderFeatures = 0;
+    // true if the mesh has a translucent diffuse texture and must be drawn with blending
+    bool translucent = false;
+    // compact id of this mesh's texture set, assigned by RenderQueue (0 = not assigned yet)
+    unsigned int materialID = 0;
+    // the same for the texture arrays holding the mesh's textures, if packed
+    unsigned int arrayMaterialID = 0;
+    // compact index of this mesh's material in its MaterialPacker (0 = textures not packed), and the layers of its
+    // diffuse, specular and normal textures in their texture arrays
+    unsigned int materialIndex = 0;
+    glm::vec3 materialLayers = glm::vec3(0.0f);
 
     /**
      * Constructs a mesh from vertices, indeces and textures. Mesh is intialized upon construction.
@@ -47,34 +70,19 @@ public:
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        setupSamplers();
         setupMesh();
     }
 
     /**
      * Method which renders the mesh using a specific shader
      */
-    void Draw(Shader shader) {
+    void Draw(Shader& shader) {
         // bind appropriate textures
-        unsigned int diffuseNr = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr = 1;
-        unsigned int heightNr = 1;
         for (unsigned int i = 0; i < textures.size(); i++) {
             glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            std::string number;
-            std::string name = textures[i].type;
-            if (name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if (name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to stream
-            else if (name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer unsigned int to stream
-            else if (name == "texture_height")
-                number = std::to_string(heightNr++); // transfer unsigned int to stream
-
             // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
+            glUniform1i(glGetUniformLocation(shader.ID, samplerNames[i].c_str()), i);
             // and finally bind the texture
             glBindTexture(GL_TEXTURE_2D, textures[i].id);
         }
@@ -92,6 +100,56 @@ private:
     // render data 
     unsigned int VBO, EBO;
 
+    /**
+     * Method that returns a small id for a sampler uniform name, the same for every mesh, so that the uniform can be
+     * looked up without comparing strings.
+     */
+    static unsigned int samplerID(const std::string& name) {
+        static std::vector<std::string> names;
+        auto it = std::find(names.begin(), names.end(), name);
+        if (it != names.end())
+            return (unsigned int)(it - names.begin());
+        names.push_back(name);
+        return (unsigned int)names.size() - 1;
+    }
+
+    /**
+     * Method that names the sampler uniform of each texture, checks if the mesh needs blending and which shader features its textures call for.
+     */
+    void setupSamplers() {
+        unsigned int diffuseNr = 1;
+        unsigned int specularNr = 1;
+        unsigned int normalNr = 1;
+        unsigned int heightNr = 1;
+        for (unsigned int i = 0; i < textures.size(); i++) {
+            // retrieve texture number (the N in diffuse_textureN)
+            std::string number;
+            std::string name = textures[i].type;
+            unsigned int feature = 0;
+            if (name == "texture_diffuse") {
+                number = std::to_string(diffuseNr++);
+                translucent = translucent || textures[i].translucent;
+            }
+            else if (name == "texture_specular") {
+                number = std::to_string(specularNr++); // transfer unsigned int to stream
+                feature = SHADER_SPECULAR_MAP;
+            }
+            else if (name == "texture_normal") {
+                number = std::to_string(normalNr++); // transfer unsigned int to stream
+                feature = SHADER_NORMAL_MAP;
+            }
+            else if (name == "texture_height") {
+                number = std::to_string(heightNr++); // transfer unsigned int to stream
+                feature = SHADER_NEVER;
+            }
+            samplerNames.push_back(name + number);
+            samplerIDs.push_back(samplerID(samplerNames.back()));
+            samplerFeatures.push_back(feature);
+            if (feature != SHADER_NEVER)
+                shaderFeatures |= feature;
+        }
+    }
+
     /**
      * Method that initializes all the buffer objects/arrays. It set the vertex buffers and its attribute pointers.
      */
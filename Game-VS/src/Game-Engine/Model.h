@@ -13,9 +13,11 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <cfloat>
 
 // forward declaration of method that reads a texture from a file
-unsigned int TextureFromFile(const char* path, const std::string& directory, bool gamma = false);
+// if translucent is non-null, it is set to true when the image has any texel with alpha below 1
+unsigned int TextureFromFile(const char* path, const std::string& directory, bool gamma = false, bool* translucent = nullptr);
 
 /**
  * Class that encapsulates the data and operations associated with a in-game object including its meshes and textures.
@@ -28,6 +30,8 @@ public:
     std::vector<Mesh>    meshes;
     std::string directory;
     bool gammaCorrection;
+    // object-space bounding box of all meshes, calculated while the model is loaded
+    glm::vec3 boundsMin = glm::vec3(FLT_MAX), boundsMax = glm::vec3(-FLT_MAX);
 
     // constructor, expects a filepath to a 3D model.
     Model(std::string const& path, bool gamma = false) : gammaCorrection(gamma) {
@@ -36,7 +40,7 @@ public:
     }
 
     // draws the model, and thus all its meshes
-    void Draw(Shader shader) {
+    void Draw(Shader& shader) {
         for (unsigned int i = 0; i < meshes.size(); i++)
             meshes[i].Draw(shader);
     }
@@ -90,6 +94,8 @@ private:
             vector.y = mesh->mVertices[i].y;
             vector.z = mesh->mVertices[i].z;
             vertex.Position = vector;
+            boundsMin = glm::min(boundsMin, vector);
+            boundsMax = glm::max(boundsMax, vector);
             // normals
             if (mesh->HasNormals()) {
                 vector.x = mesh->mNormals[i].x;
@@ -180,7 +186,7 @@ private:
             if (!skip) {   
                 // if texture hasn't been loaded already, load it
                 Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
+                texture.id = TextureFromFile(str.C_Str(), this->directory, false, &texture.translucent);
                 texture.type = typeName;
                 texture.path = str.C_Str();
                 textures.push_back(texture);
@@ -194,7 +200,7 @@ private:
 /**
  * Method that loads a texture from a file using STBI image
  */
-unsigned int TextureFromFile(const char* path, const std::string& directory, bool gamma) {
+unsigned int TextureFromFile(const char* path, const std::string& directory, bool gamma, bool* translucent) {
     std::cout << "Loading Texture from file " << path << "\n";
     std::string filename = std::string(path);
     filename = directory + '/' + filename;
@@ -213,6 +219,13 @@ unsigned int TextureFromFile(const char* path, const std::string& directory, boo
         else if (nrComponents == 4)
             format = GL_RGBA;
 
+        if (translucent) {
+            *translucent = false;
+            if (nrComponents == 4)
+                for (int i = 0; i < width * height && !*translucent; i++)
+                    *translucent = data[4 * i + 3] < 255;
+        }
+
         glBindTexture(GL_TEXTURE_2D, textureID);
         glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
         glGenerateMipmap(GL_TEXTURE_2D);
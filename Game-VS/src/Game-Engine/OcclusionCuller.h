@@ -0,0 +1,362 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <chrono>
+#include <cfloat>
+#include <iostream>
+#include <algorithm>
+#include "WorkerPool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_USE_SSE
+#include <emmintrin.h>
+#endif
+
+/**
+ * Per-frame statistics of the occlusion culling stage. Times are in milliseconds.
+ */
+struct OcclusionStats {
+	int occluderTriangles = 0;   // triangles rasterized into the depth buffer (after near-plane clipping)
+	int objectsTested = 0;       // bounding boxes tested against the hierarchical-Z buffer
+	int objectsOccluded = 0;     // boxes fully hidden behind occluders
+	int objectsOutsideView = 0;  // boxes fully outside the view frustum
+	double setupMS = 0.0, rasterMS = 0.0, hizMS = 0.0, testMS = 0.0, totalMS = 0.0;
+};
+
+/**
+ * CPU software-rasterized occlusion culling.
+ * A small set of low-poly occluder boxes (placed inside large objects such as houses and tree lines) is rasterized
+ * into a low-resolution depth buffer, a max-depth hierarchical-Z (Hi-Z) pyramid is built from it, and object
+ * bounding boxes are then tested against the pyramid. Rasterization, pyramid building and testing are split across
+ * a WorkerPool. No GPU resources are used, so the culler can run on any thread or without a GL context.
+ */
+class OcclusionCuller {
+public:
+	// Depth buffer resolution. The width must be a multiple of 4 for the SIMD rasterizer, and both are powers of two
+	// so that every Hi-Z level halves cleanly.
+	static const int DEPTH_WIDTH = 256, DEPTH_HEIGHT = 128;
+
+	OcclusionCuller() : depthLevels() {
+		for (int w = DEPTH_WIDTH, h = DEPTH_HEIGHT; w >= 1 && h >= 1; w /= 2, h /= 2) {
+			levelSizes.push_back(glm::ivec2(w, h));
+			depthLevels.push_back(std::vector<float>((size_t)w * h, 1.0f));
+		}
+	}
+
+	/**
+	 * Adds a static box occluder, defined by an object-space box and the model matrix that places it in the world.
+	 * The box must lie completely inside the visible geometry of the object so that it never hides anything the
+	 * real object would not.
+	 */
+	void addOccluderBox(const glm::mat4& modelMatrix, glm::vec3 boxMin, glm::vec3 boxMax) {
+		// 6 faces * 2 triangles, wound consistently but rasterized double sided
+		static const int faces[12][3] = {
+			{0, 1, 3}, {0, 3, 2}, {4, 6, 7}, {4, 7, 5}, {0, 4, 5}, {0, 5, 1},
+			{2, 3, 7}, {2, 7, 6}, {0, 2, 6}, {0, 6, 4}, {1, 5, 7}, {1, 7, 3}
+		};
+		glm::vec3 corners[8];
+		for (int i = 0; i < 8; i++) {
+			glm::vec3 local(i & 1 ? boxMax.x : boxMin.x, i & 2 ? boxMax.y : boxMin.y, i & 4 ? boxMax.z : boxMin.z);
+			corners[i] = glm::vec3(modelMatrix * glm::vec4(local, 1.0f));
+		}
+		for (int f = 0; f < 12; f++)
+			for (int k = 0; k < 3; k++)
+				occluderVertices.push_back(corners[faces[f][k]]);
+	}
+
+	/**
+	 * Removes all occluders.
+	 */
+	void clearOccluders() {
+		occluderVertices.clear();
+	}
+
+	/**
+	 * Runs the culling stage for one frame.
+	 * @param viewProjection the combined projection * view matrix of the camera
+	 * @param boundsMin, boundsMax world-space bounding boxes of the objects to test
+	 * @param visible resized to boundsMin.size(); set to 1 for each object that may be visible, 0 if it is culled
+	 */
+	void cull(const glm::mat4& viewProjection, const std::vector<glm::vec3>& boundsMin, const std::vector<glm::vec3>& boundsMax,
+	          std::vector<unsigned char>& visible) {
+		using Clock = std::chrono::high_resolution_clock;
+		Clock::time_point start = Clock::now();
+		stats = OcclusionStats();
+
+		// 1. transform, clip and set up occluder triangles
+		setupTriangles(viewProjection);
+		Clock::time_point setupDone = Clock::now();
+
+		// 2. rasterize into the full resolution depth buffer, one horizontal band of rows per job
+		const int bandRows = 16, numBands = DEPTH_HEIGHT / bandRows;
+		pool.parallelFor(numBands, [&](int band) {
+			std::vector<float>& depth = depthLevels[0];
+			std::fill(depth.begin() + (size_t)band * bandRows * DEPTH_WIDTH, depth.begin() + (size_t)(band + 1) * bandRows * DEPTH_WIDTH, 1.0f);
+			for (const TriangleSetup& tri : triangles)
+				rasterizeTriangle(tri, band * bandRows, (band + 1) * bandRows);
+		});
+		Clock::time_point rasterDone = Clock::now();
+
+		// 3. build the max-depth pyramid
+		for (size_t level = 1; level < depthLevels.size(); level++) {
+			int rows = levelSizes[level].y;
+			if (rows >= 16)
+				pool.parallelFor(rows / 8, [&](int block) { downsampleRows((int)level, block * 8, block * 8 + 8); });
+			else
+				downsampleRows((int)level, 0, rows);
+		}
+		Clock::time_point hizDone = Clock::now();
+
+		// 4. test bounding boxes, in chunks of objects per job
+		size_t numObjects = boundsMin.size();
+		visible.assign(numObjects, 1);
+		std::vector<unsigned char> outside(numObjects, 0);
+		const int chunkSize = 32;
+		int numChunks = (int)((numObjects + chunkSize - 1) / chunkSize);
+		pool.parallelFor(numChunks, [&](int chunk) {
+			size_t end = std::min(numObjects, (size_t)(chunk + 1) * chunkSize);
+			for (size_t i = (size_t)chunk * chunkSize; i < end; i++) {
+				int result = testBox(viewProjection, boundsMin[i], boundsMax[i]);
+				visible[i] = result == BOX_VISIBLE;
+				outside[i] = result == BOX_OUTSIDE_VIEW;
+			}
+		});
+		stats.objectsTested = (int)numObjects;
+		for (size_t i = 0; i < numObjects; i++) {
+			if (outside[i])
+				stats.objectsOutsideView++;
+			else if (!visible[i])
+				stats.objectsOccluded++;
+		}
+		Clock::time_point testDone = Clock::now();
+
+		stats.setupMS = std::chrono::duration<double, std::milli>(setupDone - start).count();
+		stats.rasterMS = std::chrono::duration<double, std::milli>(rasterDone - setupDone).count();
+		stats.hizMS = std::chrono::duration<double, std::milli>(hizDone - rasterDone).count();
+		stats.testMS = std::chrono::duration<double, std::milli>(testDone - hizDone).count();
+		stats.totalMS = std::chrono::duration<double, std::milli>(testDone - start).count();
+	}
+
+	/**
+	 * Returns the statistics of the most recent cull() call.
+	 */
+	const OcclusionStats& getStats() const {
+		return stats;
+	}
+
+	/**
+	 * Prints the statistics of the most recent cull() call to the console.
+	 */
+	void printStats() const {
+		std::cout << "Occlusion Culler: " << stats.objectsOccluded << " occluded, " << stats.objectsOutsideView << " outside view, of "
+		          << stats.objectsTested << " tested (" << stats.occluderTriangles << " occluder triangles, " << pool.getThreadCount() << " threads)\n"
+		          << "  setup " << stats.setupMS << " ms, raster " << stats.rasterMS << " ms, hi-z " << stats.hizMS
+		          << " ms, test " << stats.testMS << " ms, total " << stats.totalMS << " ms\n";
+	}
+
+	/**
+	 * Read access to the full resolution depth buffer (row 0 is the bottom of the screen), e.g. for debugging.
+	 * Depth values are window-space depth in [0,1], cleared to 1.
+	 */
+	const std::vector<float>& getDepthBuffer() const {
+		return depthLevels[0];
+	}
+
+private:
+	// Result of testing a single bounding box
+	enum { BOX_VISIBLE, BOX_OCCLUDED, BOX_OUTSIDE_VIEW };
+
+	// A triangle in depth buffer pixel space, with edge equations and a depth plane ready for rasterization
+	struct TriangleSetup {
+		int minX, maxX, minY, maxY;     // pixel bounding box, minX aligned down to a multiple of 4
+		float edgeA[3], edgeB[3], edgeC[3]; // edge function: a*x + b*y + c >= 0 inside
+		float zA, zB, zC;              // depth plane: z = zA*x + zB*y + zC
+	};
+
+	WorkerPool pool;
+	std::vector<glm::vec3> occluderVertices; // world space, 3 per triangle
+	std::vector<TriangleSetup> triangles;
+	std::vector<glm::ivec2> levelSizes;
+	std::vector<std::vector<float>> depthLevels; // level 0 is the rasterized depth buffer, the rest is the Hi-Z pyramid
+	OcclusionStats stats;
+
+	// clip space vertices closer than this w are clipped away
+	const float NEAR_W = 1e-4f;
+
+	/**
+	 * Transforms occluder triangles to clip space, clips them against the near plane and computes their setups.
+	 */
+	void setupTriangles(const glm::mat4& viewProjection) {
+		triangles.clear();
+		for (size_t t = 0; t + 2 < occluderVertices.size(); t += 3) {
+			glm::vec4 clip[3];
+			int inside = 0;
+			for (int k = 0; k < 3; k++) {
+				clip[k] = viewProjection * glm::vec4(occluderVertices[t + k], 1.0f);
+				if (clip[k].z >= -clip[k].w) inside++;
+			}
+			if (inside == 0)
+				continue;
+			// clip polygon against the near plane (z >= -w); a triangle becomes at most a quad
+			glm::vec4 poly[4];
+			int n = 0;
+			for (int k = 0; k < 3; k++) {
+				const glm::vec4& a = clip[k], & b = clip[(k + 1) % 3];
+				float da = a.z + a.w, db = b.z + b.w;
+				if (da >= 0.0f) poly[n++] = a;
+				if ((da >= 0.0f) != (db >= 0.0f))
+					poly[n++] = a + (b - a) * (da / (da - db));
+			}
+			for (int k = 1; k + 1 < n; k++)
+				addTriangle(poly[0], poly[k], poly[k + 1]);
+		}
+		stats.occluderTriangles = (int)triangles.size();
+	}
+
+	// Converts a clip space position to depth buffer pixel coordinates and window depth in [0,1]
+	static glm::vec3 toScreen(const glm::vec4& clip) {
+		float invW = 1.0f / clip.w;
+		return glm::vec3((clip.x * invW * 0.5f + 0.5f) * DEPTH_WIDTH, (clip.y * invW * 0.5f + 0.5f) * DEPTH_HEIGHT,
+		                 clip.z * invW * 0.5f + 0.5f);
+	}
+
+	void addTriangle(const glm::vec4& c0, const glm::vec4& c1, const glm::vec4& c2) {
+		if (c0.w < NEAR_W || c1.w < NEAR_W || c2.w < NEAR_W)
+			return;
+		glm::vec3 v0 = toScreen(c0), v1 = toScreen(c1), v2 = toScreen(c2);
+		float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+		if (fabsf(area) < 1e-8f)
+			return;
+		if (area < 0.0f) { // make counter-clockwise so that inside is positive for all edges
+			std::swap(v1, v2);
+			area = -area;
+		}
+		TriangleSetup tri;
+		tri.minX = std::max(0, (int)floorf(std::min(v0.x, std::min(v1.x, v2.x)))) & ~3;
+		tri.maxX = std::min(DEPTH_WIDTH - 1, (int)ceilf(std::max(v0.x, std::max(v1.x, v2.x))));
+		tri.minY = std::max(0, (int)floorf(std::min(v0.y, std::min(v1.y, v2.y))));
+		tri.maxY = std::min(DEPTH_HEIGHT - 1, (int)ceilf(std::max(v0.y, std::max(v1.y, v2.y))));
+		if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+			return;
+		const glm::vec3* v[3] = { &v0, &v1, &v2 };
+		for (int e = 0; e < 3; e++) {
+			const glm::vec3& a = *v[e], & b = *v[(e + 1) % 3];
+			tri.edgeA[e] = a.y - b.y;
+			tri.edgeB[e] = b.x - a.x;
+			tri.edgeC[e] = a.x * b.y - a.y * b.x;
+		}
+		// depth plane through the three vertices
+		float invArea = 1.0f / area;
+		tri.zA = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) * invArea;
+		tri.zB = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) * invArea;
+		tri.zC = v0.z - tri.zA * v0.x - tri.zB * v0.y;
+		triangles.push_back(tri);
+	}
+
+	/**
+	 * Rasterizes a triangle into the rows [rowStart, rowEnd) of the depth buffer, keeping the nearest depth.
+	 * Pixels are sampled at their centers, four at a time when SSE2 is available.
+	 */
+	void rasterizeTriangle(const TriangleSetup& tri, int rowStart, int rowEnd) {
+		int y0 = std::max(tri.minY, rowStart), y1 = std::min(tri.maxY, rowEnd - 1);
+		float* depth = depthLevels[0].data();
+#ifdef OCCLUSION_USE_SSE
+		const __m128 pixelOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f), zero = _mm_setzero_ps();
+		const __m128 a0 = _mm_set1_ps(tri.edgeA[0]), a1 = _mm_set1_ps(tri.edgeA[1]), a2 = _mm_set1_ps(tri.edgeA[2]);
+		const __m128 zA = _mm_set1_ps(tri.zA);
+		for (int y = y0; y <= y1; y++) {
+			float py = y + 0.5f;
+			__m128 r0 = _mm_set1_ps(tri.edgeB[0] * py + tri.edgeC[0]);
+			__m128 r1 = _mm_set1_ps(tri.edgeB[1] * py + tri.edgeC[1]);
+			__m128 r2 = _mm_set1_ps(tri.edgeB[2] * py + tri.edgeC[2]);
+			__m128 rz = _mm_set1_ps(tri.zB * py + tri.zC);
+			float* row = depth + (size_t)y * DEPTH_WIDTH;
+			for (int x = tri.minX; x <= tri.maxX; x += 4) {
+				__m128 px = _mm_add_ps(_mm_set1_ps((float)x), pixelOffsets);
+				__m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), r0);
+				__m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), r1);
+				__m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), r2);
+				__m128 mask = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+				if (_mm_movemask_ps(mask) == 0)
+					continue;
+				__m128 z = _mm_add_ps(_mm_mul_ps(zA, px), rz);
+				__m128 old = _mm_loadu_ps(row + x);
+				__m128 nearest = _mm_min_ps(old, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(mask, nearest), _mm_andnot_ps(mask, old)));
+			}
+		}
+#else
+		for (int y = y0; y <= y1; y++) {
+			float py = y + 0.5f;
+			float* row = depth + (size_t)y * DEPTH_WIDTH;
+			for (int x = tri.minX; x <= tri.maxX; x++) {
+				float px = x + 0.5f;
+				bool inside = true;
+				for (int e = 0; e < 3 && inside; e++)
+					inside = tri.edgeA[e] * px + tri.edgeB[e] * py + tri.edgeC[e] >= 0.0f;
+				if (inside)
+					row[x] = std::min(row[x], tri.zA * px + tri.zB * py + tri.zC);
+			}
+		}
+#endif
+	}
+
+	/**
+	 * Builds rows [rowStart, rowEnd) of a Hi-Z level as the maximum (farthest) depth of each 2x2 block of the level below.
+	 */
+	void downsampleRows(int level, int rowStart, int rowEnd) {
+		const std::vector<float>& src = depthLevels[level - 1];
+		std::vector<float>& dst = depthLevels[level];
+		int srcWidth = levelSizes[level - 1].x, width = levelSizes[level].x;
+		for (int y = rowStart; y < rowEnd; y++) {
+			const float* s0 = &src[(size_t)(2 * y) * srcWidth], * s1 = s0 + srcWidth;
+			float* d = &dst[(size_t)y * width];
+			for (int x = 0; x < width; x++)
+				d[x] = std::max(std::max(s0[2 * x], s0[2 * x + 1]), std::max(s1[2 * x], s1[2 * x + 1]));
+		}
+	}
+
+	/**
+	 * Tests a world-space bounding box against the Hi-Z pyramid.
+	 */
+	int testBox(const glm::mat4& viewProjection, const glm::vec3& boxMin, const glm::vec3& boxMax) const {
+		float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, nearestZ = FLT_MAX;
+		int leftOf = 0, rightOf = 0, below = 0, above = 0, behind = 0;
+		for (int i = 0; i < 8; i++) {
+			glm::vec4 clip = viewProjection * glm::vec4(i & 1 ? boxMax.x : boxMin.x, i & 2 ? boxMax.y : boxMin.y, i & 4 ? boxMax.z : boxMin.z, 1.0f);
+			if (clip.w < NEAR_W || clip.z < -clip.w) {
+				behind++;
+				continue;
+			}
+			leftOf += clip.x < -clip.w;
+			rightOf += clip.x > clip.w;
+			below += clip.y < -clip.w;
+			above += clip.y > clip.w;
+			glm::vec3 s = toScreen(clip);
+			minX = std::min(minX, s.x), maxX = std::max(maxX, s.x);
+			minY = std::min(minY, s.y), maxY = std::max(maxY, s.y);
+			nearestZ = std::min(nearestZ, s.z);
+		}
+		if (behind == 8)
+			return BOX_OUTSIDE_VIEW;
+		if (behind > 0)
+			return BOX_VISIBLE; // box crosses the near plane, can't be culled
+		if (leftOf == 8 || rightOf == 8 || below == 8 || above == 8 || nearestZ > 1.0f)
+			return BOX_OUTSIDE_VIEW;
+		int x0 = std::max(0, (int)floorf(minX)), x1 = std::min(DEPTH_WIDTH - 1, (int)floorf(maxX));
+		int y0 = std::max(0, (int)floorf(minY)), y1 = std::min(DEPTH_HEIGHT - 1, (int)floorf(maxY));
+		// pick the pyramid level where the box covers at most about 2x2 texels
+		int level = 0, extent = std::max(x1 - x0, y1 - y0);
+		while (extent > 1 && level + 1 < (int)depthLevels.size()) {
+			extent >>= 1;
+			level++;
+		}
+		const std::vector<float>& hiz = depthLevels[level];
+		int width = levelSizes[level].x;
+		for (int y = y0 >> level; y <= y1 >> level; y++)
+			for (int x = x0 >> level; x <= x1 >> level; x++)
+				if (nearestZ <= hiz[(size_t)y * width + x])
+					return BOX_VISIBLE;
+		return BOX_OCCLUDED;
+	}
+};
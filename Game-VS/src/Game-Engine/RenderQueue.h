@@ -0,0 +1,331 @@
+#pragma once
+#include <glad.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <vector>
+#include "GameObject.h"
+#include "Mesh.h"
+#include "Shader.h"
+#include "ShaderVariants.h"
+
+/**
+ * Per-frame counters of the GL state changes and draw calls issued by a RenderQueue.
+ * The 'naive' counters hold what the unsorted, per-mesh Mesh::Draw() path would have issued for the same draws.
+ */
+struct RenderStats {
+	int drawCalls = 0, opaqueDraws = 0, transparentDraws = 0;
+	int programBinds = 0, textureBinds = 0, vaoBinds = 0, samplerUniformSets = 0, blendChanges = 0;
+	int naiveProgramBinds = 0, naiveTextureBinds = 0, naiveVaoBinds = 0, naiveSamplerUniformSets = 0;
+	// draws of meshes with packed textures, the material layer uniforms they set, and the texture binds the
+	// same sorted draws would have issued with 2D textures instead of texture arrays
+	int textureArrayDraws = 0, materialUniformSets = 0, unpackedTextureBinds = 0;
+};
+
+/**
+ * Shadow copy of the GL state that the RenderQueue changes, so that redundant binds can be skipped.
+ * The cache must be invalidated whenever code outside the RenderQueue may have changed the state.
+ */
+class RenderStateCache {
+public:
+	static const int MAX_TEXTURE_UNITS = 16;
+
+	/**
+	 * Forgets all cached state, so the next bind of every kind is issued.
+	 */
+	void invalidate() {
+		program = UNKNOWN;
+		vao = UNKNOWN;
+		activeUnit = UNKNOWN;
+		blend = -1;
+		for (int i = 0; i < MAX_TEXTURE_UNITS; i++)
+			textures[i] = UNKNOWN;
+		samplerUnits.clear();
+		samplerProgram = UNKNOWN;
+		programSamplerUnits = nullptr;
+	}
+
+	// Each of the following returns true if a GL call was issued
+
+	bool useProgram(unsigned int id) {
+		if (program == id)
+			return false;
+		glUseProgram(id);
+		program = id;
+		return true;
+	}
+
+	bool bindTexture(unsigned int unit, unsigned int id, GLenum target = GL_TEXTURE_2D) {
+		if (unit >= MAX_TEXTURE_UNITS || textures[unit] == id)
+			return false;
+		if (activeUnit != unit) {
+			glActiveTexture(GL_TEXTURE0 + unit);
+			activeUnit = unit;
+		}
+		glBindTexture(target, id);
+		textures[unit] = id;
+		return true;
+	}
+
+	bool bindVertexArray(unsigned int id) {
+		if (vao == id)
+			return false;
+		glBindVertexArray(id);
+		vao = id;
+		return true;
+	}
+
+	// samplerID is the mesh's id of the sampler name (see Mesh::samplerID()), the name is only read to set it
+	bool setSampler(unsigned int programID, unsigned int samplerID, const std::string& name, int unit) {
+		if (programID != samplerProgram) {
+			samplerProgram = programID;
+			programSamplerUnits = &samplerUnits[programID];
+		}
+		std::vector<int>& units = *programSamplerUnits;
+		if (samplerID < units.size() && units[samplerID] == unit)
+			return false;
+		if (samplerID >= units.size())
+			units.resize(samplerID + 1, -1);
+		glUniform1i(glGetUniformLocation(programID, name.c_str()), unit);
+		units[samplerID] = unit;
+		return true;
+	}
+
+	bool setBlend(bool enabled) {
+		if (blend == (int)enabled)
+			return false;
+		if (enabled) {
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		}
+		else
+			glDisable(GL_BLEND);
+		blend = enabled;
+		return true;
+	}
+
+private:
+	static const unsigned int UNKNOWN = 0xFFFFFFFF;
+	unsigned int program = UNKNOWN, vao = UNKNOWN, activeUnit = UNKNOWN;
+	unsigned int textures[MAX_TEXTURE_UNITS];
+	int blend = -1;
+	// sampler uniform values are program state, so they only need to be set when they change: the unit of each
+	// sampler id per program (-1 = not set), and those of the program of the last setSampler()
+	std::map<unsigned int, std::vector<int>> samplerUnits;
+	unsigned int samplerProgram = UNKNOWN;
+	std::vector<int>* programSamplerUnits = nullptr;
+};
+
+/**
+ * A render queue which collects mesh draws for a frame, sorts them by a 64-bit key and submits them with
+ * as few GL state changes as possible.
+ *
+ * Opaque draws come first with blending disabled, sorted by shader, material (texture set), VAO and then
+ * front-to-back depth. Translucent draws follow with blending enabled, sorted back-to-front.
+ */
+class RenderQueue {
+public:
+	RenderQueue() : items(), materialIDs() {
+		stateCache.invalidate();
+	}
+
+	/**
+	 * Enables or disables drawing meshes packed by a MaterialPacker from their texture arrays, rather than
+	 * from their 2D textures, when they are submitted with shader variants
+	 */
+	void setTextureArrays(bool enabled) {
+		textureArrays = enabled;
+	}
+
+	bool textureArraysEnabled() const {
+		return textureArrays;
+	}
+
+	/**
+	 * Adds all meshes of a game object to the queue. Destroyed objects are skipped.
+	 * @param cameraPosition used to compute the sort depth of the object
+	 */
+	void submit(GameObject& gameObject, Shader* shader, glm::vec3 cameraPosition) {
+		submit(gameObject, shader, nullptr, cameraPosition);
+	}
+
+	/**
+	 * Adds all meshes of a game object to the queue, each drawn with the variant of its own features.
+	 * Textures sampled only by features a variant lacks are not bound.
+	 */
+	void submit(GameObject& gameObject, ShaderVariants& variants, glm::vec3 cameraPosition) {
+		submit(gameObject, nullptr, &variants, cameraPosition);
+	}
+
+	/**
+	 * Sorts and draws everything submitted since the last flush, then empties the queue.
+	 * Leaves blending in the state of the last pass drawn.
+	 */
+	void flush(const glm::mat4& projection, const glm::mat4& view) {
+		stats = RenderStats();
+		// other renderers (instanced objects, text, etc.) may have changed the GL state since the last flush
+		stateCache.invalidate();
+		std::sort(items.begin(), items.end(), [](const DrawItem& a, const DrawItem& b) { return a.key < b.key; });
+
+		Shader* currentShader = nullptr;
+		int modelLocation = -1;
+		unsigned int currentObject = 0xFFFFFFFF;
+		int layersLocation = -1;
+		unsigned int currentMaterial = 0;
+		unsigned int unpackedTextures[RenderStateCache::MAX_TEXTURE_UNITS];
+		std::fill(unpackedTextures, unpackedTextures + RenderStateCache::MAX_TEXTURE_UNITS, 0xFFFFFFFF);
+		for (const DrawItem& item : items) {
+			bool transparent = (item.key >> PASS_SHIFT) == PASS_TRANSPARENT;
+			stats.blendChanges += stateCache.setBlend(transparent);
+			if (item.shader != currentShader) {
+				currentShader = item.shader;
+				stats.programBinds += stateCache.useProgram(currentShader->ID);
+				currentShader->setMat4("projection", projection);
+				currentShader->setMat4("view", view);
+				modelLocation = glGetUniformLocation(currentShader->ID, "model");
+				layersLocation = glGetUniformLocation(currentShader->ID, "materialLayers");
+				currentObject = 0xFFFFFFFF;
+				currentMaterial = 0;
+			}
+			if (item.objectIndex != currentObject) {
+				currentObject = item.objectIndex;
+				glUniformMatrix4fv(modelLocation, 1, GL_FALSE, &objectMatrices[currentObject][0][0]);
+			}
+			Mesh& mesh = *item.mesh;
+			bool packed = (item.features & SHADER_TEXTURE_ARRAY) != 0;
+			for (unsigned int i = 0; i < mesh.textures.size(); i++) {
+				if (mesh.samplerFeatures[i] & ~item.features)
+					continue;
+				stats.samplerUniformSets += stateCache.setSampler(currentShader->ID, mesh.samplerIDs[i], mesh.samplerNames[i], i);
+				if (packed)
+					stats.textureBinds += stateCache.bindTexture(i, mesh.textures[i].arrayID, GL_TEXTURE_2D_ARRAY);
+				else
+					stats.textureBinds += stateCache.bindTexture(i, mesh.textures[i].id);
+				if (i < RenderStateCache::MAX_TEXTURE_UNITS && unpackedTextures[i] != mesh.textures[i].id) {
+					unpackedTextures[i] = mesh.textures[i].id;
+					stats.unpackedTextureBinds++;
+				}
+			}
+			if (packed) {
+				stats.textureArrayDraws++;
+				if (mesh.materialIndex != currentMaterial) {
+					currentMaterial = mesh.materialIndex;
+					glUniform3fv(layersLocation, 1, &mesh.materialLayers[0]);
+					stats.materialUniformSets++;
+				}
+			}
+			stats.vaoBinds += stateCache.bindVertexArray(mesh.VAO);
+			glDrawElements(GL_TRIANGLES, (GLsizei)mesh.indices.size(), GL_UNSIGNED_INT, 0);
+
+			stats.drawCalls++;
+			(transparent ? stats.transparentDraws : stats.opaqueDraws)++;
+			stats.naiveTextureBinds += (int)mesh.textures.size();
+			stats.naiveSamplerUniformSets += (int)mesh.textures.size();
+			stats.naiveVaoBinds += 2; // bind and unbind
+		}
+		stats.naiveProgramBinds = (int)objectMatrices.size(); // one use() per game object
+		glBindVertexArray(0);
+		items.clear();
+		objectMatrices.clear();
+	}
+
+	/**
+	 * Returns the counters of the most recent flush()
+	 */
+	const RenderStats& getStats() const {
+		return stats;
+	}
+
+	/**
+	 * Prints the counters of the most recent flush() to the console
+	 */
+	void printStats() const {
+		std::cout << "Render Queue: " << stats.drawCalls << " draws (" << stats.opaqueDraws << " opaque, " << stats.transparentDraws
+		          << " transparent), " << materialIDs.size() << " materials\n"
+		          << "  program binds " << stats.programBinds << " (unsorted " << stats.naiveProgramBinds << "), texture binds "
+		          << stats.textureBinds << " (unsorted " << stats.naiveTextureBinds << "), VAO binds " << stats.vaoBinds
+		          << " (unsorted " << stats.naiveVaoBinds << "), sampler uniforms " << stats.samplerUniformSets
+		          << " (unsorted " << stats.naiveSamplerUniformSets << "), blend changes " << stats.blendChanges << '\n'
+		          << "  texture arrays " << (textureArrays ? "on" : "off") << ": " << stats.textureArrayDraws << " draws, texture binds "
+		          << stats.textureBinds << " (with 2D textures " << stats.unpackedTextureBinds << "), material layer uniforms "
+		          << stats.materialUniformSets << '\n';
+	}
+
+private:
+	struct DrawItem {
+		unsigned long long key;
+		Mesh* mesh;
+		Shader* shader;
+		unsigned int objectIndex; // index into objectMatrices
+		unsigned int features;    // shader features of the variant, PLAIN_SHADER_FEATURES for a plain shader
+	};
+
+	// a plain shader samples every texture, from its 2D texture
+	static const unsigned int PLAIN_SHADER_FEATURES = ~(unsigned int)SHADER_TEXTURE_ARRAY;
+
+	// Sort key layout, from the most significant bit:
+	//   opaque:      pass(2) | shader(8) | material(16) | VAO(16) | depth(22, near first)
+	//   transparent: pass(2) | depth(22, far first) | shader(8) | material(16) | VAO(16)
+	static const int PASS_SHIFT = 62;
+	static const unsigned long long PASS_OPAQUE = 0, PASS_TRANSPARENT = 1;
+	static const unsigned int DEPTH_BITS = 22;
+	// distance at which the depth part of the key saturates; matches the far plane used in Main
+	const float MAX_SORT_DISTANCE = 100.0f;
+
+	std::vector<DrawItem> items;
+	std::vector<glm::mat4> objectMatrices;
+	std::map<std::vector<unsigned int>, unsigned int> materialIDs;
+	RenderStateCache stateCache;
+	RenderStats stats;
+	bool textureArrays = true;
+
+	void submit(GameObject& gameObject, Shader* shader, ShaderVariants* variants, glm::vec3 cameraPosition) {
+		if (gameObject.isDestroyed())
+			return;
+		glm::vec3 boundsMin, boundsMax;
+		gameObject.getWorldBounds(boundsMin, boundsMax);
+		float distance = glm::length(0.5f * (boundsMin + boundsMax) - cameraPosition);
+		unsigned int objectIndex = (unsigned int)objectMatrices.size();
+		objectMatrices.push_back(gameObject.getModel());
+		for (Mesh& mesh : gameObject.getMeshes()) {
+			Shader* meshShader = shader;
+			unsigned int features = PLAIN_SHADER_FEATURES;
+			if (variants) {
+				features = mesh.shaderFeatures | variants->getSceneFeatures();
+				if (!textureArrays)
+					features &= ~SHADER_TEXTURE_ARRAY;
+				features = ShaderVariants::resolve(features);
+				meshShader = variants->get(features);
+			}
+			bool packed = (features & SHADER_TEXTURE_ARRAY) != 0;
+			if (mesh.materialID == 0)
+				mesh.materialID = getMaterialID(mesh, false);
+			if (packed && mesh.arrayMaterialID == 0)
+				mesh.arrayMaterialID = getMaterialID(mesh, true);
+			items.push_back({ makeKey(meshShader, packed ? mesh.arrayMaterialID : mesh.materialID, mesh, distance), &mesh, meshShader, objectIndex, features });
+		}
+	}
+
+	unsigned long long makeKey(Shader* shader, unsigned int materialID, const Mesh& mesh, float distance) const {
+		const unsigned long long depthMax = (1ull << DEPTH_BITS) - 1;
+		unsigned long long depth = (unsigned long long)(std::min(std::max(distance / MAX_SORT_DISTANCE, 0.0f), 1.0f) * depthMax);
+		unsigned long long program = shader->ID & 0xFF, material = materialID & 0xFFFF, vao = mesh.VAO & 0xFFFF;
+		if (mesh.translucent)
+			return (PASS_TRANSPARENT << PASS_SHIFT) | ((depthMax - depth) << 40) | (program << 32) | (material << 16) | vao;
+		return (PASS_OPAQUE << PASS_SHIFT) | (program << 54) | (material << 38) | (vao << 22) | depth;
+	}
+
+	// Meshes that use the same textures in the same order share a material id; with texture arrays, the same arrays
+	unsigned int getMaterialID(const Mesh& mesh, bool packed) {
+		std::vector<unsigned int> textureIDs;
+		for (const Texture& texture : mesh.textures)
+			textureIDs.push_back(packed ? texture.arrayID : texture.id);
+		auto it = materialIDs.find(textureIDs);
+		if (it != materialIDs.end())
+			return it->second;
+		unsigned int id = (unsigned int)materialIDs.size() + 1;
+		materialIDs[textureIDs] = id;
+		return id;
+	}
+};
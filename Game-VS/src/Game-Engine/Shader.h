@@ -5,6 +5,24 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include "GLXtras.h"
+
+/**
+ * Feature keys of shader variants, see ShaderVariants.h. Each is a #define in the shader sources.
+ */
+enum ShaderFeature : unsigned int {
+    SHADER_INSTANCED    = 1 << 0, // model matrix from the per-instance attribute at location 3, not the model uniform
+    SHADER_LIGHTING     = 1 << 1, // ambient and directional diffuse light, from the vertex normals
+    SHADER_SPECULAR_MAP = 1 << 2, // Blinn-Phong highlights scaled by texture_specular1 (needs lighting)
+    SHADER_NORMAL_MAP   = 1 << 3, // normals from texture_normal1, in tangent space (needs lighting, not instanced)
+    SHADER_ALPHA_TEST   = 1 << 4, // discard fragments with alpha below alphaCutoff
+    SHADER_FOG          = 1 << 5, // exponential distance fog
+    SHADER_TEXTURE_ARRAY = 1 << 6, // textures are layers of texture arrays, see MaterialPacker.h
+    SHADER_INDIRECT     = 1 << 7, // model matrix and layers from the per-draw buffer of IndirectRenderer.h (GLSL 4.3)
+    SHADER_FEATURE_COUNT = 8,
+    SHADER_NEVER        = 1u << 31 // in no variant; marks textures that no shader samples, such as height maps
+};
+
 /**
  * Class that encapsulates the data and operations needed for an OpenGL shader
  * Source: https://learnopengl.com/Getting-started/Shaders
@@ -15,7 +33,8 @@ public:
     unsigned int ID;
     
     /**
-     * Constructs a shader object. Upon construction, all openGL setup
+     * Constructs a shader object. Upon construction, all openGL setup.
+     * The program is loaded from the program binary cache if it has these sources, see SetProgramCache() in GLXtras.h
      */
     Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr) {
         // Retrieve the vertex/fragment source code from provided paths
@@ -54,43 +73,47 @@ public:
         } catch (std::ifstream::failure& e) {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
-        const char* vShaderCode = vertexCode.c_str();
-        const char* fShaderCode = fragmentCode.c_str();
-        // Compile shaders
-        unsigned int vertex, fragment;
-        // Vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // Fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-        // If provided, compile geometry shader
-        unsigned int geometry;
-        if (geometryPath != nullptr) {
-            const char* gShaderCode = geometryCode.c_str();
-            geometry = glCreateShader(GL_GEOMETRY_SHADER);
-            glShaderSource(geometry, 1, &gShaderCode, NULL);
-            glCompileShader(geometry);
-            checkCompileErrors(geometry, "GEOMETRY");
-        }
-        // Create the shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        if (geometryPath != nullptr)
-            glAttachShader(ID, geometry);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // Delete the shaders as they're linked into our program now and no longer necessery
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-        if (geometryPath != nullptr)
-            glDeleteShader(geometry);
+        build(vertexCode.c_str(), fragmentCode.c_str(), geometryPath != nullptr ? geometryCode.c_str() : nullptr);
+    }
 
+    /**
+     * Constructs a shader object from source code rather than files, e.g. a variant with #defines added
+     * @param geometryCode - nullptr if none
+     */
+    static Shader fromSource(const char* vertexCode, const char* fragmentCode, const char* geometryCode = nullptr) {
+        Shader shader;
+        shader.build(vertexCode, fragmentCode, geometryCode);
+        return shader;
+    }
+
+    /**
+     * Constructs a compute shader program (GL 4.3) from a file. Compute programs are not in the program binary cache.
+     */
+    static Shader fromComputeFile(const char* computePath) {
+        std::string computeCode;
+        std::ifstream cShaderFile;
+        cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        try {
+            cShaderFile.open(computePath);
+            std::stringstream cShaderStream;
+            cShaderStream << cShaderFile.rdbuf();
+            cShaderFile.close();
+            computeCode = cShaderStream.str();
+        } catch (std::ifstream::failure& e) {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << computePath << std::endl;
+        }
+        Shader shader;
+        const char* cShaderCode = computeCode.c_str();
+        unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(compute, 1, &cShaderCode, NULL);
+        glCompileShader(compute);
+        shader.checkCompileErrors(compute, "COMPUTE");
+        shader.ID = glCreateProgram();
+        glAttachShader(shader.ID, compute);
+        glLinkProgram(shader.ID);
+        shader.checkCompileErrors(shader.ID, "PROGRAM");
+        glDeleteShader(compute);
+        return shader;
     }
 
     /**
@@ -161,6 +184,53 @@ public:
     }
 
 private:
+    Shader() : ID(0) { }
+
+    /**
+     * Compiles and links the program, or loads it from the program binary cache if it has these sources
+     */
+    void build(const char* vShaderCode, const char* fShaderCode, const char* gShaderCode) {
+        ID = LoadCachedProgram(vShaderCode, nullptr, nullptr, gShaderCode, fShaderCode);
+        if (ID)
+            return;
+        // Compile shaders
+        unsigned int vertex, fragment;
+        // Vertex shader
+        vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(vertex, 1, &vShaderCode, NULL);
+        glCompileShader(vertex);
+        checkCompileErrors(vertex, "VERTEX");
+        // Fragment Shader
+        fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fragment, 1, &fShaderCode, NULL);
+        glCompileShader(fragment);
+        checkCompileErrors(fragment, "FRAGMENT");
+        // If provided, compile geometry shader
+        unsigned int geometry;
+        if (gShaderCode != nullptr) {
+            geometry = glCreateShader(GL_GEOMETRY_SHADER);
+            glShaderSource(geometry, 1, &gShaderCode, NULL);
+            glCompileShader(geometry);
+            checkCompileErrors(geometry, "GEOMETRY");
+        }
+        // Create the shader Program
+        ID = glCreateProgram();
+        glAttachShader(ID, vertex);
+        glAttachShader(ID, fragment);
+        if (gShaderCode != nullptr)
+            glAttachShader(ID, geometry);
+        if (ProgramCacheEnabled())
+            glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+        SaveCachedProgram(ID, vShaderCode, nullptr, nullptr, gShaderCode, fShaderCode);
+        // Delete the shaders as they're linked into our program now and no longer necessery
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+        if (gShaderCode != nullptr)
+            glDeleteShader(geometry);
+    }
+
     
     /**
      * Utility function that checks shader compilation/linking errors.
@@ -0,0 +1,208 @@
+#pragma once
+#include <glad.h>
+#include <glm/glm.hpp>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include "Mesh.h"
+#include "Shader.h"
+
+/**
+ * Scene-wide values of the uniforms used by the optional shader features. They are set on each variant when it is
+ * built, and again on every built variant by ShaderVariants::setSceneSettings().
+ */
+struct ShaderSceneSettings {
+	glm::vec3 lightDirection = glm::normalize(glm::vec3(0.3f, 1.0f, 0.5f)); // toward the light, in world space
+	glm::vec3 lightColor = glm::vec3(0.8f);
+	glm::vec3 ambientColor = glm::vec3(0.4f);
+	float shininess = 32.0f;
+	glm::vec3 fogColor = glm::vec3(0.6f, 0.7f, 0.8f);
+	float fogDensity = 0.02f;
+	float alphaCutoff = 0.5f;
+};
+
+/**
+ * A family of shader programs built from one pair of vertex and fragment sources, specialized at compile time.
+ * Each ShaderFeature bit (see Shader.h) is a #define inserted after the #version line, so the code of features a
+ * variant does not have is stripped by the GLSL preprocessor instead of branching at run time. Variants are
+ * compiled on first use and cached; meshes request the features their textures need (Mesh::shaderFeatures), on
+ * top of the scene features, which apply to everything drawn with the family.
+ */
+class ShaderVariants {
+public:
+	/**
+	 * Reads the sources. No program is compiled until a variant is requested.
+	 */
+	ShaderVariants(const char* vertexPath, const char* fragmentPath) : variants() {
+		vertexCode = readFile(vertexPath);
+		fragmentCode = readFile(fragmentPath);
+	}
+
+	/**
+	 * Drops the features that cannot be combined with the rest: specular and normal maps only affect lighting,
+	 * the normal map's tangent attributes share location 3 with the instance matrix, and indirect draws take
+	 * their model matrix from the draw buffer rather than the instance matrix.
+	 */
+	static unsigned int resolve(unsigned int features) {
+		features &= (1u << SHADER_FEATURE_COUNT) - 1;
+		if (!(features & SHADER_LIGHTING))
+			features &= ~(SHADER_SPECULAR_MAP | SHADER_NORMAL_MAP);
+		if (features & SHADER_INDIRECT)
+			features &= ~SHADER_INSTANCED;
+		if (features & SHADER_INSTANCED)
+			features &= ~SHADER_NORMAL_MAP;
+		return features;
+	}
+
+	/**
+	 * Returns the variant with the given features, compiling it if this is its first use.
+	 * The pointer stays valid for the lifetime of this object.
+	 */
+	Shader* get(unsigned int features) {
+		features = resolve(features);
+		auto it = variants.find(features);
+		if (it != variants.end())
+			return &it->second.shader;
+		auto start = std::chrono::high_resolution_clock::now();
+		std::string defines = definesOf(features);
+		const char* version = (features & SHADER_INDIRECT) ? "#version 430 core" : nullptr;
+		std::string vertex = insertDefines(vertexCode, defines, version), fragment = insertDefines(fragmentCode, defines, version);
+		Variant& variant = variants.emplace(features, Variant{ Shader::fromSource(vertex.c_str(), fragment.c_str()), 0.0 }).first->second;
+		applySettings(variant.shader, features);
+		variant.buildMS = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		return &variant.shader;
+	}
+
+	/**
+	 * Returns the variant for a mesh: the features its textures call for, plus the scene features
+	 */
+	Shader* forMesh(const Mesh& mesh) {
+		return get(mesh.shaderFeatures | sceneFeatures);
+	}
+
+	/**
+	 * Sets the features added to every mesh's own, e.g. SHADER_LIGHTING | SHADER_FOG
+	 */
+	void setSceneFeatures(unsigned int features) {
+		sceneFeatures = features;
+	}
+
+	unsigned int getSceneFeatures() const {
+		return sceneFeatures;
+	}
+
+	/**
+	 * Sets the scene uniforms of every variant built so far, and of those built later
+	 */
+	void setSceneSettings(const ShaderSceneSettings& settings) {
+		this->settings = settings;
+		for (auto& entry : variants)
+			applySettings(entry.second.shader, entry.first);
+	}
+
+	const ShaderSceneSettings& getSceneSettings() const {
+		return settings;
+	}
+
+	int variantCount() const {
+		return (int)variants.size();
+	}
+
+	/**
+	 * Returns the names of the features, e.g. "INSTANCED|FOG", or "base" if none
+	 */
+	static std::string featureNames(unsigned int features) {
+		std::string names;
+		for (int i = 0; i < SHADER_FEATURE_COUNT; i++)
+			if (features & (1u << i))
+				names += (names.empty() ? "" : "|") + std::string(featureName(i));
+		return names.empty() ? "base" : names;
+	}
+
+	/**
+	 * Prints the variants built so far and their build times to the console
+	 */
+	void printStats() const {
+		double totalMS = 0.0;
+		for (auto& entry : variants)
+			totalMS += entry.second.buildMS;
+		std::cout << "Shader Variants: " << variants.size() << " built in " << std::fixed << std::setprecision(2) << totalMS << " ms\n";
+		for (auto& entry : variants)
+			std::cout << "  " << featureNames(entry.first) << ": " << entry.second.buildMS << " ms\n";
+		std::cout << std::defaultfloat;
+	}
+
+private:
+	struct Variant {
+		Shader shader;
+		double buildMS;
+	};
+
+	std::string vertexCode, fragmentCode;
+	std::map<unsigned int, Variant> variants;
+	unsigned int sceneFeatures = 0;
+	ShaderSceneSettings settings;
+
+	// name of the feature with bit i, as #defined in the sources
+	static const char* featureName(int i) {
+		static const char* names[SHADER_FEATURE_COUNT] = { "INSTANCED", "LIGHTING", "SPECULAR_MAP", "NORMAL_MAP", "ALPHA_TEST", "FOG", "TEXTURE_ARRAY", "INDIRECT" };
+		return names[i];
+	}
+
+	static std::string readFile(const char* path) {
+		std::ifstream file(path);
+		if (!file) {
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << path << std::endl;
+			return std::string();
+		}
+		std::stringstream stream;
+		stream << file.rdbuf();
+		return stream.str();
+	}
+
+	static std::string definesOf(unsigned int features) {
+		std::string defines;
+		for (int i = 0; i < SHADER_FEATURE_COUNT; i++)
+			if (features & (1u << i))
+				defines += "#define " + std::string(featureName(i)) + "\n";
+		return defines;
+	}
+
+	// #version must remain the first statement of the source, so the defines go on the line after it
+	// @param versionLine - replaces the #version line for features that need a newer GLSL, or nullptr to keep it
+	static std::string insertDefines(const std::string& code, const std::string& defines, const char* versionLine) {
+		size_t version = code.find("#version");
+		if (version == std::string::npos)
+			return (versionLine ? std::string(versionLine) + "\n" : std::string()) + defines + code;
+		size_t lineEnd = code.find('\n', version);
+		if (lineEnd == std::string::npos)
+			lineEnd = code.size();
+		std::string head = versionLine ? code.substr(0, version) + versionLine : code.substr(0, lineEnd);
+		return head + "\n" + defines + (lineEnd < code.size() ? code.substr(lineEnd + 1) : std::string());
+	}
+
+	// Sets the uniforms of the features the variant has, keeping the current program bound
+	void applySettings(Shader& shader, unsigned int features) {
+		GLint current = 0;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+		shader.use();
+		if (features & SHADER_LIGHTING) {
+			shader.setVec3("lightDirection", glm::normalize(settings.lightDirection));
+			shader.setVec3("lightColor", settings.lightColor);
+			shader.setVec3("ambientColor", settings.ambientColor);
+		}
+		if (features & SHADER_SPECULAR_MAP)
+			shader.setFloat("shininess", settings.shininess);
+		if (features & SHADER_FOG) {
+			shader.setVec3("fogColor", settings.fogColor);
+			shader.setFloat("fogDensity", settings.fogDensity);
+		}
+		if (features & SHADER_ALPHA_TEST)
+			shader.setFloat("alphaCutoff", settings.alphaCutoff);
+		glUseProgram(current);
+	}
+};
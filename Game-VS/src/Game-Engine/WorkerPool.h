@@ -0,0 +1,109 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+/**
+ * A small fixed-size pool of worker threads used to split per-frame engine work (culling, etc.) into parallel jobs.
+ * Threads are created once and sleep between jobs, so dispatching work each frame does not pay for thread creation.
+ */
+class WorkerPool {
+public:
+	/**
+	 * Constructs a worker pool. If numThreads is 0, one thread less than the hardware concurrency is used,
+	 * since the calling thread also takes part in every job.
+	 */
+	WorkerPool(unsigned int numThreads = 0) {
+		if (numThreads == 0) {
+			unsigned int hw = std::thread::hardware_concurrency();
+			numThreads = hw > 1 ? hw - 1 : 0;
+		}
+		for (unsigned int i = 0; i < numThreads; i++)
+			threads.emplace_back(&WorkerPool::workerLoop, this);
+	}
+
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		wakeWorkers.notify_all();
+		for (std::thread& thread : threads)
+			thread.join();
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	/**
+	 * Runs job(i) for every i in [0, count) across the pool and the calling thread. Returns when all jobs are done.
+	 */
+	void parallelFor(int count, const std::function<void(int)>& job) {
+		if (count <= 0)
+			return;
+		if (threads.empty() || count == 1) {
+			for (int i = 0; i < count; i++)
+				job(i);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			currentJob = &job;
+			jobCount = count;
+			nextIndex = 0;
+			busyWorkers = (int)threads.size();
+			generation++;
+		}
+		wakeWorkers.notify_all();
+		runJobs();
+		std::unique_lock<std::mutex> lock(mutex);
+		workersDone.wait(lock, [this] { return busyWorkers == 0; });
+		currentJob = nullptr;
+	}
+
+	/**
+	 * Number of threads that take part in a parallelFor(), including the calling thread.
+	 */
+	unsigned int getThreadCount() const {
+		return (unsigned int)threads.size() + 1;
+	}
+
+private:
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wakeWorkers, workersDone;
+	const std::function<void(int)>* currentJob = nullptr;
+	int jobCount = 0;
+	std::atomic<int> nextIndex{ 0 };
+	int busyWorkers = 0;
+	unsigned long long generation = 0;
+	bool quit = false;
+
+	// Pulls job indices until none are left
+	void runJobs() {
+		for (int i = nextIndex++; i < jobCount; i = nextIndex++)
+			(*currentJob)(i);
+	}
+
+	void workerLoop() {
+		unsigned long long seenGeneration = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeWorkers.wait(lock, [&] { return quit || generation != seenGeneration; });
+				if (quit)
+					return;
+				seenGeneration = generation;
+			}
+			runJobs();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				busyWorkers--;
+			}
+			workersDone.notify_one();
+		}
+	}
+};
@@ -6,7 +6,11 @@
 */
 #pragma once
 #include <glm/common.hpp>
+#include <map>
+#include <string>
+#include <vector>
 #include "Audio-Engine/SoundInfo.h"
+#include "Audio-Engine/ConvolutionReverb.h"
 
 // window size settings
 const unsigned int SCREEN_WIDTH = 1920, SCREEN_HEIGHT = 1080;
@@ -16,7 +20,29 @@ float KEY_MIN_RETRIGGER_TIME = 0.2f;
 // Variables tracking the last time a particular key was pressed
 float key1LastTime = 0.0f, key2LastTime = 0.0f, key3LastTime = 0.0f, key4LastTime = 0.0f, key5LastTime = 0.0f,
       key6LastTime = 0.0f, key7LastTime = 0.0f, key8LastTime = 0.0f, key9LastTime = 0.0f, key0LastTime = 0.0,
-      keyKLastTime = 0.0f, keyMLastTime = 0.0f;
+      keyKLastTime = 0.0f, keyMLastTime = 0.0f, keyOLastTime = 0.0f, keyPLastTime = 0.0f, keyBLastTime = 0.0f,
+      keyF11LastTime = 0.0f, keyF12LastTime = 0.0f, keyTLastTime = 0.0f, keyILastTime = 0.0f, keyGLastTime = 0.0f;
+
+// frame capture files: F12 screenshots are numbered, F11 or --record [file] records every frame (to numbered Targa
+// files if the name has a printf integer format, else to a raw BGR video file)
+const char* SCREENSHOT_FILE_FORMAT = "screenshot%03d.tga";
+const char* RECORDING_FILE = "recording.bgr";
+
+// linked shader programs saved by the driver, loaded instead of compiling while the sources and driver are unchanged
+const char* SHADER_CACHE_DIRECTORY = "shader-cache";
+
+// model shader features applied to every object (see ShaderFeature in Game-Engine/Shader.h), eg SHADER_LIGHTING | SHADER_FOG;
+// none keeps the unlit look, with textures sampled only by those features left unbound
+const unsigned int SHADER_SCENE_FEATURES = 0;
+
+// draw the game objects with multi-draw indirect commands (Game-Engine/IndirectRenderer.h) when the driver has GL 4.3,
+// else, or with this false, with the GL 3.3 render queue
+const bool INDIRECT_RENDERING = true;
+
+// cull the instances of instanced objects (grass) in a compute shader (Game-Engine/InstanceCuller.h) when the driver has
+// GL 4.3, against the view frustum and, with GPU_INSTANCE_OCCLUSION, the depth buffer of the previous frame
+const bool GPU_INSTANCE_CULLING = true;
+const bool GPU_INSTANCE_OCCLUSION = true;
 
 // black background color
 glm::vec4 COLOR_BLACK(0.05f, 0.05f, 0.05f, 1.0f);
@@ -55,6 +81,8 @@ const char* OBJ_BUSH = "res/objects/flora/trees/hazelnutbush/Hazelnut.obj";
 const char* OBJ_TREE_BUSH = "res/objects/flora/Tree4/uploads_files_885045_tree_1.obj";
 const char* OBJ_TREE_LINE = "res/objects/flora/Tree_Line/FKLPI_Forest/FKLPI_Forest.dae";
 const char* OBJ_YUN = "res/objects/Yun/Yun.obj";
+// Models read by the OBJ benchmark (--obj-benchmark), and whose triangles the mesh BVH benchmark (--bvh-benchmark) picks against
+std::vector<const char*> MESH_BENCHMARK_MODELS{ OBJ_OAK, OBJ_PINE, OBJ_TREE, OBJ_HOUSE3, OBJ_HOUSE2, OBJ_HOUSE, OBJ_WELL, OBJ_TOWNHOUSE, OBJ_FOUNTAIN };
 
 // Global object size scaling, used to bring all objects down in size proportionally
 glm::vec3 GLOBAL_SCALE(0.5f);
@@ -122,6 +150,24 @@ glm::vec3 trantreeline4(180.5f, -1.6f, 60.0f), scaletreeline4(0.90f), rottreelin
 glm::vec3 trantreeline5(-10.5f, -1.4f, -70.0f);
 
 
+/**
+ * Occluder box of an asset, given as fractions of the model's object-space bounding box (0 = min, 1 = max corner).
+ * The box must stay inside the solid part of the model (walls, dense foliage), so roof overhangs, chimneys
+ * and sparse branches are left out.
+ */
+struct OccluderBox {
+	glm::vec3 minFraction, maxFraction;
+};
+// Assets that are used as occluders by the occlusion culler. Objects not in this list never hide other objects.
+std::map<std::string, OccluderBox> OCCLUDER_BOXES{
+	{ OBJ_TOWNHOUSE,  { glm::vec3(0.15f, 0.0f, 0.15f), glm::vec3(0.85f, 0.55f, 0.85f) } },
+	{ OBJ_HOUSE2,     { glm::vec3(0.15f, 0.0f, 0.15f), glm::vec3(0.85f, 0.55f, 0.85f) } },
+	{ OBJ_HOUSE3,     { glm::vec3(0.15f, 0.0f, 0.15f), glm::vec3(0.85f, 0.50f, 0.85f) } },
+	{ OBJ_HOUSE4,     { glm::vec3(0.15f, 0.0f, 0.15f), glm::vec3(0.85f, 0.50f, 0.85f) } },
+	{ OBJ_COTTAGE,    { glm::vec3(0.20f, 0.0f, 0.20f), glm::vec3(0.80f, 0.50f, 0.80f) } },
+	{ OBJ_TREE_LINE,  { glm::vec3(0.05f, 0.0f, 0.35f), glm::vec3(0.95f, 0.45f, 0.65f) } },
+};
+
 // Coin-specific starting scale/rotation for all coin instances
 glm::vec3 scaleCoins(0.085f), rotCoins(0.0f);
 // Coin translations for each individual coin
@@ -142,16 +188,50 @@ static std::vector<glm::vec3> coinTranslations{
 const char* SFX_LOOP_FOUNTAIN    = "res/sound/fountain/Fountain_Loop2.wav";
 const char* DIALOGUE_TOWN_INTRO  = "res/sound/dialogue/Character1_Dialogue_TownIntroduction.wav";
 const char* SFX_LOOP_TREE_BIRDS  = "res/sound/animals/birds/SFX_LOOP_TREE_BIRDS.wav";
+// packed and conditioned audio assets, built from the manifest with --pack-audio. Sounds not in it load from the files above.
+const char* AUDIO_PACK_MANIFEST  = "res/sound/AudioPack.txt";
+const char* AUDIO_PACK           = "res/sound/GameAudio.pak";
+// mixer block size and output buffers; 512 x 4 samples hold about 46 ms of audio, half of FMOD's default latency
+unsigned int AUDIO_DSP_BUFFER_LENGTH = 512;
+int AUDIO_DSP_BUFFER_COUNT = 4;
 
 // default reverb and volume for sounds used in main
 float defReverb = 0.5, defVolume = 0.9;
-// Scaled translations of in-game 3D sounds. TODO add sounds to more trees
+// Scaled translations of in-game 3D sounds
 glm::vec3 fountainSoundLocation = tranFountain * GLOBAL_POSITION_SCALE;
-glm::vec3 japaneseTreeSoundLocation = tranfir1 * GLOBAL_POSITION_SCALE;
-glm::vec3 treeSoundLocation = tranWillowtree * GLOBAL_POSITION_SCALE;
 glm::vec3 npcSoundLocation = tranNPC * GLOBAL_POSITION_SCALE;
 // SoundInfo objects used in Main
 SoundInfo fountainSoundLoop(SFX_LOOP_FOUNTAIN,   defVolume, defReverb, SOUND_LOOP,     SOUND_3D, fountainSoundLocation.x, fountainSoundLocation.y,   fountainSoundLocation.z);
-SoundInfo soundJapaneseTree(SFX_LOOP_TREE_BIRDS, defVolume, defReverb, SOUND_LOOP,     SOUND_3D, japaneseTreeSoundLocation.x, japaneseTreeSoundLocation.y, japaneseTreeSoundLocation.z);
-SoundInfo soundTree        (SFX_LOOP_TREE_BIRDS, defVolume, defReverb, SOUND_LOOP,     SOUND_3D, treeSoundLocation.x,  treeSoundLocation.y, treeSoundLocation.z);
+// bird song played by the ambient emitters in the trees, its position is set per emitter
+SoundInfo soundTreeBirds   (SFX_LOOP_TREE_BIRDS, defVolume, defReverb, SOUND_LOOP,     SOUND_3D);
 SoundInfo dialogue         (DIALOGUE_TOWN_INTRO, defVolume, defReverb, SOUND_ONE_SHOT, SOUND_3D, npcSoundLocation.x, npcSoundLocation.y, npcSoundLocation.z);
+
+// Tree assets that get a bird song emitter in their canopy
+std::vector<std::string> BIRD_EMITTER_TREES{ OBJ_OAK, OBJ_PINE, OBJ_TREE, OBJ_WILLOWTREE, OBJ_TREE_BUSH };
+// Tree lines are forests, and get a bird song emitter every this many units across their footprint
+float TREE_LINE_EMITTER_SPACING = 6.0f;
+// Number of nearest bird song emitters with their own voice, the rest in range are merged into one voice
+int BIRD_EMITTERS_ACTIVE = 3;
+
+/**
+ * Reverb zone of the convolution reverb. Its impulse response is read from a wav file if one is given, otherwise it is
+ * synthesized from the settings. Zones with the same name share their impulse response. A radius of 0 marks the
+ * default zone, which applies outside all others.
+ */
+struct ReverbZoneSettings {
+	const char* name;
+	glm::vec3 position;
+	float radius;
+	const char* impulseResponseFile;
+	ImpulseResponseSettings impulseResponse; // decay s, pre-delay ms, early reflections, their ms and level, damping, seed
+	float wetLevel;
+};
+std::vector<ReverbZoneSettings> REVERB_ZONES{
+	// open square: short, diffuse decay, with sparse late reflections off the surrounding houses
+	{ "Open Square", glm::vec3(0.0f), 0.0f, nullptr, { 1.2f, 12.0f, 6, 60.0f, 0.4f, 0.6f, 1 }, 0.5f },
+	// stone well: dense, bright flutter echoes
+	{ "Well", tranWell * GLOBAL_POSITION_SCALE, 4.0f, nullptr, { 0.8f, 2.0f, 16, 12.0f, 0.6f, 0.2f, 2 }, 0.7f },
+	// town hall interiors, heard from their doors: long and warm
+	{ "Town Hall", tranGreenPine * GLOBAL_POSITION_SCALE, 10.0f, nullptr, { 2.5f, 20.0f, 10, 50.0f, 0.5f, 0.5f, 3 }, 0.6f },
+	{ "Town Hall", tranGreenPine1 * GLOBAL_POSITION_SCALE, 10.0f, nullptr, { 2.5f, 20.0f, 10, 50.0f, 0.5f, 0.5f, 3 }, 0.6f },
+};
@@ -9,8 +9,8 @@
 #include <iostream>
 #include <stdlib.h> // rand()
 #include <memory>   // shared_ptr
-#include <thread>   // std::thread
 #include <chrono>
+#include <algorithm>
 #include <glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
@@ -19,10 +19,23 @@
 #include "Game-Engine/Shader.h"
 #include "Game-Engine/Model.h"
 #include "Game-Engine/CharacterCamera.h"
+#include "Game-Engine/OcclusionCuller.h"
+#include "Game-Engine/RenderQueue.h"
+#include "Game-Engine/ShaderVariants.h"
+#include "Game-Engine/MaterialPacker.h"
+#include "Game-Engine/IndirectRenderer.h"
+#include "Game-Engine/InstanceCuller.h"
 #include "Audio-Engine/AudioEngine.h"
 #include "Audio-Engine/FootstepSoundController.h"
 #include "Audio-Engine/CoinChallengeSoundController.h"
+#include "Audio-Engine/AmbientEmitterManager.h"
+#include "Audio-Engine/AudioRenderHarness.h"
 #include "GameData.h"
+#include "MeshBVH.h"
+#include "Misc.h"
+#include "FrameCapture.h"
+#include "GLXtras.h"
+#include "Draw.h"
 // custom game objects
 #include "Game-Engine/Bird.h"
 #include "Game-Engine/Harp.h"
@@ -54,12 +67,42 @@ std::vector<Animation*> animationObjects;
 std::vector<InstancedObject*> instancedObjects;
 std::vector<Coin*> coins;
 
+// Occlusion culling of game objects, and per-frame world bounds/visibility of each game object
+OcclusionCuller* occlusionCuller;
+bool occlusionCullingEnabled = true;
+std::vector<glm::vec3> gameObjectBoundsMin, gameObjectBoundsMax;
+std::vector<unsigned char> gameObjectVisibility;
+
+// Sorted submission of game object meshes with redundant GL state changes removed
+RenderQueue* renderQueue;
+
+// Variants of the model shader, compiled with only the features each mesh and the scene use
+ShaderVariants* modelShaders;
+
+// Texture arrays shared by the game objects' materials
+MaterialPacker* materialPacker;
+
+// Multi-draw indirect rendering of game objects, if the context has GL 4.3, and whether it is used instead of the render queue
+IndirectRenderer* indirectRenderer = nullptr;
+bool indirectRenderingEnabled = true;
+
+// GPU culling of the instanced objects' instances, if the context has GL 4.3 (set i culls instancedObjects[i]), and whether it is used
+InstanceCuller* instanceCuller = nullptr;
+bool gpuCullingEnabled = true;
+
+// Asynchronous screenshots and recordings, and the number of the next screenshot
+FrameCapture* frameCapture;
+int screenshotCount = 0;
+
 // Audio Engine
 std::shared_ptr<AudioEngine> audioEngine;
 
 // Sound Controllers
 FootstepSoundController* footstepController;
 CoinChallengeSoundController* coinSoundController;
+AmbientEmitterManager* ambientEmitters;
+// Time at which the npc's dialogue line finishes and the coin challenge starts, or -1 if it isn't pending
+float dialogueEndTime = -1.0f;
 
 /**
  * Method used to make all coins appear on the game map
@@ -69,54 +112,281 @@ void resetCoins() {
 }
 
 /**
- * Method used by helper thread to display coins after waiting for dialog sound to finish
+ * Prints the statistics of the most recently rendered frame to the console
  */
-void waitForDialogueCompletion(unsigned int lengthMS) {
-	//std::cout << "In thread, waiting for  "<< lengthMS << " ms\n";
-	std::this_thread::sleep_for(std::chrono::milliseconds(lengthMS));
-	resetCoins();
-	coinSoundController->startScore();
+void printFrameStats() {
+	if (occlusionCullingEnabled)
+		occlusionCuller->printStats();
+	if (indirectRenderer && indirectRenderingEnabled)
+		indirectRenderer->printStats();
+	else
+		renderQueue->printStats();
+	if (instanceCuller && gpuCullingEnabled)
+		instanceCuller->printStats();
+	modelShaders->printStats();
+	frameCapture->PrintStats();
+	ambientEmitters->printStats();
+	audioEngine->printVoiceStats();
+	audioEngine->printEventPoolStats();
+	audioEngine->printReverbStats();
+	audioEngine->printOneShotStats();
+}
 
+/**
+ * Initializes the audio engine, starts loading the game's sounds and creates the sound controllers
+ * @param outputType, outputFilePath - FMOD output, see AudioEngine::init()
+ */
+void initAudio(FMOD_OUTPUTTYPE outputType = FMOD_OUTPUTTYPE_AUTODETECT, const char* outputFilePath = nullptr) {
+	audioEngine = std::make_shared<AudioEngine>();
+	AudioEngineInitOptions options;
+	options.outputType = outputType;
+	options.outputFilePath = outputFilePath;
+	options.dspBufferLength = AUDIO_DSP_BUFFER_LENGTH;
+	options.dspBufferCount = AUDIO_DSP_BUFFER_COUNT;
+	audioEngine->init(options);
+	audioEngine->loadAudioPack(AUDIO_PACK);
+
+	// reverb zones, zones with the same name share their impulse response
+	std::map<std::string, int> impulseResponses;
+	for (const ReverbZoneSettings& zone : REVERB_ZONES) {
+		if (!impulseResponses.count(zone.name)) {
+			ImpulseResponse impulseResponse;
+			if (!zone.impulseResponseFile || !impulseResponse.loadWav(zone.impulseResponseFile))
+				impulseResponse = ImpulseResponse::synthesize(zone.name, zone.impulseResponse, AudioEngine::AUDIO_SAMPLE_RATE);
+			impulseResponses[zone.name] = audioEngine->addReverbImpulseResponse(impulseResponse, zone.wetLevel);
+		}
+		audioEngine->addReverbZone(zone.name, zone.position, zone.radius, impulseResponses[zone.name]);
+	}
+	
+	// set voice categories, the fountain is the focal point of the square so it outranks the trees
+	fountainSoundLoop.setCategory(SOUND_CATEGORY_AMBIENT);
+	fountainSoundLoop.setPriority(64);
+	soundTreeBirds.setCategory(SOUND_CATEGORY_AMBIENT);
+	dialogue.setCategory(SOUND_CATEGORY_DIALOGUE);
+	dialogue.setPriority(0);
+
+	// start loading sounds, FMOD reads and decodes them on its loading thread while the models load
+	audioEngine->loadSound(fountainSoundLoop);
+	audioEngine->loadSound(soundTreeBirds);
+	audioEngine->loadSound(dialogue);
+	
+	// setup sound controllers
+	footstepController = new FootstepSoundController(audioEngine);
+	coinSoundController = new CoinChallengeSoundController(audioEngine, coinTranslations.size());
 }
 
 /**
- * Gets the current projection matrix based on screen dimensions and zoom amount
+ * Renders the game's audio through a scripted play-through without a window or sound card, and prints the mixing cost.
+ * Command line: --audio-render [max seconds] [--wav mixdown.wav]
+ * @returns the process exit code
  */
-static glm::mat4 getProjection() {
-	return glm::perspective(glm::radians(camera.Zoom), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT, 0.1f, 100.0f);
+int renderAudioOffline(int argc, char** argv) {
+	double maxSeconds = 120.0;
+	const char* wavFilePath = nullptr;
+	for (int i = 2; i < argc; i++) {
+		if (std::string(argv[i]) == "--wav" && i + 1 < argc)
+			wavFilePath = argv[++i];
+		else
+			maxSeconds = atof(argv[i]);
+	}
+	if (maxSeconds <= 0.0) {
+		std::cout << "usage: --audio-render [max seconds] [--wav mixdown.wav]\n";
+		return -1;
+	}
+	initAudio(wavFilePath ? FMOD_OUTPUTTYPE_WAVWRITER_NRT : FMOD_OUTPUTTYPE_NOSOUND_NRT, wavFilePath);
+	audioEngine->waitForSoundLoads();
+	AudioRenderReport report = AudioRenderHarness(audioEngine, footstepController, coinSoundController).run(maxSeconds);
+	report.print();
+	audioEngine->printReverbStats();
+	audioEngine->printOneShotStats();
+	audioEngine->printSoundMemoryReport();
+	audioEngine->deactivate();
+	return 0;
 }
 
 /**
- *  Performs the OpenGL calls to render a GameObject with a provided shader.
+ * Offline packaging step: conditions the sounds listed in a manifest and packs them into one audio pack file.
+ * Command line: --pack-audio [manifest] [pack file]
+ * @returns the process exit code
  */
-static void renderGameObject(GameObject &gameObject, Shader* shader) {
-	// enable shader before setting uniforms
-	shader->use();
-	// view/projection transformations
-	glm::mat4 projection = getProjection();
-	glm::mat4 view = camera.GetViewMatrix();
-	shader->setMat4("projection", projection);
-	shader->setMat4("view", view);
-	// render the loaded model
-	shader->setMat4("model", gameObject.getModel());
-	gameObject.draw(shader);
+int packAudio(int argc, char** argv) {
+	AudioPackBuilder builder;
+	if (!builder.readManifest(argc > 2 ? argv[2] : AUDIO_PACK_MANIFEST) || !builder.write(argc > 3 ? argv[3] : AUDIO_PACK))
+		return -1;
+	builder.printReport();
+	return 0;
 }
 
 /**
- * Main program entry point which contains the OpenGL Loop.
+ * Creates a window with a core profile context of the given version
+ * @returns the window, or NULL if the driver has no such context
  */
-int main()
-{
-	glfwInit();
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+static GLFWwindow* createWindow(int major, int minor, bool visible) {
+	glfwDefaultWindowHints();
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, major);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, minor);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
 
 #ifdef __APPLE__
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
-	GLFWwindow* window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Fountain Game", NULL, NULL);
+	return glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Fountain Game", NULL, NULL);
+}
+
+/**
+ * Renders the benchmark models with the render queue and with the indirect renderer into hidden framebuffers and
+ * compares the images, for each set of scene features with texture arrays on and off. Runs without a GPU under
+ * Mesa's software rasterizer, e.g. LIBGL_ALWAYS_SOFTWARE=1 xvfb-run GraphicsApps --indirect-validate
+ * @param argv[2] - optional fraction of pixels that may differ per image, 0.001 by default
+ * @returns 0 if every image matches, 1 if any doesn't, -1 if there is no GL 4.3 context
+ */
+int validateIndirectRendering(int argc, char** argv) {
+	float tolerance = argc > 2 ? (float)atof(argv[2]) : 0.001f;
+	glfwInit();
+	GLFWwindow* window = createWindow(4, 3, false);
+	if (window == NULL) {
+		std::cout << "Failed to create a GL 4.3 window" << std::endl;
+		glfwTerminate();
+		return -1;
+	}
+	glfwMakeContextCurrent(window);
+	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress) || !IndirectRenderer::supported()) {
+		std::cout << "Failed to initialize GLAD with GL 4.3" << std::endl;
+		glfwTerminate();
+		return -1;
+	}
+	stbi_set_flip_vertically_on_load(true);
+	glEnable(GL_DEPTH_TEST);
+
+	// the models in a row along x, each scaled to fit a 2 unit cube and standing on y = 0
+	std::vector<GameObject*> objects;
+	for (const char* path : MESH_BENCHMARK_MODELS) {
+		GameObject* object = new GameObject(path);
+		glm::vec3 localMin, localMax;
+		object->getLocalBounds(localMin, localMax);
+		glm::vec3 size = localMax - localMin;
+		float extent = std::max(size.x, std::max(size.y, size.z));
+		if (!(extent > 0.0f)) {
+			delete object;
+			continue;
+		}
+		float scale = 2.0f / extent;
+		glm::vec3 center = (localMin + localMax) * 0.5f;
+		float x = 2.5f * objects.size() - 1.25f * (MESH_BENCHMARK_MODELS.size() - 1);
+		object->setScale(glm::vec3(scale));
+		object->setTranslation(glm::vec3(x - center.x * scale, -localMin.y * scale, -center.z * scale));
+		objects.push_back(object);
+	}
+
+	ShaderVariants variants("res/shaders/model.vs", "res/shaders/model.fs");
+	MaterialPacker packer;
+	for (GameObject* object : objects)
+		packer.add(object->getMeshes());
+	packer.pack();
+	packer.printStats();
+	IndirectRenderer renderer;
+	renderer.build(objects);
+
+	float halfWidth = 1.25f * MESH_BENCHMARK_MODELS.size();
+	std::vector<glm::vec3> eyes = { glm::vec3(0.0f, 3.0f, halfWidth * 1.5f), glm::vec3(-halfWidth, 2.0f, 4.0f),
+	                                glm::vec3(halfWidth, 5.0f, -4.0f), glm::vec3(0.5f, 1.0f, 3.0f) };
+	unsigned int sceneFeatures[] = { 0, SHADER_LIGHTING | SHADER_FOG, SHADER_LIGHTING | SHADER_ALPHA_TEST | SHADER_FOG };
+	bool passed = true;
+	for (unsigned int features : sceneFeatures)
+		for (bool textureArrays : { false, true }) {
+			std::cout << "Scene features " << ShaderVariants::featureNames(features) << ", texture arrays "
+			          << (textureArrays ? "on" : "off") << '\n';
+			variants.setSceneFeatures(features);
+			renderer.setTextureArrays(textureArrays);
+			passed = renderer.validate(objects, variants, eyes, glm::vec3(0.0f, 1.0f, 0.0f), SCREEN_WIDTH, SCREEN_HEIGHT, tolerance) && passed;
+		}
+	std::cout << "Indirect rendering " << (passed ? "matches" : "does NOT match") << " the render queue" << std::endl;
+
+	renderer.release();
+	packer.release();
+	for (GameObject* object : objects)
+		delete object;
+	glfwTerminate();
+	return passed ? 0 : 1;
+}
+
+/**
+ * Culls random instances with the GPU instance culler and with its CPU reference and compares the results, in a
+ * hidden window; runs without a GPU under Mesa's software rasterizer, as validateIndirectRendering()
+ * @param argv[2], argv[3] - optional number of instances, 100000 by default, and fraction that may be culled differently
+ * @returns 0 if they match, 1 if not, -1 if there is no GL 4.3 context
+ */
+int validateInstanceCulling(int argc, char** argv) {
+	glfwInit();
+	GLFWwindow* window = createWindow(4, 3, false);
+	if (window == NULL) {
+		std::cout << "Failed to create a GL 4.3 window" << std::endl;
+		glfwTerminate();
+		return -1;
+	}
+	glfwMakeContextCurrent(window);
+	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress) || !InstanceCuller::supported()) {
+		std::cout << "Failed to initialize GLAD with GL 4.3" << std::endl;
+		glfwTerminate();
+		return -1;
+	}
+	bool passed = InstanceCuller::validate(argc > 2 ? atoi(argv[2]) : 100000, argc > 3 ? (float)atof(argv[3]) : 0.0f);
+	std::cout << "GPU instance culling " << (passed ? "matches" : "does NOT match") << " the CPU reference" << std::endl;
+	glfwTerminate();
+	return passed ? 0 : 1;
+}
+
+/**
+ * Gets the current projection matrix based on screen dimensions and zoom amount
+ */
+static glm::mat4 getProjection() {
+	return glm::perspective(glm::radians(camera.Zoom), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT, 0.1f, 100.0f);
+}
+
+/**
+ * Main program entry point which contains the OpenGL Loop.
+ */
+int main(int argc, char** argv)
+{
+	// headless audio render, before any window is created
+	if (argc > 1 && std::string(argv[1]) == "--audio-render")
+		return renderAudioOffline(argc, argv);
+	if (argc > 1 && std::string(argv[1]) == "--pack-audio")
+		return packAudio(argc, argv);
+	if (argc > 1 && std::string(argv[1]) == "--reverb-benchmark") {
+		ConvolutionReverb::runBenchmark(AudioEngine::AUDIO_SAMPLE_RATE);
+		return 0;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--bvh-benchmark") {
+		MeshBVHBenchmark(MESH_BENCHMARK_MODELS.data(), (int)MESH_BENCHMARK_MODELS.size(), argc > 2 ? atoi(argv[2]) : 10000);
+		return 0;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--obj-benchmark") {
+		ReadAsciiObjBenchmark(MESH_BENCHMARK_MODELS.data(), (int)MESH_BENCHMARK_MODELS.size(), argc > 2 ? atoi(argv[2]) : 3);
+		return 0;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--image-benchmark") {
+		// square image sizes, 4K and 8K by default
+		std::vector<int> sizes;
+		for (int i = 2; i < argc; i++)
+			sizes.push_back(atoi(argv[i]));
+		if (sizes.empty())
+			sizes = { 4096, 8192 };
+		ImageKernelBenchmark(sizes.data(), (int)sizes.size());
+		return 0;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--indirect-validate")
+		return validateIndirectRendering(argc, argv);
+	if (argc > 1 && std::string(argv[1]) == "--cull-validate")
+		return validateInstanceCulling(argc, argv);
+
+	glfwInit();
+	// the indirect renderer needs GL 4.3; drivers without it (e.g. macOS, at 4.1) get the GL 3.3 render queue
+	GLFWwindow* window = INDIRECT_RENDERING ? createWindow(4, 3, true) : NULL;
+	if (window == NULL)
+		window = createWindow(3, 3, true);
 	if (window == NULL)
 	{
 		std::cout << "Failed to create GLFW window" << std::endl;
@@ -142,9 +412,20 @@ int main()
 	// configure global opengl state
 	glEnable(GL_DEPTH_TEST);
 
-	// build and compile shaders
-	Shader gameObjectShader("res/shaders/1.model_loading.vs", "res/shaders/1.model_loading.fs");
-	Shader* instancedObjectShader = new Shader("res/shaders/instanced_model_loading.vs", "res/shaders/instanced_model_loading.fs");
+	/*
+		AUDIO ENGINE and SOUND LOADING
+	*/
+	// Initialize Audio Engine, the sounds load on FMOD's loading thread while the models below load
+	initAudio();
+
+	// build and compile shaders, or load them from the program binary cache, then link the debug drawing
+	// shaders now so the first debug draw doesn't hitch
+	SetProgramCache(SHADER_CACHE_DIRECTORY);
+	modelShaders = new ShaderVariants("res/shaders/model.vs", "res/shaders/model.fs");
+	modelShaders->setSceneFeatures(SHADER_SCENE_FEATURES);
+	Shader* instancedObjectShader = modelShaders->get(SHADER_INSTANCED | SHADER_SCENE_FEATURES);
+	PrecompileDrawShaders();
+	PrintProgramCacheStats();
 
 	/*
 		Initialize game objects and add to list
@@ -287,6 +568,42 @@ int main()
 		gameObject->setTranslation(gameObject->getTranslation()* GLOBAL_POSITION_SCALE);
 	}
 
+	renderQueue = new RenderQueue();
+	// pack the game objects' textures into texture arrays by size, so meshes can be drawn without rebinding textures
+	materialPacker = new MaterialPacker();
+	for (auto gameObject : gameObjects)
+		materialPacker->add(gameObject->getMeshes());
+	materialPacker->pack();
+	materialPacker->printStats();
+	// copy the meshes into the indirect renderer's shared buffers, after packing so they keep their materials
+	if (INDIRECT_RENDERING && IndirectRenderer::supported()) {
+		indirectRenderer = new IndirectRenderer();
+		indirectRenderer->build(gameObjects);
+	}
+	// compile the model shader variants the meshes need now, rather than on the frame they are first drawn
+	for (auto gameObject : gameObjects)
+		for (Mesh& mesh : gameObject->getMeshes()) {
+			modelShaders->forMesh(mesh);
+			if (indirectRenderer)
+				modelShaders->get(mesh.shaderFeatures | modelShaders->getSceneFeatures() | SHADER_INDIRECT);
+		}
+	modelShaders->printStats();
+	frameCapture = new FrameCapture();
+
+	// Register the occluder boxes of all large static objects with the occlusion culler and the audio engine
+	occlusionCuller = new OcclusionCuller();
+	for (auto gameObject : gameObjects) {
+		auto occluder = OCCLUDER_BOXES.find(gameObject->getObjFilePath());
+		if (occluder != OCCLUDER_BOXES.end()) {
+			glm::vec3 localMin, localMax;
+			gameObject->getLocalBounds(localMin, localMax);
+			glm::vec3 size = localMax - localMin;
+			occlusionCuller->addOccluderBox(gameObject->getModel(), localMin + size * occluder->second.minFraction, localMin + size * occluder->second.maxFraction);
+			// the same boxes occlude the sounds behind the buildings
+			audioEngine->addOcclusionBox(gameObject->getModel(), localMin + size * occluder->second.minFraction, localMin + size * occluder->second.maxFraction);
+		}
+	}
+
 
 	/*
 		Initialize instanced game objects
@@ -294,28 +611,49 @@ int main()
 
 	Grass* grass = new Grass(OBJ_GRASS, instancedObjectShader);
 	instancedObjects.push_back(grass);
+
+	// cull their instances on the GPU, in the order of instancedObjects
+	if (GPU_INSTANCE_CULLING && InstanceCuller::supported()) {
+		instanceCuller = new InstanceCuller();
+		instanceCuller->setOcclusion(GPU_INSTANCE_OCCLUSION);
+		for (InstancedObject* instancedObject : instancedObjects)
+			instanceCuller->add(*instancedObject);
+	}
 	
 	/*
-		AUDIO ENGINE and SOUND LOADING
+		AUDIO SOUNDSCAPE
 	*/
-	// Initialize Audio Engine
-	audioEngine = std::make_shared<AudioEngine>();
-	audioEngine->init();
-	
-	// load sounds
-	audioEngine->loadSound(fountainSoundLoop);
-	audioEngine->loadSound(soundTree);
-	audioEngine->loadSound(soundJapaneseTree);
-	audioEngine->loadSound(dialogue);
-	
-	// setup sound controllers
-	footstepController = new FootstepSoundController(audioEngine);
-	coinSoundController = new CoinChallengeSoundController(audioEngine, coins.size());
-
-	// Start inital soundscape
-	audioEngine->playSound(soundTree);
-	audioEngine->playSound(soundJapaneseTree);
+	// Start inital soundscape, the fountain starts as soon as its file has loaded
 	audioEngine->playSound(fountainSoundLoop);
+
+	// Place bird song emitters in the canopy of every tree, and across the tree lines
+	ambientEmitters = new AmbientEmitterManager(audioEngine);
+	int birdSoundType = ambientEmitters->addSoundType(soundTreeBirds, BIRD_EMITTERS_ACTIVE);
+	for (auto gameObject : gameObjects) {
+		std::string objFilePath = gameObject->getObjFilePath();
+		glm::vec3 boundsMin, boundsMax;
+		gameObject->getWorldBounds(boundsMin, boundsMax);
+		float canopyHeight = glm::mix(boundsMin.y, boundsMax.y, 0.7f);
+		if (objFilePath == OBJ_TREE_LINE) {
+			for (float x = boundsMin.x; x <= boundsMax.x; x += TREE_LINE_EMITTER_SPACING)
+				for (float z = boundsMin.z; z <= boundsMax.z; z += TREE_LINE_EMITTER_SPACING)
+					ambientEmitters->addEmitter(birdSoundType, glm::vec3(x, canopyHeight, z));
+		}
+		else if (std::find(BIRD_EMITTER_TREES.begin(), BIRD_EMITTER_TREES.end(), objFilePath) != BIRD_EMITTER_TREES.end())
+			ambientEmitters->addEmitter(birdSoundType, glm::vec3(0.5f * (boundsMin.x + boundsMax.x), canopyHeight, 0.5f * (boundsMin.z + boundsMax.z)));
+	}
+
+	// all sounds are ready before the first frame, so the music layers start together
+	audioEngine->waitForSoundLoads();
+	audioEngine->printSoundMemoryReport();
+
+	// from here on audio engine calls are queued to the audio thread, so they must all come from this thread
+	audioEngine->startAudioThread();
+
+	// record every frame from the start, e.g. for perf runs
+	for (int i = 1; i < argc; i++)
+		if (std::string(argv[i]) == "--record")
+			frameCapture->StartRecording(i + 1 < argc ? argv[i + 1] : RECORDING_FILE);
 	
     
     /* render loop */ 
@@ -331,10 +669,6 @@ int main()
 		glClearColor(COLOR_SKY.x, COLOR_SKY.y, COLOR_SKY.z, COLOR_SKY.w);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // enable blended overwrite of color buffer
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        
         // Collision detection for coins
         for (auto coin : coins) {
             if (!coin->isDestroyed()) {
@@ -352,27 +686,70 @@ int main()
 				audioEngine->playSound(dialogue);
 				npc->setHasSaidDialogueLine(true);
 				unsigned int lengthMS = audioEngine->getSoundLengthInMS(dialogue);
-				std::cout << "Before thread, length MS = " << lengthMS << '\n';
-				std::thread thd(waitForDialogueCompletion, lengthMS);
-				thd.detach();
+				dialogueEndTime = currentFrame + lengthMS / 1000.0f;
 			}
 		}
+		// display coins after the dialogue sound finishes
+		if (dialogueEndTime >= 0.0f && currentFrame >= dialogueEndTime) {
+			dialogueEndTime = -1.0f;
+			resetCoins();
+			coinSoundController->startScore();
+		}
 
         // update animation objects with current frame
         for (int i = 0; i < animationObjects.size(); i++)
             animationObjects[i]->update(currentFrame);
 
-        // render Game Objects
-        for (int i = 0; i < gameObjects.size(); i++) 
-            renderGameObject(*gameObjects[i], &gameObjectShader);
+        // occlusion culling of game objects, using their bounds after this frame's animation update
+        gameObjectBoundsMin.resize(gameObjects.size());
+        gameObjectBoundsMax.resize(gameObjects.size());
+        for (int i = 0; i < gameObjects.size(); i++)
+            gameObjects[i]->getWorldBounds(gameObjectBoundsMin[i], gameObjectBoundsMax[i]);
+        if (occlusionCullingEnabled)
+            occlusionCuller->cull(getProjection() * camera.GetViewMatrix(), gameObjectBoundsMin, gameObjectBoundsMax, gameObjectVisibility);
+        else
+            gameObjectVisibility.assign(gameObjects.size(), 1);
+
+        // render visible Game Objects, sorted by state with opaque meshes first and translucent meshes blended last
+        // (with GL 4.3, as a few multi-draw indirect calls)
+        if (indirectRenderer && indirectRenderingEnabled) {
+            for (int i = 0; i < gameObjects.size(); i++)
+                if (gameObjectVisibility[i])
+                    indirectRenderer->submit(*gameObjects[i], *modelShaders, camera.Position);
+            indirectRenderer->flush(getProjection(), camera.GetViewMatrix());
+        }
+        else {
+            for (int i = 0; i < gameObjects.size(); i++)
+                if (gameObjectVisibility[i])
+                    renderQueue->submit(*gameObjects[i], *modelShaders, camera.Position);
+            renderQueue->flush(getProjection(), camera.GetViewMatrix());
+        }
         
-        // render instanced objects
-        for(InstancedObject *instancedObject : instancedObjects)
-            instancedObject->drawInstances(getProjection(), camera.GetViewMatrix());
+        // enable blended overwrite of color buffer for instanced objects
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        // render instanced objects, with GL 4.3 only the instances the GPU finds visible
+        if (instanceCuller && gpuCullingEnabled) {
+            instanceCuller->cull(getProjection() * camera.GetViewMatrix());
+            for (int i = 0; i < instancedObjects.size(); i++)
+                instancedObjects[i]->drawInstancesIndirect(getProjection(), camera.GetViewMatrix(),
+                    instanceCuller->getVisibleMatrixBuffer(i), instanceCuller->getCommandBuffer(i));
+            // this frame's depth occludes the next frame's instances
+            int framebufferWidth, framebufferHeight;
+            glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+            instanceCuller->updateHiZ(getProjection() * camera.GetViewMatrix(), framebufferWidth, framebufferHeight);
+        }
+        else {
+            for(InstancedObject *instancedObject : instancedObjects)
+                instancedObject->drawInstances(getProjection(), camera.GetViewMatrix());
+        }
        
 		/*
             Audio Engine per-frame updates
         */
+		// assign ambient emitter voices around the player
+		ambientEmitters->update(camera.Position);
 		// per-frame FMOD update
 		audioEngine->update(); 
         // set current player position in audio engine (X and Y in Fron and Up vectors need to be swapped for FMOD compatability)
@@ -381,11 +758,19 @@ int main()
                                           camera.Up.y,       camera.Up.x,       camera.Up.z );
         
 
+        // start reading back this frame if capturing, and hand earlier frames to the capture's writer thread
+        frameCapture->EndFrame();
+
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc)
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
+    audioEngine->deactivate();
+    // write the frames still being captured, while the GL context exists
+    frameCapture->Release();
+    frameCapture->PrintStats();
+
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
@@ -445,6 +830,48 @@ void ProcessInput(GLFWwindow* window)
 	// Audio Engine Mute Key (m)
 	if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS && keyCanRetrigger(currentFrame, keyMLastTime))
 		audioEngine->isMuted() ? audioEngine->unmuteAllSound() : audioEngine->muteAllSounds();
+	// Occlusion Culling Toggle Key (o)
+	if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS && keyCanRetrigger(currentFrame, keyOLastTime)) {
+		occlusionCullingEnabled = !occlusionCullingEnabled;
+		std::cout << "Occlusion culling " << (occlusionCullingEnabled ? "enabled" : "disabled") << '\n';
+	}
+	// Texture Arrays Toggle Key (t)
+	if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS && keyCanRetrigger(currentFrame, keyTLastTime)) {
+		renderQueue->setTextureArrays(!renderQueue->textureArraysEnabled());
+		if (indirectRenderer)
+			indirectRenderer->setTextureArrays(renderQueue->textureArraysEnabled());
+		std::cout << "Texture arrays " << (renderQueue->textureArraysEnabled() ? "enabled" : "disabled") << '\n';
+	}
+	// Indirect Rendering Toggle Key (i), if the context has GL 4.3
+	if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS && indirectRenderer && keyCanRetrigger(currentFrame, keyILastTime)) {
+		indirectRenderingEnabled = !indirectRenderingEnabled;
+		std::cout << "Indirect rendering " << (indirectRenderingEnabled ? "enabled" : "disabled") << '\n';
+	}
+	// GPU Instance Culling Toggle Key (g), if the context has GL 4.3
+	if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS && instanceCuller && keyCanRetrigger(currentFrame, keyGLastTime)) {
+		gpuCullingEnabled = !gpuCullingEnabled;
+		std::cout << "GPU instance culling " << (gpuCullingEnabled ? "enabled" : "disabled") << '\n';
+	}
+	// Print Frame Statistics Key (p)
+	if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS && keyCanRetrigger(currentFrame, keyPLastTime))
+		printFrameStats();
+	// Audio Engine Call Cost Benchmark Key (b)
+	if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS && keyCanRetrigger(currentFrame, keyBLastTime))
+		audioEngine->benchmarkCallCost(fountainSoundLoop);
+	// Screenshot Key (F12)
+	if (glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS && keyCanRetrigger(currentFrame, keyF12LastTime)) {
+		char filename[64];
+		snprintf(filename, sizeof(filename), SCREENSHOT_FILE_FORMAT, screenshotCount++);
+		frameCapture->Screenshot(filename);
+		std::cout << "Screenshot " << filename << '\n';
+	}
+	// Recording Toggle Key (F11)
+	if (glfwGetKey(window, GLFW_KEY_F11) == GLFW_PRESS && keyCanRetrigger(currentFrame, keyF11LastTime)) {
+		if (frameCapture->Recording())
+			frameCapture->StopRecording();
+		else
+			frameCapture->StartRecording(RECORDING_FILE);
+	}
 
 
 	// Number Keys: Coin Controls TODO fix collision detection so that these controls aren't needed
@@ -3,6 +3,7 @@
 #ifndef DRAW_HDR
 #define DRAW_HDR
 
+#include <vector>
 #include "VecMat.h"
 
 // screen operations
@@ -33,6 +34,7 @@ int UseDrawShader();
 	// return previous shader ID
 int UseDrawShader(mat4 viewMatrix);
 	// as above, but set view transformation
+// the following append to the current batch, if any (see SetDrawBatch), else draw immediately
 void Disk(vec3 p, float diameter, vec3 color, float opacity = 1);
 void Line(vec3 p1, vec3 p2, float width, vec3 col, float opacity = 1);
 void Line(vec3 p1, vec3 p2, float width, vec3 col1, vec3 col2, float opacity = 1);
@@ -48,8 +50,77 @@ void ArrowV(vec3 base, vec3 v, mat4 modelview, mat4 persp, vec3 color, float lin
 // triangle operations
 void UseTriangleShader();
 void UseTriangleShader(mat4 viewMatrix);
+void PrecompileDrawShaders();
+	// link the draw and triangle shaders now (eg, while loading) rather than at the first draw
 void Triangle(vec3 p1, vec3 p2, vec3 p3, vec3 c1, vec3 c2, vec3 c3,
 			  float opacity = 1, bool outline = false,
 			  vec4 outlineCol = vec3(0,0,0), float outlineWidth = 1, float transition = 1);
 
+// batched drawing
+
+struct DrawVertex {
+	vec3 point;
+	vec4 color;				// rgb and opacity
+	DrawVertex() { }
+	DrawVertex(vec3 p, vec3 c, float opacity) : point(p), color(c, opacity) { }
+};
+
+class DebugDraw {
+	// retained batch of Disk, Line, Quad, and Triangle primitives, eg for thousands of collider outlines
+	// primitives are appended to CPU-side streams by type, point size or line width, depth test, and outline;
+	// Flush uploads all streams at once into a growing ring buffer, then issues one draw per stream
+public:
+	enum DepthMode { DepthOff, DepthOn, DepthUnchanged };
+	void SetDepthMode(DepthMode mode) { depthMode = mode; }
+		// depth test for subsequently appended primitives; default DepthOn
+	void Disk(vec3 p, float diameter, vec3 color, float opacity = 1);
+	void Line(vec3 p1, vec3 p2, float width, vec3 col, float opacity = 1) { Line(p1, p2, width, col, col, opacity); }
+	void Line(vec3 p1, vec3 p2, float width, vec3 col1, vec3 col2, float opacity = 1);
+	void LineStrip(int nPoints, vec3 *points, vec3 color, float opacity = 1, float width = 1);
+	void Quad(vec3 p1, vec3 p2, vec3 p3, vec3 p4, bool solid, vec3 color, float opacity = 1, float lineWidth = 1);
+	void Triangle(vec3 p1, vec3 p2, vec3 p3, vec3 c1, vec3 c2, vec3 c3,
+				  float opacity = 1, bool outline = false,
+				  vec4 outlineCol = vec3(0,0,0), float outlineWidth = 1, float transition = 1);
+	void Box(vec3 min, vec3 max, float width, vec3 color, float opacity = 1);
+		// outline of an axis-aligned box
+	void Sphere(vec3 center, float radius, float width, vec3 color, float opacity = 1, int nSegments = 24);
+		// circles about the x, y, and z axes
+	void Flush();
+		// draw and clear the appended primitives, using the current view of the draw and triangle shaders
+	void Flush(mat4 view);
+		// as above, but set the view
+	void Clear();
+		// discard the appended primitives
+	void Release();
+		// free the GL buffers (requires current GL context)
+	struct Stats { int primitives = 0, vertices = 0, draws = 0, bufferVertices = 0; };
+	Stats LastFlush() const { return lastFlush; }
+		// counts for the most recent Flush; bufferVertices is the ring buffer capacity
+private:
+	enum Type { Points, Lines, Triangles, TriangleShaded };	// TriangleShaded: via triangle shader, as Triangle()
+	struct Stream {
+		Type type;
+		float size;				// point diameter or line width
+		DepthMode depth;
+		bool outline;
+		vec4 outlineColor;
+		float outlineWidth, transition;
+		std::vector<DrawVertex> vertices;
+		int first;				// in ring buffer, during Flush
+	};
+	std::vector<Stream> streams;
+	int current = -1;			// most recently appended stream
+	int nPrimitives = 0;
+	DepthMode depthMode = DepthOn;
+	unsigned int vertexArray = 0, vertexBuffer = 0;
+	int capacity = 0, head = 0;	// ring buffer size and next free vertex
+	Stats lastFlush;
+	std::vector<DrawVertex> &Append(Type type, float size, bool outline = false, vec4 outlineColor = vec4(), float outlineWidth = 0, float transition = 0);
+	void Draw(const mat4 *view);
+};
+
+void SetDrawBatch(DebugDraw *batch);
+	// if non-null, the 2D/3D drawing functions and Triangle append to batch, to be drawn by batch->Flush
+	// if null (default), they draw immediately
+
 #endif
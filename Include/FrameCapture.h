@@ -0,0 +1,85 @@
+// FrameCapture.h - asynchronous capture of the framebuffer to Targa files or a raw video stream
+
+#ifndef FRAME_CAPTURE_HDR
+#define FRAME_CAPTURE_HDR
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+class FrameCapture {
+	// frames are read into a ring of pixel-pack buffers, each with a fence; a few frames later, once its fence
+	// has signaled, a buffer is mapped and handed to a writer thread, which copies the pixels out and encodes them
+	// the render thread never waits on the GPU or the disk unless a screenshot finds every buffer in use;
+	// a recorded frame that finds every buffer in use is dropped (and counted) instead
+public:
+	FrameCapture(int nBuffers = 4) : nSlots(nBuffers < 2? 2 : nBuffers) { }
+	~FrameCapture() { Release(); }
+	void Screenshot(const char *targaFilename);
+		// capture the next frame to a Targa file
+	bool StartRecording(const char *filename);
+		// capture every frame until StopRecording: if filename has a printf integer format (eg, "frame%05d.tga"),
+		// to numbered Targa files, else appended to a raw BGR video file (bottom row first, no header), eg for
+		// ffmpeg -f rawvideo -pixel_format bgr24 -video_size WxH -framerate 60 -i file -vf vflip out.mp4
+	void StopRecording();
+	bool Recording() const { return recording; }
+	void EndFrame();
+		// call once per frame, after rendering and before swapping buffers (requires current GL context)
+		// start reading back the frame if capturing, hand earlier frames that have arrived to the writer
+	void Finish();
+		// wait until all captured frames are written (eg, before comparing a screenshot)
+	void Release();
+		// finish, stop the writer thread, free the GL buffers (requires current GL context if any were made)
+	struct Stats {
+		int captured = 0, written = 0, dropped = 0, stalls = 0;	// stalls: screenshots that waited for a buffer
+		float averageMs = 0, maxMs = 0;							// render thread time in EndFrame, while capturing
+	};
+	Stats GetStats();
+	void PrintStats();
+private:
+	enum State { Free, Reading, Mapped, Copied };	// Reading: fence pending; Mapped: with writer; Copied: writer done
+	struct Slot {
+		unsigned int buffer = 0;
+		size_t capacity = 0;
+		void *fence = NULL;			// GLsync
+		const unsigned char *pixels = NULL;
+		int width = 0, height = 0;
+		std::string filename;		// Targa file, or empty to append to raw
+		FILE *raw = NULL;
+		std::atomic<int> state{Free};
+	};
+	struct Job {
+		int slot;					// -1: close raw
+		FILE *raw;
+	};
+	int nSlots;
+	std::unique_ptr<Slot[]> slots;
+	int oldest = 0, used = 0;		// slots in use, in capture order
+	std::vector<std::string> screenshots;
+	bool recording = false;
+	std::string pattern;			// Targa sequence format, or empty for raw
+	FILE *raw = NULL;
+	std::vector<FILE *> closing;	// stopped raw files, closed by the writer after their last frame
+	int frame = 0, recordWidth = 0, recordHeight = 0;
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable jobReady, slotCopied;
+	std::deque<Job> jobs;
+	bool quit = false;
+	int busyJobs = 0;				// queued or being encoded
+	Stats stats;
+	double totalMs = 0;
+	int timedFrames = 0;
+	bool Read(const std::string &filename, FILE *rawFile, bool recorded);
+	void Collect(bool wait);
+	void Unmap(Slot &s);
+	void Write();
+};
+
+#endif
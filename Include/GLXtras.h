@@ -25,6 +25,23 @@ GLuint LinkProgramViaCode(const char **vertexCode, const char **tessellationCont
 GLuint LinkProgram(GLuint vshader, GLuint pshader);
 GLuint LinkProgram(GLuint vshader, GLuint tcshader, GLuint teshader, GLuint gshader, GLuint pshader);
 GLuint LinkProgramViaFile(const char *vertexShaderFile, const char *pixelShaderFile);
+	// the LinkProgramViaCode functions load the program from the binary cache, if set and current
+
+// Program Binary Cache
+void SetProgramCache(const char *directory);
+	// if non-null, save linked programs as driver binaries in directory (made if needed), to load instead of compile
+	// entries are keyed by a hash of the shader sources and the GL vendor, renderer and version, so editing a
+	// shader or updating the driver recompiles; a binary the driver rejects is recompiled and replaced
+	// requires a current GL context with glProgramBinary (GL 4.1), else programs are always compiled
+bool ProgramCacheEnabled();
+GLuint LoadCachedProgram(const char *vertexCode, const char *tessellationControlCode, const char *tessellationEvalCode,
+						 const char *geometryCode, const char *pixelCode);
+	// return a program linked from the cached binary for these sources (null if no such stage), or 0 if none
+void SaveCachedProgram(GLuint program, const char *vertexCode, const char *tessellationControlCode,
+					   const char *tessellationEvalCode, const char *geometryCode, const char *pixelCode);
+	// save the binary of a program linked from these sources
+	// set GL_PROGRAM_BINARY_RETRIEVABLE_HINT before linking, as LinkProgram does if the cache is enabled
+void PrintProgramCacheStats();
 
 int CurrentProgram();
 
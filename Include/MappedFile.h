@@ -0,0 +1,72 @@
+// MappedFile.h - read-only memory-mapped file
+
+#ifndef MAPPED_FILE_HDR
+#define MAPPED_FILE_HDR
+
+#include <stddef.h>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class MappedFile {
+	// map a file into memory for reading; pages load on first access, without a copy into a buffer
+public:
+	const char *data = NULL;
+	size_t size = 0;
+	bool ok = false;		// an empty file can't be mapped (data is null), but is ok
+	MappedFile(const char *filename) {
+#ifdef _WIN32
+		file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		LARGE_INTEGER fileSize;
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize))
+			return;
+		size = (size_t) fileSize.QuadPart;
+		ok = size == 0;
+		if (size && (mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL)) != NULL)
+			ok = (data = (const char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) != NULL;
+#else
+		int fd = open(filename, O_RDONLY);
+		struct stat s;
+		if (fd < 0 || fstat(fd, &s) != 0) {
+			if (fd >= 0) close(fd);
+			return;
+		}
+		size = (size_t) s.st_size;
+		ok = size == 0;
+		if (size) {
+			void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			ok = p != MAP_FAILED;
+			data = ok? (const char *) p : NULL;
+		}
+		close(fd);
+#endif
+	}
+	~MappedFile() {
+#ifdef _WIN32
+		if (data) UnmapViewOfFile(data);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+		if (data) munmap((void *) data, size);
+#endif
+	}
+private:
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE, mapping = NULL;
+#endif
+};
+
+#endif
@@ -30,6 +30,10 @@ bool ReadAsciiObj(const char    *filename,					// must be ASCII file
 				  vector<int4>  *quads = NULL);				// optional quadrilaterals
 	// set points and triangles; normals, textures, quads optional
 	// return true if successful
+	// the file is memory-mapped and parsed in parallel; no limit on line length
+
+void ReadAsciiObjBenchmark(const char **objFilenames, int nFiles, int nRuns = 3);
+	// for each .obj file, time ReadAsciiObj against the former line-by-line reader, check they agree, print results
 
 bool WriteAsciiObj(const char *filename,
 				   vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs,
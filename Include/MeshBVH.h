@@ -0,0 +1,77 @@
+// MeshBVH.h - bounding volume hierarchy for line queries against triangle meshes
+
+#ifndef MESH_BVH_HDR
+#define MESH_BVH_HDR
+
+#include <vector>
+#include "Mesh.h"
+#include "VecMat.h"
+
+using std::vector;
+
+// Nodes
+
+struct BVHNode {
+	// 32 bytes, so two nodes share a cache line; the children of a node are adjacent
+	vec3 min;
+	int first;			// leaf: first triangle (in tree order); interior: left child, right child is first+1
+	vec3 max;
+	int count;			// leaf: # triangles (> 0); interior: -1-split axis
+	bool IsLeaf() const { return count > 0; }
+};
+
+struct BVHTriangle {
+	vec3 v0, e1, e2;	// first vertex and its edges, as used by the Moller-Trumbore test
+};
+
+struct BVHHit {
+	int triangle;		// index into mesh triangles (and the TriInfos built from them)
+	float alpha;		// intersection = p1+alpha*(p2-p1)
+	BVHHit() : triangle(-1), alpha(0) { }
+	BVHHit(int t, float a) : triangle(t), alpha(a) { }
+};
+
+// Hierarchy
+
+class MeshBVH {
+public:
+	void Build(vector<vec3> &points, vector<int3> &triangles, int nThreads = 0);
+		// build with the surface area heuristic (SAH), binning triangle centroids
+		// nThreads: build large subtrees in parallel, 0 for all hardware threads
+	void Refit(vector<vec3> &points);
+		// update triangles and node bounds for moved points (same triangles as Build)
+		// much faster than Build, but queries slow down if points move far from where they were built
+	int IntersectWithLine(vec3 p1, vec3 p2, float &alpha) const;
+		// return index of nearest triangle intersected by segment p1,p2 (0 <= alpha <= 1), or -1 if none
+		// intersection = p1+alpha*(p2-p1)
+	bool AnyIntersection(vec3 p1, vec3 p2) const;
+		// return true if segment p1,p2 intersects any triangle; stops at first hit (eg, line of sight)
+	int AllIntersections(vec3 p1, vec3 p2, vector<BVHHit> &hits) const;
+		// set all triangles intersected by segment p1,p2 in order of alpha; return # hits
+	void IntersectWithLines(int n, const vec3 *p1s, const vec3 *p2s, int *triangles, float *alphas) const;
+		// as IntersectWithLine for n segments, traced in packets of 4 with SSE
+		// fastest for coherent segments, such as picking rays through neighboring pixels
+	int NodeCount() const { return (int) nodes.size(); }
+	int TriangleCount() const { return (int) tris.size(); }
+	int Depth() const { return depth; }
+	static const int MaxLeafSize = 8, MaxDepth = 64;
+private:
+	vector<BVHNode> nodes;
+	vector<BVHTriangle> tris;	// triangles in tree order
+	vector<int3> vids;			// vertex ids of tris, for Refit
+	vector<int> triIds;			// mesh triangle index of tris
+	int depth = 0;
+	friend struct BVHBuilder;
+};
+
+int IntersectWithLine(vec3 p1, vec3 p2, MeshBVH &bvh, float &alpha);
+	// as IntersectWithLine for TriInfos, using a BVH built from the same triangles
+	// unlike the linear version, only considers intersections on the segment (0 <= alpha <= 1)
+
+// Benchmark
+
+void MeshBVHBenchmark(const char **objFilenames, int nFiles, int nLines = 10000);
+	// for each .obj file, time BVH builds, refits and queries against linear IntersectWithLine
+	// check the BVH finds the same triangles, and print the results
+
+#endif
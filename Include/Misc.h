@@ -20,14 +20,15 @@ float RaySphere(vec3 base, vec3 v, vec3 center, float radius);
 unsigned char *ReadTarga(const char *filename, int &width, int &height);
 	// allocate width*height pixels, set them from file, return pointer
 	// this memory should be freed by the caller
-	// expects 24 bpp
-	// *** pixel data is BGR format ***
+	// expects uncompressed 24 or 32 bpp; the file is memory-mapped and its rows copied in parallel
+	// *** pixel data is BGR format, bottom row first ***
 
 bool WriteTarga(const char *filename, unsigned char *pixels, int width, int height);
 	// save raster to named Targa file
 
 bool WriteTarga(char *filename);
 	// as above but with entire application raster
+	// waits for the GPU; FrameCapture.h captures without stalling the frame
 
 // Texture
 
@@ -49,4 +50,32 @@ unsigned char *GetNormals(unsigned char *depthPixels, int &width, int &height, f
 	// return normal pixels that correspond with depth pixels
 	// this memory should be freed by the caller
 
+// Image kernels
+// rows are split into bands processed in parallel, with SSE (SSSE3) or AVX2 chosen at run time
+
+enum ImageSimd { ImageScalar, ImageSSE, ImageAVX2 };
+
+ImageSimd SetImageSimd(ImageSimd level);
+	// use instruction sets up to level (default ImageAVX2), eg to compare; return the level supported by the CPU
+void SetImageThreads(int nThreads);
+	// threads for image kernels, 0 (default) for all hardware threads
+
+void HeightToNormals(const unsigned char *heights, int width, int height, int channels, unsigned char *normals,
+					 float pixelScale = 25, bool sobel = false);
+	// set width*height RGB normals from heights, the first of channels bytes per pixel
+	// slopes by central differences (as GetNormals), or if sobel by a 3x3 Sobel filter (smoother)
+
+void UnormToFloat(const unsigned char *in, float *out, size_t n);
+	// out[i] = in[i]/255
+void FloatToUnorm(const float *in, unsigned char *out, size_t n);
+	// out[i] = in[i] clamped to [0,1], times 255, rounded
+
+void SwizzleChannels(const unsigned char *in, int inChannels, unsigned char *out, int outChannels,
+					 const int *map, size_t nPixels, unsigned char fill = 255);
+	// out channel c = in channel map[c], or fill if map[c] < 0; channels 1-4
+	// eg, BGR to RGBA: map = {2, 1, 0, -1}
+
+void ImageKernelBenchmark(const int *sizes, int nSizes, int nRuns = 3);
+	// for square images of each size, time the kernels against the former scalar loops and check they agree
+
 #endif
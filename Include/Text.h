@@ -5,25 +5,32 @@
 
 #include <glad.h>
 #include <GLFW/glfw3.h>
+#include <memory>
+#include <vector>
 #include "GLXtras.h"
 
 class Character {
 public:
-    GLuint	textureID;	// glyph texture
+    GLuint	textureID;	// glyph texture (the font atlas)
     int2	gSize;		// glyph size
     int2	bearing;    // offset from baseline to left/top of glyph
     GLuint	advance;	// offset to next glyph
+	vec2	uv0, uv1;	// top-left and bottom-right of glyph in atlas
 	Character() { }
-    Character(int textureID, int2 gSize, int2 bearing, GLuint advance) :
-		textureID(textureID), gSize(gSize), bearing(bearing), advance(advance) { }
+    Character(int textureID, int2 gSize, int2 bearing, GLuint advance, vec2 uv0 = vec2(0, 0), vec2 uv1 = vec2(1, 1)) :
+		textureID(textureID), gSize(gSize), bearing(bearing), advance(advance), uv0(uv0), uv1(uv1) { }
 };
 
 // character set and current pointer
 struct CharacterSet {
 	int charRes;
+	GLuint atlas;		// single texture with all glyphs, packed at SetFont
+	int2 atlasSize;
 	Character characters[128];
-	CharacterSet() { charRes = 0; }
-	CharacterSet(const CharacterSet &cs) { for (int i = 0; i < 128; i++) characters[i] = cs.characters[i]; }
+	CharacterSet() { charRes = 0; atlas = 0; }
+	CharacterSet(const CharacterSet &cs) : charRes(cs.charRes), atlas(cs.atlas), atlasSize(cs.atlasSize) {
+		for (int i = 0; i < 128; i++) characters[i] = cs.characters[i];
+	}
 };
 
 CharacterSet *SetFont(const char *fontName, int charRes = 15, int pixelRes = 15);
@@ -40,4 +47,63 @@ float TextWidth(float scale, const char *format, ...);
 void RenderText(const char *text, float x, float y, vec3 color, float scale, mat4 view);
 	// text with arbitrary orientation
 
+// layout
+
+struct TextQuad {
+	vec2 p0, p1;		// glyph bottom-left and top-right, in font pixels from the text origin
+	vec2 uv0, uv1;		// glyph top-left and bottom-right in atlas
+};
+
+struct TextLayout {
+	CharacterSet *font = NULL;
+	std::vector<TextQuad> quads;
+	float width = 0;	// in font pixels
+};
+
+void LayoutText(const char *text, TextLayout &layout);
+	// position glyphs of text with the current font
+
+std::shared_ptr<const TextLayout> CachedLayout(const char *text);
+	// as LayoutText, but laid out once per font and kept, for labels and other strings that do not change
+	// the cache starts over once full; a returned layout stays valid for as long as the caller keeps it
+
+void RenderText(const TextLayout &layout, float x, float y, vec3 color, float scale, mat4 view);
+	// as RenderText above, for a laid-out string
+
+// batched text
+
+class TextBatch {
+	// glyphs of many strings, in any colors and orientations, as one indexed triangle buffer per font atlas
+	// Flush uploads the buffer and draws it with a single call per atlas (usually one)
+public:
+	void Add(const char *text, float x, float y, vec3 color, float scale, mat4 view);
+	void Add(const TextLayout &layout, float x, float y, vec3 color, float scale, mat4 view);
+	void Flush();
+		// draw and clear the added text
+	void Clear();
+	void Release();
+		// free the GL buffers (requires current GL context)
+	int Glyphs() const;
+private:
+	struct Vertex {
+		vec4 point;		// clip space
+		vec2 uv;
+		vec3 color;
+	};
+	struct Run {
+		GLuint atlas;
+		std::vector<Vertex> vertices;		// four per glyph
+	};
+	std::vector<Run> runs;
+	GLuint vertexArray = 0, vertexBuffer = 0, indexBuffer = 0;
+	int vertexCapacity = 0, indexCapacity = 0;	// in glyphs
+};
+
+void SetTextBatch(TextBatch *batch);
+	// if non-null, Text and RenderText append to batch, to be drawn by batch->Flush (eg, once per frame)
+	// if null (default), they draw immediately, a single draw call per string
+
+void PrecompileTextShader();
+	// link the text shader now (eg, while loading) rather than at the first text drawn
+
 #endif
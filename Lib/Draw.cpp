@@ -5,9 +5,12 @@
 #include "Draw.h"
 #include "GLXtras.h"
 #include "Misc.h"
+#include <algorithm>
 #include <float.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 
 // Screen Mode
@@ -127,8 +130,8 @@ int drawShader = 0;
 const char *drawVShader = "\
 	#version 130									\n\
 	in vec3 position;								\n\
-	in vec3 color;									\n\
-	out vec3 vColor;								\n\
+	in vec4 color;									\n\
+	out vec4 vColor;								\n\
     uniform mat4 view;								\n\
 	void main() {									\n\
 		gl_Position = view*vec4(position, 1);		\n\
@@ -137,7 +140,7 @@ const char *drawVShader = "\
 
 const char *drawPShader = "\
 	#version 130									\n\
-	in vec3 vColor;									\n\
+	in vec4 vColor;									\n\
 	out vec4 pColor;								\n\
 	uniform float opacity = 1;						\n\
 	uniform int fadeToCenter = 0;					\n\
@@ -156,21 +159,25 @@ const char *drawPShader = "\
 	void main() {									\n\
 		// GL_POINT_SMOOTH deprecated, so calc here	\n\
 		// needs GL_POINT_SPRITE enabled			\n\
-		float o = opacity;							\n\
+		float o = opacity*vColor.a;					\n\
 	    if (fadeToCenter == 1)						\n\
 			o *= Fade(DistanceToCenter());			\n\
-	    pColor = vec4(vColor, o);					\n\
+	    pColor = vec4(vColor.rgb, o);				\n\
 	}\n";
 
+static void LinkDrawShader() {
+	// link, with identity view
+	drawShader = LinkProgramViaCode(&drawVShader, &drawPShader);
+	glUseProgram(drawShader);
+	SetUniform(drawShader, "view", mat4());
+}
+
 int UseDrawShader() {
 	int was = 0;
 	glGetIntegerv(GL_CURRENT_PROGRAM, &was);
-	bool init = !drawShader;
-	if (init)
-		drawShader = LinkProgramViaCode(&drawVShader, &drawPShader);
+	if (!drawShader)
+		LinkDrawShader();
 	glUseProgram(drawShader);
-	if (init)
-		SetUniform(drawShader, "view", mat4());
 	return was;
 }
 
@@ -180,68 +187,41 @@ int UseDrawShader(mat4 viewMatrix) {
 	return was;
 }
 
-// Disks
+// Immediate or Batched Primitives
+
+static DebugDraw immediateBatch, *drawBatch = NULL;
+
+void SetDrawBatch(DebugDraw *batch) {
+	drawBatch = batch;
+}
+
+static DebugDraw &CurrentBatch() {
+	if (drawBatch)
+		return *drawBatch;
+	immediateBatch.SetDepthMode(DebugDraw::DepthUnchanged);
+	return immediateBatch;
+}
 
-GLuint diskBuffer = -1;
+static void FlushIfImmediate(DebugDraw &batch) {
+	if (&batch == &immediateBatch)
+		immediateBatch.Flush();
+}
+
+// Disks
 
 void Disk(vec3 p, float diameter, vec3 color, float opacity) {
 	// diameter should be >= 0, <= 20
-	UseDrawShader();
-	// create buffer for single vertex (x,y,z,r,g,b)
-	if (diskBuffer < 0) {
-		glGenBuffers(1, &diskBuffer);
-		glBindBuffer(GL_ARRAY_BUFFER, diskBuffer);
-		int bufferSize = 6*sizeof(float);
-		glBufferData(GL_ARRAY_BUFFER, bufferSize, NULL, GL_STATIC_DRAW);
-	}
-	glBindBuffer(GL_ARRAY_BUFFER, diskBuffer); // set active buffer
-    // allocate buffer memory and load location and color data
-	glBufferData(GL_ARRAY_BUFFER, 6*sizeof(float), NULL, GL_STATIC_DRAW); // *** needed??
-	glBufferSubData(GL_ARRAY_BUFFER, 0, 3*sizeof(float), &p.x);
-	glBufferSubData(GL_ARRAY_BUFFER, 3*sizeof(float), 3*sizeof(float), &color.x);
-	// connect shader inputs
-	VertexAttribPointer(drawShader, "position", 3, 0, (void *) 0);
-	VertexAttribPointer(drawShader, "color", 3, 0, (void *) sizeof(vec3));
-	// draw
-	SetUniform(drawShader, "opacity", opacity);
-	// *** there really is something funny going on with the point smooth option
-	//     normally it would be enabled with GL_POINT_SMOOTH, but at times this
-	//	   appears undefined, in which case glEnable(0x8861) appears to work, and fadeToCenter needed
-//	SetUniform(drawShader, "fadeToCenter", 1); // needed as GL_POINT_SMOOTH removed
-	glPointSize(diameter);
-#ifdef GL_POINT_SMOOTH
-	glEnable(GL_POINT_SMOOTH);
-#else
-	//glEnable(GL_POINT_SPRITE);
-	glEnable(0x8861); // same as GL_POINT_SMOOTH [this is a 4.5 core bug]
-#endif
-	glDrawArrays(GL_POINTS, 0, 1);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	DebugDraw &batch = CurrentBatch();
+	batch.Disk(p, diameter, color, opacity);
+	FlushIfImmediate(batch);
 }
 
 // Lines
 
-GLuint lineBuffer = -1;
-
 void Line(vec3 p1, vec3 p2, float width, vec3 col1, vec3 col2, float opacity) {
-	UseDrawShader();
- 	// create a vertex buffer for the array
-	vec3 data[] = {p1, p2, col1, col2};
-	if (lineBuffer <= 0)
-		glGenBuffers(1, &lineBuffer);
-    // set active vertex buffer, load location and color data
-    glBindBuffer(GL_ARRAY_BUFFER, lineBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
-    // connect shader inputs, set uniforms
-	VertexAttribPointer(drawShader, "position", 3, 0, (void *) 0);
-    VertexAttribPointer(drawShader, "color", 3, 0, (void *) (2*sizeof(vec3))); // sizeof(points));
-	SetUniform(drawShader, "fadeToCenter", 0);	// gl_PointCoord fails for lines (instead, use GL_LINE_SMOOTH)
-	SetUniform(drawShader, "opacity", opacity);
-	// draw
-	glLineWidth(width);
-	glDrawArrays(GL_LINES, 0, 2);
-	// cleanup
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	DebugDraw &batch = CurrentBatch();
+	batch.Line(p1, p2, width, col1, col2, opacity);
+	FlushIfImmediate(batch);
 }
 
 void Line(vec3 p1, vec3 p2, float width, vec3 col, float opacity) {
@@ -257,45 +237,18 @@ void Line(vec2 p1, vec2 p2, float width, vec3 col, float opacity) {
 	Line(p1, p2, width, col, col, opacity);
 }
 
-GLuint lineStripBuffer = 0;
-
 void LineStrip(int nPoints, vec3 *points, vec3 &color, float opacity, float width) {
-	if (!lineStripBuffer)
-		glGenBuffers(1, &lineStripBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, lineStripBuffer);
-    int pSize = nPoints*sizeof(vec3);
-	std::vector<vec3> colors(nPoints, color);
-    glBufferData(GL_ARRAY_BUFFER, 2*pSize, NULL, GL_STATIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, pSize, points);
-    glBufferSubData(GL_ARRAY_BUFFER, pSize, pSize, &colors[0]);
-	VertexAttribPointer(drawShader, "position", 3, 0, (void *) 0);
-	VertexAttribPointer(drawShader, "color", 3, 0, (void *) pSize);
-	SetUniform(drawShader, "fadeToCenter", 0);
-	SetUniform(drawShader, "opacity", opacity);
-	glLineWidth(width);
-	glDrawArrays(GL_LINE_STRIP, 0, nPoints);
+	DebugDraw &batch = CurrentBatch();
+	batch.LineStrip(nPoints, points, color, opacity, width);
+	FlushIfImmediate(batch);
 }
 
 // Quads
 
-GLuint quadBuffer = 0;
-
 void Quad(vec3 p1, vec3 p2, vec3 p3, vec3 p4, bool solid, vec3 col, float opacity, float lineWidth) {
-	vec3 data[] = { p1, p2, p3, p4, col, col, col, col };
-	UseDrawShader();
-	if (quadBuffer == 0) {
-		glGenBuffers(1, &quadBuffer);
-		glBindBuffer(GL_ARRAY_BUFFER, quadBuffer);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(data), NULL, GL_STATIC_DRAW);
-	}
-    glBindBuffer(GL_ARRAY_BUFFER, quadBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
-	VertexAttribPointer(drawShader, "position", 3, 0, (void *) 0);
-    VertexAttribPointer(drawShader, "color", 3, 0, (void *) (4*sizeof(vec3)));
-	SetUniform(drawShader, "opacity", opacity);
-	SetUniform(drawShader, "fadeToCenter", 0);
-	glLineWidth(lineWidth);
-	glDrawArrays(solid? GL_QUADS : GL_LINE_LOOP, 0, 4);
+	DebugDraw &batch = CurrentBatch();
+	batch.Quad(p1, p2, p3, p4, solid, col, opacity, lineWidth);
+	FlushIfImmediate(batch);
 }
 
 // Arrows
@@ -341,14 +294,14 @@ void ArrowV(vec3 base, vec3 v, mat4 modelview, mat4 persp, vec3 col, float lineW
 
 // Triangles with optional outline
 
-GLuint triShader = 0, triBuffer = 0;
+GLuint triShader = 0;
 
 // vertex shader
 const char *triVShaderCode = "\
 	#version 330 core																			\n\
 	in vec3 point;																				\n\
-	in vec3 color;																				\n\
-	out vec3 vColor;																			\n\
+	in vec4 color;																				\n\
+	out vec4 vColor;																			\n\
     uniform mat4 view;																			\n\
 	void main()	{																				\n\
 		gl_Position = view*vec4(point, 1);														\n\
@@ -361,8 +314,8 @@ const char *triGShaderCode = "\
 	layout (triangles) in;																		\n\
 	layout (triangle_strip, max_vertices = 3) out;												\n\
 	in vec3 vPoint[];																			\n\
-	in vec3 vColor[];																			\n\
-	out vec3 gColor;																			\n\
+	in vec4 vColor[];																			\n\
+	out vec4 gColor;																			\n\
 	noperspective out vec3 gEdgeDistance;														\n\
 	uniform mat4 viewptM;																		\n\
 	vec3 ViewPoint(int i) {																		\n\
@@ -393,7 +346,7 @@ const char *triGShaderCode = "\
 // pixel shader
 const char *triPShaderCode = "\
     #version 410 core																			\n\
-	in vec3 gColor;																				\n\
+	in vec4 gColor;																				\n\
 	noperspective in vec3 gEdgeDistance;														\n\
 	uniform vec4 outlineColor = vec4(0, 0, 0, 1);												\n\
 	uniform float opacity = 1;																	\n\
@@ -402,7 +355,7 @@ const char *triPShaderCode = "\
 	uniform int outlineOn = 1;																	\n\
 	out vec4 pColor;																			\n\
 	void main() {																				\n\
-		pColor = vec4(gColor, opacity);															\n\
+		pColor = vec4(gColor.rgb, gColor.a*opacity);											\n\
 		if (outlineOn > 0) {																	\n\
 			float minDist = min(gEdgeDistance.x, min(gEdgeDistance.y, gEdgeDistance.z));		\n\
 			float t = smoothstep(outlineWidth-transition, outlineWidth+transition, minDist);	\n\
@@ -411,13 +364,17 @@ const char *triPShaderCode = "\
 		}																						\n\
 	}";
 
- void UseTriangleShader() {
-	bool init = triShader == 0;
-	if (init)
-		triShader = LinkProgramViaCode(&triVShaderCode, NULL, NULL, &triGShaderCode, &triPShaderCode);
+static void LinkTriangleShader() {
+	// link, with identity view
+	triShader = LinkProgramViaCode(&triVShaderCode, NULL, NULL, &triGShaderCode, &triPShaderCode);
+	glUseProgram(triShader);
+	SetUniform(triShader, "view", mat4());
+}
+
+void UseTriangleShader() {
+	if (!triShader)
+		LinkTriangleShader();
 	glUseProgram(triShader);
-	if (init)
-		SetUniform(triShader, "view", mat4());
 	glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_LINE_SMOOTH);
@@ -428,20 +385,264 @@ void UseTriangleShader(mat4 view) {
 	SetUniform(triShader, "view", view);
 }
 
+void PrecompileDrawShaders() {
+	int was = CurrentProgram();
+	if (!drawShader)
+		LinkDrawShader();
+	if (!triShader)
+		LinkTriangleShader();
+	glUseProgram(was);
+}
+
 void Triangle(vec3 p1, vec3 p2, vec3 p3, vec3 c1, vec3 c2, vec3 c3,
 			  float opacity, bool outline, vec4 outlineCol, float outlineWidth, float transition) {
-	vec3 data[] = { p1, p2, p3, c1, c2, c3 };
-	UseTriangleShader();
-	if (triBuffer == 0)
-		glGenBuffers(1, &triBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, triBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
-	VertexAttribPointer(triShader, "point", 3, 0, (void *) 0);
-    VertexAttribPointer(triShader, "color", 3, 0, (void *) (3*sizeof(vec3)));
-	SetUniform(triShader, "viewptM", Viewport());
-	SetUniform(triShader, "opacity", opacity);
-	SetUniform(triShader, "outlineOn", outline? 1 : 0);
-	SetUniform(triShader, "outlineWidth", outlineWidth);
-	SetUniform(triShader, "transition", transition);
-	glDrawArrays(GL_TRIANGLES, 0, 3);
+	DebugDraw &batch = CurrentBatch();
+	batch.Triangle(p1, p2, p3, c1, c2, c3, opacity, outline, outlineCol, outlineWidth, transition);
+	FlushIfImmediate(batch);
+}
+
+// Debug Draw Batching
+
+std::vector<DrawVertex> &DebugDraw::Append(Type type, float size, bool outline, vec4 outlineColor, float outlineWidth, float transition) {
+	// return vertices of the stream for these attributes, creating it if needed
+	nPrimitives++;
+	for (int i = -1; i < (int) streams.size(); i++) {
+		// check the most recent stream first, as primitives tend to come in runs
+		int k = i < 0? current : i;
+		if (k < 0 || (i >= 0 && i == current))
+			continue;
+		Stream &s = streams[k];
+		if (s.type == type && s.size == size && s.depth == depthMode && s.outline == outline && (!outline ||
+			(s.outlineWidth == outlineWidth && s.transition == transition &&
+			 s.outlineColor.x == outlineColor.x && s.outlineColor.y == outlineColor.y &&
+			 s.outlineColor.z == outlineColor.z && s.outlineColor.w == outlineColor.w))) {
+			current = k;
+			return s.vertices;
+		}
+	}
+	Stream s;
+	s.type = type;
+	s.size = size;
+	s.depth = depthMode;
+	s.outline = outline;
+	s.outlineColor = outlineColor;
+	s.outlineWidth = outlineWidth;
+	s.transition = transition;
+	s.first = 0;
+	streams.push_back(s);
+	current = (int) streams.size()-1;
+	return streams[current].vertices;
+}
+
+void DebugDraw::Disk(vec3 p, float diameter, vec3 color, float opacity) {
+	Append(Points, diameter).push_back(DrawVertex(p, color, opacity));
+}
+
+void DebugDraw::Line(vec3 p1, vec3 p2, float width, vec3 col1, vec3 col2, float opacity) {
+	std::vector<DrawVertex> &v = Append(Lines, width);
+	v.push_back(DrawVertex(p1, col1, opacity));
+	v.push_back(DrawVertex(p2, col2, opacity));
+}
+
+void DebugDraw::LineStrip(int nPoints, vec3 *points, vec3 color, float opacity, float width) {
+	// as separate segments, so strips share a stream and draw
+	std::vector<DrawVertex> &v = Append(Lines, width);
+	for (int i = 1; i < nPoints; i++) {
+		v.push_back(DrawVertex(points[i-1], color, opacity));
+		v.push_back(DrawVertex(points[i], color, opacity));
+	}
+}
+
+void DebugDraw::Quad(vec3 p1, vec3 p2, vec3 p3, vec3 p4, bool solid, vec3 col, float opacity, float lineWidth) {
+	vec3 p[] = { p1, p2, p3, p4 };
+	if (solid) {
+		// as two triangles (GL_QUADS is not in the core profile)
+		std::vector<DrawVertex> &v = Append(Triangles, 0);
+		int ids[] = { 0, 1, 2, 0, 2, 3 };
+		for (int i = 0; i < 6; i++)
+			v.push_back(DrawVertex(p[ids[i]], col, opacity));
+	}
+	else {
+		std::vector<DrawVertex> &v = Append(Lines, lineWidth);
+		for (int i = 0; i < 4; i++) {
+			v.push_back(DrawVertex(p[i], col, opacity));
+			v.push_back(DrawVertex(p[(i+1)%4], col, opacity));
+		}
+	}
+}
+
+void DebugDraw::Triangle(vec3 p1, vec3 p2, vec3 p3, vec3 c1, vec3 c2, vec3 c3,
+						 float opacity, bool outline, vec4 outlineCol, float outlineWidth, float transition) {
+	std::vector<DrawVertex> &v = Append(TriangleShaded, 0, outline, outlineCol, outlineWidth, transition);
+	v.push_back(DrawVertex(p1, c1, opacity));
+	v.push_back(DrawVertex(p2, c2, opacity));
+	v.push_back(DrawVertex(p3, c3, opacity));
+}
+
+void DebugDraw::Box(vec3 min, vec3 max, float width, vec3 color, float opacity) {
+	std::vector<DrawVertex> &v = Append(Lines, width);
+	for (int i = 0; i < 8; i++)
+		for (int axis = 0; axis < 3; axis++)
+			// edge from each corner on the min side of an axis to the max side
+			if (!(i & (1 << axis))) {
+				int j = i | (1 << axis);
+				v.push_back(DrawVertex(vec3(i&1? max.x : min.x, i&2? max.y : min.y, i&4? max.z : min.z), color, opacity));
+				v.push_back(DrawVertex(vec3(j&1? max.x : min.x, j&2? max.y : min.y, j&4? max.z : min.z), color, opacity));
+			}
+}
+
+void DebugDraw::Sphere(vec3 center, float radius, float width, vec3 color, float opacity, int nSegments) {
+	std::vector<DrawVertex> &v = Append(Lines, width);
+	nSegments = nSegments < 3? 3 : nSegments;
+	for (int axis = 0; axis < 3; axis++) {
+		int u = (axis+1)%3, w = (axis+2)%3;
+		vec3 prev = center;
+		prev[u] += radius;
+		for (int i = 1; i <= nSegments; i++) {
+			float a = 2*3.1415926f*i/nSegments;
+			vec3 p = center;
+			p[u] += radius*cos(a);
+			p[w] += radius*sin(a);
+			v.push_back(DrawVertex(prev, color, opacity));
+			v.push_back(DrawVertex(p, color, opacity));
+			prev = p;
+		}
+	}
+}
+
+void DebugDraw::Clear() {
+	for (Stream &s : streams)
+		s.vertices.resize(0);
+	nPrimitives = 0;
+}
+
+void DebugDraw::Flush() {
+	Draw(NULL);
+}
+
+void DebugDraw::Flush(mat4 view) {
+	Draw(&view);
+}
+
+void DebugDraw::Draw(const mat4 *view) {
+	int nVertices = 0;
+	for (Stream &s : streams) {
+		s.first = nVertices;
+		nVertices += (int) s.vertices.size();
+	}
+	lastFlush = Stats();
+	lastFlush.primitives = nPrimitives;
+	lastFlush.vertices = nVertices;
+	if (nVertices) {
+		GLint wasVertexArray = 0;
+		glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &wasVertexArray);
+		bool wasDepthTest = glIsEnabled(GL_DEPTH_TEST) == GL_TRUE;
+		if (!vertexArray) {
+			glGenVertexArrays(1, &vertexArray);
+			glGenBuffers(1, &vertexBuffer);
+		}
+		glBindVertexArray(vertexArray);
+		glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+		// write after the previous flush without synchronizing, as the GPU may still read it;
+		// at the end of the ring, orphan the buffer so the driver supplies fresh storage
+		if (nVertices > capacity) {
+			while (capacity < nVertices)
+				capacity = capacity? 2*capacity : 4096;
+			glBufferData(GL_ARRAY_BUFFER, capacity*sizeof(DrawVertex), NULL, GL_STREAM_DRAW);
+			head = 0;
+		}
+		else if (head+nVertices > capacity) {
+			glBufferData(GL_ARRAY_BUFFER, capacity*sizeof(DrawVertex), NULL, GL_STREAM_DRAW);
+			head = 0;
+		}
+		DrawVertex *mapped = (DrawVertex *) glMapBufferRange(GL_ARRAY_BUFFER, head*sizeof(DrawVertex), nVertices*sizeof(DrawVertex),
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (mapped) {
+			for (Stream &s : streams)
+				if (s.vertices.size())
+					std::copy(s.vertices.begin(), s.vertices.end(), mapped+s.first);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+			// points, lines, and quads with the draw shader, then triangles with the triangle shader
+			for (int pass = 0; pass < 2; pass++) {
+				bool shaded = pass == 1, shaderSet = false;
+				int program = 0;
+				for (Stream &s : streams) {
+					if (s.vertices.empty() || (s.type == TriangleShaded) != shaded)
+						continue;
+					if (!shaderSet) {
+						if (shaded) {
+							UseTriangleShader();
+							program = triShader;
+							VertexAttribPointer(program, "point", 3, sizeof(DrawVertex), (void *) 0);
+							SetUniform(program, "viewptM", Viewport());
+						}
+						else {
+							UseDrawShader();
+							program = drawShader;
+							VertexAttribPointer(program, "position", 3, sizeof(DrawVertex), (void *) 0);
+							SetUniform(program, "fadeToCenter", 0);
+						}
+						VertexAttribPointer(program, "color", 4, sizeof(DrawVertex), (void *) sizeof(vec3));
+						SetUniform(program, "opacity", 1.f);
+						if (view)
+							SetUniform(program, "view", *view);
+						shaderSet = true;
+					}
+					if (s.depth != DepthUnchanged)
+						(s.depth == DepthOn? glEnable : glDisable)(GL_DEPTH_TEST);
+					GLenum mode = GL_TRIANGLES;
+					if (s.type == Points) {
+						mode = GL_POINTS;
+						glPointSize(s.size);
+						// *** normally enabled with GL_POINT_SMOOTH, but at times this appears undefined,
+						//     in which case glEnable(0x8861) appears to work
+#ifdef GL_POINT_SMOOTH
+						glEnable(GL_POINT_SMOOTH);
+#else
+						glEnable(0x8861); // same as GL_POINT_SMOOTH [this is a 4.5 core bug]
+#endif
+					}
+					if (s.type == Lines) {
+						mode = GL_LINES;
+						glLineWidth(s.size);
+					}
+					if (s.type == TriangleShaded) {
+						SetUniform(program, "outlineOn", s.outline? 1 : 0);
+						SetUniform(program, "outlineColor", &s.outlineColor);
+						SetUniform(program, "outlineWidth", s.outlineWidth);
+						SetUniform(program, "transition", s.transition);
+					}
+					glDrawArrays(mode, head+s.first, (GLsizei) s.vertices.size());
+					lastFlush.draws++;
+				}
+			}
+		}
+		else
+			printf("DebugDraw: can't map vertex buffer\n");
+		head += nVertices;
+		(wasDepthTest? glEnable : glDisable)(GL_DEPTH_TEST);
+		glBindVertexArray(wasVertexArray);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	lastFlush.bufferVertices = capacity;
+	// keep streams that were used, for their vertex capacity; drop the others
+	size_t nKept = 0;
+	for (size_t i = 0; i < streams.size(); i++)
+		if (streams[i].vertices.size()) {
+			if (nKept != i)
+				std::swap(streams[nKept], streams[i]);
+			streams[nKept++].vertices.resize(0);
+		}
+	streams.resize(nKept);
+	current = -1;
+	nPrimitives = 0;
+}
+
+void DebugDraw::Release() {
+	if (vertexArray) {
+		glDeleteBuffers(1, &vertexBuffer);
+		glDeleteVertexArrays(1, &vertexArray);
+	}
+	vertexArray = vertexBuffer = 0;
+	capacity = head = 0;
 }
@@ -0,0 +1,270 @@
+// FrameCapture.cpp - asynchronous capture of the framebuffer to Targa files or a raw video stream
+
+#include <glad.h>
+#include <chrono>
+#include <string.h>
+#include "Draw.h"
+#include "FrameCapture.h"
+#include "Misc.h"
+
+// Capture
+
+void FrameCapture::Screenshot(const char *targaFilename) {
+	screenshots.push_back(targaFilename);
+}
+
+bool FrameCapture::StartRecording(const char *filename) {
+	StopRecording();
+	pattern = strchr(filename, '%')? filename : "";
+	if (pattern.empty() && !(raw = fopen(filename, "wb"))) {
+		printf("can't record to %s\n", filename);
+		return false;
+	}
+	GetViewportSize(recordWidth, recordHeight);
+	frame = 0;
+	recording = true;
+	printf("recording %dx%d frames to %s\n", recordWidth, recordHeight, filename);
+	return true;
+}
+
+void FrameCapture::StopRecording() {
+	if (!recording)
+		return;
+	if (raw)
+		closing.push_back(raw);
+	raw = NULL;
+	recording = false;
+	printf("recorded %d frames\n", frame);
+}
+
+void FrameCapture::EndFrame() {
+	if (!recording && screenshots.empty() && !used && closing.empty())
+		return;
+	auto start = std::chrono::high_resolution_clock::now();
+	Collect(false);
+	for (const std::string &s : screenshots)
+		Read(s, NULL, false);
+	screenshots.clear();
+	if (recording) {
+		int width, height;
+		GetViewportSize(width, height);
+		if (!pattern.empty()) {
+			char filename[1024];
+			snprintf(filename, sizeof(filename), pattern.c_str(), frame);
+			if (Read(filename, NULL, true))
+				frame++;
+		}
+		else if (width != recordWidth || height != recordHeight) {
+			printf("viewport resized during raw recording\n");
+			StopRecording();
+		}
+		else if (Read("", raw, true))
+			frame++;
+	}
+	// as the frame time, only while capturing
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now()-start).count();
+	totalMs += ms;
+	timedFrames++;
+	stats.averageMs = (float) (totalMs/timedFrames);
+	stats.maxMs = stats.maxMs > ms? stats.maxMs : (float) ms;
+}
+
+bool FrameCapture::Read(const std::string &filename, FILE *rawFile, bool recorded) {
+	// start an asynchronous read of the framebuffer into the next slot; return false if dropped
+	if (!slots)
+		slots.reset(new Slot[nSlots]);
+	if (!writer.joinable()) {
+		quit = false;
+		writer = std::thread(&FrameCapture::Write, this);
+	}
+	if (used == nSlots) {
+		// the GPU or the writer is behind: drop a recorded frame, but wait for a slot for a screenshot
+		if (recorded) {
+			stats.dropped++;
+			return false;
+		}
+		stats.stalls++;
+		Collect(true);
+	}
+	Slot &s = slots[(oldest+used)%nSlots];
+	GetViewportSize(s.width, s.height);
+	size_t size = (size_t) 3*s.width*s.height;
+	if (!s.buffer)
+		glGenBuffers(1, &s.buffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+	if (s.capacity < size) {
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		s.capacity = size;
+	}
+	GLint alignment;
+	glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);			// rows packed, as in the file
+	glReadPixels(0, 0, s.width, s.height, GL_BGR, GL_UNSIGNED_BYTE, 0);	// into the buffer, Targa is BGR ordered
+	glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	s.filename = filename;
+	s.raw = rawFile;
+	s.state = Reading;
+	used++;
+	stats.captured++;
+	return true;
+}
+
+void FrameCapture::Collect(bool wait) {
+	// map slots whose fences have signaled and queue them for the writer, in capture order;
+	// then free slots the writer has copied; if wait, block until the oldest slot is free
+	for (int k = 0; k < used; k++) {
+		Slot &s = slots[(oldest+k)%nSlots];
+		if (s.state != Reading)
+			continue;
+		bool block = wait && k == 0;
+		GLenum r;
+		do
+			r = glClientWaitSync((GLsync) s.fence, block? GL_SYNC_FLUSH_COMMANDS_BIT : 0, block? 1000000000 : 0);
+		while (block && r == GL_TIMEOUT_EXPIRED);
+		if (r == GL_TIMEOUT_EXPIRED)
+			break;							// later slots were read after this one
+		glDeleteSync((GLsync) s.fence);
+		s.fence = NULL;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+		s.pixels = (const unsigned char *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (size_t) 3*s.width*s.height, GL_MAP_READ_BIT);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		if (!s.pixels) {
+			printf("can't map frame capture buffer\n");
+			s.state = Copied;
+			continue;
+		}
+		s.state = Mapped;
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back({(oldest+k)%nSlots, s.raw});
+		busyJobs++;
+		jobReady.notify_one();
+	}
+	// close stopped raw files once all their frames are queued
+	for (size_t i = 0; i < closing.size(); ) {
+		bool pending = false;
+		for (int k = 0; k < used; k++) {
+			Slot &s = slots[(oldest+k)%nSlots];
+			pending = pending || (s.raw == closing[i] && s.state == Reading);
+		}
+		if (pending) {
+			i++;
+			continue;
+		}
+		if (!writer.joinable()) {
+			fclose(closing[i]);			// no frames were captured
+			closing.erase(closing.begin()+i);
+			continue;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back({-1, closing[i]});
+		busyJobs++;
+		jobReady.notify_one();
+		closing.erase(closing.begin()+i);
+	}
+	while (used > 0) {
+		Slot &s = slots[oldest];
+		if (wait && s.state == Mapped) {
+			std::unique_lock<std::mutex> lock(mutex);
+			slotCopied.wait(lock, [&]() { return s.state == Copied; });
+		}
+		if (s.state != Copied)
+			break;
+		Unmap(s);
+		oldest = (oldest+1)%nSlots;
+		used--;
+		wait = false;
+	}
+}
+
+void FrameCapture::Unmap(Slot &s) {
+	if (s.pixels) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+	s.pixels = NULL;
+	s.state = Free;
+}
+
+void FrameCapture::Finish() {
+	while (used > 0)
+		Collect(true);
+	Collect(false);						// close stopped raw files
+	std::unique_lock<std::mutex> lock(mutex);
+	slotCopied.wait(lock, [&]() { return busyJobs == 0; });
+}
+
+void FrameCapture::Release() {
+	StopRecording();
+	Finish();
+	if (writer.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		jobReady.notify_one();
+		writer.join();
+	}
+	for (int i = 0; slots && i < nSlots; i++)
+		if (slots[i].buffer)
+			glDeleteBuffers(1, &slots[i].buffer);
+	slots.reset();
+	oldest = used = 0;
+}
+
+// Writer
+
+void FrameCapture::Write() {
+	// writer thread: copy mapped frames out, so their slots can be reused, then encode them
+	std::vector<unsigned char> pixels;
+	for (;;) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			jobReady.wait(lock, [&]() { return quit || !jobs.empty(); });
+			if (jobs.empty())
+				return;
+			job = jobs.front();
+			jobs.pop_front();
+		}
+		bool ok = true;
+		if (job.slot < 0)
+			fclose(job.raw);
+		else {
+			Slot &s = slots[job.slot];
+			int width = s.width, height = s.height;
+			std::string filename = s.filename;
+			pixels.assign(s.pixels, s.pixels+(size_t) 3*width*height);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				s.state = Copied;
+			}
+			slotCopied.notify_all();
+			ok = filename.empty()?
+				fwrite(pixels.data(), pixels.size(), 1, job.raw) == 1 :
+				WriteTarga(filename.c_str(), pixels.data(), width, height);
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busyJobs--;
+			if (ok && job.slot >= 0)
+				stats.written++;
+		}
+		slotCopied.notify_all();
+	}
+}
+
+// Stats
+
+FrameCapture::Stats FrameCapture::GetStats() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+void FrameCapture::PrintStats() {
+	Stats s = GetStats();
+	printf("frame capture: %d captured, %d written, %d dropped, %d stalls, %.2f ms per frame average, %.2f max\n",
+		   s.captured, s.written, s.dropped, s.stalls, s.averageMs, s.maxMs);
+}
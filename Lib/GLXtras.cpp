@@ -5,6 +5,13 @@
 #include "GLXtras.h"
 #include <stdio.h>
 #include <string.h>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
 
 // Support
@@ -149,12 +156,16 @@ GLuint CompileShaderViaCode(const char **code, GLint type) {
 // Linking
 
 GLuint LinkProgramViaCode(const char **vertexCode, const char **pixelCode) {
-	GLuint vshader = CompileShaderViaCode(vertexCode, GL_VERTEX_SHADER);
-	GLuint pshader = CompileShaderViaCode(pixelCode, GL_FRAGMENT_SHADER);
-	return LinkProgram(vshader, pshader);
+	return LinkProgramViaCode(vertexCode, NULL, NULL, NULL, pixelCode);
 }
 
 GLuint LinkProgramViaCode(const char **vertexCode, const char **tessellationControlCode, const char **tessellationEvalCode, const char **geometryCode, const char **pixelCode) {
+	const char *tc = tessellationControlCode? *tessellationControlCode : NULL;
+	const char *te = tessellationEvalCode? *tessellationEvalCode : NULL;
+	const char *g = geometryCode? *geometryCode : NULL;
+	GLuint program = LoadCachedProgram(*vertexCode, tc, te, g, *pixelCode);
+	if (program)
+		return program;
 	GLuint vshader = CompileShaderViaCode(vertexCode, GL_VERTEX_SHADER);
 	// TODO remove 2 following comments and set tcshader/te shader = tessellation<>Code()?
 	GLuint tcshader = tessellationControlCode? CompileShaderViaCode(tessellationControlCode, GL_TESS_CONTROL_SHADER) : 0;
@@ -162,7 +173,9 @@ GLuint LinkProgramViaCode(const char **vertexCode, const char **tessellationCont
 	
 	GLuint gshader = geometryCode? CompileShaderViaCode(geometryCode, GL_GEOMETRY_SHADER) : 0;
 	GLuint pshader = CompileShaderViaCode(pixelCode, GL_FRAGMENT_SHADER);
-	return LinkProgram(vshader, tcshader, teshader, gshader, pshader);
+	program = LinkProgram(vshader, tcshader, teshader, gshader, pshader);
+	SaveCachedProgram(program, *vertexCode, tc, te, g, *pixelCode);
+	return program;
 }
 
 GLuint LinkProgram(GLuint vshader, GLuint pshader) {
@@ -184,6 +197,8 @@ GLuint LinkProgram(GLuint vshader, GLuint tcshader, GLuint teshader, GLuint gsha
 		if (gshader > 0)
 			glAttachShader(program, gshader);
         glAttachShader(program, pshader);
+		if (ProgramCacheEnabled())
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         // link and verify
         glLinkProgram(program);
         GLint status;
@@ -200,6 +215,145 @@ GLuint LinkProgramViaFile(const char *vertexShaderFile, const char *pixelShaderF
 	return LinkProgram(vshader, fshader);
 }
 
+// Program Binary Cache
+
+struct ProgramCacheHeader {
+	char magic[4];					// "GLPB"
+	unsigned int version;
+	unsigned long long sourceHash, driverHash;
+	unsigned int format, length;	// of the binary that follows
+};
+
+static std::string programCacheDirectory;
+static bool programCacheEnabled = false;
+static unsigned long long programCacheDriverHash = 0;
+static int programCacheLoads = 0, programCacheMisses = 0, programCacheRejects = 0, programCacheSaves = 0;
+
+static unsigned long long Hash(const char *s, unsigned long long h = 14695981039346656037ull) {
+	// 64-bit FNV-1a
+	for (; s && *s; s++)
+		h = (h^(unsigned char) *s)*1099511628211ull;
+	return h;
+}
+
+static unsigned long long SourceHash(const char *vertexCode, const char *tessellationControlCode, const char *tessellationEvalCode,
+									 const char *geometryCode, const char *pixelCode) {
+	const char *codes[] = {vertexCode, tessellationControlCode, tessellationEvalCode, geometryCode, pixelCode};
+	unsigned long long h = Hash(NULL);
+	for (const char *code : codes)
+		h = Hash(code? "\1" : "\2", Hash(code, h));	// separate stages, tell an empty stage from a missing one
+	return h;
+}
+
+static std::string ProgramCacheFilename(unsigned long long sourceHash) {
+	// one file per sources, replaced when the driver changes
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.bin", sourceHash);
+	return programCacheDirectory+name;
+}
+
+void SetProgramCache(const char *directory) {
+	programCacheEnabled = false;
+	if (!directory)
+		return;
+	GLint nFormats = 0;
+	if (glProgramBinary && glGetProgramBinary && glProgramParameteri)
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nFormats);
+	if (nFormats < 1) {
+		printf("no program binary formats, shaders will be compiled\n");
+		return;
+	}
+#ifdef _WIN32
+	_mkdir(directory);
+#else
+	mkdir(directory, 0755);
+#endif
+	programCacheDirectory = directory;
+	GLenum strings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION};
+	programCacheDriverHash = Hash(NULL);
+	for (GLenum s : strings)
+		programCacheDriverHash = Hash("\n", Hash((const char *) glGetString(s), programCacheDriverHash));
+	programCacheEnabled = true;
+}
+
+bool ProgramCacheEnabled() {
+	return programCacheEnabled;
+}
+
+GLuint LoadCachedProgram(const char *vertexCode, const char *tessellationControlCode, const char *tessellationEvalCode,
+						 const char *geometryCode, const char *pixelCode) {
+	if (!programCacheEnabled)
+		return 0;
+	unsigned long long sourceHash = SourceHash(vertexCode, tessellationControlCode, tessellationEvalCode, geometryCode, pixelCode);
+	std::string filename = ProgramCacheFilename(sourceHash);
+	FILE *in = fopen(filename.c_str(), "rb");
+	if (!in) {
+		programCacheMisses++;
+		return 0;
+	}
+	ProgramCacheHeader header;
+	std::vector<char> binary;
+	bool ok = fread(&header, sizeof(header), 1, in) == 1 && !strncmp(header.magic, "GLPB", 4) && header.version == 1 &&
+			  header.sourceHash == sourceHash && header.driverHash == programCacheDriverHash && header.length > 0;
+	if (ok) {
+		binary.resize(header.length);
+		ok = fread(binary.data(), header.length, 1, in) == 1;
+	}
+	fclose(in);
+	GLuint program = 0;
+	if (ok) {
+		program = glCreateProgram();
+		glProgramBinary(program, header.format, binary.data(), header.length);
+		GLint status = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		if (status == GL_FALSE) {
+			glDeleteProgram(program);
+			program = 0;
+			while (glGetError() != GL_NO_ERROR)
+				;	// an unknown binary format is an error, but the program is compiled instead
+		}
+	}
+	if (program)
+		programCacheLoads++;
+	else
+		programCacheRejects++;		// stale (other driver) or corrupt, replaced by SaveCachedProgram
+	return program;
+}
+
+void SaveCachedProgram(GLuint program, const char *vertexCode, const char *tessellationControlCode,
+					   const char *tessellationEvalCode, const char *geometryCode, const char *pixelCode) {
+	if (!programCacheEnabled || !program)
+		return;
+	GLint status = GL_FALSE, length = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (status == GL_FALSE || length <= 0)
+		return;
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+	ProgramCacheHeader header = {{'G', 'L', 'P', 'B'}, 1,
+		SourceHash(vertexCode, tessellationControlCode, tessellationEvalCode, geometryCode, pixelCode),
+		programCacheDriverHash, format, (unsigned int) length};
+	std::string filename = ProgramCacheFilename(header.sourceHash);
+	FILE *out = fopen(filename.c_str(), "wb");
+	if (!out) {
+		printf("can't save %s\n", filename.c_str());
+		return;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, out) == 1 && fwrite(binary.data(), length, 1, out) == 1;
+	fclose(out);
+	if (ok)
+		programCacheSaves++;
+	else
+		remove(filename.c_str());
+}
+
+void PrintProgramCacheStats() {
+	printf("program cache: %d loaded, %d compiled (%d stale), %d saved\n",
+		   programCacheLoads, programCacheMisses+programCacheRejects, programCacheRejects, programCacheSaves);
+}
+
 int CurrentProgram() {
 	int program = 0;
 	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
@@ -1,6 +1,6 @@
 // Mesh.cpp - mesh IO and operations
 
-#include "Mesh.h"
+#include "../Include/Mesh.h"	// not the game's Mesh.h, found first on its include path
 #include <assert.h>
 #include <iostream>
 #include <fstream>
@@ -8,6 +8,14 @@
 #include <float.h>
 #include <string.h>
 #include <cstdlib>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "MappedFile.h"
 
 using std::string;
 using std::vector;
@@ -295,7 +303,7 @@ struct Compare {
 
 typedef std::map<int3, int, Compare> VidMap;
 
-bool ReadAsciiObj(const char    *filename,
+static bool ReadAsciiObjLineByLine(const char *filename,
 				  vector<vec3>	&points,
 				  vector<int3>	&triangles,
 				  vector<vec3>	*normals,
@@ -432,8 +440,507 @@ bool ReadAsciiObj(const char    *filename,
 	// if (vertexNormals)
 	//	SetVertexNormals(vertices, triangles, *vertexNormals);
 	return true;
+} // end ReadAsciiObjLineByLine
+
+// memory-mapped OBJ reader: the file is split into chunks of whole lines, parsed in parallel into chunk-local
+// arrays; vertex/texture/normal triples are deduplicated per chunk with a hash table, then merged in file order
+// into the mesh, so points are numbered as the line-by-line reader numbers them
+
+static const char *ParseFloat(const char *p, const char *end, float &f) {
+	// parse a decimal float as std::from_chars would (no locale, no copy, no allocation)
+	// return pointer past it, or NULL if none; uncommon forms (inf, nan, hex, > 19 digits) go through strtod
+	static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+								   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+	const char *start = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool any = false, exact = true;
+	for (; p < end && (unsigned) (*p-'0') < 10; p++, any = true)
+		if (digits < 19) {
+			mantissa = mantissa*10+(*p-'0');
+			digits += mantissa != 0;
+		}
+		else {
+			exponent++;
+			exact &= *p == '0';
+		}
+	if (p < end && *p == '.') {
+		for (p++; p < end && (unsigned) (*p-'0') < 10; p++, any = true)
+			if (digits < 19) {
+				mantissa = mantissa*10+(*p-'0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+			else
+				exact &= *p == '0';
+	}
+	if (!any || !exact || (p < end && ((*p|0x20) == 'x' || (*p|0x20) == 'n' || (*p|0x20) == 'i'))) {
+		// rare: let the C library round it
+		char buf[128];
+		size_t n = 0;
+		for (const char *q = start; q < end && n < sizeof(buf)-1 && !strchr(" \t\r\n", *q); q++)
+			buf[n++] = *q;
+		buf[n] = 0;
+		char *stop;
+		double d = strtod(buf, &stop);
+		if (stop == buf)
+			return NULL;
+		f = (float) d;
+		return start+(stop-buf);
+	}
+	if (p < end && (*p|0x20) == 'e') {
+		const char *q = p+1;
+		bool negativeExponent = q < end && *q == '-';
+		if (q < end && (*q == '-' || *q == '+'))
+			q++;
+		if (q < end && (unsigned) (*q-'0') < 10) {
+			int e = 0;
+			for (; q < end && (unsigned) (*q-'0') < 10; q++)
+				e = e < 10000? e*10+(*q-'0') : e;
+			exponent += negativeExponent? -e : e;
+			p = q;
+		}
+	}
+	double d = (double) mantissa;
+	if (mantissa == 0)
+		d = 0;
+	else if (exponent >= -22 && exponent <= 22)
+		d = exponent < 0? d/pow10[-exponent] : d*pow10[exponent];
+	else
+		d *= pow(10., exponent);
+	f = (float) (negative? -d : d);
+	return p;
+}
+
+static const char *ParseInt(const char *p, const char *end, int &i) {
+	// return pointer past a decimal integer, or NULL if none
+	bool negative = p < end && *p == '-';
+	if (p < end && (*p == '-' || *p == '+'))
+		p++;
+	if (p >= end || (unsigned) (*p-'0') >= 10)
+		return NULL;
+	int n = 0;
+	for (; p < end && (unsigned) (*p-'0') < 10; p++)
+		n = n*10+(*p-'0');
+	i = negative? -n : n;
+	return p;
+}
+
+static inline bool IsBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+class TripleHash {
+	// open addressing hash table of vertex/texture/normal triples, kept at most half full
+public:
+	TripleHash(size_t n = 0) { Resize(n); }
+	int &Find(const int3 &k, bool &found) {
+		// return the value of k, found false if new (the value is then to be set by the caller)
+		if (2*(count+1) > entries.size())
+			Resize(entries.size());
+		for (size_t i = Hash(k);; i = (i+1)&mask) {
+			Entry &e = entries[i];
+			if (e.value < 0) {
+				e.key = k;
+				e.value = 0;
+				count++;
+				found = false;
+				return e.value;
+			}
+			if (e.key.i1 == k.i1 && e.key.i2 == k.i2 && e.key.i3 == k.i3) {
+				found = true;
+				return e.value;
+			}
+		}
+	}
+private:
+	struct Entry { int3 key; int value = -1; };	// value -1 if empty
+	vector<Entry> entries;
+	size_t mask = 0, count = 0;
+	size_t Hash(const int3 &k) const {
+		unsigned int h = ((unsigned int) k.i1*0x9e3779b1u)^((unsigned int) k.i2*0x85ebca77u)^((unsigned int) k.i3*0xc2b2ae3du);
+		return (h^(h >> 16))&mask;
+	}
+	void Resize(size_t n) {
+		// capacity for 2n entries, rehash
+		size_t capacity = 64;
+		while (capacity < 2*n)
+			capacity *= 2;
+		vector<Entry> old(capacity);
+		old.swap(entries);
+		mask = capacity-1;
+		for (Entry &e : old)
+			if (e.value >= 0)
+				for (size_t i = Hash(e.key);; i = (i+1)&mask)
+					if (entries[i].value < 0) {
+						entries[i] = e;
+						break;
+					}
+	}
+};
+
+struct ObjChunk {
+	static const int Absent = INT_MIN;		// texture or normal id not given, use the vertex id
+	static const int Relative = -(1 << 30);	// negative obj id, stored as Relative+id counted from the chunk start
+	static const int NoGroup = INT_MIN;		// face precedes the chunk's first integer "g"
+	const char *begin = NULL, *end = NULL;
+	// pass 1: parse
+	vector<vec3> vertices, normals;
+	vector<vec2> uvs;
+	vector<int3> corners;					// face vertex/texture/normal ids: >= 0 0-based, else Relative or Absent
+	vector<int> faceSizes, faceGroups;
+	int nLines = 0, badLine = -1, lastGroup = NoGroup;
+	const char *badWhat = NULL;
+	// pass 2: chunk-local dedup
+	int vertexBase = 0, normalBase = 0, uvBase = 0, lineBase = 0, startGroup = 0;
+	vector<int3> keys;						// 0-based vertex/texture/normal ids, in order of first use
+	vector<int> cornerKeys;					// local key of each corner, -1 if out of range
+	vector<int> pointIds;					// mesh point of each local key
+	int nBadIds = 0;
+	// pass 3: faces
+	vector<int3> triangles;
+	vector<int> triangleGroups;
+	vector<int4> quads;
+	int nShortFaces = 0;
+	void Parse();
+	void Dedup(int nVertices);
+	void MakeFaces(vector<vec3> &points, vector<vec3> *normals, bool wantQuads);
+};
+
+void ObjChunk::Parse() {
+	int group = NoGroup;
+	for (const char *line = begin; line < end; nLines++) {
+		const char *eol = (const char *) memchr(line, '\n', end-line);
+		if (!eol)
+			eol = end;
+		const char *p = line, *next = eol+1;
+		while (p < eol && IsBlank(*p))
+			p++;
+		const char *word = p;
+		while (p < eol && !IsBlank(*p))
+			p++;
+		size_t len = p-word;
+		char c0 = len? word[0]|0x20 : 0, c1 = len > 1? word[1]|0x20 : 0;
+		line = next;
+		if (len == 1 && c0 == 'f') {
+			int n = 0;
+			for (;;) {
+				while (p < eol && IsBlank(*p))
+					p++;
+				int v, t = Absent, nrm = Absent;
+				const char *q = ParseInt(p, eol, v);
+				if (!q || !v)
+					break;
+				if (q < eol && *q == '/') {
+					const char *r = ParseInt(q+1, eol, t);
+					q = r? r : q+1;
+					if (!r)
+						t = Absent;
+					if (q < eol && *q == '/') {
+						r = ParseInt(q+1, eol, nrm);
+						q = r? r : q+1;
+						if (!r)
+							nrm = Absent;
+					}
+				}
+				while (q < eol && !IsBlank(*q))
+					q++;
+				p = q;
+				// 1-based ids become 0-based; negative ids count back from the last one read, which may be in an earlier chunk
+				corners.push_back(int3(v > 0? v-1 : Relative+(int) vertices.size()+v,
+									   t == Absent || t == 0? Absent : t > 0? t-1 : Relative+(int) uvs.size()+t,
+									   nrm == Absent || nrm == 0? Absent : nrm > 0? nrm-1 : Relative+(int) normals.size()+nrm));
+				n++;
+			}
+			faceSizes.push_back(n);
+			faceGroups.push_back(group);
+		}
+		else if (len == 1 && c0 == 'v') {
+			vec3 v;
+			const char *q = p;
+			for (int k = 0; k < 3 && q; k++) {
+				while (q < eol && IsBlank(*q))
+					q++;
+				q = ParseFloat(q, eol, v[k]);
+			}
+			if (!q) {
+				badLine = badLine < 0? nLines : badLine;
+				badWhat = "vertex";
+				return;
+			}
+			vertices.push_back(v);
+		}
+		else if (len == 2 && c0 == 'v' && (c1 == 'n' || c1 == 't')) {
+			vec3 v;
+			const char *q = p;
+			for (int k = 0; k < (c1 == 'n'? 3 : 2) && q; k++) {
+				while (q < eol && IsBlank(*q))
+					q++;
+				q = ParseFloat(q, eol, v[k]);
+			}
+			if (!q) {
+				badLine = badLine < 0? nLines : badLine;
+				badWhat = c1 == 'n'? "normal" : "texture";
+				return;
+			}
+			if (c1 == 'n')
+				normals.push_back(v);
+			else
+				uvs.push_back(vec2(v.x, v.y));
+		}
+		else if (len == 1 && c0 == 'g') {
+			// group significant only if integer
+			while (p < eol && IsBlank(*p))
+				p++;
+			int g;
+			if (ParseInt(p, eol, g))
+				group = lastGroup = g;
+		}
+		// anything else (comments, o, s, usemtl, mtllib, blank lines) is ignored
+	}
+}
+
+void ObjChunk::Dedup(int nVertices) {
+	TripleHash hash(corners.size()/4);		// triples are typically shared by several faces
+	cornerKeys.resize(corners.size());
+	keys.resize(0);
+	for (size_t i = 0; i < corners.size(); i++) {
+		int3 c = corners[i];
+		int vid = c.i1 >= 0? c.i1 : vertexBase+c.i1-Relative;
+		int tid = c.i2 == Absent? vid : c.i2 >= 0? c.i2 : uvBase+c.i2-Relative;
+		int nid = c.i3 == Absent? vid : c.i3 >= 0? c.i3 : normalBase+c.i3-Relative;
+		if (vid < 0 || vid >= nVertices || tid < 0 || nid < 0) {
+			cornerKeys[i] = -1;
+			nBadIds++;
+			continue;
+		}
+		bool found;
+		int3 key(vid, tid, nid);
+		int &slot = hash.Find(key, found);
+		if (!found) {
+			slot = (int) keys.size();
+			keys.push_back(key);
+		}
+		cornerKeys[i] = slot;
+	}
+}
+
+void ObjChunk::MakeFaces(vector<vec3> &points, vector<vec3> *normals, bool wantQuads) {
+	int group = startGroup;
+	int vids[256];
+	vector<int> longFace;
+	for (size_t f = 0, c = 0; f < faceSizes.size(); c += faceSizes[f++]) {
+		if (faceGroups[f] != NoGroup)
+			group = faceGroups[f];
+		// as the line-by-line reader, a bad corner ends the face
+		int n = 0, size = faceSizes[f];
+		int *ids = size <= 256? vids : (longFace.resize(size), longFace.data());
+		while (n < size && cornerKeys[c+n] >= 0) {
+			ids[n] = pointIds[cornerKeys[c+n]];
+			n++;
+		}
+		if (n < 3)
+			nShortFaces++;
+		if (n == 3) {
+			int id1 = ids[0], id2 = ids[1], id3 = ids[2];
+			if (normals && (int) normals->size() > id1) {
+				vec3 &p1 = points[id1], &p2 = points[id2], &p3 = points[id3];
+				vec3 a(p2-p1), b(p3-p2), nrm(cross(a, b));
+				if (dot(nrm, (*normals)[id1]) < 0)
+					std::swap(id1, id3);
+			}
+			triangles.push_back(int3(id1, id2, id3));
+			triangleGroups.push_back(group);
+		}
+		else if (n == 4 && wantQuads)
+			quads.push_back(int4(ids[0], ids[1], ids[2], ids[3]));
+		else
+			for (int i = 1; i < n-1; i++) {
+				triangles.push_back(int3(ids[0], ids[i], ids[(i+1)%n]));
+				triangleGroups.push_back(group);
+			}
+	}
+}
+
+template <typename Function>
+static void ParallelFor(int n, int nThreads, Function f) {
+	// call f(i) for i in [0, n), spread over threads
+	std::atomic<int> next(0);
+	auto run = [&]() { for (int i; (i = next++) < n; ) f(i); };
+	vector<std::thread> threads;
+	for (int t = 1; t < std::min(n, nThreads); t++)
+		threads.push_back(std::thread(run));
+	run();
+	for (std::thread &t : threads)
+		t.join();
+}
+
+bool ReadAsciiObj(const char    *filename,
+				  vector<vec3>	&points,
+				  vector<int3>	&triangles,
+				  vector<vec3>	*normals,
+				  vector<vec2>	*textures,
+				  vector<int>	*triangleGroups,
+				  vector<int4>  *quads) {
+	// read 'object' file (Alias/Wavefront .obj format); return true if successful;
+	// polygons are assumed simple (ie, no holes and not self-intersecting);
+	// some file attributes are not supported by this implementation;
+	// obj format indexes vertices from 1, negative indices count back from the latest vertex
+	MappedFile file(filename);
+	if (!file.ok)
+		return false;
+	// chunks of about 1MB, at least one per thread for large files
+	static const size_t ChunkSize = 1 << 20;
+	int nThreads = std::max(1, (int) std::thread::hardware_concurrency());
+	int nChunks = (int) std::max<size_t>(1, std::min<size_t>(file.size/ChunkSize, 64*nThreads));
+	if (file.size > ChunkSize)
+		nChunks = std::max(nChunks, nThreads);
+	vector<ObjChunk> chunks(nChunks);
+	const char *data = file.data, *end = data+file.size;
+	for (int i = 0; i < nChunks; i++) {
+		const char *b = i? chunks[i-1].end : data, *e = i == nChunks-1? end : data+(file.size*(i+1))/nChunks;
+		if (e < b)
+			e = b;
+		// end each chunk after a newline, so lines aren't split
+		const char *nl = e < end? (const char *) memchr(e, '\n', end-e) : NULL;
+		chunks[i].begin = b;
+		chunks[i].end = i == nChunks-1 || !nl? end : nl+1;
+	}
+	// pass 1: parse
+	ParallelFor(nChunks, nThreads, [&](int i) { chunks[i].Parse(); });
+	// offsets of each chunk's vertices, normals, uvs, lines and groups; stop at the first bad line
+	int nVertices = 0, nNormals = 0, nUvs = 0, nLines = 0, group = 0;
+	for (ObjChunk &c : chunks) {
+		if (c.badLine >= 0) {
+			printf("bad %s on line %d in object file\n", c.badWhat, nLines+c.badLine);
+			return false;
+		}
+		c.vertexBase = nVertices;
+		c.normalBase = nNormals;
+		c.uvBase = nUvs;
+		c.lineBase = nLines;
+		c.startGroup = group;
+		nVertices += (int) c.vertices.size();
+		nNormals += (int) c.normals.size();
+		nUvs += (int) c.uvs.size();
+		nLines += c.nLines;
+		if (c.lastGroup != ObjChunk::NoGroup)
+			group = c.lastGroup;
+	}
+	vector<vec3> allVertices, allNormals;
+	vector<vec2> allUvs;
+	allVertices.reserve(nVertices);
+	allNormals.reserve(nNormals);
+	allUvs.reserve(nUvs);
+	for (ObjChunk &c : chunks) {
+		allVertices.insert(allVertices.end(), c.vertices.begin(), c.vertices.end());
+		allNormals.insert(allNormals.end(), c.normals.begin(), c.normals.end());
+		allUvs.insert(allUvs.end(), c.uvs.begin(), c.uvs.end());
+	}
+	// pass 2: dedup triples within each chunk
+	ParallelFor(nChunks, nThreads, [&](int i) { chunks[i].Dedup(nVertices); });
+	// merge chunk triples in file order, which numbers points in order of first use
+	size_t nKeys = 0;
+	for (ObjChunk &c : chunks)
+		nKeys += c.keys.size();
+	TripleHash merged(nChunks > 1? nKeys : 0);
+	points.reserve(points.size()+nKeys);
+	if (normals && nNormals)
+		normals->reserve(normals->size()+nKeys);
+	if (textures && nUvs)
+		textures->reserve(textures->size()+nKeys);
+	for (ObjChunk &c : chunks) {
+		c.pointIds.resize(c.keys.size());
+		for (size_t k = 0; k < c.keys.size(); k++) {
+			int3 &key = c.keys[k];
+			bool found = false;
+			int *slot = nChunks > 1? &merged.Find(key, found) : NULL;
+			if (found) {
+				c.pointIds[k] = *slot;
+				continue;
+			}
+			int id = (int) points.size();
+			if (slot)
+				*slot = id;
+			c.pointIds[k] = id;
+			points.push_back(allVertices[key.i1]);
+			if (normals && nNormals > key.i3)
+				normals->push_back(allNormals[key.i3]);
+			if (textures && nUvs > key.i2)
+				textures->push_back(allUvs[key.i2]);
+		}
+	}
+	// pass 3: faces
+	ParallelFor(nChunks, nThreads, [&](int i) { chunks[i].MakeFaces(points, normals, quads != NULL); });
+	int nBadIds = 0, nShortFaces = 0;
+	for (ObjChunk &c : chunks) {
+		triangles.insert(triangles.end(), c.triangles.begin(), c.triangles.end());
+		if (triangleGroups)
+			triangleGroups->insert(triangleGroups->end(), c.triangleGroups.begin(), c.triangleGroups.end());
+		if (quads)
+			quads->insert(quads->end(), c.quads.begin(), c.quads.end());
+		nBadIds += c.nBadIds;
+		nShortFaces += c.nShortFaces;
+	}
+	if (nBadIds)
+		printf("%d bad face vertex ids in %s\n", nBadIds, filename);
+	if (nShortFaces)
+		printf("%d faces with fewer than 3 vertices in %s\n", nShortFaces, filename);
+	return true;
 } // end ReadAsciiObj
 
+void ReadAsciiObjBenchmark(const char **objFilenames, int nFiles, int nRuns) {
+	typedef std::chrono::steady_clock Clock;
+	printf("OBJ read benchmark: best of %i runs, %i hardware threads\n", nRuns, std::max(1, (int) std::thread::hardware_concurrency()));
+	double totalMB = 0, totalOld = 0, totalNew = 0;
+	for (int f = 0; f < nFiles; f++) {
+		vector<vec3> points[2], normals[2];
+		vector<vec2> uvs[2];
+		vector<int3> triangles[2];
+		vector<int> groups[2];
+		double best[2] = {DBL_MAX, DBL_MAX};
+		bool ok[2];
+		for (int run = 0; run < nRuns; run++)
+			for (int reader = 0; reader < 2; reader++) {
+				points[reader].resize(0);
+				normals[reader].resize(0);
+				uvs[reader].resize(0);
+				triangles[reader].resize(0);
+				groups[reader].resize(0);
+				Clock::time_point start = Clock::now();
+				ok[reader] = (reader? ReadAsciiObj : ReadAsciiObjLineByLine)
+					(objFilenames[f], points[reader], triangles[reader], &normals[reader], &uvs[reader], &groups[reader], NULL);
+				best[reader] = std::min(best[reader], std::chrono::duration<double, std::milli>(Clock::now()-start).count());
+			}
+		if (!ok[0] || !ok[1]) {
+			printf("%s: can't read (line by line %s, mapped %s)\n", objFilenames[f], ok[0]? "ok" : "failed", ok[1]? "ok" : "failed");
+			continue;
+		}
+		FILE *in = fopen(objFilenames[f], "rb");
+		fseek(in, 0, SEEK_END);
+		double mb = ftell(in)/(1024.*1024.);
+		fclose(in);
+		// the readers should agree exactly, but for float rounding
+		float maxDiff = 0;
+		bool same = points[0].size() == points[1].size() && normals[0].size() == normals[1].size() &&
+					uvs[0].size() == uvs[1].size() && triangles[0].size() == triangles[1].size() && groups[0] == groups[1];
+		for (size_t i = 0; same && i < points[0].size(); i++)
+			for (int k = 0; k < 3; k++)
+				maxDiff = std::max(maxDiff, fabsf(points[0][i][k]-points[1][i][k])/std::max(1.f, fabsf(points[0][i][k])));
+		for (size_t i = 0; same && i < triangles[0].size(); i++)
+			same = triangles[0][i].i1 == triangles[1][i].i1 && triangles[0][i].i2 == triangles[1][i].i2 && triangles[0][i].i3 == triangles[1][i].i3;
+		printf("%s: %.1f MB, %d points, %d triangles\n", objFilenames[f], mb, (int) points[1].size(), (int) triangles[1].size());
+		printf("  line by line %.1f ms (%.1f MB/s), mapped %.1f ms (%.1f MB/s), %.1fx; %s, max relative point difference %g\n",
+			best[0], mb/best[0]*1000, best[1], mb/best[1]*1000, best[0]/best[1], same? "same mesh" : "MESHES DIFFER", maxDiff);
+		totalMB += mb;
+		totalOld += best[0];
+		totalNew += best[1];
+	}
+	if (totalNew > 0)
+		printf("total %.1f MB: line by line %.1f ms, mapped %.1f ms, %.1fx\n", totalMB, totalOld, totalNew, totalOld/totalNew);
+}
+
 bool WriteAsciiObj(const char *filename, vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> *triangles, vector<int4> *quads) {
 	FILE *file = fopen(filename, "w");
 	if (!file) {
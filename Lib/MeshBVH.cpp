@@ -0,0 +1,573 @@
+// MeshBVH.cpp - bounding volume hierarchy for line queries against triangle meshes
+
+#include "MeshBVH.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <float.h>
+#include <stdio.h>
+#include <thread>
+#include <emmintrin.h>
+
+// bounds
+
+struct BVHBounds {
+	vec3 min, max;
+	BVHBounds() : min(FLT_MAX), max(-FLT_MAX) { }
+	void Grow(const vec3 &p) {
+		min = vec3(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+		max = vec3(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+	}
+	void Grow(const BVHBounds &b) {
+		// an empty b (min > max) leaves this unchanged
+		min = vec3(std::min(min.x, b.min.x), std::min(min.y, b.min.y), std::min(min.z, b.min.z));
+		max = vec3(std::max(max.x, b.max.x), std::max(max.y, b.max.y), std::max(max.z, b.max.z));
+	}
+	float HalfArea() const {
+		vec3 d = max-min;
+		return d.x < 0? 0 : d.x*d.y+d.y*d.z+d.z*d.x;
+	}
+};
+
+static BVHTriangle MakeTriangle(vector<vec3> &points, int3 &t) {
+	BVHTriangle tri;
+	tri.v0 = points[t.i1];
+	tri.e1 = points[t.i2]-tri.v0;
+	tri.e2 = points[t.i3]-tri.v0;
+	return tri;
+}
+
+// build
+
+struct BVHBuilder {
+	// binned SAH (Wald 2007): triangles are sorted into bins by centroid, and the best split between bins is
+	// the one with least (area x triangles) on either side
+	static const int NBins = 16;
+	static const int ParallelSize = 4096;	// subtrees with more triangles may be built on another thread
+	MeshBVH &bvh;
+	vector<BVHBounds> triBounds;
+	vector<vec3> centroids;
+	vector<int> order;						// mesh triangle ids, partitioned in place as nodes are split
+	std::atomic<int> nodesUsed, threadsLeft, depth;
+	BVHBuilder(MeshBVH &bvh) : bvh(bvh), nodesUsed(0), threadsLeft(0), depth(0) { }
+	void Subdivide(int nodeId, int first, int count, int level) {
+		BVHNode &node = bvh.nodes[nodeId];
+		BVHBounds bounds, centroidBounds;
+		for (int i = first; i < first+count; i++) {
+			bounds.Grow(triBounds[order[i]]);
+			centroidBounds.Grow(centroids[order[i]]);
+		}
+		node.min = bounds.min;
+		node.max = bounds.max;
+		node.first = first;
+		node.count = count;
+		int d = level+1;
+		for (int prev = depth; prev < d && !depth.compare_exchange_weak(prev, d); )
+			;
+		if (count == 1 || level >= MeshBVH::MaxDepth-2)
+			return;
+		// find least cost split
+		float bestCost = FLT_MAX;
+		int bestAxis = -1, bestSplit = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			float lo = centroidBounds.min[axis], extent = centroidBounds.max[axis]-lo;
+			if (extent <= 0)
+				continue;
+			float scale = NBins/extent;
+			BVHBounds binBounds[NBins];
+			int binCounts[NBins] = {0};
+			for (int i = first; i < first+count; i++) {
+				int t = order[i], b = std::min(NBins-1, (int) ((centroids[t][axis]-lo)*scale));
+				binCounts[b]++;
+				binBounds[b].Grow(triBounds[t]);
+			}
+			// sweep from the left and from the right, for the cost of each split between bins
+			float leftArea[NBins-1];
+			int leftCount[NBins-1];
+			BVHBounds left, right;
+			for (int i = 0, n = 0; i < NBins-1; i++) {
+				left.Grow(binBounds[i]);
+				leftArea[i] = left.HalfArea();
+				leftCount[i] = n += binCounts[i];
+			}
+			for (int i = NBins-1, n = 0; i > 0; i--) {
+				right.Grow(binBounds[i]);
+				n += binCounts[i];
+				int nLeft = leftCount[i-1];
+				if (!nLeft || !n)
+					continue;
+				float cost = nLeft*leftArea[i-1]+n*right.HalfArea();
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = i;
+				}
+			}
+		}
+		// split if cheaper than intersecting every triangle, with traversal as costly as one intersection
+		float leafCost = (float) count, splitCost = 1+bestCost/bounds.HalfArea();
+		if (bestAxis < 0 || (splitCost >= leafCost && count <= MeshBVH::MaxLeafSize))
+			return;
+		float lo = centroidBounds.min[bestAxis], scale = NBins/(centroidBounds.max[bestAxis]-lo);
+		int *mid = std::partition(&order[first], &order[first]+count, [&](int t) {
+			return std::min(NBins-1, (int) ((centroids[t][bestAxis]-lo)*scale)) < bestSplit;
+		});
+		int nLeft = (int) (mid-&order[first]);
+		int leftId = nodesUsed.fetch_add(2);
+		node.first = leftId;
+		node.count = -1-bestAxis;
+		// large subtrees are built in parallel, each thread writes only its own nodes
+		if (count > ParallelSize && threadsLeft.fetch_sub(1) > 0) {
+			std::thread thread(&BVHBuilder::Subdivide, this, leftId, first, nLeft, level+1);
+			Subdivide(leftId+1, first+nLeft, count-nLeft, level+1);
+			thread.join();
+			threadsLeft++;
+		}
+		else {
+			if (count > ParallelSize)
+				threadsLeft++;
+			Subdivide(leftId, first, nLeft, level+1);
+			Subdivide(leftId+1, first+nLeft, count-nLeft, level+1);
+		}
+	}
+};
+
+void MeshBVH::Build(vector<vec3> &points, vector<int3> &triangles, int nThreads) {
+	int nTris = (int) triangles.size();
+	nodes.resize(0);
+	tris.resize(0);
+	vids.resize(0);
+	triIds.resize(0);
+	depth = 0;
+	if (!nTris)
+		return;
+	BVHBuilder builder(*this);
+	builder.triBounds.resize(nTris);
+	builder.centroids.resize(nTris);
+	builder.order.resize(nTris);
+	for (int i = 0; i < nTris; i++) {
+		int3 &t = triangles[i];
+		BVHBounds &b = builder.triBounds[i];
+		b.Grow(points[t.i1]);
+		b.Grow(points[t.i2]);
+		b.Grow(points[t.i3]);
+		builder.centroids[i] = (points[t.i1]+points[t.i2]+points[t.i3])/3;
+		builder.order[i] = i;
+	}
+	// at most 2n-1 nodes; preallocated so threads can claim nodes without locking
+	nodes.resize(2*nTris);
+	builder.nodesUsed = 1;
+	builder.threadsLeft = (nThreads > 0? nThreads : std::max(1, (int) std::thread::hardware_concurrency()))-1;
+	builder.Subdivide(0, 0, nTris, 0);
+	nodes.resize(builder.nodesUsed);
+	depth = builder.depth;
+	// store triangles in tree order, so leaves reference contiguous triangles
+	tris.resize(nTris);
+	vids.resize(nTris);
+	triIds.resize(nTris);
+	for (int i = 0; i < nTris; i++) {
+		int t = builder.order[i];
+		vids[i] = triangles[t];
+		triIds[i] = t;
+		tris[i] = MakeTriangle(points, triangles[t]);
+	}
+}
+
+void MeshBVH::Refit(vector<vec3> &points) {
+	for (size_t i = 0; i < tris.size(); i++)
+		tris[i] = MakeTriangle(points, vids[i]);
+	// children are allocated after their parent, so a reverse pass updates children first
+	for (int n = (int) nodes.size()-1; n >= 0; n--) {
+		BVHNode &node = nodes[n];
+		BVHBounds b;
+		if (node.IsLeaf())
+			for (int i = node.first; i < node.first+node.count; i++) {
+				int3 &t = vids[i];
+				b.Grow(points[t.i1]);
+				b.Grow(points[t.i2]);
+				b.Grow(points[t.i3]);
+			}
+		else {
+			BVHNode &left = nodes[node.first], &right = nodes[node.first+1];
+			b.Grow(left.min);
+			b.Grow(left.max);
+			b.Grow(right.min);
+			b.Grow(right.max);
+		}
+		node.min = b.min;
+		node.max = b.max;
+	}
+}
+
+// single line traversal
+
+static inline float HitBox(const BVHNode &n, const vec3 &o, const vec3 &inv, float tMax) {
+	// return entry alpha of line o+alpha*d (inv = 1/d) into node bounds, or FLT_MAX if missed before tMax
+	float x1 = (n.min.x-o.x)*inv.x, x2 = (n.max.x-o.x)*inv.x;
+	float y1 = (n.min.y-o.y)*inv.y, y2 = (n.max.y-o.y)*inv.y;
+	float z1 = (n.min.z-o.z)*inv.z, z2 = (n.max.z-o.z)*inv.z;
+	float tNear = std::max(std::max(std::min(x1, x2), std::min(y1, y2)), std::max(std::min(z1, z2), 0.f));
+	float tFar = std::min(std::min(std::max(x1, x2), std::max(y1, y2)), std::min(std::max(z1, z2), tMax));
+	return tNear <= tFar? tNear : FLT_MAX;
+}
+
+static inline bool HitTriangle(const BVHTriangle &t, const vec3 &o, const vec3 &d, float &alpha) {
+	// Moller-Trumbore: solve o+alpha*d = v0+u*e1+v*e2, hit if u, v inside triangle; either side
+	vec3 p = cross(d, t.e2);
+	float det = dot(t.e1, p);
+	if (det > -FLT_MIN && det < FLT_MIN)
+		return false;
+	float inv = 1/det;
+	vec3 s = o-t.v0;
+	float u = dot(s, p)*inv;
+	if (u < 0 || u > 1)
+		return false;
+	vec3 q = cross(s, t.e1);
+	float v = dot(d, q)*inv;
+	if (v < 0 || u+v > 1)
+		return false;
+	alpha = dot(t.e2, q)*inv;
+	return true;
+}
+
+struct StackEntry {
+	const BVHNode *node;
+	float alpha;		// entry alpha, so nodes beyond a nearer hit are skipped
+};
+
+int MeshBVH::IntersectWithLine(vec3 p1, vec3 p2, float &alpha) const {
+	alpha = FLT_MAX;
+	if (nodes.empty())
+		return -1;
+	vec3 d = p2-p1, inv(1/d.x, 1/d.y, 1/d.z);
+	float tMax = 1;
+	int hit = -1;
+	StackEntry stack[MaxDepth];
+	int sp = 0;
+	const BVHNode *node = HitBox(nodes[0], p1, inv, tMax) < FLT_MAX? &nodes[0] : NULL;
+	while (node) {
+		if (node->IsLeaf()) {
+			for (int i = node->first; i < node->first+node->count; i++) {
+				float a;
+				if (HitTriangle(tris[i], p1, d, a) && a >= 0 && a <= tMax) {
+					tMax = a;
+					hit = i;
+				}
+			}
+		}
+		else {
+			// visit the nearer child first, the farther one may then be skipped
+			const BVHNode *c1 = &nodes[node->first], *c2 = c1+1;
+			float a1 = HitBox(*c1, p1, inv, tMax), a2 = HitBox(*c2, p1, inv, tMax);
+			if (a1 > a2) {
+				std::swap(c1, c2);
+				std::swap(a1, a2);
+			}
+			if (a1 < FLT_MAX) {
+				if (a2 < FLT_MAX)
+					stack[sp++] = {c2, a2};
+				node = c1;
+				continue;
+			}
+		}
+		for (node = NULL; sp > 0 && !node; )
+			if (stack[--sp].alpha <= tMax)
+				node = stack[sp].node;
+	}
+	if (hit < 0)
+		return -1;
+	alpha = tMax;
+	return triIds[hit];
+}
+
+bool MeshBVH::AnyIntersection(vec3 p1, vec3 p2) const {
+	if (nodes.empty())
+		return false;
+	vec3 d = p2-p1, inv(1/d.x, 1/d.y, 1/d.z);
+	const BVHNode *stack[MaxDepth+1];
+	int sp = 0;
+	stack[sp++] = &nodes[0];
+	while (sp > 0) {
+		const BVHNode *node = stack[--sp];
+		if (HitBox(*node, p1, inv, 1) == FLT_MAX)
+			continue;
+		if (node->IsLeaf()) {
+			for (int i = node->first; i < node->first+node->count; i++) {
+				float a;
+				if (HitTriangle(tris[i], p1, d, a) && a >= 0 && a <= 1)
+					return true;
+			}
+		}
+		else {
+			stack[sp++] = &nodes[node->first+1];
+			stack[sp++] = &nodes[node->first];
+		}
+	}
+	return false;
+}
+
+int MeshBVH::AllIntersections(vec3 p1, vec3 p2, vector<BVHHit> &hits) const {
+	hits.resize(0);
+	if (nodes.empty())
+		return 0;
+	vec3 d = p2-p1, inv(1/d.x, 1/d.y, 1/d.z);
+	const BVHNode *stack[MaxDepth+1];
+	int sp = 0;
+	stack[sp++] = &nodes[0];
+	while (sp > 0) {
+		const BVHNode *node = stack[--sp];
+		if (HitBox(*node, p1, inv, 1) == FLT_MAX)
+			continue;
+		if (node->IsLeaf()) {
+			for (int i = node->first; i < node->first+node->count; i++) {
+				float a;
+				if (HitTriangle(tris[i], p1, d, a) && a >= 0 && a <= 1)
+					hits.push_back(BVHHit(triIds[i], a));
+			}
+		}
+		else {
+			stack[sp++] = &nodes[node->first+1];
+			stack[sp++] = &nodes[node->first];
+		}
+	}
+	std::sort(hits.begin(), hits.end(), [](const BVHHit &a, const BVHHit &b) { return a.alpha < b.alpha; });
+	return (int) hits.size();
+}
+
+int IntersectWithLine(vec3 p1, vec3 p2, MeshBVH &bvh, float &alpha) {
+	return bvh.IntersectWithLine(p1, p2, alpha);
+}
+
+// packet traversal: four lines at once in SSE registers, one line per lane
+
+struct LinePacket {
+	__m128 ox, oy, oz, dx, dy, dz, ix, iy, iz;
+	__m128 tMax;		// nearest hit so far, -1 for unused lanes so they never hit
+	__m128i hit;		// tree-order triangle of nearest hit, or -1
+};
+
+static inline bool PacketHitsBox(const BVHNode &n, const LinePacket &p) {
+	__m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.min.x), p.ox), p.ix), x2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.max.x), p.ox), p.ix);
+	__m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.min.y), p.oy), p.iy), y2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.max.y), p.oy), p.iy);
+	__m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.min.z), p.oz), p.iz), z2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.max.z), p.oz), p.iz);
+	__m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(x1, x2), _mm_min_ps(y1, y2)), _mm_max_ps(_mm_min_ps(z1, z2), _mm_setzero_ps()));
+	__m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(x1, x2), _mm_max_ps(y1, y2)), _mm_min_ps(_mm_max_ps(z1, z2), p.tMax));
+	return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar)) != 0;
+}
+
+static inline void PacketHitTriangle(const BVHTriangle &t, int id, LinePacket &p) {
+	__m128 e1x = _mm_set1_ps(t.e1.x), e1y = _mm_set1_ps(t.e1.y), e1z = _mm_set1_ps(t.e1.z);
+	__m128 e2x = _mm_set1_ps(t.e2.x), e2y = _mm_set1_ps(t.e2.y), e2z = _mm_set1_ps(t.e2.z);
+	// p = cross(d, e2), det = dot(e1, p)
+	__m128 px = _mm_sub_ps(_mm_mul_ps(p.dy, e2z), _mm_mul_ps(p.dz, e2y));
+	__m128 py = _mm_sub_ps(_mm_mul_ps(p.dz, e2x), _mm_mul_ps(p.dx, e2z));
+	__m128 pz = _mm_sub_ps(_mm_mul_ps(p.dx, e2y), _mm_mul_ps(p.dy, e2x));
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	__m128 inv = _mm_div_ps(_mm_set1_ps(1), det);
+	// s = o-v0, u = dot(s, p)/det
+	__m128 sx = _mm_sub_ps(p.ox, _mm_set1_ps(t.v0.x)), sy = _mm_sub_ps(p.oy, _mm_set1_ps(t.v0.y)), sz = _mm_sub_ps(p.oz, _mm_set1_ps(t.v0.z));
+	__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv);
+	// q = cross(s, e1), v = dot(d, q)/det, alpha = dot(e2, q)/det
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+	__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(p.dx, qx), _mm_mul_ps(p.dy, qy)), _mm_mul_ps(p.dz, qz)), inv);
+	__m128 a = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv);
+	// comparisons with NaN (from det = 0) are false, so parallel lines miss
+	__m128 zero = _mm_setzero_ps();
+	__m128 mask = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero));
+	mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1)));
+	mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(a, zero), _mm_cmple_ps(a, p.tMax)));
+	mask = _mm_and_ps(mask, _mm_cmpneq_ps(det, zero));
+	p.tMax = _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, p.tMax));
+	__m128i m = _mm_castps_si128(mask);
+	p.hit = _mm_or_si128(_mm_and_si128(m, _mm_set1_epi32(id)), _mm_andnot_si128(m, p.hit));
+}
+
+void MeshBVH::IntersectWithLines(int n, const vec3 *p1s, const vec3 *p2s, int *triangles, float *alphas) const {
+	for (int base = 0; base < n; base += 4) {
+		int m = std::min(4, n-base);
+		alignas(16) float ox[4], oy[4], oz[4], dx[4], dy[4], dz[4], tMax[4];
+		for (int k = 0; k < 4; k++) {
+			int i = base+(k < m? k : 0);		// pad a short last packet with its first line
+			vec3 d = p2s[i]-p1s[i];
+			ox[k] = p1s[i].x; oy[k] = p1s[i].y; oz[k] = p1s[i].z;
+			dx[k] = d.x; dy[k] = d.y; dz[k] = d.z;
+			tMax[k] = k < m? 1.f : -1.f;
+		}
+		LinePacket p;
+		p.ox = _mm_load_ps(ox); p.oy = _mm_load_ps(oy); p.oz = _mm_load_ps(oz);
+		p.dx = _mm_load_ps(dx); p.dy = _mm_load_ps(dy); p.dz = _mm_load_ps(dz);
+		__m128 one = _mm_set1_ps(1);
+		p.ix = _mm_div_ps(one, p.dx); p.iy = _mm_div_ps(one, p.dy); p.iz = _mm_div_ps(one, p.dz);
+		p.tMax = _mm_load_ps(tMax);
+		p.hit = _mm_set1_epi32(-1);
+		if (!nodes.empty()) {
+			const BVHNode *stack[MaxDepth+1];
+			int sp = 0;
+			stack[sp++] = &nodes[0];
+			while (sp > 0) {
+				const BVHNode *node = stack[--sp];
+				if (!PacketHitsBox(*node, p))
+					continue;
+				if (node->IsLeaf())
+					for (int i = node->first; i < node->first+node->count; i++)
+						PacketHitTriangle(tris[i], i, p);
+				else {
+					// coherent lines share direction signs, so the first line orders the children for all
+					int axis = -1-node->count;
+					bool leftFirst = (axis == 0? dx[0] : axis == 1? dy[0] : dz[0]) >= 0;
+					stack[sp++] = &nodes[node->first+(leftFirst? 1 : 0)];
+					stack[sp++] = &nodes[node->first+(leftFirst? 0 : 1)];
+				}
+			}
+		}
+		alignas(16) int hit[4];
+		_mm_store_ps(tMax, p.tMax);
+		_mm_store_si128((__m128i *) hit, p.hit);
+		for (int k = 0; k < m; k++) {
+			triangles[base+k] = hit[k] < 0? -1 : triIds[hit[k]];
+			alphas[base+k] = hit[k] < 0? FLT_MAX : tMax[k];
+		}
+	}
+}
+
+// benchmark
+
+static float Random(unsigned int &seed) {
+	// return pseudo-random float in [-1, 1)
+	seed = seed*1664525u+1013904223u;
+	return (seed >> 8)*(2.f/16777216.f)-1;
+}
+
+static vec3 RandomDirection(unsigned int &seed) {
+	for (;;) {
+		vec3 v(Random(seed), Random(seed), Random(seed));
+		float d = dot(v, v);
+		if (d > .01f && d <= 1)
+			return v/sqrt(d);
+	}
+}
+
+static double Microseconds(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now()-start).count();
+}
+
+static bool SameHit(int t1, float a1, int t2, float a2) {
+	// ties between triangles at the same alpha may be broken either way
+	return t1 == t2 || (t1 >= 0 && t2 >= 0 && fabs(a1-a2) < 1e-5f);
+}
+
+void MeshBVHBenchmark(const char **objFilenames, int nFiles, int nLines) {
+	typedef std::chrono::steady_clock Clock;
+	int nThreads = std::max(1, (int) std::thread::hardware_concurrency());
+	printf("BVH benchmark: %i lines per model, %i hardware threads\n", nLines, nThreads);
+	for (int f = 0; f < nFiles; f++) {
+		vector<vec3> points;
+		vector<int3> triangles;
+		if (!ReadAsciiObj(objFilenames[f], points, triangles) || triangles.empty()) {
+			printf("%s: can't read\n", objFilenames[f]);
+			continue;
+		}
+		int nTris = (int) triangles.size();
+		vector<TriInfo> triInfos;
+		BuildTriInfos(points, triangles, triInfos);
+		// builds
+		MeshBVH bvh;
+		Clock::time_point start = Clock::now();
+		bvh.Build(points, triangles, 1);
+		double buildSerial = Microseconds(start);
+		start = Clock::now();
+		bvh.Build(points, triangles, nThreads);
+		double buildParallel = Microseconds(start);
+		// random lines through the model, with ends outside its bounds so every hit is on the segment
+		vec3 min(FLT_MAX), max(-FLT_MAX);
+		for (size_t i = 0; i < points.size(); i++)
+			for (int k = 0; k < 3; k++) {
+				min[k] = std::min(min[k], points[i][k]);
+				max[k] = std::max(max[k], points[i][k]);
+			}
+		vec3 center = (min+max)/2;
+		float radius = 1.1f*length(max-min)/2;
+		unsigned int seed = 1;
+		vector<vec3> p1s(nLines), p2s(nLines);
+		for (int i = 0; i < nLines; i++) {
+			p1s[i] = center+radius*RandomDirection(seed);
+			p2s[i] = center+radius*RandomDirection(seed);
+		}
+		// linear, on as many lines as take about as long as the BVH on all of them would at 1000x speedup
+		int nLinear = std::max(1, std::min(nLines, 200000000/nTris));
+		vector<int> linearHits(nLinear);
+		vector<float> linearAlphas(nLinear);
+		start = Clock::now();
+		for (int i = 0; i < nLinear; i++)
+			linearHits[i] = IntersectWithLine(p1s[i], p2s[i], triInfos, linearAlphas[i]);
+		double linear = Microseconds(start)/nLinear;
+		// closest, any and all hits
+		vector<int> hits(nLines);
+		vector<float> alphas(nLines);
+		start = Clock::now();
+		for (int i = 0; i < nLines; i++)
+			hits[i] = bvh.IntersectWithLine(p1s[i], p2s[i], alphas[i]);
+		double closest = Microseconds(start)/nLines;
+		int agree = 0, nHit = 0, nAny = 0, nAll = 0;
+		for (int i = 0; i < nLinear; i++)
+			agree += SameHit(linearHits[i], linearAlphas[i], hits[i], alphas[i]);
+		start = Clock::now();
+		for (int i = 0; i < nLines; i++)
+			nAny += bvh.AnyIntersection(p1s[i], p2s[i]);
+		double any = Microseconds(start)/nLines;
+		vector<BVHHit> all;
+		start = Clock::now();
+		for (int i = 0; i < nLines; i++)
+			nAll += bvh.AllIntersections(p1s[i], p2s[i], all);
+		double multi = Microseconds(start)/nLines;
+		for (int i = 0; i < nLines; i++)
+			nHit += hits[i] >= 0;
+		// camera lines through a grid of pixels, in 2x2 pixel packets
+		int res = std::max(2, 2*(int) (sqrt((double) nLines)/2));
+		vec3 eye = center+3*radius*normalize(vec3(.3f, .4f, 1)), look = normalize(center-eye);
+		vec3 right = normalize(cross(look, vec3(0, 1, 0))), up = cross(right, look);
+		vector<vec3> eyes(res*res, eye), ends(res*res);
+		for (int y = 0, i = 0; y < res; y += 2)
+			for (int x = 0; x < res; x += 2)
+				for (int k = 0; k < 4; k++, i++) {
+					float s = 2.f*(x+(k&1)+.5f)/res-1, t = 2.f*(y+(k>>1)+.5f)/res-1;
+					ends[i] = eye+6*radius*normalize(look+.4f*(s*right+t*up));
+				}
+		int nCamera = res*res;
+		vector<int> singleHits(nCamera), packetHits(nCamera);
+		vector<float> singleAlphas(nCamera), packetAlphas(nCamera);
+		start = Clock::now();
+		for (int i = 0; i < nCamera; i++)
+			singleHits[i] = bvh.IntersectWithLine(eyes[i], ends[i], singleAlphas[i]);
+		double single = Microseconds(start)/nCamera;
+		start = Clock::now();
+		bvh.IntersectWithLines(nCamera, eyes.data(), ends.data(), packetHits.data(), packetAlphas.data());
+		double packet = Microseconds(start)/nCamera;
+		int packetAgree = 0;
+		for (int i = 0; i < nCamera; i++)
+			packetAgree += SameHit(singleHits[i], singleAlphas[i], packetHits[i], packetAlphas[i]);
+		// refit to slightly moved points, and query the refit tree
+		vector<vec3> moved(points);
+		for (size_t i = 0; i < moved.size(); i++)
+			moved[i] += (.01f*radius)*vec3(Random(seed), Random(seed), Random(seed));
+		start = Clock::now();
+		bvh.Refit(moved);
+		double refit = Microseconds(start);
+		float a;
+		start = Clock::now();
+		for (int i = 0; i < nLines; i++)
+			bvh.IntersectWithLine(p1s[i], p2s[i], a);
+		double refitClosest = Microseconds(start)/nLines;
+		printf("%s\n", objFilenames[f]);
+		printf("  %i triangles, %i nodes, depth %i; build %.1f ms (1 thread), %.1f ms (%i threads); refit %.2f ms\n",
+			nTris, bvh.NodeCount(), bvh.Depth(), buildSerial/1000, buildParallel/1000, nThreads, refit/1000);
+		printf("  random lines (%i%% hit): linear %.1f us, bvh %.3f us (%.0fx), %.3f us after refit; %i/%i agree with linear\n",
+			100*nHit/nLines, linear, closest, linear/closest, refitClosest, agree, nLinear);
+		printf("  any-hit %.3f us (%i%% hit), all-hits %.3f us (%.2f hits per line)\n",
+			any, 100*nAny/nLines, multi, (float) nAll/nLines);
+		printf("  camera lines: single %.3f us, packets of 4 %.3f us (%.1fx); %i/%i agree\n",
+			single, packet, single/packet, packetAgree, nCamera);
+	}
+}
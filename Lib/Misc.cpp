@@ -1,12 +1,31 @@
 // Misc.cpp
 
+#include "MappedFile.h"		// before glad.h, which includes windows.h unless APIENTRY is defined
 #include <glad.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <stdio.h>
 #include <float.h>
 #include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
 #include "Draw.h"
 #include "Misc.h"
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	#define IMAGE_X86
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#define IMAGE_TARGET(isa)
+	#else
+		#include <cpuid.h>
+		#define IMAGE_TARGET(isa) __attribute__((target(isa)))
+	#endif
+#endif
+
 // Sphere
 
 int LineSphere(vec3 ln1, vec3 ln2, vec3 center, float radius, vec3 &p1, vec3 &p2) {
@@ -34,10 +53,398 @@ float RaySphere(vec3 base, vec3 v, vec3 center, float radius) {
 	return a > 0? a : -vDot+root;
 }
 
+// Image Kernels
+
+static ImageSimd imageSimdLimit = ImageAVX2;
+static int imageThreads = 0;
+
+static ImageSimd ImageSimdSupported() {
+	// best instruction set of the CPU (and, for AVX2, the OS)
+	static int supported = -1;
+	if (supported < 0) {
+		supported = ImageScalar;
+#ifdef IMAGE_X86
+		unsigned int r1[4] = {0, 0, 0, 0}, r7[4] = {0, 0, 0, 0};
+		unsigned long long xcr0 = 0;
+#ifdef _MSC_VER
+		int r[4];
+		__cpuid(r, 0);
+		int maxLeaf = r[0];
+		__cpuid(r, 1);
+		memcpy(r1, r, sizeof(r));
+		if (maxLeaf >= 7) {
+			__cpuidex(r, 7, 0);
+			memcpy(r7, r, sizeof(r));
+		}
+		if (r1[2] & (1 << 27))
+			xcr0 = _xgetbv(0);
+#else
+		__get_cpuid(1, &r1[0], &r1[1], &r1[2], &r1[3]);
+		__get_cpuid_count(7, 0, &r7[0], &r7[1], &r7[2], &r7[3]);
+		if (r1[2] & (1 << 27)) {
+			unsigned int lo, hi;
+			__asm__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+			xcr0 = ((unsigned long long) hi << 32) | lo;
+		}
+#endif
+		bool ssse3 = (r1[2] & (1 << 9)) != 0;
+		bool avx2 = (r1[2] & (1 << 28)) && (r7[1] & (1 << 5)) && (xcr0 & 6) == 6;	// AVX, AVX2, and OS saves ymm
+		supported = avx2 && ssse3? ImageAVX2 : ssse3? ImageSSE : ImageScalar;
+#endif
+	}
+	return (ImageSimd) supported;
+}
+
+ImageSimd SetImageSimd(ImageSimd level) {
+	imageSimdLimit = level;
+	return ImageSimdSupported();
+}
+
+void SetImageThreads(int nThreads) {
+	imageThreads = nThreads;
+}
+
+static ImageSimd ImageSimdLevel() {
+	ImageSimd supported = ImageSimdSupported();
+	return supported < imageSimdLimit? supported : imageSimdLimit;
+}
+
+template <typename Function>
+static void ParallelBands(size_t n, size_t bandSize, Function f) {
+	// call f(begin, end) for bands of [0, n), spread over threads
+	size_t nBands = (n+bandSize-1)/bandSize;
+	int nThreads = imageThreads > 0? imageThreads : std::max(1, (int) std::thread::hardware_concurrency());
+	std::atomic<size_t> next(0);
+	auto run = [&]() {
+		for (size_t b; (b = next++) < nBands; )
+			f(b*bandSize, std::min(n, (b+1)*bandSize));
+	};
+	std::vector<std::thread> threads;
+	for (size_t t = 1; t < std::min(nBands, (size_t) nThreads); t++)
+		threads.push_back(std::thread(run));
+	run();
+	for (std::thread &t : threads)
+		t.join();
+}
+
+// normals
+
+static inline void NormalPixel(float zx, float zy, float dx, float dy, unsigned char *out) {
+	// normalized cross((dx, 0, zx), (0, dy, zy)) as RGB, rounded as GetNormals always has
+	float x = 0*zy-zx*dy, y = zx*0-dx*zy, z = dx*dy;
+	float len = sqrt(x*x+y*y+z*z);
+	if (len > 0) {
+		float r = 1.f/len;
+		x *= r;
+		y *= r;
+		z *= r;
+	}
+	else
+		z = 1;
+	out[0] = (unsigned char) (127.5f*(x+1));
+	out[1] = (unsigned char) (127.5f*(y+1));
+	out[2] = (unsigned char) (255.f*z);
+}
+
+static inline void Slopes(const float *p, const float *c, const float *n, int i, bool sobel, float &zx, float &zy) {
+	// height differences across pixel i of row c, between rows p and n
+	if (sobel) {
+		zx = ((p[i+1]+2*c[i+1]+n[i+1])-(p[i-1]+2*c[i-1]+n[i-1]))*.25f;
+		zy = ((n[i-1]+2*n[i]+n[i+1])-(p[i-1]+2*p[i]+p[i+1]))*.25f;
+	}
+	else {
+		zx = c[i+1]-c[i-1];
+		zy = n[i]-p[i];
+	}
+}
+
+static void NormalRowScalar(const float *p, const float *c, const float *n, int i0, int i1, float dx, float dy, bool sobel, unsigned char *out) {
+	for (int i = i0; i < i1; i++) {
+		float zx, zy;
+		Slopes(p, c, n, i, sobel, zx, zy);
+		NormalPixel(zx, zy, dx, dy, out+3*i);
+	}
+}
+
+#ifdef IMAGE_X86
+
+IMAGE_TARGET("ssse3")
+static inline void StoreRGB4(__m128i r, __m128i g, __m128i b, unsigned char *out) {
+	// interleave four pixels of 32-bit channels (0-255) into 12 bytes
+	__m128i bytes = _mm_packus_epi16(_mm_packs_epi32(r, g), _mm_packs_epi32(b, _mm_setzero_si128()));
+	__m128i rgb = _mm_shuffle_epi8(bytes, _mm_setr_epi8(0, 4, 8, 1, 5, 9, 2, 6, 10, 3, 7, 11, -1, -1, -1, -1));
+	_mm_storel_epi64((__m128i *) out, rgb);
+	int last = _mm_cvtsi128_si32(_mm_srli_si128(rgb, 8));
+	memcpy(out+8, &last, 4);
+}
+
+IMAGE_TARGET("ssse3")
+static int NormalRowSSE(const float *p, const float *c, const float *n, int width, float dx, float dy, bool sobel, unsigned char *out) {
+	// as NormalRowScalar, four pixels at a time; return # pixels done
+	__m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1), half255 = _mm_set1_ps(127.5f), full255 = _mm_set1_ps(255);
+	__m128 vdx = _mm_set1_ps(dx), vdy = _mm_set1_ps(dy), quarter = _mm_set1_ps(.25f), z = _mm_set1_ps(dx*dy);
+	int i = 0;
+	for (; i+4 <= width; i += 4) {
+		__m128 zx, zy;
+		if (sobel) {
+			__m128 pl = _mm_loadu_ps(p+i-1), pc = _mm_loadu_ps(p+i), pr = _mm_loadu_ps(p+i+1);
+			__m128 cl = _mm_loadu_ps(c+i-1), cr = _mm_loadu_ps(c+i+1);
+			__m128 nl = _mm_loadu_ps(n+i-1), nc = _mm_loadu_ps(n+i), nr = _mm_loadu_ps(n+i+1);
+			zx = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(_mm_add_ps(pr, _mm_add_ps(cr, cr)), nr), _mm_add_ps(_mm_add_ps(pl, _mm_add_ps(cl, cl)), nl)), quarter);
+			zy = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(_mm_add_ps(nl, _mm_add_ps(nc, nc)), nr), _mm_add_ps(_mm_add_ps(pl, _mm_add_ps(pc, pc)), pr)), quarter);
+		}
+		else {
+			zx = _mm_sub_ps(_mm_loadu_ps(c+i+1), _mm_loadu_ps(c+i-1));
+			zy = _mm_sub_ps(_mm_loadu_ps(n+i), _mm_loadu_ps(p+i));
+		}
+		__m128 x = _mm_sub_ps(zero, _mm_mul_ps(zx, vdy)), y = _mm_sub_ps(zero, _mm_mul_ps(vdx, zy));
+		__m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+		__m128 r = _mm_div_ps(one, len);
+		__m128i red = _mm_cvttps_epi32(_mm_mul_ps(half255, _mm_add_ps(_mm_mul_ps(x, r), one)));
+		__m128i grn = _mm_cvttps_epi32(_mm_mul_ps(half255, _mm_add_ps(_mm_mul_ps(y, r), one)));
+		__m128i blu = _mm_cvttps_epi32(_mm_mul_ps(full255, _mm_mul_ps(z, r)));
+		StoreRGB4(red, grn, blu, out+3*i);
+	}
+	return i;
+}
+
+IMAGE_TARGET("avx2")
+static int NormalRowAVX2(const float *p, const float *c, const float *n, int width, float dx, float dy, bool sobel, unsigned char *out) {
+	// as NormalRowSSE, eight pixels at a time
+	__m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1), half255 = _mm256_set1_ps(127.5f), full255 = _mm256_set1_ps(255);
+	__m256 vdx = _mm256_set1_ps(dx), vdy = _mm256_set1_ps(dy), quarter = _mm256_set1_ps(.25f), z = _mm256_set1_ps(dx*dy);
+	int i = 0;
+	for (; i+8 <= width; i += 8) {
+		__m256 zx, zy;
+		if (sobel) {
+			__m256 pl = _mm256_loadu_ps(p+i-1), pc = _mm256_loadu_ps(p+i), pr = _mm256_loadu_ps(p+i+1);
+			__m256 cl = _mm256_loadu_ps(c+i-1), cr = _mm256_loadu_ps(c+i+1);
+			__m256 nl = _mm256_loadu_ps(n+i-1), nc = _mm256_loadu_ps(n+i), nr = _mm256_loadu_ps(n+i+1);
+			zx = _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(pr, _mm256_add_ps(cr, cr)), nr), _mm256_add_ps(_mm256_add_ps(pl, _mm256_add_ps(cl, cl)), nl)), quarter);
+			zy = _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(nl, _mm256_add_ps(nc, nc)), nr), _mm256_add_ps(_mm256_add_ps(pl, _mm256_add_ps(pc, pc)), pr)), quarter);
+		}
+		else {
+			zx = _mm256_sub_ps(_mm256_loadu_ps(c+i+1), _mm256_loadu_ps(c+i-1));
+			zy = _mm256_sub_ps(_mm256_loadu_ps(n+i), _mm256_loadu_ps(p+i));
+		}
+		__m256 x = _mm256_sub_ps(zero, _mm256_mul_ps(zx, vdy)), y = _mm256_sub_ps(zero, _mm256_mul_ps(vdx, zy));
+		__m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z)));
+		__m256 r = _mm256_div_ps(one, len);
+		__m256i red = _mm256_cvttps_epi32(_mm256_mul_ps(half255, _mm256_add_ps(_mm256_mul_ps(x, r), one)));
+		__m256i grn = _mm256_cvttps_epi32(_mm256_mul_ps(half255, _mm256_add_ps(_mm256_mul_ps(y, r), one)));
+		__m256i blu = _mm256_cvttps_epi32(_mm256_mul_ps(full255, _mm256_mul_ps(z, r)));
+		StoreRGB4(_mm256_castsi256_si128(red), _mm256_castsi256_si128(grn), _mm256_castsi256_si128(blu), out+3*i);
+		StoreRGB4(_mm256_extracti128_si256(red, 1), _mm256_extracti128_si256(grn, 1), _mm256_extracti128_si256(blu, 1), out+3*i+12);
+	}
+	return i;
+}
+
+#endif // IMAGE_X86
+
+void HeightToNormals(const unsigned char *heights, int width, int height, int channels, unsigned char *normals, float pixelScale, bool sobel) {
+	ImageSimd simd = ImageSimdLevel();
+	ParallelBands(height, 32, [&](size_t j0, size_t j1) {
+		// heights of three rows as floats, each padded with a copy of its end pixels, so slopes at
+		// the image border are one-sided differences, as in GetNormals
+		std::vector<float> buffer(3*(width+2));
+		auto load = [&](int j, float *row) {
+			j = j < 0? 0 : j >= height? height-1 : j;
+			const unsigned char *h = heights+(size_t) j*width*channels;
+			for (int i = 0; i < width; i++)
+				row[i+1] = ((float) h[(size_t) i*channels])/255.f;
+			row[0] = row[1];
+			row[width+1] = row[width];
+		};
+		float *p = &buffer[0], *c = p+width+2, *n = c+width+2;
+		load((int) j0-1, p);
+		load((int) j0, c);
+		for (int j = (int) j0; j < (int) j1; j++) {
+			load(j+1, n);
+			// interior pixels span two pixels, border pixels one
+			float dx = 2/pixelScale, dy = (float) (std::min(j+1, height-1)-std::max(j-1, 0))/pixelScale;
+			unsigned char *out = normals+(size_t) j*width*3;
+			int done = 0;
+#ifdef IMAGE_X86
+			if (simd == ImageAVX2)
+				done = NormalRowAVX2(p+1, c+1, n+1, width, dx, dy, sobel, out);
+			else if (simd == ImageSSE)
+				done = NormalRowSSE(p+1, c+1, n+1, width, dx, dy, sobel, out);
+#endif
+			NormalRowScalar(p+1, c+1, n+1, done, width, dx, dy, sobel, out);
+			// border columns
+			NormalRowScalar(p+1, c+1, n+1, 0, 1, (float) (std::min(1, width-1))/pixelScale, dy, sobel, out);
+			if (width > 1)
+				NormalRowScalar(p+1, c+1, n+1, width-1, width, 1/pixelScale, dy, sobel, out);
+			std::swap(p, c);
+			std::swap(c, n);
+		}
+	});
+}
+
+// unorm conversion
+
+static void UnormToFloatScalar(const unsigned char *in, float *out, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		out[i] = in[i]*(1.f/255.f);
+}
+
+static void FloatToUnormScalar(const float *in, unsigned char *out, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		float f = in[i] > 0? in[i] : 0;
+		out[i] = (unsigned char) ((f < 1? f : 1)*255.f+.5f);
+	}
+}
+
+#ifdef IMAGE_X86
+
+static size_t UnormToFloatSSE(const unsigned char *in, float *out, size_t n) {
+	__m128 scale = _mm_set1_ps(1.f/255.f);
+	__m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i+16 <= n; i += 16) {
+		__m128i b = _mm_loadu_si128((const __m128i *) (in+i));
+		__m128i lo = _mm_unpacklo_epi8(b, zero), hi = _mm_unpackhi_epi8(b, zero);
+		_mm_storeu_ps(out+i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+		_mm_storeu_ps(out+i+4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+		_mm_storeu_ps(out+i+8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+		_mm_storeu_ps(out+i+12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+	}
+	return i;
+}
+
+static size_t FloatToUnormSSE(const float *in, unsigned char *out, size_t n) {
+	// max and min return their second operand for NaN, so NaN becomes 0, as in the scalar version
+	__m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1), scale = _mm_set1_ps(255), half = _mm_set1_ps(.5f);
+	size_t i = 0;
+	for (; i+16 <= n; i += 16) {
+		__m128i v[4];
+		for (int k = 0; k < 4; k++) {
+			__m128 f = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in+i+4*k), zero), one);
+			v[k] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, scale), half));
+		}
+		_mm_storeu_si128((__m128i *) (out+i), _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3])));
+	}
+	return i;
+}
+
+IMAGE_TARGET("avx2")
+static size_t UnormToFloatAVX2(const unsigned char *in, float *out, size_t n) {
+	__m256 scale = _mm256_set1_ps(1.f/255.f);
+	size_t i = 0;
+	for (; i+32 <= n; i += 32)
+		for (int k = 0; k < 4; k++) {
+			__m256i b = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (in+i+8*k)));
+			_mm256_storeu_ps(out+i+8*k, _mm256_mul_ps(_mm256_cvtepi32_ps(b), scale));
+		}
+	return i;
+}
+
+IMAGE_TARGET("avx2")
+static size_t FloatToUnormAVX2(const float *in, unsigned char *out, size_t n) {
+	__m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1), scale = _mm256_set1_ps(255), half = _mm256_set1_ps(.5f);
+	__m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);	// undo the per-lane packing
+	size_t i = 0;
+	for (; i+32 <= n; i += 32) {
+		__m256i v[4];
+		for (int k = 0; k < 4; k++) {
+			__m256 f = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in+i+8*k), zero), one);
+			v[k] = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(f, scale), half));
+		}
+		__m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(v[0], v[1]), _mm256_packs_epi32(v[2], v[3]));
+		_mm256_storeu_si256((__m256i *) (out+i), _mm256_permutevar8x32_epi32(bytes, order));
+	}
+	return i;
+}
+
+#endif // IMAGE_X86
+
+void UnormToFloat(const unsigned char *in, float *out, size_t n) {
+	ImageSimd simd = ImageSimdLevel();
+	ParallelBands(n, 1 << 18, [&](size_t i0, size_t i1) {
+		size_t done = 0;
+#ifdef IMAGE_X86
+		done = simd == ImageAVX2? UnormToFloatAVX2(in+i0, out+i0, i1-i0) :
+			   simd == ImageSSE? UnormToFloatSSE(in+i0, out+i0, i1-i0) : 0;
+#endif
+		UnormToFloatScalar(in+i0+done, out+i0+done, i1-i0-done);
+	});
+}
+
+void FloatToUnorm(const float *in, unsigned char *out, size_t n) {
+	ImageSimd simd = ImageSimdLevel();
+	ParallelBands(n, 1 << 18, [&](size_t i0, size_t i1) {
+		size_t done = 0;
+#ifdef IMAGE_X86
+		done = simd == ImageAVX2? FloatToUnormAVX2(in+i0, out+i0, i1-i0) :
+			   simd == ImageSSE? FloatToUnormSSE(in+i0, out+i0, i1-i0) : 0;
+#endif
+		FloatToUnormScalar(in+i0+done, out+i0+done, i1-i0-done);
+	});
+}
+
+// swizzle
+
+static void SwizzleScalar(const unsigned char *in, int inChannels, unsigned char *out, int outChannels,
+						  const int *map, size_t i0, size_t i1, unsigned char fill) {
+	for (size_t i = i0; i < i1; i++) {
+		const unsigned char *p = in+i*inChannels;
+		unsigned char *q = out+i*outChannels;
+		for (int c = 0; c < outChannels; c++)
+			q[c] = map[c] < 0? fill : p[map[c]];
+	}
+}
+
+#ifdef IMAGE_X86
+
+IMAGE_TARGET("ssse3")
+static size_t SwizzleSSE(const unsigned char *in, int inChannels, unsigned char *out, int outChannels,
+						 const int *map, size_t i0, size_t i1, size_t nPixels, unsigned char fill) {
+	// four pixels per shuffle; a 16-byte store may spill past the four pixels, but not past i1, and
+	// the spill is overwritten by the next four; return first pixel not done
+	alignas(16) unsigned char shuffle[16], constant[16];
+	for (int k = 0; k < 16; k++) {
+		int pixel = k/outChannels, c = k%outChannels;
+		bool used = pixel < 4 && map[c] >= 0;
+		shuffle[k] = used? (unsigned char) (pixel*inChannels+map[c]) : 0x80;
+		constant[k] = pixel < 4 && map[c] < 0? fill : 0;
+	}
+	__m128i s = _mm_load_si128((const __m128i *) shuffle), f = _mm_load_si128((const __m128i *) constant);
+	size_t i = i0, inEnd = nPixels*inChannels, outEnd = i1*outChannels;
+	for (; i+4 <= i1 && i*inChannels+16 <= inEnd && i*outChannels+16 <= outEnd; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (in+i*inChannels));
+		_mm_storeu_si128((__m128i *) (out+i*outChannels), _mm_or_si128(_mm_shuffle_epi8(v, s), f));
+	}
+	return i;
+}
+
+#endif // IMAGE_X86
+
+void SwizzleChannels(const unsigned char *in, int inChannels, unsigned char *out, int outChannels,
+					 const int *map, size_t nPixels, unsigned char fill) {
+	if (inChannels < 1 || inChannels > 4 || outChannels < 1 || outChannels > 4) {
+		printf("SwizzleChannels: channels must be 1-4\n");
+		return;
+	}
+	for (int c = 0; c < outChannels; c++)
+		if (map[c] >= inChannels) {
+			printf("SwizzleChannels: no input channel %d\n", map[c]);
+			return;
+		}
+	ImageSimd simd = ImageSimdLevel();
+	ParallelBands(nPixels, 1 << 16, [&](size_t i0, size_t i1) {
+		size_t i = i0;
+#ifdef IMAGE_X86
+		if (simd >= ImageSSE)
+			i = SwizzleSSE(in, inChannels, out, outChannels, map, i0, i1, nPixels, fill);
+#endif
+		SwizzleScalar(in, inChannels, out, outChannels, map, i, i1, fill);
+	});
+}
+
 // Image File
 
-unsigned char *ReadTarga(const char *filename, int &width, int &height) {
-	// open targa file, read header, return pointer to pixels
+static unsigned char *ReadTargaFread(const char *filename, int &width, int &height) {
+	// former ReadTarga, for ImageKernelBenchmark
 	FILE *in = fopen(filename, "rb");
 	if (in) {
 		short tgaHeader[9];
@@ -47,6 +454,7 @@ unsigned char *ReadTarga(const char *filename, int &width, int &height) {
 		int bitsPerPixel = tgaHeader[8], bytesPerPixel = bitsPerPixel/8, bytesPerImage = w*h*bytesPerPixel;
 		if (bytesPerPixel != 3) {
 			printf("bytes per pixel not 3!\n");
+			fclose(in);
 			return NULL;
 		}
 		unsigned char *pixels = new unsigned char[bytesPerImage];
@@ -58,6 +466,48 @@ unsigned char *ReadTarga(const char *filename, int &width, int &height) {
 	return NULL;
 }
 
+unsigned char *ReadTarga(const char *filename, int &width, int &height) {
+	// map targa file, read header, return pointer to pixels
+	MappedFile file(filename);
+	if (!file.ok) {
+		printf("can't open %s\n", filename);
+		return NULL;
+	}
+	const unsigned char *header = (const unsigned char *) file.data;
+	if (file.size < 18 || header[1] != 0 || header[2] != 2) {
+		printf("%s: not an uncompressed true-color Targa file\n", filename);
+		return NULL;
+	}
+	int idLength = header[0], bitsPerPixel = header[16], bytesPerPixel = bitsPerPixel/8;
+	int w = header[12] | header[13] << 8, h = header[14] | header[15] << 8;
+	bool topFirst = (header[17] & 0x20) != 0;
+	if (bytesPerPixel != 3 && bytesPerPixel != 4) {
+		printf("bytes per pixel not 3 or 4!\n");
+		return NULL;
+	}
+	size_t rowIn = (size_t) w*bytesPerPixel, rowOut = (size_t) w*3;
+	if (file.size < 18+idLength+rowIn*h) {
+		printf("%s: file truncated\n", filename);
+		return NULL;
+	}
+	width = w;
+	height = h;
+	// allocate, copy (or drop alpha) rows, bottom row first
+	const unsigned char *pixelsIn = header+18+idLength;
+	unsigned char *pixels = new unsigned char[rowOut*h];
+	int map[] = {0, 1, 2};
+	ParallelBands(h, 64, [&](size_t j0, size_t j1) {
+		for (size_t j = j0; j < j1; j++) {
+			const unsigned char *in = pixelsIn+rowIn*(topFirst? h-1-j : j);
+			if (bytesPerPixel == 3)
+				memcpy(pixels+rowOut*j, in, rowOut);
+			else
+				SwizzleChannels(in, 4, pixels+rowOut*j, 3, map, w);
+		}
+	});
+	return pixels;
+}
+
 bool WriteTarga(const char *filename, unsigned char *pixels, int width, int height) {
 	FILE *out = fopen(filename, "wb");
 	if (!out) {
@@ -83,18 +533,14 @@ bool WriteTarga(const char *filename, unsigned char *pixels, int width, int heig
 bool WriteTarga(char *filename) {
 	int width, height;
 	GetViewportSize(width, height);
-	int npixels = width*height;
-	unsigned char *cPixels = new unsigned char[3*npixels], *c = cPixels;
-	float *fPixels = new float[3*npixels*sizeof(float)], *f = fPixels;
-	glReadPixels(0, 0, width, height, GL_BGR, GL_FLOAT, fPixels);	// Targa is BGR ordered
-	for (int i = 0; i < npixels; i++) {
-		*c++ = (unsigned char) 255.f*(*f++);
-		*c++ = (unsigned char) 255.f*(*f++);
-		*c++ = (unsigned char) 255.f*(*f++);
-	}
-	bool ok = WriteTarga(filename, (unsigned char *) cPixels, width, height);
-	delete [] fPixels;
-	delete [] cPixels;
+	unsigned char *pixels = new unsigned char[3*width*height];
+	GLint alignment;
+	glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);			// rows packed, as in the file
+	glReadPixels(0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, pixels);	// Targa is BGR ordered
+	glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+	bool ok = WriteTarga(filename, pixels, width, height);
+	delete [] pixels;
 	return ok;
 }
 
@@ -134,7 +580,8 @@ GLuint LoadTexture(const char *targaFilename, GLuint textureUnit, bool mipmap) {
 
 // Bump map
 
-unsigned char *GetNormals(unsigned char *depthPixels, int &width, int &height, float pixelScale) {
+static unsigned char *GetNormalsHelper(unsigned char *depthPixels, int &width, int &height, float pixelScale) {
+	// former GetNormals, for ImageKernelBenchmark
 	class Helper { public:
 		unsigned char *depthPixels, *bumpPixels;
 		int width, height;
@@ -170,3 +617,103 @@ unsigned char *GetNormals(unsigned char *depthPixels, int &width, int &height, f
 	} h(depthPixels, width, height, pixelScale);
 	return h.bumpPixels;
 }
+
+unsigned char *GetNormals(unsigned char *depthPixels, int &width, int &height, float pixelScale) {
+	unsigned char *normals = new unsigned char[3*width*height];
+	HeightToNormals(depthPixels, width, height, 3, normals, pixelScale);
+	return normals;
+}
+
+// Benchmark
+
+static double Seconds(std::chrono::high_resolution_clock::time_point t) {
+	return std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-t).count();
+}
+
+template <typename Function>
+static double BestTime(int nRuns, Function f) {
+	// least seconds over nRuns calls
+	double best = DBL_MAX;
+	for (int r = 0; r < nRuns; r++) {
+		auto t = std::chrono::high_resolution_clock::now();
+		f();
+		best = std::min(best, Seconds(t));
+	}
+	return best;
+}
+
+void ImageKernelBenchmark(const int *sizes, int nSizes, int nRuns) {
+	static const char *simdNames[] = {"scalar", "SSE", "AVX2"};
+	ImageSimd supported = SetImageSimd(ImageAVX2);
+	int nThreads = std::max(1, (int) std::thread::hardware_concurrency());
+	printf("image kernels: %s supported, %d threads, best of %d runs\n", simdNames[supported], nThreads, nRuns);
+	for (int s = 0; s < nSizes; s++) {
+		int w = sizes[s], h = sizes[s];
+		size_t nPixels = (size_t) w*h, nBytes = 3*nPixels;
+		printf("%dx%d:\n", w, h);
+		// smooth hills with noise, as gray RGB
+		std::vector<unsigned char> heights(nBytes), normals(nBytes), sobel(nBytes);
+		unsigned int seed = 1;
+		for (int j = 0; j < h; j++)
+			for (int i = 0; i < w; i++) {
+				seed = seed*1664525u+1013904223u;
+				float v = 127.5f+100*sin(.01f*i)*cos(.013f*j)+(float) (seed >> 29);
+				unsigned char *p = &heights[3*((size_t) j*w+i)];
+				p[0] = p[1] = p[2] = (unsigned char) v;
+			}
+		// normals
+		unsigned char *legacy = NULL;
+		double tLegacy = BestTime(nRuns, [&]() { delete [] legacy; legacy = GetNormalsHelper(&heights[0], w, h, 25); });
+		printf("  normals: former GetNormals %.1f ms\n", 1000*tLegacy);
+		for (int level = ImageScalar; level <= supported; level++) {
+			SetImageSimd((ImageSimd) level);
+			for (int threads = 1; threads <= nThreads; threads = threads == nThreads? threads+1 : nThreads) {
+				SetImageThreads(threads);
+				double t = BestTime(nRuns, [&]() { HeightToNormals(&heights[0], w, h, 3, &normals[0], 25); });
+				bool same = memcmp(legacy, &normals[0], nBytes) == 0;
+				printf("    %s, %d thread%s: %.1f ms (%.1fx)%s\n", simdNames[level], threads, threads > 1? "s" : "",
+					   1000*t, tLegacy/t, same? "" : " *** differs from GetNormals ***");
+			}
+		}
+		SetImageSimd(ImageAVX2);
+		SetImageThreads(0);
+		double tSobel = BestTime(nRuns, [&]() { HeightToNormals(&heights[0], w, h, 3, &sobel[0], 25, true); });
+		printf("    Sobel: %.1f ms\n", 1000*tSobel);
+		delete [] legacy;
+		// unorm conversion, over all channels
+		std::vector<float> floats(nBytes), floatsScalar(nBytes);
+		std::vector<unsigned char> bytes(nBytes), bytesScalar(nBytes);
+		double tToFloatScalar = BestTime(nRuns, [&]() { UnormToFloatScalar(&heights[0], &floatsScalar[0], nBytes); });
+		double tToFloat = BestTime(nRuns, [&]() { UnormToFloat(&heights[0], &floats[0], nBytes); });
+		double tToUnormScalar = BestTime(nRuns, [&]() { FloatToUnormScalar(&floats[0], &bytesScalar[0], nBytes); });
+		double tToUnorm = BestTime(nRuns, [&]() { FloatToUnorm(&floats[0], &bytes[0], nBytes); });
+		bool floatsSame = memcmp(&floats[0], &floatsScalar[0], nBytes*sizeof(float)) == 0;
+		bool bytesSame = bytes == heights && bytesScalar == heights;
+		printf("  unorm to float: scalar %.1f ms, %.1f ms (%.1fx)%s\n", 1000*tToFloatScalar, 1000*tToFloat,
+			   tToFloatScalar/tToFloat, floatsSame? "" : " *** differs ***");
+		printf("  float to unorm: scalar %.1f ms, %.1f ms (%.1fx)%s\n", 1000*tToUnormScalar, 1000*tToUnorm,
+			   tToUnormScalar/tToUnorm, bytesSame? "" : " *** not round trip ***");
+		// swizzle BGR to RGBA
+		int map[] = {2, 1, 0, -1};
+		std::vector<unsigned char> rgba(4*nPixels), rgbaScalar(4*nPixels);
+		double tSwizzleScalar = BestTime(nRuns, [&]() { SwizzleScalar(&normals[0], 3, &rgbaScalar[0], 4, map, 0, nPixels, 255); });
+		double tSwizzle = BestTime(nRuns, [&]() { SwizzleChannels(&normals[0], 3, &rgba[0], 4, map, nPixels); });
+		printf("  swizzle BGR to RGBA: scalar %.1f ms, %.1f ms (%.1fx)%s\n", 1000*tSwizzleScalar, 1000*tSwizzle,
+			   tSwizzleScalar/tSwizzle, rgba == rgbaScalar? "" : " *** differs ***");
+		// Targa read
+		const char *filename = "image-benchmark.tga";
+		if (WriteTarga(filename, &normals[0], w, h)) {
+			int rw, rh;
+			unsigned char *pixels = NULL;
+			double tFread = BestTime(nRuns, [&]() { delete [] pixels; pixels = ReadTargaFread(filename, rw, rh); });
+			delete [] pixels;
+			pixels = NULL;
+			double tMapped = BestTime(nRuns, [&]() { delete [] pixels; pixels = ReadTarga(filename, rw, rh); });
+			bool same = pixels && rw == w && rh == h && memcmp(pixels, &normals[0], nBytes) == 0;
+			printf("  ReadTarga: fread %.1f ms, mapped %.1f ms (%.1fx)%s\n", 1000*tFread, 1000*tMapped,
+				   tFread/tMapped, same? "" : " *** differs ***");
+			delete [] pixels;
+			remove(filename);
+		}
+	}
+}
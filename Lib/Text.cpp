@@ -5,8 +5,10 @@
 #include "Draw.h"
 #include "GLXtras.h"
 #include "Text.h"
+#include <algorithm>
 #include <map>
 #include <stdio.h>
+#include <string.h>
 
 // if FreeType not linked, comment next line:
 #define FREETYPE_OK
@@ -15,6 +17,17 @@ CharacterSet *SetFont(const char *fontName, int charRese, int pixelRes) { return
 void Text(int x, int y, vec3 color, float scale, const char *format, ...) { }
 void Text(vec3 p, mat4 m, vec3 color, float scale, const char *format, ...) { }
 void RenderText(const char *text, float x, float y, vec3 color, float scale, mat4 view) { }
+void LayoutText(const char *text, TextLayout &layout) { layout = TextLayout(); }
+std::shared_ptr<const TextLayout> CachedLayout(const char *text) { return std::make_shared<TextLayout>(); }
+void RenderText(const TextLayout &layout, float x, float y, vec3 color, float scale, mat4 view) { }
+void TextBatch::Add(const char *text, float x, float y, vec3 color, float scale, mat4 view) { }
+void TextBatch::Add(const TextLayout &layout, float x, float y, vec3 color, float scale, mat4 view) { }
+void TextBatch::Flush() { }
+void TextBatch::Clear() { }
+void TextBatch::Release() { }
+int TextBatch::Glyphs() const { return 0; }
+void SetTextBatch(TextBatch *batch) { }
+void PrecompileTextShader() { }
 #else
 
 #include <ft2build.h>
@@ -22,7 +35,7 @@ void RenderText(const char *text, float x, float y, vec3 color, float scale, mat
 
 using std::string;
 
-static GLuint textShaderProgram = 0, textVertexBuffer = 0;
+static GLuint textShaderProgram = 0;
 
 CharacterSet *currentFont = NULL;
 
@@ -43,29 +56,75 @@ void SetCharacterSet(CharacterSet &cs, const char *fontName, int charRes, int pi
 			printf("problem with FreeType, font load, or font face\n");
 			return;
 	}
-	// load glyphs
+	// load glyphs, keeping their bitmaps to pack into the atlas
 	FT_GlyphSlot g = face->glyph;
+	std::vector<unsigned char> bitmaps[128];
+	int area = 0;
 	for (GLubyte c = 0; c < 128; c++) {
 		if (FT_Load_Char(face, c, FT_LOAD_RENDER))
 			printf("FreeType: failed to load Glyph\n");
 		else {
-			// generate texture
-			GLuint texture;
-			glGenTextures(1, &texture);
-			glBindTexture(GL_TEXTURE_2D, texture);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, g->bitmap.width, g->bitmap.rows, 0, GL_RED, GL_UNSIGNED_BYTE, g->bitmap.buffer);
-			// texture options
-			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			// store character
-			cs.characters[c] = Character(texture, int2(g->bitmap.width, g->bitmap.rows), int2(g->bitmap_left, g->bitmap_top), (GLuint) g->advance.x);
+			int w = g->bitmap.width, h = g->bitmap.rows;
+			bitmaps[c].resize(w*h);
+			for (int row = 0; row < h; row++)
+				memcpy(&bitmaps[c][row*w], g->bitmap.buffer+row*g->bitmap.pitch, w);
+			cs.characters[c] = Character(0, int2(w, h), int2(g->bitmap_left, g->bitmap_top), (GLuint) g->advance.x);
+			area += (w+1)*(h+1);
 		}
 	}
 	FT_Done_Face(face);
 	FT_Done_FreeType(ft);
+	// pack glyphs in rows, tallest first, with a pixel between them so linear filtering doesn't bleed
+	int order[128];
+	for (int i = 0; i < 128; i++)
+		order[i] = i;
+	std::sort(order, order+128, [&cs](int a, int b) { return cs.characters[a].gSize.i2 > cs.characters[b].gSize.i2; });
+	int width = 64;
+	while (width*width < 2*area)
+		width *= 2;
+	int2 at[128];
+	int x = 0, y = 0, rowHeight = 0;
+	for (int i = 0; i < 128; i++) {
+		Character &ch = cs.characters[order[i]];
+		if (x+ch.gSize.i1+1 > width) {
+			x = 0;
+			y += rowHeight;
+			rowHeight = 0;
+		}
+		at[order[i]] = int2(x, y);
+		x += ch.gSize.i1+1;
+		rowHeight = std::max(rowHeight, ch.gSize.i2+1);
+	}
+	int height = 1;
+	while (height < y+rowHeight)
+		height *= 2;
+	std::vector<unsigned char> atlas(width*height, 0);
+	for (int c = 0; c < 128; c++) {
+		Character &ch = cs.characters[c];
+		for (int row = 0; row < ch.gSize.i2; row++)
+			memcpy(&atlas[(at[c].i2+row)*width+at[c].i1], &bitmaps[c][row*ch.gSize.i1], ch.gSize.i1);
+	}
+	// single texture for all glyphs
+	GLint alignment;
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glGenTextures(1, &cs.atlas);
+	glBindTexture(GL_TEXTURE_2D, cs.atlas);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, atlas.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+	// texture options
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	cs.atlasSize = int2(width, height);
+	for (int c = 0; c < 128; c++) {
+		Character &ch = cs.characters[c];
+		ch.textureID = cs.atlas;
+		ch.uv0 = vec2((float) at[c].i1/width, (float) at[c].i2/height);
+		ch.uv1 = vec2((float) (at[c].i1+ch.gSize.i1)/width, (float) (at[c].i2+ch.gSize.i2)/height);
+	}
 }
 
 CharacterSet *SetFont(const char *fontName, int charRes, int pixelRes) {
@@ -80,62 +139,209 @@ CharacterSet *SetFont(const char *fontName, int charRes, int pixelRes) {
 	return currentFont;
 }
 
+static CharacterSet *CurrentFont() {
+	if (!currentFont)
+		SetFont("C:/Fonts/OpenSans/OpenSans-Regular.ttf", 15, 30);	// unsure exact effect of charRes, pixelRes
+	return currentFont;
+}
+
+// Layout
+
+void LayoutText(const char *text, TextLayout &layout) {
+	CharacterSet *font = CurrentFont();
+	layout.font = font;
+	layout.quads.resize(0);
+	float x = 0;
+	for (const char *c = text; *c; c++) {
+		Character &ch = font->characters[*c & 127];
+		if (ch.gSize.i1 && ch.gSize.i2) {	// skip blanks
+			TextQuad q;
+			q.p0 = vec2(x+ch.bearing.i1, (float) (ch.bearing.i2-ch.gSize.i2));
+			q.p1 = vec2(q.p0.x+ch.gSize.i1, q.p0.y+ch.gSize.i2);
+			q.uv0 = ch.uv0;
+			q.uv1 = ch.uv1;
+			layout.quads.push_back(q);
+		}
+		x += ch.advance >> 6;				// advance character position in terms of 1/64 pixel
+	}
+	layout.width = x;
+}
+
+typedef std::map<std::pair<CharacterSet *, string>, std::shared_ptr<TextLayout>> LayoutCache;
+static LayoutCache layoutCache;
+static const size_t MaxCachedLayouts = 4096;
+
+std::shared_ptr<const TextLayout> CachedLayout(const char *text) {
+	LayoutCache::key_type key(CurrentFont(), string(text));
+	LayoutCache::iterator it = layoutCache.find(key);
+	if (it != layoutCache.end())
+		return it->second;
+	if (layoutCache.size() >= MaxCachedLayouts)
+		layoutCache.clear();				// strings are not as static as intended; start over (callers keep theirs)
+	std::shared_ptr<TextLayout> layout = std::make_shared<TextLayout>();
+	LayoutText(text, *layout);
+	layoutCache[key] = layout;
+	return layout;
+}
+
+// Batches
+
 static const char *textVertexShader = "\
 	#version 130									\n\
 	in vec4 point;									\n\
+	in vec2 uv;										\n\
+	in vec3 color;									\n\
 	out vec2 vUv;									\n\
-	uniform mat4 view;								\n\
+	out vec3 vColor;								\n\
 	void main() {									\n\
-		gl_Position = view*vec4(point.xy, 0, 1);	\n\
-		vUv = point.zw;								\n\
+		gl_Position = point;						\n\
+		vUv = uv;									\n\
+		vColor = color;								\n\
 	}												\n";
 
 static const char *textPixelShader = "\
 	#version 130									\n\
 	in vec2 vUv;									\n\
+	in vec3 vColor;									\n\
 	out vec4 pColor;								\n\
 	uniform sampler2D textureImage;					\n\
-	uniform vec3 color;								\n\
 	void main() {									\n\
 		float a = texture(textureImage, vUv).r;		\n\
-		pColor = vec4(color, a);					\n\
+		pColor = vec4(vColor, a);					\n\
 	}												\n";
 
-void RenderText(const char *text, float x, float y, vec3 color, float scale, mat4 view) {
+static TextBatch immediateText, *textBatch = NULL;
+
+void SetTextBatch(TextBatch *batch) {
+	textBatch = batch;
+}
+
+void PrecompileTextShader() {
 	if (!textShaderProgram)
 		textShaderProgram = LinkProgramViaCode(&textVertexShader, &textPixelShader);
+}
+
+void TextBatch::Add(const char *text, float x, float y, vec3 color, float scale, mat4 view) {
+	static TextLayout layout;
+	LayoutText(text, layout);
+	Add(layout, x, y, color, scale, view);
+}
+
+void TextBatch::Add(const TextLayout &layout, float x, float y, vec3 color, float scale, mat4 view) {
+	if (!layout.font || layout.quads.empty())
+		return;
+	Run *run = NULL;
+	for (Run &r : runs)
+		if (r.atlas == layout.font->atlas)
+			run = &r;
+	if (!run) {
+		runs.push_back(Run());
+		run = &runs.back();
+		run->atlas = layout.font->atlas;
+	}
+	// the view is affine in the text plane, so transform the origin and axes once, rather than every corner
+	scale /= (float) layout.font->charRes;
+	vec4 o = view*vec4(x, y, 0, 1), ax = view*vec4(scale, 0, 0, 0), ay = view*vec4(0, scale, 0, 0);
+	for (const TextQuad &q : layout.quads) {
+		vec4 x0 = o+q.p0.x*ax, x1 = o+q.p1.x*ax, y0 = q.p0.y*ay, y1 = q.p1.y*ay;
+		Vertex v[] = {{x0+y1, q.uv0, color}, {x1+y1, vec2(q.uv1.x, q.uv0.y), color},
+					  {x1+y0, q.uv1, color}, {x0+y0, vec2(q.uv0.x, q.uv1.y), color}};
+		run->vertices.insert(run->vertices.end(), v, v+4);
+	}
+}
+
+int TextBatch::Glyphs() const {
+	int n = 0;
+	for (const Run &r : runs)
+		n += (int) r.vertices.size()/4;
+	return n;
+}
+
+void TextBatch::Clear() {
+	for (Run &r : runs)
+		r.vertices.resize(0);
+}
+
+void TextBatch::Flush() {
+	int nGlyphs = Glyphs();
+	if (!nGlyphs)
+		return;
+	PrecompileTextShader();
 	glUseProgram(textShaderProgram);
-	if (!currentFont) {
-		SetFont("C:/Fonts/OpenSans/OpenSans-Regular.ttf", 15, 30);	// unsure exact effect of charRes, pixelRes
-	//	return;
+	GLint wasVertexArray = 0;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &wasVertexArray);
+	if (!vertexArray) {
+		glGenVertexArrays(1, &vertexArray);
+		glGenBuffers(1, &vertexBuffer);
+		glGenBuffers(1, &indexBuffer);
+	}
+	glBindVertexArray(vertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	if (nGlyphs > indexCapacity) {
+		// two triangles per glyph; the indices never change, only grow
+		while (indexCapacity < nGlyphs)
+			indexCapacity = indexCapacity? 2*indexCapacity : 256;
+		std::vector<GLuint> indices(6*indexCapacity);
+		for (int i = 0; i < indexCapacity; i++) {
+			GLuint *t = &indices[6*i], v = 4*i;
+			t[0] = v; t[1] = v+1; t[2] = v+2;
+			t[3] = v; t[4] = v+2; t[5] = v+3;
+		}
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+	}
+	// orphan the previous frame's vertices, then upload all runs at once
+	vertexCapacity = std::max(vertexCapacity, nGlyphs);
+	glBufferData(GL_ARRAY_BUFFER, 4*vertexCapacity*sizeof(Vertex), NULL, GL_STREAM_DRAW);
+	int offset = 0;
+	for (Run &r : runs) {
+		glBufferSubData(GL_ARRAY_BUFFER, offset*sizeof(Vertex), r.vertices.size()*sizeof(Vertex), r.vertices.data());
+		offset += (int) r.vertices.size();
 	}
-	scale /= (float) currentFont->charRes;
-	// create quad vertex buffer and build characters
-	if (textVertexBuffer == 0)
-		glGenBuffers(1, &textVertexBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, textVertexBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*6*4, NULL, GL_DYNAMIC_DRAW);
-	VertexAttribPointer(textShaderProgram, "point", 4, 4*sizeof(float), 0);
-	SetUniform(textShaderProgram, "view", view);
-	SetUniform(textShaderProgram, "color", color);
-	// SetUniform(textShaderProgram, "textureImage", (int) textureID); // not needed? (defaults to 0?)
-    glActiveTexture(GL_TEXTURE0);
-    glBindBuffer(GL_ARRAY_BUFFER, textVertexBuffer);
+	VertexAttribPointer(textShaderProgram, "point", 4, sizeof(Vertex), (void *) 0);
+	VertexAttribPointer(textShaderProgram, "uv", 2, sizeof(Vertex), (void *) sizeof(vec4));
+	VertexAttribPointer(textShaderProgram, "color", 3, sizeof(Vertex), (void *) (sizeof(vec4)+sizeof(vec2)));
+	glActiveTexture(GL_TEXTURE0);
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    for (const char *c = text; *c; c++) {
-        Character ch = currentFont->characters[(int)*c];
-        float xpos = x+ch.bearing.i1*scale, ypos = y-(ch.gSize.i2-ch.bearing.i2)*scale;
-        float w = ch.gSize.i1*scale, h = ch.gSize.i2*scale;
-        glBindTexture(GL_TEXTURE_2D, ch.textureID);
-        // update vertex memory
-        float vertices[][4] = {{xpos, ypos+h, 0, 0}, {xpos+w, ypos+h, 1, 0}, {xpos+w, ypos, 1, 1}, {xpos, ypos, 0, 1}};
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-        glDrawArrays(GL_QUADS, 0, 4);	// render glyph texture with quad
-        x += (ch.advance >> 6)*scale;	// advance character position in terms of 1/64 pixel
-    }
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
+	offset = 0;
+	for (Run &r : runs) {
+		int n = (int) r.vertices.size()/4;
+		if (n) {
+			glBindTexture(GL_TEXTURE_2D, r.atlas);
+			glDrawElementsBaseVertex(GL_TRIANGLES, 6*n, GL_UNSIGNED_INT, (void *) 0, offset);
+		}
+		offset += 4*n;
+	}
+	glBindVertexArray(wasVertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	// keep runs that were used, for their vertex capacity
+	runs.erase(std::remove_if(runs.begin(), runs.end(), [](const Run &r) { return r.vertices.empty(); }), runs.end());
+	Clear();
+}
+
+void TextBatch::Release() {
+	if (vertexArray) {
+		glDeleteBuffers(1, &vertexBuffer);
+		glDeleteBuffers(1, &indexBuffer);
+		glDeleteVertexArrays(1, &vertexArray);
+	}
+	vertexArray = vertexBuffer = indexBuffer = 0;
+	vertexCapacity = indexCapacity = 0;
+}
+
+void RenderText(const TextLayout &layout, float x, float y, vec3 color, float scale, mat4 view) {
+	TextBatch &batch = textBatch? *textBatch : immediateText;
+	batch.Add(layout, x, y, color, scale, view);
+	if (&batch == &immediateText)
+		immediateText.Flush();
+}
+
+void RenderText(const char *text, float x, float y, vec3 color, float scale, mat4 view) {
+	static TextLayout layout;
+	LayoutText(text, layout);
+	RenderText(layout, x, y, color, scale, view);
 }
 
 #define FormatString(buffer, maxBufferSize, format) {  \
@@ -152,11 +358,10 @@ float TextWidth(float scale, const char *format, ...) {
 	float w = 0;
     char text[500];
     FormatString(text, 500, format);
-	if (!currentFont)
-		SetFont("C:/Fonts/OpenSans/OpenSans-Regular.ttf", 15, 30);	// unsure exact affect of charRes, pixelRes
-	scale /= (float) currentFont->charRes;
+	CharacterSet *font = CurrentFont();
+	scale /= (float) font->charRes;
     for (const char *c = text; *c; c++) {
-        Character ch = currentFont->characters[(int)*c];
+        Character &ch = font->characters[*c & 127];
         w += (ch.advance >> 6)*scale;
     }
 //    printf("wid of %s = %4.3f\n", text, w);